@@ -17,24 +17,23 @@ namespace vks
 	* 
 	* @param size (Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete buffer range.
 	* @param offset (Optional) Byte offset from beginning
+	*
+	* @note Host visible memory is persistently mapped by the allocator, this only hands out a pointer into it
 	*/
-	void Buffer::map(vk::DeviceSize size, vk::DeviceSize offset)
+	void Buffer::map([[maybe_unused]] vk::DeviceSize size, vk::DeviceSize offset)
 	{
-		mapped = device.mapMemory(*memory, offset, size, {});
+		assert(memory.mapped());
+		mapped = static_cast<uint8_t*>(memory.mapped()) + offset;
 	}
 
 	/**
 	* Unmap a mapped memory range
 	*
-	* @note Does not return a result as vkUnmapMemory can't fail
+	* @note The memory itself stays mapped until the buffer is destroyed
 	*/
 	void Buffer::unmap()
 	{
-		if (mapped)
-		{
-			device.unmapMemory(*memory);
-			mapped = nullptr;
-		}
+		mapped = nullptr;
 	}
 
 	/** 
@@ -46,7 +45,7 @@ namespace vks
 	*/
 	void Buffer::bind(vk::DeviceSize offset)
 	{
-		device.bindBufferMemory(*buffer, *memory, offset);
+		device.bindBufferMemory(*buffer, memory.memory(), memory.offset() + offset);
 	}
 
 	/**
@@ -89,9 +88,10 @@ namespace vks
 	void Buffer::flush(vk::DeviceSize size, vk::DeviceSize offset)
 	{
 		vk::MappedMemoryRange mappedRange = {};
-		mappedRange.memory = *memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
+		mappedRange.memory = memory.memory();
+		mappedRange.offset = memory.offset() + offset;
+		// Stay within the range of the allocation, the memory object may be shared with other buffers
+		mappedRange.size = (size == VK_WHOLE_SIZE && !memory.dedicated()) ? memory.size() - offset : size;
 		device.flushMappedMemoryRanges({mappedRange});
 	}
 
@@ -108,9 +108,10 @@ namespace vks
 	void Buffer::invalidate(vk::DeviceSize size, vk::DeviceSize offset)
 	{
 		vk::MappedMemoryRange mappedRange = {};
-		mappedRange.memory = *memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
+		mappedRange.memory = memory.memory();
+		mappedRange.offset = memory.offset() + offset;
+		// Stay within the range of the allocation, the memory object may be shared with other buffers
+		mappedRange.size = (size == VK_WHOLE_SIZE && !memory.dedicated()) ? memory.size() - offset : size;
 		device.invalidateMappedMemoryRanges({mappedRange});
 	}
 
@@ -123,9 +124,7 @@ namespace vks
 		{
 			buffer.reset();
 		}
-		if (memory)
-		{
-			memory.reset();
-		}
+		memory.reset();
+		mapped = nullptr;
 	}
 };
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "vulkan/vulkan.h"
+#include "VulkanMemoryAllocator.h"
 #include "VulkanTools.h"
 
 namespace vks
@@ -25,7 +26,8 @@ namespace vks
 	{
 		vk::Device device;
 		vk::UniqueBuffer buffer;
-		vk::UniqueDeviceMemory memory;
+		/** @brief Range of device memory backing the buffer, host visible memory stays mapped for its whole lifetime */
+		vks::Allocation memory;
 		vk::DescriptorBufferInfo descriptor;
 		vk::DeviceSize size = 0;
 		vk::DeviceSize alignment = 0;
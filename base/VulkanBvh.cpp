@@ -0,0 +1,427 @@
+/*
+* Bounding volume hierarchy
+*
+* Dynamic BVH over axis aligned item bounds, built with binned SAH and refit incrementally when
+* item bounds change, with frustum, sphere and ray queries
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanBvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <utility>
+
+namespace vks
+{
+	namespace
+	{
+		using Aabb = vks::transforms::Aabb;
+
+		inline Aabb emptyAabb()
+		{
+			return Aabb{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+		}
+
+		inline void grow(Aabb &box, const Aabb &other)
+		{
+			box.min = glm::min(box.min, other.min);
+			box.max = glm::max(box.max, other.max);
+		}
+
+		inline float surfaceArea(const Aabb &box)
+		{
+			const glm::vec3 size = glm::max(box.max - box.min, glm::vec3(0.0f));
+			return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+
+		inline glm::vec3 centroid(const Aabb &box)
+		{
+			return (box.min + box.max) * 0.5f;
+		}
+
+		enum class Containment
+		{
+			Outside,
+			Intersecting,
+			Inside,
+		};
+
+		Containment classify(const glm::vec4 planes[6], const Aabb &box)
+		{
+			const glm::vec3 center = centroid(box);
+			const glm::vec3 extent = (box.max - box.min) * 0.5f;
+			Containment result = Containment::Inside;
+			for (int i = 0; i < 6; i++) {
+				const glm::vec3 normal(planes[i]);
+				const float distance = glm::dot(normal, center) + planes[i].w;
+				const float radius = glm::dot(glm::abs(normal), extent);
+				if (distance + radius < 0.0f) {
+					return Containment::Outside;
+				}
+				if (distance - radius < 0.0f) {
+					result = Containment::Intersecting;
+				}
+			}
+			return result;
+		}
+
+		inline bool overlapsSphere(const Aabb &box, const glm::vec3 &center, float radius)
+		{
+			const glm::vec3 closest = glm::clamp(center, box.min, box.max);
+			const glm::vec3 offset = closest - center;
+			return glm::dot(offset, offset) <= radius * radius;
+		}
+
+		// Slab test, returns the entry distance or a negative value if the ray misses the box
+		inline float intersectRay(const Aabb &box, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance)
+		{
+			const glm::vec3 t0 = (box.min - origin) * inverseDirection;
+			const glm::vec3 t1 = (box.max - origin) * inverseDirection;
+			const glm::vec3 tMin = glm::min(t0, t1);
+			const glm::vec3 tMax = glm::max(t0, t1);
+			const float entry = std::max({ tMin.x, tMin.y, tMin.z, 0.0f });
+			const float exit = std::min({ tMax.x, tMax.y, tMax.z, maxDistance });
+			return entry <= exit ? entry : -1.0f;
+		}
+	}
+
+	/**
+	* Build the hierarchy from scratch
+	*
+	* @param itemBounds Bounds of each item, items are referred to by their index in this array
+	*/
+	void Bvh::build(const std::vector<Aabb> &itemBounds)
+	{
+		clear();
+		if (itemBounds.empty()) {
+			return;
+		}
+		bounds = itemBounds;
+		items.resize(bounds.size());
+		for (uint32_t i = 0; i < static_cast<uint32_t>(items.size()); i++) {
+			items[i] = i;
+		}
+		itemLeaves.resize(bounds.size());
+		nodes.reserve(bounds.size() * 2);
+		parents.reserve(bounds.size() * 2);
+
+		Node root;
+		root.first = 0;
+		root.count = static_cast<uint32_t>(items.size());
+		nodes.push_back(root);
+		parents.push_back(0);
+
+		// Split with an explicit stack, degenerate inputs could otherwise get very deep
+		std::vector<uint32_t> pending{ 0 };
+		while (!pending.empty()) {
+			const uint32_t nodeIndex = pending.back();
+			pending.pop_back();
+			split(nodeIndex, pending);
+		}
+		dirty.assign(nodes.size(), 0);
+		dirtyNodes.clear();
+	}
+
+	/**
+	* Change the bounds of an item, the hierarchy is updated by the next refit()
+	*/
+	void Bvh::update(uint32_t item, const Aabb &itemBounds)
+	{
+		assert(item < bounds.size());
+		bounds[item] = itemBounds;
+		markDirty(itemLeaves[item]);
+	}
+
+	void Bvh::markDirty(uint32_t node)
+	{
+		if (!dirty[node]) {
+			dirty[node] = 1;
+			dirtyNodes.push_back(node);
+			std::push_heap(dirtyNodes.begin(), dirtyNodes.end());
+		}
+	}
+
+	/**
+	* Recompute the bounds of all nodes above items changed with update()
+	*
+	* Only visits the changed leaves and their ancestors, so moving a few items is cheap in large hierarchies
+	*
+	* @note Refitting keeps the tree topology, so the tree quality degrades if items move far. Rebuild in that case
+	*/
+	void Bvh::refit()
+	{
+		// Children come after their parents, so taking the highest dirty index first visits each node after both of its children
+		while (!dirtyNodes.empty()) {
+			std::pop_heap(dirtyNodes.begin(), dirtyNodes.end());
+			const uint32_t i = dirtyNodes.back();
+			dirtyNodes.pop_back();
+			Node &node = nodes[i];
+			node.bounds = emptyAabb();
+			if (node.count > 0) {
+				for (uint32_t j = 0; j < node.count; j++) {
+					grow(node.bounds, bounds[items[node.first + j]]);
+				}
+			} else {
+				grow(node.bounds, nodes[node.first].bounds);
+				grow(node.bounds, nodes[node.first + 1].bounds);
+			}
+			dirty[i] = 0;
+			if (i > 0) {
+				markDirty(parents[i]);
+			}
+		}
+	}
+
+	void Bvh::clear()
+	{
+		nodes.clear();
+		parents.clear();
+		dirty.clear();
+		dirtyNodes.clear();
+		items.clear();
+		bounds.clear();
+		itemLeaves.clear();
+	}
+
+	/**
+	* Collect all items whose bounds intersect or are inside the frustum
+	*
+	* @param planes Frustum planes (normals pointing inwards), e.g. from vks::transforms::extractFrustumPlanes()
+	* @param result Indices of the items found are appended to this
+	*/
+	void Bvh::queryFrustum(const glm::vec4 planes[6], std::vector<uint32_t> &result) const
+	{
+		if (nodes.empty()) {
+			return;
+		}
+		std::vector<uint32_t> stack{ 0 };
+		while (!stack.empty()) {
+			const Node &node = nodes[stack.back()];
+			const uint32_t nodeIndex = stack.back();
+			stack.pop_back();
+			const Containment containment = classify(planes, node.bounds);
+			if (containment == Containment::Outside) {
+				continue;
+			}
+			// Everything below a node that is fully inside is visible, no need to test any further
+			if (containment == Containment::Inside) {
+				collect(nodeIndex, result);
+				continue;
+			}
+			if (node.count > 0) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					const uint32_t item = items[node.first + i];
+					if (classify(planes, bounds[item]) != Containment::Outside) {
+						result.push_back(item);
+					}
+				}
+			} else {
+				stack.push_back(node.first);
+				stack.push_back(node.first + 1);
+			}
+		}
+	}
+
+	/**
+	* Collect all items whose bounds overlap a sphere
+	*
+	* @param center Center of the sphere
+	* @param radius Radius of the sphere
+	* @param result Indices of the items found are appended to this
+	*/
+	void Bvh::querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &result) const
+	{
+		if (nodes.empty()) {
+			return;
+		}
+		std::vector<uint32_t> stack{ 0 };
+		while (!stack.empty()) {
+			const Node &node = nodes[stack.back()];
+			stack.pop_back();
+			if (!overlapsSphere(node.bounds, center, radius)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					const uint32_t item = items[node.first + i];
+					if (overlapsSphere(bounds[item], center, radius)) {
+						result.push_back(item);
+					}
+				}
+			} else {
+				stack.push_back(node.first);
+				stack.push_back(node.first + 1);
+			}
+		}
+	}
+
+	/**
+	* Collect all items whose bounds are hit by a ray
+	*
+	* @param origin Origin of the ray
+	* @param direction Direction of the ray (does not need to be normalized, distances are in multiples of it)
+	* @param maxDistance Items further away than this are ignored
+	* @param result Indices of the items found are appended to this, ordered by the distance at which the ray enters their bounds
+	*/
+	void Bvh::queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, std::vector<uint32_t> &result) const
+	{
+		if (nodes.empty()) {
+			return;
+		}
+		const glm::vec3 inverseDirection = 1.0f / direction;
+		std::vector<std::pair<float, uint32_t>> hits;
+		std::vector<uint32_t> stack{ 0 };
+		while (!stack.empty()) {
+			const Node &node = nodes[stack.back()];
+			stack.pop_back();
+			if (intersectRay(node.bounds, origin, inverseDirection, maxDistance) < 0.0f) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					const uint32_t item = items[node.first + i];
+					const float distance = intersectRay(bounds[item], origin, inverseDirection, maxDistance);
+					if (distance >= 0.0f) {
+						hits.emplace_back(distance, item);
+					}
+				}
+			} else {
+				stack.push_back(node.first);
+				stack.push_back(node.first + 1);
+			}
+		}
+		std::sort(hits.begin(), hits.end());
+		for (const auto &hit : hits) {
+			result.push_back(hit.second);
+		}
+	}
+
+	/**
+	* Turn a node into a leaf or split it in two at the binned SAH optimum
+	*
+	* @param nodeIndex Node to split, covering its range of items
+	* @param pending Children created by the split are pushed to this
+	*/
+	void Bvh::split(uint32_t nodeIndex, std::vector<uint32_t> &pending)
+	{
+		const uint32_t first = nodes[nodeIndex].first;
+		const uint32_t count = nodes[nodeIndex].count;
+
+		Aabb nodeBounds = emptyAabb();
+		Aabb centroidBounds = emptyAabb();
+		for (uint32_t i = first; i < first + count; i++) {
+			grow(nodeBounds, bounds[items[i]]);
+			const glm::vec3 c = centroid(bounds[items[i]]);
+			grow(centroidBounds, Aabb{ c, c });
+		}
+		nodes[nodeIndex].bounds = nodeBounds;
+
+		const auto makeLeaf = [&]() {
+			for (uint32_t i = first; i < first + count; i++) {
+				itemLeaves[items[i]] = nodeIndex;
+			}
+		};
+		if (count <= maxLeafSize) {
+			makeLeaf();
+			return;
+		}
+
+		struct Bin
+		{
+			Aabb bounds = emptyAabb();
+			uint32_t count = 0;
+		};
+		std::vector<Bin> bins(binCount);
+		std::vector<float> rightCosts(binCount);
+		float bestCost = FLT_MAX;
+		int bestAxis = -1;
+		uint32_t bestSplit = 0;
+		const glm::vec3 centroidExtent = centroidBounds.max - centroidBounds.min;
+		for (int axis = 0; axis < 3; axis++) {
+			if (centroidExtent[axis] <= 0.0f) {
+				continue;
+			}
+			const float scale = static_cast<float>(binCount) / centroidExtent[axis];
+			std::fill(bins.begin(), bins.end(), Bin{});
+			for (uint32_t i = first; i < first + count; i++) {
+				const Aabb &box = bounds[items[i]];
+				const uint32_t bin = std::min(binCount - 1, static_cast<uint32_t>((centroid(box)[axis] - centroidBounds.min[axis]) * scale));
+				bins[bin].count++;
+				grow(bins[bin].bounds, box);
+			}
+			// Sweep from the right to get the cost of everything right of each split, then from the left to combine
+			Aabb right = emptyAabb();
+			uint32_t rightCount = 0;
+			for (uint32_t b = binCount - 1; b > 0; b--) {
+				grow(right, bins[b].bounds);
+				rightCount += bins[b].count;
+				rightCosts[b] = rightCount > 0 ? rightCount * surfaceArea(right) : 0.0f;
+			}
+			Aabb left = emptyAabb();
+			uint32_t leftCount = 0;
+			for (uint32_t b = 1; b < binCount; b++) {
+				grow(left, bins[b - 1].bounds);
+				leftCount += bins[b - 1].count;
+				if (leftCount == 0 || leftCount == count) {
+					continue;
+				}
+				const float cost = leftCount * surfaceArea(left) + rightCosts[b];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		// All centroids in one spot, there is no way to split
+		if (bestAxis < 0) {
+			makeLeaf();
+			return;
+		}
+
+		const float scale = static_cast<float>(binCount) / centroidExtent[bestAxis];
+		const float minimum = centroidBounds.min[bestAxis];
+		const auto middle = std::partition(items.begin() + first, items.begin() + first + count, [&](uint32_t item) {
+			const uint32_t bin = std::min(binCount - 1, static_cast<uint32_t>((centroid(bounds[item])[bestAxis] - minimum) * scale));
+			return bin < bestSplit;
+		});
+		const uint32_t leftCount = static_cast<uint32_t>(middle - (items.begin() + first));
+
+		const uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+		Node leftNode;
+		leftNode.first = first;
+		leftNode.count = leftCount;
+		Node rightNode;
+		rightNode.first = first + leftCount;
+		rightNode.count = count - leftCount;
+		nodes.push_back(leftNode);
+		nodes.push_back(rightNode);
+		parents.push_back(nodeIndex);
+		parents.push_back(nodeIndex);
+
+		nodes[nodeIndex].first = leftIndex;
+		nodes[nodeIndex].count = 0;
+		pending.push_back(leftIndex);
+		pending.push_back(leftIndex + 1);
+	}
+
+	/** @brief Append all items below a node */
+	void Bvh::collect(uint32_t nodeIndex, std::vector<uint32_t> &result) const
+	{
+		std::vector<uint32_t> stack{ nodeIndex };
+		while (!stack.empty()) {
+			const Node &node = nodes[stack.back()];
+			stack.pop_back();
+			if (node.count > 0) {
+				result.insert(result.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+			} else {
+				stack.push_back(node.first);
+				stack.push_back(node.first + 1);
+			}
+		}
+	}
+}
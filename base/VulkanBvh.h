@@ -0,0 +1,69 @@
+/*
+* Bounding volume hierarchy
+*
+* Dynamic BVH over axis aligned item bounds, built with binned SAH and refit incrementally when
+* item bounds change, with frustum, sphere and ray queries
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "VulkanTransformKernels.h"
+
+namespace vks
+{
+	class Bvh
+	{
+	public:
+		using Aabb = vks::transforms::Aabb;
+
+		/** @brief Node of the hierarchy, children always come after their parent */
+		struct Node
+		{
+			Aabb bounds;
+			/** @brief Index of the left child (the right child follows it) for interior nodes, index into items for leaves */
+			uint32_t first = 0;
+			/** @brief Number of items of a leaf, 0 for interior nodes */
+			uint32_t count = 0;
+		};
+
+		/** @brief Number of bins candidate splits are evaluated at per axis */
+		uint32_t binCount = 12;
+		/** @brief Nodes with at most this many items are never split */
+		uint32_t maxLeafSize = 4;
+
+		void build(const std::vector<Aabb> &itemBounds);
+		void update(uint32_t item, const Aabb &bounds);
+		void refit();
+		void clear();
+
+		void queryFrustum(const glm::vec4 planes[6], std::vector<uint32_t> &result) const;
+		void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &result) const;
+		void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, std::vector<uint32_t> &result) const;
+
+		const std::vector<Node> &getNodes() const { return nodes; }
+		/** @brief Bounds enclosing all items (only valid if not empty) */
+		const Aabb &getBounds() const { return nodes.front().bounds; }
+		bool empty() const { return nodes.empty(); }
+
+	private:
+		std::vector<Node> nodes;
+		std::vector<uint32_t> parents;
+		std::vector<uint8_t> dirty;
+		/** @brief Max-heap of the dirty nodes, so children are refit before their parents without visiting clean nodes */
+		std::vector<uint32_t> dirtyNodes;
+		/** @brief Item indices, each leaf references a contiguous range */
+		std::vector<uint32_t> items;
+		std::vector<Aabb> bounds;
+		/** @brief Leaf node each item is stored in */
+		std::vector<uint32_t> itemLeaves;
+
+		void split(uint32_t nodeIndex, std::vector<uint32_t> &pending);
+		void markDirty(uint32_t node);
+		void collect(uint32_t nodeIndex, std::vector<uint32_t> &result) const;
+	};
+}
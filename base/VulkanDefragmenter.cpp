@@ -0,0 +1,289 @@
+/*
+* Vulkan device memory defragmenter
+*
+* Moves registered buffers and textures out of sparsely used memory allocator blocks into the
+* fuller ones a few at a time, so the emptied blocks are released over long sessions with
+* many (re)loaded resources
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanDefragmenter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace vks
+{
+	/**
+	* Prepare the defragmenter for use
+	*
+	* @param device Vulkan device the resources have been created on
+	* @param copyQueue Queue used for the copy commands (must support transfer)
+	*/
+	void Defragmenter::prepare(vks::VulkanDevice *device, vk::Queue copyQueue)
+	{
+		this->device = device;
+		this->copyQueue = copyQueue;
+	}
+
+	/**
+	* Allow a buffer to be moved
+	*
+	* Device local buffers must have been created with transfer source and destination usage,
+	* host visible buffers are copied on the host
+	*
+	* @param buffer Buffer to manage, must stay at the same address until released
+	*
+	* @return Handle used to refer to the buffer in further calls
+	*/
+	uint32_t Defragmenter::registerBuffer(vks::Buffer *buffer)
+	{
+		assert((buffer->memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) ||
+			((buffer->usageFlags & vk::BufferUsageFlagBits::eTransferSrc) && (buffer->usageFlags & vk::BufferUsageFlagBits::eTransferDst)));
+		Entry entry{};
+		entry.buffer = buffer;
+		entries.push_back(entry);
+		return static_cast<uint32_t>(entries.size() - 1);
+	}
+
+	/**
+	* Allow an optimal tiled texture to be moved
+	*
+	* The texture may be recreated by its owner (e.g. with fewer mip levels) while registered, as long as
+	* the format, usage and view type stay the same
+	*
+	* @param texture Texture to manage, must stay at the same address until released
+	* @param format Format the texture's image has been created with
+	* @param usage Usage flags the texture's image has been created with, must include transfer source
+	* @param viewType (Optional) Type of the texture's image view (defaults to 2D)
+	*
+	* @return Handle used to refer to the texture in further calls
+	*/
+	uint32_t Defragmenter::registerTexture(vks::Texture *texture, vk::Format format, vk::ImageUsageFlags usage, vk::ImageViewType viewType)
+	{
+		assert(usage & vk::ImageUsageFlagBits::eTransferSrc);
+		Entry entry{};
+		entry.texture = texture;
+		entry.format = format;
+		entry.usage = usage | vk::ImageUsageFlagBits::eTransferDst;
+		entry.viewType = viewType;
+		entries.push_back(entry);
+		return static_cast<uint32_t>(entries.size() - 1);
+	}
+
+	/** @brief Stop managing the resource referred to by handle (does not destroy the resource) */
+	void Defragmenter::release(uint32_t handle)
+	{
+		assert(handle < entries.size());
+		entries[handle].buffer = nullptr;
+		entries[handle].texture = nullptr;
+	}
+
+	/**
+	* Move resources out of the least used allocator block that holds any managed resource, must be called while
+	* none of the managed resources are in use by the device
+	*
+	* At most maxBytesPerStep bytes are copied (or a single resource if it's larger than that)
+	*
+	* @return True if any resource has been moved, descriptors and command buffers referencing managed resources need to be updated
+	*/
+	bool Defragmenter::step()
+	{
+		assert(device);
+
+		const std::vector<vk::DeviceMemory> candidates = device->allocator.getDefragmentationCandidates();
+		if (candidates.empty()) {
+			return false;
+		}
+		const uint32_t blocksBefore = device->allocator.getStats().blocks;
+
+		// Only allocated once a resource has found room elsewhere, candidates often stay unmovable for many steps
+		vk::UniqueCommandBuffer commandBuffer;
+		std::vector<Move> moves;
+		vk::DeviceSize bytes = 0;
+		for (vk::DeviceMemory candidate : candidates) {
+			for (auto &entry : entries) {
+				vks::Allocation *allocation = getAllocation(entry);
+				if (!allocation || !*allocation || allocation->dedicated() || allocation->memory() != candidate) {
+					continue;
+				}
+				const vk::DeviceSize size = allocation->size();
+				if (bytes > 0 && bytes + size > maxBytesPerStep) {
+					break;
+				}
+				Move move;
+				move.entry = &entry;
+				const bool moved = entry.buffer ? moveBuffer(entry, commandBuffer, move) : moveTexture(entry, commandBuffer, move);
+				if (moved) {
+					bytes += size;
+					moves.push_back(std::move(move));
+				}
+			}
+			// Only evacuate one block per step, the next candidates are tried if nothing in this one could be moved
+			if (!moves.empty()) {
+				break;
+			}
+		}
+
+		if (moves.empty()) {
+			return false;
+		}
+		if (commandBuffer) {
+			device->flushCommandBuffer(commandBuffer, copyQueue, true);
+		}
+		for (auto &move : moves) {
+			finish(move);
+		}
+
+		stats.passes++;
+		stats.movedResources += static_cast<uint32_t>(moves.size());
+		stats.movedBytes += bytes;
+		const uint32_t blocksAfter = device->allocator.getStats().blocks;
+		if (blocksAfter < blocksBefore) {
+			stats.releasedBlocks += blocksBefore - blocksAfter;
+		}
+		return true;
+	}
+
+	/** @brief Stop managing all resources */
+	void Defragmenter::clear()
+	{
+		entries.clear();
+	}
+
+	vks::Allocation *Defragmenter::getAllocation(const Entry &entry)
+	{
+		if (entry.buffer) {
+			return &entry.buffer->memory;
+		}
+		if (entry.texture) {
+			return &entry.texture->deviceMemory;
+		}
+		return nullptr;
+	}
+
+	/** @brief Returns the command buffer copies are recorded to, beginning it on first use */
+	vk::CommandBuffer Defragmenter::getCommandBuffer(vk::UniqueCommandBuffer &commandBuffer)
+	{
+		if (!commandBuffer) {
+			commandBuffer = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+		}
+		return *commandBuffer;
+	}
+
+	/**
+	* Create a copy of a buffer in another block and record the copy of its contents
+	*
+	* @return False if no other block has room for the buffer
+	*/
+	bool Defragmenter::moveBuffer(Entry &entry, vk::UniqueCommandBuffer &commandBuffer, Move &move)
+	{
+		vks::Buffer &buffer = *entry.buffer;
+		vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(buffer.usageFlags, buffer.size);
+		move.buffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
+		const vk::MemoryRequirements memoryRequirements = device->logicalDevice->getBufferMemoryRequirements(*move.buffer);
+		move.memory = device->allocator.allocateForMove(buffer.memory, memoryRequirements);
+		if (!move.memory) {
+			return false;
+		}
+		device->logicalDevice->bindBufferMemory(*move.buffer, move.memory.memory(), move.memory.offset());
+
+		if (buffer.memory.mapped() && move.memory.mapped()) {
+			std::memcpy(move.memory.mapped(), buffer.memory.mapped(), buffer.size);
+			if (!(buffer.memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+				device->logicalDevice->flushMappedMemoryRanges({ vk::MappedMemoryRange{ move.memory.memory(), move.memory.offset(), move.memory.size() } });
+			}
+		} else {
+			vk::BufferCopy copyRegion{};
+			copyRegion.size = buffer.size;
+			getCommandBuffer(commandBuffer).copyBuffer(*buffer.buffer, *move.buffer, { copyRegion });
+		}
+		return true;
+	}
+
+	/**
+	* Create a copy of a texture's image in another block and record the copy of all of its mip levels and layers
+	*
+	* @return False if no other block has room for the image
+	*/
+	bool Defragmenter::moveTexture(Entry &entry, vk::UniqueCommandBuffer &commandBuffer, Move &move)
+	{
+		vks::Texture &texture = *entry.texture;
+		vk::ImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+		if (entry.viewType == vk::ImageViewType::eCube || entry.viewType == vk::ImageViewType::eCubeArray) {
+			imageCreateInfo.flags = vk::ImageCreateFlagBits::eCubeCompatible;
+		}
+		imageCreateInfo.imageType = vk::ImageType::e2D;
+		imageCreateInfo.format = entry.format;
+		imageCreateInfo.extent = vk::Extent3D{ texture.width, texture.height, 1 };
+		imageCreateInfo.mipLevels = texture.mipLevels;
+		imageCreateInfo.arrayLayers = texture.layerCount;
+		imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+		imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+		imageCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+		imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+		imageCreateInfo.usage = entry.usage;
+		move.image = device->logicalDevice->createImageUnique(imageCreateInfo);
+		const vk::MemoryRequirements memoryRequirements = device->logicalDevice->getImageMemoryRequirements(*move.image);
+		move.memory = device->allocator.allocateForMove(texture.deviceMemory, memoryRequirements);
+		if (!move.memory) {
+			return false;
+		}
+		device->logicalDevice->bindImageMemory(*move.image, move.memory.memory(), move.memory.offset());
+
+		const vk::CommandBuffer copyCommandBuffer = getCommandBuffer(commandBuffer);
+		vk::ImageSubresourceRange subresourceRange{};
+		subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+		subresourceRange.levelCount = texture.mipLevels;
+		subresourceRange.layerCount = texture.layerCount;
+		vks::tools::setImageLayout(copyCommandBuffer, *texture.image, texture.imageLayout, vk::ImageLayout::eTransferSrcOptimal, subresourceRange);
+		vks::tools::setImageLayout(copyCommandBuffer, *move.image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, subresourceRange);
+
+		std::vector<vk::ImageCopy> copyRegions;
+		for (uint32_t level = 0; level < texture.mipLevels; level++) {
+			vk::ImageCopy copyRegion{};
+			copyRegion.srcSubresource = vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level, 0, texture.layerCount };
+			copyRegion.dstSubresource = copyRegion.srcSubresource;
+			copyRegion.extent = vk::Extent3D{ std::max(texture.width >> level, 1u), std::max(texture.height >> level, 1u), 1 };
+			copyRegions.push_back(copyRegion);
+		}
+		copyCommandBuffer.copyImage(*texture.image, vk::ImageLayout::eTransferSrcOptimal, *move.image, vk::ImageLayout::eTransferDstOptimal, copyRegions);
+
+		vks::tools::setImageLayout(copyCommandBuffer, *move.image, vk::ImageLayout::eTransferDstOptimal, texture.imageLayout, subresourceRange);
+		return true;
+	}
+
+	/** @brief Swap the moved resource into its owner, releasing the old resource and its memory */
+	void Defragmenter::finish(Move &move)
+	{
+		Entry &entry = *move.entry;
+		if (entry.buffer) {
+			vks::Buffer &buffer = *entry.buffer;
+			const bool mapped = buffer.mapped != nullptr;
+			const vk::DeviceSize mappedOffset = mapped ? static_cast<uint8_t *>(buffer.mapped) - static_cast<uint8_t *>(buffer.memory.mapped()) : 0;
+			buffer.buffer = std::move(move.buffer);
+			buffer.memory = std::move(move.memory);
+			if (mapped) {
+				buffer.map(VK_WHOLE_SIZE, mappedOffset);
+			}
+			if (buffer.descriptor.buffer) {
+				buffer.setupDescriptor(buffer.descriptor.range, buffer.descriptor.offset);
+			}
+			return;
+		}
+
+		vks::Texture &texture = *entry.texture;
+		vk::ImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+		viewCreateInfo.viewType = entry.viewType;
+		viewCreateInfo.format = entry.format;
+		viewCreateInfo.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+		viewCreateInfo.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, texture.mipLevels, 0, texture.layerCount };
+		viewCreateInfo.image = *move.image;
+		texture.view = device->logicalDevice->createImageViewUnique(viewCreateInfo);
+		texture.image = std::move(move.image);
+		texture.deviceMemory = std::move(move.memory);
+		texture.updateDescriptor();
+	}
+}
@@ -0,0 +1,79 @@
+/*
+* Vulkan device memory defragmenter
+*
+* Moves registered buffers and textures out of sparsely used memory allocator blocks into the
+* fuller ones a few at a time, so the emptied blocks are released over long sessions with
+* many (re)loaded resources
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "VulkanBuffer.h"
+#include "VulkanDevice.h"
+#include "VulkanTexture.h"
+
+namespace vks
+{
+	class Defragmenter
+	{
+	public:
+		struct Stats
+		{
+			/** @brief Number of steps that moved at least one resource */
+			uint32_t passes = 0;
+			uint32_t movedResources = 0;
+			/** @brief Total size of the moved resources (in bytes) */
+			vk::DeviceSize movedBytes = 0;
+			/** @brief Number of allocator blocks released as a result of moving resources */
+			uint32_t releasedBlocks = 0;
+		};
+
+		/** @brief Upper bound for the amount of memory copied by a single step */
+		vk::DeviceSize maxBytesPerStep = 16ull * 1024 * 1024;
+		Stats stats;
+
+		void prepare(vks::VulkanDevice *device, vk::Queue copyQueue);
+		uint32_t registerBuffer(vks::Buffer *buffer);
+		uint32_t registerTexture(vks::Texture *texture, vk::Format format, vk::ImageUsageFlags usage, vk::ImageViewType viewType = vk::ImageViewType::e2D);
+		void release(uint32_t handle);
+		bool step();
+		void clear();
+
+	private:
+		struct Entry
+		{
+			vks::Buffer *buffer = nullptr;
+			vks::Texture *texture = nullptr;
+			vk::Format format;
+			vk::ImageUsageFlags usage;
+			vk::ImageViewType viewType;
+		};
+
+		/** @brief Resource created in its new location, swapped into the owner once the copy has completed */
+		struct Move
+		{
+			Entry *entry = nullptr;
+			vk::UniqueBuffer buffer;
+			vk::UniqueImage image;
+			vks::Allocation memory;
+		};
+
+		vks::VulkanDevice *device = nullptr;
+		vk::Queue copyQueue;
+
+		std::vector<Entry> entries;
+
+		vks::Allocation *getAllocation(const Entry &entry);
+		vk::CommandBuffer getCommandBuffer(vk::UniqueCommandBuffer &commandBuffer);
+		bool moveBuffer(Entry &entry, vk::UniqueCommandBuffer &commandBuffer, Move &move);
+		bool moveTexture(Entry &entry, vk::UniqueCommandBuffer &commandBuffer, Move &move);
+		void finish(Move &move);
+	};
+}
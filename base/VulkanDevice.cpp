@@ -49,6 +49,7 @@ namespace vks
 	*/
 	VulkanDevice::~VulkanDevice()
 	{
+		allocator.destroy();
 		commandPool.reset();
 		logicalDevice.reset();
 	}
@@ -266,6 +267,8 @@ namespace vks
 
 		logicalDevice = physicalDevice.createDeviceUnique(deviceCreateInfo);
 
+		allocator.prepare(*logicalDevice, memoryProperties.memoryProperties, properties.properties.limits);
+
 		// Create a default command pool for graphics command buffers
 		commandPool = createCommandPool(queueFamilyIndices.graphics);
 
@@ -279,54 +282,41 @@ namespace vks
 	* @param memoryPropertyFlags Memory properties for this buffer (i.e. device local, host visible, coherent)
 	* @param size Size of the buffer in byes
 	* @param buffer Pointer to the buffer handle acquired by the function
-	* @param memory Pointer to the memory handle acquired by the function
+	* @param memory Pointer to the memory allocation acquired by the function
 	* @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
 	*
 	* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
 	*/
-	vk::Result VulkanDevice::createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, vk::UniqueBuffer *buffer, vk::UniqueDeviceMemory *memory, void *data)
+	vk::Result VulkanDevice::createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, vk::UniqueBuffer *buffer, vks::Allocation *memory, void *data)
 	{
 		// Create the buffer handle
 		vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
 		bufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
 		*buffer = logicalDevice->createBufferUnique(bufferCreateInfo);
 
-		// Create the memory backing up the buffer handle
-		vk::MemoryRequirements2 memReqs;
-		vk::MemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-		memReqs = logicalDevice->getBufferMemoryRequirements2(**buffer);
-		memAlloc.allocationSize = memReqs.memoryRequirements.size;
-		// Find a memory type index that fits the properties of the buffer
-		memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryRequirements.memoryTypeBits, memoryPropertyFlags);
+		// Take the memory backing up the buffer handle from the allocator and attach it to the buffer object
 		// If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
-		vk::MemoryAllocateFlagsInfoKHR allocFlagsInfo{};
+		vk::MemoryAllocateFlags allocFlags;
 		if (usageFlags & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
-			allocFlagsInfo.flags = vk::MemoryAllocateFlagBits::eDeviceAddress;
-			memAlloc.pNext = &allocFlagsInfo;
+			allocFlags = vk::MemoryAllocateFlagBits::eDeviceAddress;
 		}
-		*memory = logicalDevice->allocateMemoryUnique(memAlloc);
-			
-		// If a pointer to the buffer data has been passed, map the buffer and copy over the data
+		*memory = allocator.allocateForBuffer(**buffer, memoryPropertyFlags, allocFlags);
+
+		// If a pointer to the buffer data has been passed, copy it over through the persistent mapping
 		if (data != nullptr)
 		{
-			void *mapped;
-			mapped = logicalDevice->mapMemory(**memory, 0, size, {});
-			std::copy_n(static_cast<std::byte*>(data), size, static_cast<std::byte*>(mapped));
+			std::copy_n(static_cast<std::byte*>(data), size, static_cast<std::byte*>(memory->mapped()));
 			// If host coherency hasn't been requested, do a manual flush to make writes visible
 			if (!(memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent))
 			{
 				vk::MappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
-				mappedRange.memory = **memory;
-				mappedRange.offset = 0;
-				mappedRange.size = size;
+				mappedRange.memory = memory->memory();
+				mappedRange.offset = memory->offset();
+				mappedRange.size = memory->dedicated() ? VK_WHOLE_SIZE : memory->size();
 				logicalDevice->flushMappedMemoryRanges({mappedRange});
 			}
-			logicalDevice->unmapMemory(**memory);
 		}
 
-		// Attach the memory to the buffer object
-		logicalDevice->bindBufferMemory(**buffer, **memory, 0);
-
 		return vk::Result::eSuccess;
 	}
 
@@ -349,20 +339,15 @@ namespace vks
 		vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(vk::BufferUsageFlags(usageFlags), size);
 		buffer->buffer = logicalDevice->createBufferUnique(bufferCreateInfo);
 
-		// Create the memory backing up the buffer handle
+		// Take the memory backing up the buffer handle from the allocator, it is bound to the buffer right away
 		vk::MemoryRequirements2 memReqs;
-		vk::MemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
 		memReqs = logicalDevice->getBufferMemoryRequirements2(*buffer->buffer);
-		memAlloc.allocationSize = memReqs.memoryRequirements.size;
-		// Find a memory type index that fits the properties of the buffer
-		memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryRequirements.memoryTypeBits, memoryPropertyFlags);
 		// If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
-		vk::MemoryAllocateFlagsInfoKHR allocFlagsInfo{};
+		vk::MemoryAllocateFlags allocFlags;
 		if (usageFlags & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
-			allocFlagsInfo.flags = vk::MemoryAllocateFlagBits::eDeviceAddress;
-			memAlloc.pNext = &allocFlagsInfo;
+			allocFlags = vk::MemoryAllocateFlagBits::eDeviceAddress;
 		}
-		buffer->memory = logicalDevice->allocateMemoryUnique(memAlloc);
+		buffer->memory = allocator.allocateForBuffer(*buffer->buffer, memoryPropertyFlags, allocFlags);
 
 		buffer->alignment = memReqs.memoryRequirements.alignment;
 		buffer->size = size;
@@ -383,8 +368,6 @@ namespace vks
 		// Initialize a default descriptor that covers the whole buffer size
 		buffer->setupDescriptor();
 
-		// Attach the memory to the buffer object
-		buffer->bind();
 		return vk::Result::eSuccess;
 	}
 
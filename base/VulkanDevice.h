@@ -11,6 +11,7 @@
 #pragma once
 
 #include "VulkanBuffer.h"
+#include "VulkanMemoryAllocator.h"
 #include "VulkanTools.h"
 #include "vulkan/vulkan.h"
 #include <algorithm>
@@ -37,6 +38,8 @@ struct VulkanDevice
 	std::vector<vk::QueueFamilyProperties2> queueFamilyProperties;
 	/** @brief List of extensions supported by the device */
 	std::vector<std::string> supportedExtensions;
+	/** @brief Sub-allocator all buffer and image memory is taken from */
+	vks::MemoryAllocator allocator;
 	/** @brief Default command pool for the graphics queue family index */
 	vk::UniqueCommandPool commandPool;
 	/** @brief Set to true when the debug marker extension is detected */
@@ -57,7 +60,7 @@ struct VulkanDevice
 	uint32_t                getMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags properties, vk::Bool32 *memTypeFound = nullptr) const;
 	uint32_t                getQueueFamilyIndex(vk::QueueFlags queueFlags) const;
 	vk::Result              createLogicalDevice(vk::PhysicalDeviceFeatures2 enabledFeatures, std::vector<const char *> enabledExtensions, void *pNextChain, bool useSwapChain = true, vk::QueueFlags requestedQueueTypes = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute);
-	vk::Result              createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, vk::UniqueBuffer *buffer, vk::UniqueDeviceMemory *memory, void *data = nullptr);
+	vk::Result              createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, vk::UniqueBuffer *buffer, vks::Allocation *memory, void *data = nullptr);
 	vk::Result              createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vks::Buffer *buffer, vk::DeviceSize size, void *data = nullptr);
 	void                    copyBuffer(vks::Buffer *src, vks::Buffer *dst, vk::Queue queue, vk::BufferCopy *copyRegion = nullptr);
 	vk::UniqueCommandPool   createCommandPool(uint32_t queueFamilyIndex, vk::CommandPoolCreateFlags createFlags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
@@ -23,7 +23,7 @@ namespace vks
 	struct FramebufferAttachment
 	{
 		vk::UniqueImage image;
-		vk::UniqueDeviceMemory memory;
+		vks::Allocation memory;
 		vk::UniqueImageView view;
 		vk::Format format;
 		vk::ImageSubresourceRange subresourceRange;
@@ -175,16 +175,9 @@ namespace vks
 			image.tiling = vk::ImageTiling::eOptimal;
 			image.usage = createinfo.usage;
 
-			vk::MemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-			vk::MemoryRequirements2 memReqs;
-
 			// Create image for this attachment
 			attachment.image = vulkanDevice->logicalDevice->createImageUnique(image);
-			memReqs = vulkanDevice->logicalDevice->getImageMemoryRequirements2(*attachment.image);
-			memAlloc.allocationSize = memReqs.memoryRequirements.size;
-			memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-			attachment.memory = vulkanDevice->logicalDevice->allocateMemoryUnique(memAlloc);
-			vulkanDevice->logicalDevice->bindImageMemory(*attachment.image, *attachment.memory, {});
+			attachment.memory = vulkanDevice->allocator.allocateForImage(*attachment.image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 			attachment.subresourceRange = vk::ImageSubresourceRange{};
 			attachment.subresourceRange.aspectMask = aspectMask;
@@ -12,6 +12,7 @@
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.h"
 #include "VulkanBuffer.h"
+#include "VulkanPixelConversion.h"
 #include <ktx.h>
 #include <ktxvulkan.h>
 
@@ -20,7 +21,8 @@ namespace vks
 	class HeightMap
 	{
 	private:
-		uint16_t *heightdata;
+		// Heights normalized to [0, 1]
+		std::vector<float> heightdata;
 		uint32_t dim;
 		uint32_t scale;
 
@@ -55,7 +57,6 @@ namespace vks
 		{
 			vertexBuffer.destroy();
 			indexBuffer.destroy();
-			delete[] heightdata;
 		}
 
 		float getHeight(uint32_t x, uint32_t y)
@@ -64,7 +65,7 @@ namespace vks
 			rpos.x = std::max(0, std::min(rpos.x, (int)dim - 1));
 			rpos.y = std::max(0, std::min(rpos.y, (int)dim - 1));
 			rpos /= glm::ivec2(scale);
-			return *(heightdata + (rpos.x + rpos.y * dim) * scale) / 65535.0f * heightScale;
+			return heightdata[(rpos.x + rpos.y * dim) * scale] * heightScale;
 		}
 
 		void loadFromFile(const std::string filename, uint32_t patchsize, glm::vec3 scale, Topology topology)
@@ -79,8 +80,8 @@ namespace vks
 			ktx_size_t ktxSize = ktxTexture_GetImageSize(ktxTexture, 0);
 			ktx_uint8_t* ktxImage = ktxTexture_GetData(ktxTexture);
 			dim = ktxTexture->baseWidth;
-			heightdata = new uint16_t[dim * dim];
-			std::copy_n(reinterpret_cast<std::byte*>(ktxImage), ktxSize, reinterpret_cast<std::byte*>(heightdata));
+			heightdata.resize(dim * dim);
+			vks::pixels::unorm16ToFloat(reinterpret_cast<const uint16_t*>(ktxImage), heightdata.data(), std::min<size_t>(ktxSize / sizeof(uint16_t), heightdata.size()));
 			this->scale = dim / patchsize;
 			ktxTexture_Destroy(ktxTexture);
 
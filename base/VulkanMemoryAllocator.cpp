@@ -0,0 +1,515 @@
+/*
+* Vulkan device memory allocator
+*
+* Sub-allocates buffers and images from large device memory blocks (one pool of blocks per memory type
+* and resource kind) using a buddy allocator, so the number of vkAllocateMemory calls stays far below
+* maxMemoryAllocationCount. Large resources and those the driver wants dedicated memory for get
+* their own allocation.
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanMemoryAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+
+namespace vks
+{
+	namespace
+	{
+		vk::DeviceSize nextPowerOfTwo(vk::DeviceSize value)
+		{
+			vk::DeviceSize result = 1;
+			while (result < value) {
+				result <<= 1;
+			}
+			return result;
+		}
+
+		uint32_t log2(vk::DeviceSize value)
+		{
+			uint32_t result = 0;
+			while (value > 1) {
+				value >>= 1;
+				result++;
+			}
+			return result;
+		}
+	}
+
+	Allocation::Allocation(Allocation &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	Allocation &Allocation::operator=(Allocation &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			allocator = std::exchange(other.allocator, nullptr);
+			block = std::exchange(other.block, nullptr);
+			deviceMemory = std::exchange(other.deviceMemory, nullptr);
+			memoryOffset = std::exchange(other.memoryOffset, 0);
+			rangeSize = std::exchange(other.rangeSize, 0);
+			order = std::exchange(other.order, 0);
+			mappedData = std::exchange(other.mappedData, nullptr);
+		}
+		return *this;
+	}
+
+	Allocation::~Allocation()
+	{
+		reset();
+	}
+
+	void Allocation::reset()
+	{
+		if (allocator && deviceMemory) {
+			allocator->free(*this);
+		}
+		allocator = nullptr;
+		block = nullptr;
+		deviceMemory = nullptr;
+		memoryOffset = 0;
+		rangeSize = 0;
+		order = 0;
+		mappedData = nullptr;
+	}
+
+	MemoryAllocator::~MemoryAllocator()
+	{
+		destroy();
+	}
+
+	/**
+	* Prepare the allocator for use
+	*
+	* @param device Logical device memory is allocated from
+	* @param memoryProperties Memory types and heaps of the physical device
+	* @param limits Limits of the physical device (for the non-coherent atom size)
+	*/
+	void MemoryAllocator::prepare(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memoryProperties, const vk::PhysicalDeviceLimits &limits)
+	{
+		this->device = device;
+		this->memoryProperties = memoryProperties;
+		// Ranges of non-coherent memory are flushed in multiples of the atom size, so keep every range atom aligned
+		nonCoherentAtomSize = std::max<vk::DeviceSize>(limits.nonCoherentAtomSize, 1);
+		minAllocationSize = nextPowerOfTwo(std::max(minAllocationSize, nonCoherentAtomSize));
+	}
+
+	/**
+	* Free all device memory blocks
+	*
+	* @note All allocations must have been released before
+	*/
+	void MemoryAllocator::destroy()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto &pool : pools) {
+			for (auto &block : pool.blocks) {
+				assert(block->allocationCount == 0);
+				device.freeMemory(block->memory);
+			}
+		}
+		pools.clear();
+		assert(dedicatedCount == 0);
+	}
+
+	/**
+	* Allocate a range of device memory
+	*
+	* @param memoryRequirements Size, alignment and supported memory types of the resource
+	* @param properties Memory properties the memory type must have
+	* @param kind Resource kind (buffers and linear images vs. optimal images)
+	* @param allocateFlags (Optional) Flags for the memory allocation (e.g. device address)
+	*
+	* @return Allocation of at least the requested size and alignment
+	*/
+	Allocation MemoryAllocator::allocate(const vk::MemoryRequirements &memoryRequirements, vk::MemoryPropertyFlags properties, ResourceKind kind, vk::MemoryAllocateFlags allocateFlags)
+	{
+		const uint32_t memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+		const vk::DeviceSize blockSize = blockSizeFor(memoryTypeIndex);
+
+		// Resources that take up a large part of a block would mostly waste it
+		const vk::DeviceSize size = nextPowerOfTwo(std::max({ memoryRequirements.size, memoryRequirements.alignment, minAllocationSize }));
+		if (size > blockSize / 2) {
+			return allocateDedicated(memoryRequirements.size, memoryTypeIndex, allocateFlags);
+		}
+
+		const uint32_t order = log2(size / minAllocationSize);
+		Allocation allocation;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			const uint32_t poolIndex = getPool(memoryTypeIndex, kind, allocateFlags);
+			Pool &pool = pools[poolIndex];
+
+			vk::DeviceSize offset = 0;
+			Allocation::Block *target = nullptr;
+			for (auto &block : pool.blocks) {
+				if (allocateFromBlock(*block, order, offset)) {
+					target = block.get();
+					break;
+				}
+			}
+
+			if (!target) {
+				auto block = std::make_unique<Allocation::Block>();
+				try {
+					block->memory = allocateMemory(blockSize, memoryTypeIndex, allocateFlags, nullptr, &block->mapped);
+				} catch (const vk::OutOfDeviceMemoryError &) {
+					// Not enough memory left for another block, the resource might still fit on its own
+					block.reset();
+				}
+				if (block) {
+					block->size = blockSize;
+					block->pool = poolIndex;
+					block->freeLists.resize(log2(blockSize / minAllocationSize) + 1);
+					block->freeLists.back().insert(0);
+					allocateFromBlock(*block, order, offset);
+					target = block.get();
+					pool.blocks.push_back(std::move(block));
+				}
+			}
+
+			if (target) {
+				target->usedBytes += size;
+				target->allocationCount++;
+				allocation.allocator = this;
+				allocation.block = target;
+				allocation.deviceMemory = target->memory;
+				allocation.memoryOffset = offset;
+				allocation.rangeSize = size;
+				allocation.order = order;
+				allocation.mappedData = target->mapped ? static_cast<uint8_t *>(target->mapped) + offset : nullptr;
+			}
+		}
+
+		if (!allocation) {
+			return allocateDedicated(memoryRequirements.size, memoryTypeIndex, allocateFlags);
+		}
+		return allocation;
+	}
+
+	/**
+	* Allocate memory for a buffer and bind it
+	*
+	* @param buffer Buffer to allocate memory for
+	* @param properties Memory properties the memory type must have
+	* @param allocateFlags (Optional) Flags for the memory allocation (e.g. device address)
+	*
+	* @return Allocation bound to the buffer
+	*/
+	Allocation MemoryAllocator::allocateForBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties, vk::MemoryAllocateFlags allocateFlags)
+	{
+		vk::BufferMemoryRequirementsInfo2 requirementsInfo{ buffer };
+		auto requirements = device.getBufferMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(requirementsInfo);
+		const auto &memoryRequirements = requirements.get<vk::MemoryRequirements2>().memoryRequirements;
+		const auto &dedicatedRequirements = requirements.get<vk::MemoryDedicatedRequirements>();
+
+		Allocation allocation;
+		if (dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation) {
+			vk::MemoryDedicatedAllocateInfo dedicatedInfo{};
+			dedicatedInfo.buffer = buffer;
+			allocation = allocateDedicated(memoryRequirements.size, findMemoryType(memoryRequirements.memoryTypeBits, properties), allocateFlags, &dedicatedInfo);
+		} else {
+			allocation = allocate(memoryRequirements, properties, ResourceKind::Linear, allocateFlags);
+		}
+		device.bindBufferMemory(buffer, allocation.memory(), allocation.offset());
+		return allocation;
+	}
+
+	/**
+	* Allocate memory for an image and bind it
+	*
+	* @param image Image to allocate memory for
+	* @param properties Memory properties the memory type must have
+	* @param tiling (Optional) Tiling the image has been created with (defaults to optimal)
+	*
+	* @return Allocation bound to the image
+	*/
+	Allocation MemoryAllocator::allocateForImage(vk::Image image, vk::MemoryPropertyFlags properties, vk::ImageTiling tiling)
+	{
+		vk::ImageMemoryRequirementsInfo2 requirementsInfo{ image };
+		auto requirements = device.getImageMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(requirementsInfo);
+		const auto &memoryRequirements = requirements.get<vk::MemoryRequirements2>().memoryRequirements;
+		const auto &dedicatedRequirements = requirements.get<vk::MemoryDedicatedRequirements>();
+
+		Allocation allocation;
+		if (dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation) {
+			vk::MemoryDedicatedAllocateInfo dedicatedInfo{};
+			dedicatedInfo.image = image;
+			allocation = allocateDedicated(memoryRequirements.size, findMemoryType(memoryRequirements.memoryTypeBits, properties), {}, &dedicatedInfo);
+		} else {
+			const ResourceKind kind = tiling == vk::ImageTiling::eOptimal ? ResourceKind::Optimal : ResourceKind::Linear;
+			allocation = allocate(memoryRequirements, properties, kind);
+		}
+		device.bindImageMemory(image, allocation.memory(), allocation.offset());
+		return allocation;
+	}
+
+	/**
+	* Allocate a new range for a resource that is to be moved out of its current block
+	*
+	* Only blocks of the same pool that are at least as full as the current one are considered, so resources
+	* always move towards dense blocks and the sparse ones run empty and get released
+	*
+	* @param current Allocation currently backing the resource (must not be dedicated)
+	* @param memoryRequirements Memory requirements of the resource the new range is bound to
+	*
+	* @return New allocation or an empty allocation if no other block has room (never allocates new blocks)
+	*/
+	Allocation MemoryAllocator::allocateForMove(const Allocation &current, const vk::MemoryRequirements &memoryRequirements)
+	{
+		assert(current.block);
+		const vk::DeviceSize size = nextPowerOfTwo(std::max({ memoryRequirements.size, memoryRequirements.alignment, minAllocationSize }));
+		const uint32_t order = log2(size / minAllocationSize);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		Allocation allocation;
+		Pool &pool = pools[current.block->pool];
+		if (!(memoryRequirements.memoryTypeBits & (1u << pool.memoryTypeIndex))) {
+			return allocation;
+		}
+
+		// Prefer the fullest blocks
+		std::vector<Allocation::Block *> targets;
+		for (auto &block : pool.blocks) {
+			if (block.get() != current.block && block->usedBytes >= current.block->usedBytes) {
+				targets.push_back(block.get());
+			}
+		}
+		std::sort(targets.begin(), targets.end(), [](const Allocation::Block *a, const Allocation::Block *b) { return a->usedBytes > b->usedBytes; });
+
+		for (Allocation::Block *target : targets) {
+			vk::DeviceSize offset = 0;
+			if (order < target->freeLists.size() && allocateFromBlock(*target, order, offset)) {
+				target->usedBytes += size;
+				target->allocationCount++;
+				allocation.allocator = this;
+				allocation.block = target;
+				allocation.deviceMemory = target->memory;
+				allocation.memoryOffset = offset;
+				allocation.rangeSize = size;
+				allocation.order = order;
+				allocation.mappedData = target->mapped ? static_cast<uint8_t *>(target->mapped) + offset : nullptr;
+				break;
+			}
+		}
+		return allocation;
+	}
+
+	/**
+	* Get the blocks worth evacuating, i.e. all blocks of pools with more than one block
+	*
+	* @return Memory objects of the blocks, least used first
+	*/
+	std::vector<vk::DeviceMemory> MemoryAllocator::getDefragmentationCandidates() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<const Allocation::Block *> blocks;
+		for (const auto &pool : pools) {
+			if (pool.blocks.size() > 1) {
+				for (const auto &block : pool.blocks) {
+					blocks.push_back(block.get());
+				}
+			}
+		}
+		std::sort(blocks.begin(), blocks.end(), [](const Allocation::Block *a, const Allocation::Block *b) { return a->usedBytes < b->usedBytes; });
+
+		std::vector<vk::DeviceMemory> candidates;
+		for (const Allocation::Block *block : blocks) {
+			candidates.push_back(block->memory);
+		}
+		return candidates;
+	}
+
+	/** @brief Get the current block and allocation counts and the fragmentation of the free block memory */
+	MemoryAllocator::Stats MemoryAllocator::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Stats stats{};
+		for (const auto &pool : pools) {
+			for (const auto &block : pool.blocks) {
+				stats.blocks++;
+				stats.subAllocations += block->allocationCount;
+				stats.reservedBytes += block->size;
+				stats.usedBytes += block->usedBytes;
+				for (uint32_t order = 0; order < block->freeLists.size(); order++) {
+					if (!block->freeLists[order].empty()) {
+						stats.freeRanges += static_cast<uint32_t>(block->freeLists[order].size());
+						stats.largestFreeRange = std::max(stats.largestFreeRange, minAllocationSize << order);
+					}
+				}
+			}
+		}
+		const vk::DeviceSize freeBytes = stats.reservedBytes - stats.usedBytes;
+		if (freeBytes > 0) {
+			stats.fragmentation = 1.0f - static_cast<float>(stats.largestFreeRange) / static_cast<float>(freeBytes);
+		}
+		stats.dedicatedAllocations = dedicatedCount;
+		stats.memoryObjects = stats.blocks + dedicatedCount;
+		stats.reservedBytes += dedicatedBytes;
+		stats.usedBytes += dedicatedBytes;
+		return stats;
+	}
+
+	/**
+	* Get the memory reserved in blocks but not handed out to any resource, on heaps with the given flags
+	*
+	* Freeing a resource returns its range to the block without releasing any memory to the driver, so this is how much of the
+	* heap usage reported by VK_EXT_memory_budget is still available to new resources
+	*/
+	vk::DeviceSize MemoryAllocator::getFreeBlockBytes(vk::MemoryHeapFlags heapFlags) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		vk::DeviceSize freeBytes = 0;
+		for (const auto &pool : pools) {
+			const uint32_t heapIndex = memoryProperties.memoryTypes[pool.memoryTypeIndex].heapIndex;
+			if ((memoryProperties.memoryHeaps[heapIndex].flags & heapFlags) != heapFlags) {
+				continue;
+			}
+			for (const auto &block : pool.blocks) {
+				freeBytes += block->size - block->usedBytes;
+			}
+		}
+		return freeBytes;
+	}
+
+	uint32_t MemoryAllocator::findMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags properties) const
+	{
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("Could not find a matching memory type");
+	}
+
+	/** @brief Get the size of the blocks allocated from the given memory type, small heaps get smaller blocks */
+	vk::DeviceSize MemoryAllocator::blockSizeFor(uint32_t memoryTypeIndex) const
+	{
+		const vk::MemoryType &memoryType = memoryProperties.memoryTypes[memoryTypeIndex];
+		const vk::MemoryHeap &heap = memoryProperties.memoryHeaps[memoryType.heapIndex];
+		vk::DeviceSize size = nextPowerOfTwo((heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? deviceLocalBlockSize : hostBlockSize);
+		while (size > heap.size / 8 && size > minAllocationSize) {
+			size >>= 1;
+		}
+		return std::max(size, minAllocationSize);
+	}
+
+	uint32_t MemoryAllocator::getPool(uint32_t memoryTypeIndex, ResourceKind kind, vk::MemoryAllocateFlags allocateFlags)
+	{
+		for (uint32_t i = 0; i < static_cast<uint32_t>(pools.size()); i++) {
+			if (pools[i].memoryTypeIndex == memoryTypeIndex && pools[i].kind == kind && pools[i].allocateFlags == allocateFlags) {
+				return i;
+			}
+		}
+		Pool pool;
+		pool.memoryTypeIndex = memoryTypeIndex;
+		pool.kind = kind;
+		pool.allocateFlags = allocateFlags;
+		pools.push_back(std::move(pool));
+		return static_cast<uint32_t>(pools.size() - 1);
+	}
+
+	/** @brief Allocate a device memory object, host visible memory is persistently mapped */
+	vk::DeviceMemory MemoryAllocator::allocateMemory(vk::DeviceSize size, uint32_t memoryTypeIndex, vk::MemoryAllocateFlags allocateFlags, const vk::MemoryDedicatedAllocateInfo *dedicatedInfo, void **mapped)
+	{
+		vk::MemoryAllocateInfo memAlloc{};
+		memAlloc.allocationSize = size;
+		memAlloc.memoryTypeIndex = memoryTypeIndex;
+		vk::MemoryAllocateFlagsInfo allocFlagsInfo{};
+		allocFlagsInfo.flags = allocateFlags;
+		allocFlagsInfo.pNext = dedicatedInfo;
+		if (allocateFlags) {
+			memAlloc.pNext = &allocFlagsInfo;
+		} else {
+			memAlloc.pNext = dedicatedInfo;
+		}
+		vk::DeviceMemory memory = device.allocateMemory(memAlloc);
+
+		*mapped = nullptr;
+		if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+			*mapped = device.mapMemory(memory, 0, VK_WHOLE_SIZE, {});
+		}
+		return memory;
+	}
+
+	Allocation MemoryAllocator::allocateDedicated(vk::DeviceSize size, uint32_t memoryTypeIndex, vk::MemoryAllocateFlags allocateFlags, const vk::MemoryDedicatedAllocateInfo *dedicatedInfo)
+	{
+		Allocation allocation;
+		allocation.deviceMemory = allocateMemory(size, memoryTypeIndex, allocateFlags, dedicatedInfo, &allocation.mappedData);
+		allocation.allocator = this;
+		allocation.rangeSize = size;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		dedicatedCount++;
+		dedicatedBytes += size;
+		return allocation;
+	}
+
+	/**
+	* Take a free range of the given order from a block, splitting larger ranges as needed
+	*
+	* @return False if the block has no free range large enough
+	*/
+	bool MemoryAllocator::allocateFromBlock(Allocation::Block &block, uint32_t order, vk::DeviceSize &offset)
+	{
+		uint32_t current = order;
+		while (current < block.freeLists.size() && block.freeLists[current].empty()) {
+			current++;
+		}
+		if (current >= block.freeLists.size()) {
+			return false;
+		}
+
+		offset = *block.freeLists[current].begin();
+		block.freeLists[current].erase(block.freeLists[current].begin());
+		// Return the upper halves of the split range to the free lists
+		while (current > order) {
+			current--;
+			block.freeLists[current].insert(offset + (minAllocationSize << current));
+		}
+		return true;
+	}
+
+	void MemoryAllocator::free(Allocation &allocation)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!allocation.block) {
+			device.freeMemory(allocation.deviceMemory);
+			dedicatedCount--;
+			dedicatedBytes -= allocation.rangeSize;
+			return;
+		}
+
+		Allocation::Block &block = *allocation.block;
+		block.usedBytes -= allocation.rangeSize;
+		block.allocationCount--;
+
+		// Merge with the buddy range as long as it is free too
+		vk::DeviceSize offset = allocation.memoryOffset;
+		uint32_t order = allocation.order;
+		while (order + 1 < block.freeLists.size()) {
+			const vk::DeviceSize buddy = offset ^ (minAllocationSize << order);
+			auto it = block.freeLists[order].find(buddy);
+			if (it == block.freeLists[order].end()) {
+				break;
+			}
+			block.freeLists[order].erase(it);
+			offset = std::min(offset, buddy);
+			order++;
+		}
+		block.freeLists[order].insert(offset);
+
+		// Release empty blocks, but keep one per pool around to avoid reallocating it right away
+		Pool &pool = pools[block.pool];
+		if (block.allocationCount == 0 && pool.blocks.size() > 1) {
+			device.freeMemory(block.memory);
+			pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(), [&](const auto &b) { return b.get() == &block; }));
+		}
+	}
+}
@@ -0,0 +1,160 @@
+/*
+* Vulkan device memory allocator
+*
+* Sub-allocates buffers and images from large device memory blocks (one pool of blocks per memory type
+* and resource kind) using a buddy allocator, so the number of vkAllocateMemory calls stays far below
+* maxMemoryAllocationCount. Large resources and those the driver wants dedicated memory for get
+* their own allocation.
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace vks
+{
+	class MemoryAllocator;
+
+	/**
+	* A range of device memory handed out by the MemoryAllocator
+	*
+	* Returns the range to the allocator when destroyed, must not outlive the allocator
+	*/
+	class Allocation
+	{
+	public:
+		Allocation() = default;
+		Allocation(Allocation &&other) noexcept;
+		Allocation &operator=(Allocation &&other) noexcept;
+		Allocation(const Allocation &) = delete;
+		Allocation &operator=(const Allocation &) = delete;
+		~Allocation();
+
+		/** @brief Memory object the range belongs to (shared with other allocations unless dedicated) */
+		vk::DeviceMemory memory() const { return deviceMemory; }
+		/** @brief Offset of the range inside memory() */
+		vk::DeviceSize offset() const { return memoryOffset; }
+		/** @brief Size of the range, may be larger than requested */
+		vk::DeviceSize size() const { return rangeSize; }
+		/** @brief Host pointer to the start of the range, nullptr if the memory is not host visible */
+		void *mapped() const { return mappedData; }
+		bool dedicated() const { return block == nullptr; }
+		/** @brief Return the range to the allocator */
+		void reset();
+		explicit operator bool() const { return static_cast<bool>(deviceMemory); }
+
+	private:
+		friend class MemoryAllocator;
+
+		/** @brief Device memory block shared by several allocations, split into power of two ranges (buddies) */
+		struct Block
+		{
+			vk::DeviceMemory memory;
+			vk::DeviceSize size = 0;
+			void *mapped = nullptr;
+			/** @brief Index of the pool the block belongs to */
+			uint32_t pool = 0;
+			/** @brief Offsets of the free ranges of each order, order n ranges are minAllocationSize << n bytes large */
+			std::vector<std::set<vk::DeviceSize>> freeLists;
+			vk::DeviceSize usedBytes = 0;
+			uint32_t allocationCount = 0;
+		};
+
+		MemoryAllocator *allocator = nullptr;
+		Block *block = nullptr;
+		vk::DeviceMemory deviceMemory;
+		vk::DeviceSize memoryOffset = 0;
+		vk::DeviceSize rangeSize = 0;
+		uint32_t order = 0;
+		void *mappedData = nullptr;
+	};
+
+	class MemoryAllocator
+	{
+	public:
+		/** @brief Kind of resource an allocation is made for, linear and optimal resources never share a block (bufferImageGranularity) */
+		enum class ResourceKind
+		{
+			Linear,
+			Optimal,
+		};
+
+		struct Stats
+		{
+			/** @brief Number of vkAllocateMemory calls currently alive (blocks and dedicated allocations) */
+			uint32_t memoryObjects = 0;
+			uint32_t blocks = 0;
+			uint32_t dedicatedAllocations = 0;
+			/** @brief Number of live sub-allocations */
+			uint32_t subAllocations = 0;
+			/** @brief Device memory allocated from the driver (in bytes) */
+			vk::DeviceSize reservedBytes = 0;
+			/** @brief Device memory handed out to resources (in bytes, including rounding) */
+			vk::DeviceSize usedBytes = 0;
+			/** @brief Number of free ranges in all blocks */
+			uint32_t freeRanges = 0;
+			/** @brief Largest free range of any block (in bytes) */
+			vk::DeviceSize largestFreeRange = 0;
+			/** @brief Share of free block memory not part of the largest free range (0 = unfragmented, close to 1 = free memory is split into many small ranges) */
+			float fragmentation = 0.0f;
+		};
+
+		/** @brief Size of the blocks allocated from device local heaps (capped to an eighth of the heap) */
+		vk::DeviceSize deviceLocalBlockSize = 256ull * 1024 * 1024;
+		/** @brief Size of the blocks allocated from other heaps */
+		vk::DeviceSize hostBlockSize = 64ull * 1024 * 1024;
+		/** @brief Smallest range handed out, smaller requests are rounded up */
+		vk::DeviceSize minAllocationSize = 256;
+
+		MemoryAllocator() = default;
+		MemoryAllocator(const MemoryAllocator &) = delete;
+		MemoryAllocator &operator=(const MemoryAllocator &) = delete;
+		~MemoryAllocator();
+
+		void prepare(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memoryProperties, const vk::PhysicalDeviceLimits &limits);
+		void destroy();
+
+		Allocation allocate(const vk::MemoryRequirements &memoryRequirements, vk::MemoryPropertyFlags properties, ResourceKind kind, vk::MemoryAllocateFlags allocateFlags = {});
+		Allocation allocateForBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties, vk::MemoryAllocateFlags allocateFlags = {});
+		Allocation allocateForImage(vk::Image image, vk::MemoryPropertyFlags properties, vk::ImageTiling tiling = vk::ImageTiling::eOptimal);
+		Allocation allocateForMove(const Allocation &current, const vk::MemoryRequirements &memoryRequirements);
+		std::vector<vk::DeviceMemory> getDefragmentationCandidates() const;
+		Stats getStats() const;
+		vk::DeviceSize getFreeBlockBytes(vk::MemoryHeapFlags heapFlags) const;
+
+	private:
+		friend class Allocation;
+
+		struct Pool
+		{
+			uint32_t memoryTypeIndex = 0;
+			ResourceKind kind = ResourceKind::Linear;
+			vk::MemoryAllocateFlags allocateFlags;
+			std::vector<std::unique_ptr<Allocation::Block>> blocks;
+		};
+
+		vk::Device device;
+		vk::PhysicalDeviceMemoryProperties memoryProperties;
+		vk::DeviceSize nonCoherentAtomSize = 1;
+		std::vector<Pool> pools;
+		uint32_t dedicatedCount = 0;
+		vk::DeviceSize dedicatedBytes = 0;
+		mutable std::mutex mutex;
+
+		uint32_t findMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags properties) const;
+		vk::DeviceSize blockSizeFor(uint32_t memoryTypeIndex) const;
+		uint32_t getPool(uint32_t memoryTypeIndex, ResourceKind kind, vk::MemoryAllocateFlags allocateFlags);
+		vk::DeviceMemory allocateMemory(vk::DeviceSize size, uint32_t memoryTypeIndex, vk::MemoryAllocateFlags allocateFlags, const vk::MemoryDedicatedAllocateInfo *dedicatedInfo, void **mapped);
+		Allocation allocateDedicated(vk::DeviceSize size, uint32_t memoryTypeIndex, vk::MemoryAllocateFlags allocateFlags, const vk::MemoryDedicatedAllocateInfo *dedicatedInfo = nullptr);
+		bool allocateFromBlock(Allocation::Block &block, uint32_t order, vk::DeviceSize &offset);
+		void free(Allocation &allocation);
+	};
+}
@@ -0,0 +1,297 @@
+/*
+* Pixel format conversion kernels
+*
+* Vectorized (AVX2, SSE4.1 or NEON, depending on the target the file is compiled for) conversions
+* between the 8/16 bit pixel layouts used when loading textures and reading back images,
+* with a scalar fallback for other targets and for the remaining pixels of each call
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanPixelConversion.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__AVX2__)
+#define VKS_PIXELS_AVX2
+#define VKS_PIXELS_SSE4
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#define VKS_PIXELS_SSE4
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VKS_PIXELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace vks
+{
+	namespace pixels
+	{
+		namespace
+		{
+			// Exact round(x / 255) for x in [0, 255 * 255]
+			inline uint8_t div255(uint32_t x)
+			{
+				x += 128;
+				return static_cast<uint8_t>((x + (x >> 8)) >> 8);
+			}
+
+			inline uint8_t packUnorm8(float value)
+			{
+				const float v = std::min(std::max(value * 127.5f + 127.5f, 0.0f), 255.0f);
+				return static_cast<uint8_t>(std::lrint(v));
+			}
+
+			const std::array<float, 256> &srgbTable()
+			{
+				static const std::array<float, 256> table = [] {
+					std::array<float, 256> t{};
+					for (size_t i = 0; i < t.size(); i++) {
+						const float c = static_cast<float>(i) / 255.0f;
+						t[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+					}
+					return t;
+				}();
+				return table;
+			}
+		}
+
+		const char *simdLevel()
+		{
+#if defined(VKS_PIXELS_AVX2)
+			return "AVX2";
+#elif defined(VKS_PIXELS_SSE4)
+			return "SSE4.1";
+#elif defined(VKS_PIXELS_NEON)
+			return "NEON";
+#else
+			return "Scalar";
+#endif
+		}
+
+		void rgbToRgba(const uint8_t *src, uint8_t *dst, size_t pixelCount, uint8_t alpha)
+		{
+			size_t i = 0;
+#if defined(VKS_PIXELS_SSE4)
+			const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(alpha) << 24));
+#if defined(VKS_PIXELS_AVX2)
+			const __m256i shuffle256 = _mm256_broadcastsi128_si256(shuffle);
+			const __m256i alphaMask256 = _mm256_broadcastsi128_si256(alphaMask);
+			// Each 16 byte load only uses 12 bytes, stop early enough to not read past the end
+			for (; i + 10 <= pixelCount; i += 8) {
+				const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 3));
+				const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 3 + 12));
+				const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle256), alphaMask256));
+			}
+#endif
+			for (; i + 6 <= pixelCount; i += 4) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 3));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alphaMask));
+			}
+#elif defined(VKS_PIXELS_NEON)
+			const uint8x16_t a = vdupq_n_u8(alpha);
+			for (; i + 16 <= pixelCount; i += 16) {
+				const uint8x16x3_t rgb = vld3q_u8(src + i * 3);
+				uint8x16x4_t rgba;
+				rgba.val[0] = rgb.val[0];
+				rgba.val[1] = rgb.val[1];
+				rgba.val[2] = rgb.val[2];
+				rgba.val[3] = a;
+				vst4q_u8(dst + i * 4, rgba);
+			}
+#endif
+			for (; i < pixelCount; i++) {
+				dst[i * 4 + 0] = src[i * 3 + 0];
+				dst[i * 4 + 1] = src[i * 3 + 1];
+				dst[i * 4 + 2] = src[i * 3 + 2];
+				dst[i * 4 + 3] = alpha;
+			}
+		}
+
+		namespace
+		{
+			// Shared implementation for the 4 to 3 channel conversions, swapRB selects BGRA input
+			template <bool swapRB>
+			void fourToThree(const uint8_t *src, uint8_t *dst, size_t pixelCount)
+			{
+				constexpr int r = swapRB ? 2 : 0;
+				constexpr int b = swapRB ? 0 : 2;
+				size_t i = 0;
+#if defined(VKS_PIXELS_SSE4)
+				const __m128i shuffle = _mm_setr_epi8(r, 1, b, r + 4, 5, b + 4, r + 8, 9, b + 8, r + 12, 13, b + 12, -1, -1, -1, -1);
+#if defined(VKS_PIXELS_AVX2)
+				const __m256i shuffle256 = _mm256_broadcastsi128_si256(shuffle);
+				// Each 16 byte store only carries 12 bytes of output, stop early enough to not write past the end
+				for (; i + 10 <= pixelCount; i += 8) {
+					const __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 4)), shuffle256);
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 3), _mm256_castsi256_si128(v));
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 3 + 12), _mm256_extracti128_si256(v, 1));
+				}
+#endif
+				for (; i + 6 <= pixelCount; i += 4) {
+					const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 3), _mm_shuffle_epi8(v, shuffle));
+				}
+#elif defined(VKS_PIXELS_NEON)
+				for (; i + 16 <= pixelCount; i += 16) {
+					const uint8x16x4_t rgba = vld4q_u8(src + i * 4);
+					uint8x16x3_t rgb;
+					rgb.val[0] = rgba.val[r];
+					rgb.val[1] = rgba.val[1];
+					rgb.val[2] = rgba.val[b];
+					vst3q_u8(dst + i * 3, rgb);
+				}
+#endif
+				for (; i < pixelCount; i++) {
+					dst[i * 3 + 0] = src[i * 4 + r];
+					dst[i * 3 + 1] = src[i * 4 + 1];
+					dst[i * 3 + 2] = src[i * 4 + b];
+				}
+			}
+		}
+
+		void bgraToRgb(const uint8_t *src, uint8_t *dst, size_t pixelCount)
+		{
+			fourToThree<true>(src, dst, pixelCount);
+		}
+
+		void rgbaToRgb(const uint8_t *src, uint8_t *dst, size_t pixelCount)
+		{
+			fourToThree<false>(src, dst, pixelCount);
+		}
+
+		void srgbToLinear(const uint8_t *src, float *dst, size_t count)
+		{
+			const std::array<float, 256> &table = srgbTable();
+			size_t i = 0;
+#if defined(VKS_PIXELS_AVX2)
+			for (; i + 8 <= count; i += 8) {
+				const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + i)));
+				_mm256_storeu_ps(dst + i, _mm256_i32gather_ps(table.data(), index, 4));
+			}
+#endif
+			// Without gathers a table lookup per value beats evaluating the transfer function
+			for (; i < count; i++) {
+				dst[i] = table[src[i]];
+			}
+		}
+
+		void premultiplyAlpha(uint8_t *rgba, size_t pixelCount)
+		{
+			size_t i = 0;
+#if defined(VKS_PIXELS_SSE4)
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i bias = _mm_set1_epi16(128);
+			// Broadcast the alpha of each pixel to its four 16 bit lanes
+			const __m128i alphaShuffle = _mm_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+			const __m128i alphaLanes = _mm_set1_epi32(static_cast<int>(0xff000000u));
+			for (; i + 4 <= pixelCount; i += 4) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgba + i * 4));
+				__m128i lo = _mm_unpacklo_epi8(v, zero);
+				__m128i hi = _mm_unpackhi_epi8(v, zero);
+				lo = _mm_add_epi16(_mm_mullo_epi16(lo, _mm_shuffle_epi8(lo, alphaShuffle)), bias);
+				hi = _mm_add_epi16(_mm_mullo_epi16(hi, _mm_shuffle_epi8(hi, alphaShuffle)), bias);
+				lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+				hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + i * 4), _mm_blendv_epi8(_mm_packus_epi16(lo, hi), v, alphaLanes));
+			}
+#elif defined(VKS_PIXELS_NEON)
+			for (; i + 8 <= pixelCount; i += 8) {
+				uint8x8x4_t v = vld4_u8(rgba + i * 4);
+				for (int c = 0; c < 3; c++) {
+					const uint16x8_t x = vmull_u8(v.val[c], v.val[3]);
+					v.val[c] = vraddhn_u16(x, vrshrq_n_u16(x, 8));
+				}
+				vst4_u8(rgba + i * 4, v);
+			}
+#endif
+			for (; i < pixelCount; i++) {
+				uint8_t *p = rgba + i * 4;
+				p[0] = div255(static_cast<uint32_t>(p[0]) * p[3]);
+				p[1] = div255(static_cast<uint32_t>(p[1]) * p[3]);
+				p[2] = div255(static_cast<uint32_t>(p[2]) * p[3]);
+			}
+		}
+
+		void unorm16ToFloat(const uint16_t *src, float *dst, size_t count, float scale)
+		{
+			const float factor = scale / 65535.0f;
+			size_t i = 0;
+#if defined(VKS_PIXELS_AVX2)
+			const __m256i zero256 = _mm256_setzero_si256();
+			const __m256 factor256 = _mm256_set1_ps(factor);
+			for (; i + 16 <= count; i += 16) {
+				// Unpacking works per 128 bit lane, so the results are permuted back into order on store
+				const __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)), 0xd8);
+				_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(v, zero256)), factor256));
+				_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpackhi_epi16(v, zero256)), factor256));
+			}
+#endif
+#if defined(VKS_PIXELS_SSE4)
+			const __m128i zero = _mm_setzero_si128();
+			const __m128 factor128 = _mm_set1_ps(factor);
+			for (; i + 8 <= count; i += 8) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), factor128));
+				_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), factor128));
+			}
+#elif defined(VKS_PIXELS_NEON)
+			for (; i + 8 <= count; i += 8) {
+				const uint16x8_t v = vld1q_u16(src + i);
+				vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))), factor));
+				vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), factor));
+			}
+#endif
+			for (; i < count; i++) {
+				dst[i] = static_cast<float>(src[i]) * factor;
+			}
+		}
+
+		void packNormals(const float *src, uint8_t *dst, size_t count)
+		{
+			size_t i = 0;
+#if defined(VKS_PIXELS_SSE4)
+			// Every float gets the same treatment, so the xyz triplets don't need to be deinterleaved
+			const __m128 half = _mm_set1_ps(127.5f);
+			const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000u));
+			for (; i + 4 <= count; i += 4) {
+				const float *p = src + i * 3;
+				const __m128i a = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p), half), half));
+				const __m128i b = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p + 4), half), half));
+				const __m128i c = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p + 8), half), half));
+				// Saturating packs clamp to [0, 255]
+				const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, c));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(bytes, shuffle), alphaMask));
+			}
+#elif defined(VKS_PIXELS_NEON)
+			const float32x4_t zero = vdupq_n_f32(0.0f);
+			const float32x4_t max = vdupq_n_f32(255.0f);
+			for (; i + 8 <= count; i += 8) {
+				const float32x4x3_t lo = vld3q_f32(src + i * 3);
+				const float32x4x3_t hi = vld3q_f32(src + i * 3 + 12);
+				uint8x8x4_t texels;
+				for (int c = 0; c < 3; c++) {
+					const float32x4_t l = vminq_f32(vmaxq_f32(vmlaq_n_f32(vdupq_n_f32(128.0f), lo.val[c], 127.5f), zero), max);
+					const float32x4_t h = vminq_f32(vmaxq_f32(vmlaq_n_f32(vdupq_n_f32(128.0f), hi.val[c], 127.5f), zero), max);
+					// The extra 0.5 turns the truncating conversion into rounding
+					texels.val[c] = vmovn_u16(vcombine_u16(vmovn_u32(vcvtq_u32_f32(l)), vmovn_u32(vcvtq_u32_f32(h))));
+				}
+				texels.val[3] = vdup_n_u8(0xff);
+				vst4_u8(dst + i * 4, texels);
+			}
+#endif
+			for (; i < count; i++) {
+				dst[i * 4 + 0] = packUnorm8(src[i * 3 + 0]);
+				dst[i * 4 + 1] = packUnorm8(src[i * 3 + 1]);
+				dst[i * 4 + 2] = packUnorm8(src[i * 3 + 2]);
+				dst[i * 4 + 3] = 0xff;
+			}
+		}
+	}
+}
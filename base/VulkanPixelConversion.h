@@ -0,0 +1,70 @@
+/*
+* Pixel format conversion kernels
+*
+* Vectorized (AVX2, SSE4.1 or NEON, depending on the target the file is compiled for) conversions
+* between the 8/16 bit pixel layouts used when loading textures and reading back images,
+* with a scalar fallback for other targets and for the remaining pixels of each call
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vks
+{
+	namespace pixels
+	{
+		/** @brief Returns the name of the instruction set the kernels have been compiled for */
+		const char *simdLevel();
+
+		/**
+		* Expand tightly packed RGB8 pixels to RGBA8
+		*
+		* @param src Source pixels (3 bytes per pixel)
+		* @param dst Destination pixels (4 bytes per pixel), must not overlap src
+		* @param pixelCount Number of pixels to convert
+		* @param alpha (Optional) Value written to the alpha channel (defaults to 0xff)
+		*/
+		void rgbToRgba(const uint8_t *src, uint8_t *dst, size_t pixelCount, uint8_t alpha = 0xff);
+
+		/** @brief Convert BGRA8 pixels to RGB8, dropping the alpha channel */
+		void bgraToRgb(const uint8_t *src, uint8_t *dst, size_t pixelCount);
+
+		/** @brief Convert RGBA8 pixels to RGB8, dropping the alpha channel */
+		void rgbaToRgb(const uint8_t *src, uint8_t *dst, size_t pixelCount);
+
+		/**
+		* Convert sRGB encoded 8 bit channel values to linear floats in [0, 1]
+		*
+		* @param src Source channel values, color channels only (alpha is linear and must not be passed through this)
+		* @param dst Destination values
+		* @param count Number of channel values to convert
+		*/
+		void srgbToLinear(const uint8_t *src, float *dst, size_t count);
+
+		/** @brief Multiply the color channels of RGBA8 pixels by their alpha in place (rounded, alpha is kept) */
+		void premultiplyAlpha(uint8_t *rgba, size_t pixelCount);
+
+		/**
+		* Convert 16 bit unsigned normalized values to floats
+		*
+		* @param src Source values
+		* @param dst Destination values
+		* @param count Number of values to convert
+		* @param scale (Optional) Scale applied to the normalized [0, 1] result (defaults to 1.0)
+		*/
+		void unorm16ToFloat(const uint16_t *src, float *dst, size_t count, float scale = 1.0f);
+
+		/**
+		* Pack unit length normals into RGBA8 normal map texels (n * 0.5 + 0.5, alpha set to 0xff)
+		*
+		* @param src Source normals (3 floats per normal, components in [-1, 1])
+		* @param dst Destination texels (4 bytes per texel)
+		* @param count Number of normals to pack
+		*/
+		void packNormals(const float *src, uint8_t *dst, size_t count);
+	}
+}
@@ -45,18 +45,26 @@ namespace vks
 	* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
 	* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 	* @param (Optional) forceLinear Force linear tiling (not advised, defaults to false)
+	* @param (Optional) firstMipLevel First mip level of the file to upload, higher levels are skipped (staging only, defaults to 0)
 	*
 	*/
-	void Texture2D::loadFromFile(std::string filename, vk::Format format, vks::VulkanDevice *device, vk::Queue copyQueue, vk::ImageUsageFlags imageUsageFlags, vk::ImageLayout imageLayout, bool forceLinear)
+	void Texture2D::loadFromFile(std::string filename, vk::Format format, vks::VulkanDevice *device, vk::Queue copyQueue, vk::ImageUsageFlags imageUsageFlags, vk::ImageLayout imageLayout, bool forceLinear, uint32_t firstMipLevel)
 	{
 		ktxTexture* ktxTexture;
 		ktxResult result = loadKTXFile(filename, &ktxTexture);
 		assert(result == KTX_SUCCESS);
 
+		// Linear tiled images only ever contain the first mip level
+		if (forceLinear) {
+			firstMipLevel = 0;
+		}
+		firstMipLevel = std::min(firstMipLevel, ktxTexture->numLevels - 1);
+
 		this->device = device;
-		width = ktxTexture->baseWidth;
-		height = ktxTexture->baseHeight;
-		mipLevels = ktxTexture->numLevels;
+		width = std::max(1u, ktxTexture->baseWidth >> firstMipLevel);
+		height = std::max(1u, ktxTexture->baseHeight >> firstMipLevel);
+		mipLevels = ktxTexture->numLevels - firstMipLevel;
+		layerCount = 1;
 
 		ktx_uint8_t *ktxTextureData = ktxTexture_GetData(ktxTexture);
 		ktx_size_t ktxTextureSize = ktxTexture_GetDataSize(ktxTexture);
@@ -71,7 +79,6 @@ namespace vks
 		// limited amount of formats and features (mip maps, cubemaps, arrays, etc.)
 		vk::Bool32 useStaging = !forceLinear;
 
-		vk::MemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
 		vk::MemoryRequirements2 memReqs;
 
 		// Use a separate command buffer for texture loading
@@ -81,7 +88,7 @@ namespace vks
 		{
 			// Create a host-visible staging buffer that contains the raw image data
 			vk::UniqueBuffer stagingBuffer;
-			vk::UniqueDeviceMemory stagingMemory;
+			vks::Allocation stagingMemory;
 
 			vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
 			bufferCreateInfo.size = ktxTextureSize;
@@ -91,21 +98,12 @@ namespace vks
 
 			stagingBuffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
 
-			// Get memory requirements for the staging buffer (alignment, memory type bits)
-			memReqs = device->logicalDevice->getBufferMemoryRequirements2(*stagingBuffer);
-
-			memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-			// Get memory type index for a host visible buffer
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-			stagingMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-			device->logicalDevice->bindBufferMemory(*stagingBuffer, *stagingMemory, 0);
+			stagingMemory = device->allocator.allocateForBuffer(*stagingBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
 			// Copy texture data into staging buffer
 			uint8_t *data;
-			data = (uint8_t*)device->logicalDevice->mapMemory(*stagingMemory, 0, memReqs.memoryRequirements.size, {});
+			data = (uint8_t*)stagingMemory.mapped();
 			std::copy_n(ktxTextureData, ktxTextureSize, data);
-			device->logicalDevice->unmapMemory(*stagingMemory);
 
 			// Setup buffer copy regions for each mip level
 			std::vector<vk::BufferImageCopy> bufferCopyRegions;
@@ -113,7 +111,7 @@ namespace vks
 			for (uint32_t i = 0; i < mipLevels; i++)
 			{
 				ktx_size_t offset;
-				KTX_error_code result = ktxTexture_GetImageOffset(ktxTexture, i, 0, 0, &offset);
+				KTX_error_code result = ktxTexture_GetImageOffset(ktxTexture, firstMipLevel + i, 0, 0, &offset);
 				assert(result == KTX_SUCCESS);
 
 				vk::BufferImageCopy bufferCopyRegion = {};
@@ -121,8 +119,8 @@ namespace vks
 				bufferCopyRegion.imageSubresource.mipLevel = i;
 				bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
 				bufferCopyRegion.imageSubresource.layerCount = 1;
-				bufferCopyRegion.imageExtent.width = std::max(1u, ktxTexture->baseWidth >> i);
-				bufferCopyRegion.imageExtent.height = std::max(1u, ktxTexture->baseHeight >> i);
+				bufferCopyRegion.imageExtent.width = std::max(1u, width >> i);
+				bufferCopyRegion.imageExtent.height = std::max(1u, height >> i);
 				bufferCopyRegion.imageExtent.depth = 1;
 				bufferCopyRegion.bufferOffset = offset;
 
@@ -148,13 +146,7 @@ namespace vks
 			}
 			image = device->logicalDevice->createImageUnique(imageCreateInfo);
 
-			memReqs = device->logicalDevice->getImageMemoryRequirements2(*image);
-
-			memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-			deviceMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-			device->logicalDevice->bindImageMemory(*image, *deviceMemory, 0);
+			deviceMemory = device->allocator.allocateForImage(*image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 			vk::ImageSubresourceRange subresourceRange = {};
 			subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -199,7 +191,7 @@ namespace vks
 			assert(formatProperties.formatProperties.linearTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage);
 
 			vk::UniqueImage mappableImage;
-			vk::UniqueDeviceMemory mappableMemory;
+			vks::Allocation mappableMemory;
 
 			vk::ImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
 			imageCreateInfo.imageType = vk::ImageType::e2D;
@@ -216,20 +208,7 @@ namespace vks
 			// Load mip map level 0 to linear tiling image
 			mappableImage = device->logicalDevice->createImageUnique(imageCreateInfo);
 
-			// Get memory requirements for this image 
-			// like size and alignment
-			memReqs = device->logicalDevice->getImageMemoryRequirements2(*mappableImage);
-			// Set memory allocation size to required memory size
-			memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-
-			// Get memory type that can be mapped to host memory
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-			// Allocate host memory
-			mappableMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-
-			// Bind allocated image for use
-			device->logicalDevice->bindImageMemory(*mappableImage, *mappableMemory, 0);
+			mappableMemory = device->allocator.allocateForImage(*mappableImage, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, vk::ImageTiling::eLinear);
 
 			// Get sub resource layout
 			// Mip map count, array layer, etc.
@@ -244,14 +223,13 @@ namespace vks
 			// Includes row pitch, size offsets, etc.
 			subResLayout = device->logicalDevice->getImageSubresourceLayout(*mappableImage, subRes);
 
-			// Map image memory
-			data = device->logicalDevice->mapMemory(*mappableMemory, 0, memReqs.memoryRequirements.size, {});
+			// Image memory is persistently mapped by the allocator
+			data = mappableMemory.mapped();
 
 			// Copy image data into memory
+			memReqs = device->logicalDevice->getImageMemoryRequirements2(*mappableImage);
 			std::copy_n(reinterpret_cast<std::byte*>(ktxTextureData), memReqs.memoryRequirements.size, static_cast<std::byte*>(data));
 
-			device->logicalDevice->unmapMemory(*mappableMemory);
-
 			// Linear tiled images don't need to be staged
 			// and can be directly used as textures
 			image = std::move(mappableImage);
@@ -326,16 +304,14 @@ namespace vks
 		width = texWidth;
 		height = texHeight;
 		mipLevels = 1;
-
-		vk::MemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		vk::MemoryRequirements2 memReqs;
+		layerCount = 1;
 
 		// Use a separate command buffer for texture loading
 		vk::UniqueCommandBuffer copyCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
 
 		// Create a host-visible staging buffer that contains the raw image data
 		vk::UniqueBuffer stagingBuffer;
-		vk::UniqueDeviceMemory stagingMemory;
+		vks::Allocation stagingMemory;
 
 		vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
 		bufferCreateInfo.size = bufferSize;
@@ -345,21 +321,12 @@ namespace vks
 
 		stagingBuffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
 
-		// Get memory requirements for the staging buffer (alignment, memory type bits)
-		memReqs = device->logicalDevice->getBufferMemoryRequirements2(*stagingBuffer);
-
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		// Get memory type index for a host visible buffer
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-		stagingMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindBufferMemory(*stagingBuffer, *stagingMemory, 0);
+		stagingMemory = device->allocator.allocateForBuffer(*stagingBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
 		// Copy texture data into staging buffer
 		uint8_t *data;
-		data = (uint8_t*)device->logicalDevice->mapMemory(*stagingMemory, 0, memReqs.memoryRequirements.size, {});
+		data = (uint8_t*)stagingMemory.mapped();
 		std::copy_n(static_cast<std::byte*>(buffer), bufferSize, reinterpret_cast<std::byte*>(data));
-		device->logicalDevice->unmapMemory(*stagingMemory);
 
 		vk::BufferImageCopy bufferCopyRegion = {};
 		bufferCopyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -390,13 +357,7 @@ namespace vks
 		}
 		image = device->logicalDevice->createImageUnique(imageCreateInfo);
 
-		memReqs = device->logicalDevice->getImageMemoryRequirements2(*image);
-
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		deviceMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindImageMemory(*image, *deviceMemory, 0);
+		deviceMemory = device->allocator.allocateForImage(*image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 		vk::ImageSubresourceRange subresourceRange = {};
 		subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -487,12 +448,9 @@ namespace vks
 		ktx_uint8_t *ktxTextureData = ktxTexture_GetData(ktxTexture);
 		ktx_size_t ktxTextureSize = ktxTexture_GetDataSize(ktxTexture);
 
-		vk::MemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		vk::MemoryRequirements2 memReqs;
-
 		// Create a host-visible staging buffer that contains the raw image data
 		vk::UniqueBuffer stagingBuffer;
-		vk::UniqueDeviceMemory stagingMemory;
+		vks::Allocation stagingMemory;
 
 		vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
 		bufferCreateInfo.size = ktxTextureSize;
@@ -502,21 +460,12 @@ namespace vks
 
 		stagingBuffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
 
-		// Get memory requirements for the staging buffer (alignment, memory type bits)
-		memReqs = device->logicalDevice->getBufferMemoryRequirements2(*stagingBuffer);
-
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		// Get memory type index for a host visible buffer
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-		stagingMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindBufferMemory(*stagingBuffer, *stagingMemory, 0);
+		stagingMemory = device->allocator.allocateForBuffer(*stagingBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
 		// Copy texture data into staging buffer
 		uint8_t *data;
-		data = (uint8_t*)device->logicalDevice->mapMemory(*stagingMemory, 0, memReqs.memoryRequirements.size, {});
+		data = (uint8_t*)stagingMemory.mapped();
 		std::copy_n(ktxTextureData, ktxTextureSize, data);
-		device->logicalDevice->unmapMemory(*stagingMemory);
 
 		// Setup buffer copy regions for each layer including all of its miplevels
 		std::vector<vk::BufferImageCopy> bufferCopyRegions;
@@ -563,13 +512,7 @@ namespace vks
 
 		image = device->logicalDevice->createImageUnique(imageCreateInfo);
 
-		memReqs = device->logicalDevice->getImageMemoryRequirements2(*image);
-
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-		deviceMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindImageMemory(*image, *deviceMemory, 0);
+		deviceMemory = device->allocator.allocateForImage(*image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 		// Use a separate command buffer for texture loading
 		vk::UniqueCommandBuffer copyCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
@@ -661,16 +604,14 @@ namespace vks
 		width = ktxTexture->baseWidth;
 		height = ktxTexture->baseHeight;
 		mipLevels = ktxTexture->numLevels;
+		layerCount = 6;
 
 		ktx_uint8_t *ktxTextureData = ktxTexture_GetData(ktxTexture);
 		ktx_size_t ktxTextureSize = ktxTexture_GetDataSize(ktxTexture);
 
-		vk::MemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		vk::MemoryRequirements2 memReqs;
-
 		// Create a host-visible staging buffer that contains the raw image data
 		vk::UniqueBuffer stagingBuffer;
-		vk::UniqueDeviceMemory stagingMemory;
+		vks::Allocation stagingMemory;
 
 		vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
 		bufferCreateInfo.size = ktxTextureSize;
@@ -680,21 +621,12 @@ namespace vks
 
 		stagingBuffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
 
-		// Get memory requirements for the staging buffer (alignment, memory type bits)
-		memReqs = device->logicalDevice->getBufferMemoryRequirements2(*stagingBuffer);
-
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		// Get memory type index for a host visible buffer
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-		stagingMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindBufferMemory(*stagingBuffer, *stagingMemory, 0);
+		stagingMemory = device->allocator.allocateForBuffer(*stagingBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
 		// Copy texture data into staging buffer
 		uint8_t *data;
-		data = (uint8_t*)device->logicalDevice->mapMemory(*stagingMemory, 0, memReqs.memoryRequirements.size, {});
+		data = (uint8_t*)stagingMemory.mapped();
 		std::copy_n(ktxTextureData, ktxTextureSize, data);
-		device->logicalDevice->unmapMemory(*stagingMemory);
 
 		// Setup buffer copy regions for each face including all of its mip levels
 		std::vector<vk::BufferImageCopy> bufferCopyRegions;
@@ -745,13 +677,7 @@ namespace vks
 
 		image = device->logicalDevice->createImageUnique(imageCreateInfo);
 
-		memReqs = device->logicalDevice->getImageMemoryRequirements2(*image);
-
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-		deviceMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindImageMemory(*image, *deviceMemory, 0);
+		deviceMemory = device->allocator.allocateForImage(*image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 		// Use a separate command buffer for texture loading
 		vk::UniqueCommandBuffer copyCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
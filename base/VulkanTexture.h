@@ -30,7 +30,7 @@ class Texture
 	vks::VulkanDevice *   device;
 	vk::UniqueImage               image;
 	vk::ImageLayout         imageLayout;
-	vk::UniqueDeviceMemory        deviceMemory;
+	vks::Allocation        deviceMemory;
 	vk::UniqueImageView           view;
 	uint32_t              width, height;
 	uint32_t              mipLevels;
@@ -53,7 +53,8 @@ class Texture2D : public Texture
 	    vk::Queue            copyQueue,
 	    vk::ImageUsageFlags  imageUsageFlags = vk::ImageUsageFlagBits::eSampled,
 	    vk::ImageLayout      imageLayout     = vk::ImageLayout::eShaderReadOnlyOptimal,
-	    bool               forceLinear     = false);
+	    bool               forceLinear     = false,
+	    uint32_t           firstMipLevel   = 0);
 	void fromBuffer(
 	    void *             buffer,
 	    vk::DeviceSize       bufferSize,
@@ -0,0 +1,204 @@
+/*
+* Content addressed texture cache
+*
+* Shares one texture between all references to byte-identical image data, independent of
+* the file name or model it was referenced from
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+namespace vks
+{
+	/** @brief 128 bit content hash, wide enough to identify textures by their content alone */
+	struct ContentHash
+	{
+		uint64_t low = 0;
+		uint64_t high = 0;
+
+		bool operator==(const ContentHash &other) const { return low == other.low && high == other.high; }
+		bool operator!=(const ContentHash &other) const { return !(*this == other); }
+	};
+
+	/**
+	* Incremental 128 bit hash of a stream of bytes (two independent 64 bit lanes, eight bytes per step)
+	*
+	* Data passed in several calls to update() hashes the same as when passed at once
+	*/
+	class ContentHasher
+	{
+	public:
+		void update(const void *data, size_t size)
+		{
+			const auto *bytes = static_cast<const uint8_t *>(data);
+			totalSize += size;
+			// Complete a word left over from the previous call first
+			while (pendingSize > 0 && pendingSize < 8 && size > 0) {
+				pending[pendingSize++] = *bytes++;
+				size--;
+			}
+			if (pendingSize == 8) {
+				uint64_t word;
+				std::memcpy(&word, pending, sizeof(word));
+				step(word);
+				pendingSize = 0;
+			}
+			for (; size >= 8; bytes += 8, size -= 8) {
+				uint64_t word;
+				std::memcpy(&word, bytes, sizeof(word));
+				step(word);
+			}
+			std::memcpy(pending + pendingSize, bytes, size);
+			pendingSize += size;
+		}
+
+		ContentHash finish() const
+		{
+			uint64_t tail = 0;
+			std::memcpy(&tail, pending, pendingSize);
+			const uint64_t size = totalSize * primeLow;
+			return { mix(low ^ mix(tail) ^ size), mix(high ^ mix(tail ^ laneOffset) ^ size) };
+		}
+
+	private:
+		static constexpr uint64_t primeLow = 0x9e3779b97f4a7c15ull;
+		static constexpr uint64_t primeHigh = 0xc2b2ae3d27d4eb4full;
+		static constexpr uint64_t laneOffset = 0x632be59bd9b4e019ull;
+
+		uint64_t low = 0x243f6a8885a308d3ull;
+		uint64_t high = 0x13198a2e03707344ull;
+		uint64_t totalSize = 0;
+		uint8_t pending[8] = {};
+		size_t pendingSize = 0;
+
+		static uint64_t mix(uint64_t h)
+		{
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return h;
+		}
+
+		void step(uint64_t word)
+		{
+			low = (low ^ mix(word)) * primeLow;
+			high = ((high ^ mix(word ^ laneOffset)) * primeHigh) ^ (high >> 29);
+		}
+	};
+
+	/** @brief Hash a block of memory */
+	inline ContentHash contentHash(const void *data, size_t size)
+	{
+		ContentHasher hasher;
+		hasher.update(data, size);
+		return hasher.finish();
+	}
+
+	/**
+	* Hash the contents of a file, read in chunks so the file is never held in memory as a whole
+	*
+	* @param filename File to hash
+	* @param hash Hash of the file contents
+	*
+	* @return False if the file can't be read
+	*/
+	inline bool fileContentHash(const std::string &filename, ContentHash &hash)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+		ContentHasher hasher;
+		std::vector<char> chunk(1 << 16);
+		while (file) {
+			file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+			hasher.update(chunk.data(), static_cast<size_t>(file.gcount()));
+		}
+		hash = hasher.finish();
+		return true;
+	}
+
+	/**
+	* Cache of textures keyed by a 128 bit hash of their content
+	*
+	* Textures are identified by the hash alone, collisions are not expected at 128 bits. Only weak references are kept,
+	* a texture is destroyed as soon as the last model using it releases it
+	* All textures of a cache must belong to the same device
+	*/
+	template <typename T>
+	class TextureCache
+	{
+	public:
+		struct Stats
+		{
+			/** @brief Number of textures created through the cache */
+			uint32_t uniqueTextures = 0;
+			/** @brief Number of loads served by an existing texture */
+			uint32_t sharedReferences = 0;
+			/** @brief Device memory not allocated thanks to shared textures (in bytes) */
+			vk::DeviceSize bytesSaved = 0;
+		};
+		Stats stats;
+
+		/**
+		* Look up a texture by the hash of its content
+		*
+		* @param key Hash of everything that makes two textures different, e.g. the file contents or the dimensions followed by the pixels
+		*
+		* @return Shared texture or nullptr if no texture with that content is alive
+		*/
+		std::shared_ptr<T> find(const ContentHash &key)
+		{
+			auto it = entries.find(key);
+			if (it == entries.end()) {
+				return nullptr;
+			}
+			std::shared_ptr<T> texture = it->second.texture.lock();
+			if (!texture) {
+				entries.erase(it);
+				return nullptr;
+			}
+			stats.sharedReferences++;
+			stats.bytesSaved += it->second.size;
+			return texture;
+		}
+
+		/**
+		* Add a newly created texture to the cache
+		*
+		* @param key Hash of the content the texture was created from, as passed to find()
+		* @param texture Texture to share
+		* @param size Device memory held by the texture, used for reporting
+		*/
+		void insert(const ContentHash &key, const std::shared_ptr<T> &texture, vk::DeviceSize size)
+		{
+			entries[key] = Entry{ texture, size };
+			stats.uniqueTextures++;
+		}
+
+	private:
+		struct Entry
+		{
+			std::weak_ptr<T> texture;
+			vk::DeviceSize size;
+		};
+		struct KeyHash
+		{
+			size_t operator()(const ContentHash &key) const { return static_cast<size_t>(key.low); }
+		};
+		std::unordered_map<ContentHash, Entry, KeyHash> entries;
+	};
+}
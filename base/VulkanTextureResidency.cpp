@@ -0,0 +1,291 @@
+/*
+* Vulkan texture residency manager
+*
+* Keeps KTX textures within the device memory budget (VK_EXT_memory_budget) by dropping
+* the top mip levels of the least recently used textures
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanTextureResidency.h"
+
+#include <algorithm>
+
+#include <ktx.h>
+
+namespace vks
+{
+	/**
+	* Prepare the residency manager for use
+	*
+	* @param device Vulkan device textures are created on
+	* @param copyQueue Queue used for the texture staging copy commands (must support transfer)
+	* @param memoryBudgetEnabled True if VK_EXT_memory_budget has been enabled on the device, otherwise only the memory held by managed textures is tracked
+	*/
+	void TextureResidency::prepare(vks::VulkanDevice *device, vk::Queue copyQueue, bool memoryBudgetEnabled)
+	{
+		this->device = device;
+		this->copyQueue = copyQueue;
+		this->memoryBudgetEnabled = memoryBudgetEnabled;
+	}
+
+	/**
+	* Load a KTX texture under control of the residency manager
+	*
+	* If the texture does not fit into the remaining budget, top mip levels of the least recently used textures
+	* are dropped first, then those of the new texture, down to the resident tail
+	*
+	* @param texture Texture to load into, must stay at the same address until released
+	* @param filename File to load (supports .ktx)
+	* @param format Vulkan format of the image data stored in the file
+	*
+	* @return Handle used to refer to the texture in further calls
+	*/
+	uint32_t TextureResidency::load(vks::Texture2D *texture, const std::string &filename, vk::Format format)
+	{
+		assert(device);
+
+		Entry entry{};
+		entry.texture = texture;
+		entry.filename = filename;
+		entry.format = format;
+		entry.lastUsed = currentFrame;
+
+		// Only read the header to get the size of the mip chain
+		if (!vks::tools::fileExists(filename)) {
+			vks::tools::exitFatal("Could not load texture from " + filename + "\n\nThe file may be part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
+		}
+		ktxTexture *ktxTexture;
+		ktxResult result = ktxTexture_CreateFromNamedFile(filename.c_str(), KTX_TEXTURE_CREATE_NO_FLAGS, &ktxTexture);
+		assert(result == KTX_SUCCESS);
+		entry.levelSizes.resize(ktxTexture->numLevels);
+		for (uint32_t i = 0; i < ktxTexture->numLevels; i++) {
+			entry.levelSizes[i] = ktxTexture_GetImageSize(ktxTexture, i);
+		}
+		entry.tailLevel = ktxTexture->numLevels - 1;
+		for (uint32_t i = 0; i < ktxTexture->numLevels; i++) {
+			if (std::max(ktxTexture->baseWidth >> i, ktxTexture->baseHeight >> i) <= tailExtent) {
+				entry.tailLevel = i;
+				break;
+			}
+		}
+		ktxTexture_Destroy(ktxTexture);
+
+		// Make room for the full texture, and only skip its top mips if other textures can't give up enough memory
+		int64_t over = excess(estimateSize(entry, 0));
+		while (over > 0 && dropLeastRecentlyUsed(over)) {}
+		uint32_t baseLevel = 0;
+		while (over > 0 && baseLevel < entry.tailLevel) {
+			over -= static_cast<int64_t>(entry.levelSizes[baseLevel]);
+			baseLevel++;
+		}
+
+		upload(entry, baseLevel);
+		uint32_t handle;
+		if (!freeHandles.empty()) {
+			handle = freeHandles.back();
+			freeHandles.pop_back();
+			entries[handle] = std::move(entry);
+		} else {
+			handle = static_cast<uint32_t>(entries.size());
+			entries.push_back(std::move(entry));
+		}
+		updateStats();
+
+		return handle;
+	}
+
+	/** @brief Stop managing the texture referred to by handle (does not destroy the texture) */
+	void TextureResidency::release(uint32_t handle)
+	{
+		assert(handle < entries.size() && entries[handle].texture);
+		entries[handle] = Entry{};
+		freeHandles.push_back(handle);
+	}
+
+	/** @brief Mark the texture referred to by handle as used in the given frame */
+	void TextureResidency::touch(uint32_t handle, uint64_t frame)
+	{
+		assert(handle < entries.size());
+		entries[handle].lastUsed = frame;
+	}
+
+	/**
+	* Enforce the memory budget, must be called while none of the managed textures are in use by the device
+	*
+	* Drops top mip levels of the least recently used textures while over budget, otherwise restores one
+	* mip level of the most recently used downsampled texture if it fits
+	*
+	* @param frame Index of the frame about to be recorded
+	*
+	* @return True if any texture has been recreated, descriptors referencing managed textures need to be updated
+	*/
+	bool TextureResidency::update(uint64_t frame)
+	{
+		currentFrame = frame;
+
+		bool changed = false;
+		int64_t over = excess();
+		if (over > 0) {
+			while (over > 0 && dropLeastRecentlyUsed(over)) {
+				changed = true;
+			}
+		} else {
+			Entry *candidate = nullptr;
+			for (auto &entry : entries) {
+				if (entry.texture && entry.baseLevel > 0 && entry.lastUsed + restoreWindow >= frame) {
+					if (!candidate || entry.lastUsed > candidate->lastUsed) {
+						candidate = &entry;
+					}
+				}
+			}
+			if (candidate) {
+				// Keep some headroom so a restored texture isn't dropped again right away
+				const vk::DeviceSize cost = estimateSize(*candidate, candidate->baseLevel - 1) - candidate->size;
+				if (excess(cost + stats.budget / 20) <= 0) {
+					upload(*candidate, candidate->baseLevel - 1);
+					stats.restoredMips++;
+					changed = true;
+				}
+			}
+		}
+
+		if (changed) {
+			updateStats();
+		}
+		return changed;
+	}
+
+	/** @brief Stop managing all textures */
+	void TextureResidency::clear()
+	{
+		entries.clear();
+		freeHandles.clear();
+		updateStats();
+	}
+
+	/**
+	* Get the amount of memory by which the budget would be exceeded after an additional allocation
+	*
+	* @param additional Size of the additional allocation
+	*
+	* @return Bytes over budget, negative if the allocation still fits
+	*/
+	int64_t TextureResidency::excess(vk::DeviceSize additional)
+	{
+		vk::DeviceSize textureBytes = 0;
+		for (const auto &entry : entries) {
+			textureBytes += entry.size;
+		}
+
+		vk::DeviceSize heapBudget = 0;
+		vk::DeviceSize heapUsage = 0;
+		if (memoryBudgetEnabled) {
+			auto memoryProperties = device->physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+			const auto &heaps = memoryProperties.get<vk::PhysicalDeviceMemoryProperties2>().memoryProperties;
+			const auto &budget = memoryProperties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+			for (uint32_t i = 0; i < heaps.memoryHeapCount; i++) {
+				if (heaps.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+					heapBudget += budget.heapBudget[i];
+					heapUsage += budget.heapUsage[i];
+				}
+			}
+			// Ranges of dropped mips go back to the allocator's blocks, which keep holding on to the memory
+			heapUsage -= std::min(heapUsage, device->allocator.getFreeBlockBytes(vk::MemoryHeapFlagBits::eDeviceLocal));
+		} else {
+			// Without the extension the heap size is the only limit we know of
+			const auto &heaps = device->memoryProperties.memoryProperties;
+			for (uint32_t i = 0; i < heaps.memoryHeapCount; i++) {
+				if (heaps.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+					heapBudget += heaps.memoryHeaps[i].size;
+				}
+			}
+			heapUsage = textureBytes;
+		}
+
+		// A fixed budget only covers the textures themselves
+		if (budgetOverride > 0) {
+			stats.budget = budgetOverride;
+			stats.usage = textureBytes;
+		} else {
+			stats.budget = static_cast<vk::DeviceSize>(static_cast<double>(heapBudget) * budgetScale);
+			stats.usage = heapUsage;
+		}
+		return static_cast<int64_t>(stats.usage + additional) - static_cast<int64_t>(stats.budget);
+	}
+
+	/** @brief Estimate the device memory required by the texture when uploaded starting at baseLevel */
+	vk::DeviceSize TextureResidency::estimateSize(const Entry &entry, uint32_t baseLevel) const
+	{
+		vk::DeviceSize size = 0;
+		for (uint32_t i = baseLevel; i < entry.levelSizes.size(); i++) {
+			size += entry.levelSizes[i];
+		}
+		return size;
+	}
+
+	/**
+	* (Re)create the texture starting at the given mip level
+	*
+	* Falls back to smaller mip levels if the device runs out of memory
+	*/
+	void TextureResidency::upload(Entry &entry, uint32_t baseLevel)
+	{
+		while (true) {
+			// Release the old image first so its memory can be reused
+			entry.texture->destroy();
+			try {
+				entry.texture->loadFromFile(entry.filename, entry.format, device, copyQueue, imageUsageFlags, vk::ImageLayout::eShaderReadOnlyOptimal, false, baseLevel);
+				break;
+			} catch (const vk::OutOfDeviceMemoryError &) {
+				if (baseLevel >= entry.tailLevel) {
+					throw;
+				}
+				baseLevel++;
+			}
+		}
+		entry.baseLevel = baseLevel;
+		entry.size = entry.texture->deviceMemory.size();
+	}
+
+	/**
+	* Drop the top mip level of the least recently used texture that is not yet down to its resident tail
+	*
+	* @param over Bytes over budget, reduced by the amount of memory released
+	*
+	* @return False if there is no texture left that could be downsampled
+	*/
+	bool TextureResidency::dropLeastRecentlyUsed(int64_t &over)
+	{
+		Entry *candidate = nullptr;
+		for (auto &entry : entries) {
+			if (entry.texture && entry.baseLevel < entry.tailLevel) {
+				if (!candidate || entry.lastUsed < candidate->lastUsed || (entry.lastUsed == candidate->lastUsed && entry.size > candidate->size)) {
+					candidate = &entry;
+				}
+			}
+		}
+		if (!candidate) {
+			return false;
+		}
+
+		const vk::DeviceSize oldSize = candidate->size;
+		upload(*candidate, candidate->baseLevel + 1);
+		over -= static_cast<int64_t>(oldSize) - static_cast<int64_t>(candidate->size);
+		stats.droppedMips++;
+		return true;
+	}
+
+	void TextureResidency::updateStats()
+	{
+		excess();
+		stats.textureBytes = 0;
+		stats.downsampledTextures = 0;
+		for (const auto &entry : entries) {
+			stats.textureBytes += entry.size;
+			if (entry.texture && entry.baseLevel > 0) {
+				stats.downsampledTextures++;
+			}
+		}
+	}
+}
@@ -0,0 +1,93 @@
+/*
+* Vulkan texture residency manager
+*
+* Keeps KTX textures within the device memory budget (VK_EXT_memory_budget) by dropping
+* the top mip levels of the least recently used textures
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "VulkanDevice.h"
+#include "VulkanTexture.h"
+
+namespace vks
+{
+	class TextureResidency
+	{
+	public:
+		struct Stats
+		{
+			/** @brief Budget textures are measured against (in bytes) */
+			vk::DeviceSize budget = 0;
+			/** @brief Current usage measured against the budget (in bytes), memory the allocator holds on to without using it doesn't count */
+			vk::DeviceSize usage = 0;
+			/** @brief Device memory held by managed textures (in bytes) */
+			vk::DeviceSize textureBytes = 0;
+			/** @brief Number of textures currently missing one or more top mip levels */
+			uint32_t downsampledTextures = 0;
+			/** @brief Total number of mip levels dropped / restored since startup */
+			uint32_t droppedMips = 0;
+			uint32_t restoredMips = 0;
+		};
+
+		/** @brief Fraction of the reported device local heap budget the application may fill */
+		float budgetScale = 0.9f;
+		/** @brief Fixed texture budget in bytes, overrides the reported heap budget if non-zero */
+		vk::DeviceSize budgetOverride = 0;
+		/** @brief Mip levels at or below this extent form the resident tail and are never dropped */
+		uint32_t tailExtent = 128;
+		/** @brief Textures not used within this many frames are not restored */
+		uint32_t restoreWindow = 2;
+		/** @brief Usage flags managed textures are created with */
+		vk::ImageUsageFlags imageUsageFlags = vk::ImageUsageFlagBits::eSampled;
+		/** @brief Statistics as of the last call to update() */
+		Stats stats;
+
+		void prepare(vks::VulkanDevice *device, vk::Queue copyQueue, bool memoryBudgetEnabled);
+		uint32_t load(vks::Texture2D *texture, const std::string &filename, vk::Format format);
+		void release(uint32_t handle);
+		void touch(uint32_t handle, uint64_t frame);
+		bool update(uint64_t frame);
+		void clear();
+
+	private:
+		struct Entry
+		{
+			vks::Texture2D *texture = nullptr;
+			std::string filename;
+			vk::Format format;
+			/** @brief Size of each mip level as stored in the file */
+			std::vector<vk::DeviceSize> levelSizes;
+			/** @brief First mip level of the resident tail */
+			uint32_t tailLevel = 0;
+			/** @brief First mip level currently uploaded to the device */
+			uint32_t baseLevel = 0;
+			/** @brief Device memory currently held by the texture */
+			vk::DeviceSize size = 0;
+			uint64_t lastUsed = 0;
+		};
+
+		vks::VulkanDevice *device = nullptr;
+		vk::Queue copyQueue;
+		bool memoryBudgetEnabled = false;
+		uint64_t currentFrame = 0;
+
+		std::vector<Entry> entries;
+		/** @brief Handles of released entries, reused by load() */
+		std::vector<uint32_t> freeHandles;
+
+		int64_t excess(vk::DeviceSize additional = 0);
+		vk::DeviceSize estimateSize(const Entry &entry, uint32_t baseLevel) const;
+		void upload(Entry &entry, uint32_t baseLevel);
+		bool dropLeastRecentlyUsed(int64_t &over);
+		void updateStats();
+	};
+}
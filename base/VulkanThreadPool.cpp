@@ -0,0 +1,119 @@
+/*
+* Thread pool
+*
+* Fixed set of worker threads that split index ranges with the calling thread, for per-frame
+* work like animation and command buffer recording
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanThreadPool.h"
+
+#include <algorithm>
+
+namespace vks
+{
+	ThreadPool::~ThreadPool()
+	{
+		stop();
+	}
+
+	/**
+	* Restart the pool with a new number of threads
+	*
+	* @param count Number of threads taking part in parallelFor() including the calling thread, 0 uses all hardware threads
+	*/
+	void ThreadPool::setThreadCount(uint32_t count)
+	{
+		stop();
+		if (count == 0) {
+			count = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		stopping = false;
+		// Workers start from the current generation, otherwise a restarted pool would take the last finished job for a new one
+		for (uint32_t i = 1; i < count; i++) {
+			threads.emplace_back(&ThreadPool::worker, this, i, generation);
+		}
+	}
+
+	/**
+	* Run a function over a range of indices on all threads and wait for it to finish
+	*
+	* @param count Number of indices
+	* @param grainSize Number of consecutive indices handed to a thread at once
+	* @param function Function to run, called concurrently for disjoint ranges
+	*/
+	void ThreadPool::parallelFor(size_t count, size_t grainSize, const RangeFunction &function)
+	{
+		grainSize = std::max<size_t>(grainSize, 1);
+		if (count == 0) {
+			return;
+		}
+		if (threads.empty() || count <= grainSize) {
+			function(0, count, 0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			this->function = &function;
+			this->count = count;
+			this->grainSize = grainSize;
+			next = 0;
+			busy = static_cast<uint32_t>(threads.size());
+			generation++;
+		}
+		wake.notify_all();
+		run(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+		this->function = nullptr;
+	}
+
+	void ThreadPool::worker(uint32_t threadIndex, uint64_t seen)
+	{
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping) {
+					return;
+				}
+				seen = generation;
+			}
+			run(threadIndex);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--busy == 0) {
+					done.notify_one();
+				}
+			}
+		}
+	}
+
+	/** @brief Take ranges of the current job until none are left */
+	void ThreadPool::run(uint32_t threadIndex)
+	{
+		for (;;) {
+			const size_t begin = next.fetch_add(grainSize);
+			if (begin >= count) {
+				return;
+			}
+			(*function)(begin, std::min(begin + grainSize, count), threadIndex);
+		}
+	}
+
+	void ThreadPool::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto &thread : threads) {
+			thread.join();
+		}
+		threads.clear();
+	}
+}
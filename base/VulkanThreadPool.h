@@ -0,0 +1,59 @@
+/*
+* Thread pool
+*
+* Fixed set of worker threads that split index ranges with the calling thread, for per-frame
+* work like animation and command buffer recording
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vks
+{
+	class ThreadPool
+	{
+	public:
+		/** @brief Called with a range of indices [begin, end) and the index of the thread running it (0 is the calling thread) */
+		using RangeFunction = std::function<void(size_t begin, size_t end, uint32_t threadIndex)>;
+
+		ThreadPool() = default;
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator=(const ThreadPool &) = delete;
+		~ThreadPool();
+
+		void setThreadCount(uint32_t count);
+		/** @brief Number of threads taking part in parallelFor(), including the calling thread */
+		uint32_t getThreadCount() const { return static_cast<uint32_t>(threads.size()) + 1; }
+		void parallelFor(size_t count, size_t grainSize, const RangeFunction &function);
+
+	private:
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		bool stopping = false;
+		/** @brief Incremented for every job, so workers can tell a new job from a spurious wake up */
+		uint64_t generation = 0;
+		/** @brief Number of workers that haven't finished the current job yet */
+		uint32_t busy = 0;
+
+		const RangeFunction *function = nullptr;
+		size_t count = 0;
+		size_t grainSize = 1;
+		std::atomic<size_t> next{ 0 };
+
+		void worker(uint32_t threadIndex, uint64_t seen);
+		void run(uint32_t threadIndex);
+		void stop();
+	};
+}
@@ -0,0 +1,577 @@
+/*
+* Batched transform kernels
+*
+* Vectorized (AVX2, SSE4.1 or NEON, depending on the target the file is compiled for) matrix and
+* bounding volume operations over arrays of nodes, with a scalar fallback for other targets
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanTransformKernels.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define VKS_TRANSFORMS_AVX2
+#define VKS_TRANSFORMS_SSE4
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#define VKS_TRANSFORMS_SSE4
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VKS_TRANSFORMS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace vks
+{
+	namespace transforms
+	{
+		namespace
+		{
+			// Four float lanes, all kernels are written against these helpers once
+#if defined(VKS_TRANSFORMS_SSE4)
+			using V4 = __m128;
+			inline V4 load(const float *p) { return _mm_loadu_ps(p); }
+			inline void store(float *p, V4 v) { _mm_storeu_ps(p, v); }
+			inline V4 set1(float f) { return _mm_set1_ps(f); }
+			inline V4 set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+			inline V4 add(V4 a, V4 b) { return _mm_add_ps(a, b); }
+			inline V4 sub(V4 a, V4 b) { return _mm_sub_ps(a, b); }
+			inline V4 mul(V4 a, V4 b) { return _mm_mul_ps(a, b); }
+			inline V4 abs(V4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+			inline V4 div(V4 a, V4 b) { return _mm_div_ps(a, b); }
+			inline V4 min(V4 a, V4 b) { return _mm_min_ps(a, b); }
+			inline V4 max(V4 a, V4 b) { return _mm_max_ps(a, b); }
+			inline V4 sqrt(V4 a) { return _mm_sqrt_ps(a); }
+			// Magnitude of a with the sign of b
+			inline V4 copySign(V4 a, V4 b)
+			{
+				const V4 signMask = _mm_set1_ps(-0.0f);
+				return _mm_or_ps(_mm_andnot_ps(signMask, a), _mm_and_ps(signMask, b));
+			}
+#if defined(__FMA__)
+			// a * b + c
+			inline V4 madd(V4 a, V4 b, V4 c) { return _mm_fmadd_ps(a, b, c); }
+#else
+			inline V4 madd(V4 a, V4 b, V4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+#endif
+			inline bool anyNegative(V4 a) { return _mm_movemask_ps(_mm_cmplt_ps(a, _mm_setzero_ps())) != 0; }
+			// Bit i set if lane i is negative
+			inline int negativeMask(V4 a) { return _mm_movemask_ps(_mm_cmplt_ps(a, _mm_setzero_ps())); }
+			inline void transpose(V4 &a, V4 &b, V4 &c, V4 &d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+#elif defined(VKS_TRANSFORMS_NEON)
+			using V4 = float32x4_t;
+			inline V4 load(const float *p) { return vld1q_f32(p); }
+			inline void store(float *p, V4 v) { vst1q_f32(p, v); }
+			inline V4 set1(float f) { return vdupq_n_f32(f); }
+			inline V4 set(float x, float y, float z, float w)
+			{
+				const float values[4] = { x, y, z, w };
+				return vld1q_f32(values);
+			}
+			inline V4 add(V4 a, V4 b) { return vaddq_f32(a, b); }
+			inline V4 sub(V4 a, V4 b) { return vsubq_f32(a, b); }
+			inline V4 mul(V4 a, V4 b) { return vmulq_f32(a, b); }
+			inline V4 abs(V4 a) { return vabsq_f32(a); }
+			inline V4 min(V4 a, V4 b) { return vminq_f32(a, b); }
+			inline V4 max(V4 a, V4 b) { return vmaxq_f32(a, b); }
+#if defined(__aarch64__)
+			inline V4 div(V4 a, V4 b) { return vdivq_f32(a, b); }
+			inline V4 sqrt(V4 a) { return vsqrtq_f32(a); }
+#else
+			inline V4 div(V4 a, V4 b)
+			{
+				// Two Newton-Raphson steps on the reciprocal estimate
+				V4 reciprocal = vrecpeq_f32(b);
+				reciprocal = vmulq_f32(vrecpsq_f32(b, reciprocal), reciprocal);
+				reciprocal = vmulq_f32(vrecpsq_f32(b, reciprocal), reciprocal);
+				return vmulq_f32(a, reciprocal);
+			}
+			inline V4 sqrt(V4 a)
+			{
+				float values[4];
+				vst1q_f32(values, a);
+				for (float &value : values) {
+					value = std::sqrt(value);
+				}
+				return vld1q_f32(values);
+			}
+#endif
+			inline V4 copySign(V4 a, V4 b)
+			{
+				return vbslq_f32(vdupq_n_u32(0x80000000u), b, a);
+			}
+			inline V4 madd(V4 a, V4 b, V4 c) { return vmlaq_f32(c, a, b); }
+			inline bool anyNegative(V4 a)
+			{
+				const uint32x4_t mask = vcltq_f32(a, vdupq_n_f32(0.0f));
+				const uint32x2_t folded = vorr_u32(vget_low_u32(mask), vget_high_u32(mask));
+				return vget_lane_u32(vpmax_u32(folded, folded), 0) != 0;
+			}
+			inline int negativeMask(V4 a)
+			{
+				static const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+				const uint32x4_t mask = vandq_u32(vcltq_f32(a, vdupq_n_f32(0.0f)), vld1q_u32(laneBits));
+				const uint32x2_t folded = vorr_u32(vget_low_u32(mask), vget_high_u32(mask));
+				return static_cast<int>(vget_lane_u32(vpadd_u32(folded, folded), 0));
+			}
+			inline void transpose(V4 &a, V4 &b, V4 &c, V4 &d)
+			{
+				const float32x4x2_t ab = vtrnq_f32(a, b);
+				const float32x4x2_t cd = vtrnq_f32(c, d);
+				a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+				b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+				c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+				d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+			}
+#else
+			struct V4
+			{
+				float v[4];
+			};
+			inline V4 load(const float *p) { return V4{ { p[0], p[1], p[2], p[3] } }; }
+			inline void store(float *p, V4 a) { std::memcpy(p, a.v, sizeof(a.v)); }
+			inline V4 set1(float f) { return V4{ { f, f, f, f } }; }
+			inline V4 set(float x, float y, float z, float w) { return V4{ { x, y, z, w } }; }
+			inline V4 add(V4 a, V4 b) { return V4{ { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } }; }
+			inline V4 sub(V4 a, V4 b) { return V4{ { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } }; }
+			inline V4 mul(V4 a, V4 b) { return V4{ { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } }; }
+			inline V4 abs(V4 a) { return V4{ { std::fabs(a.v[0]), std::fabs(a.v[1]), std::fabs(a.v[2]), std::fabs(a.v[3]) } }; }
+			inline V4 div(V4 a, V4 b) { return V4{ { a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3] } }; }
+			inline V4 min(V4 a, V4 b) { return V4{ { std::fmin(a.v[0], b.v[0]), std::fmin(a.v[1], b.v[1]), std::fmin(a.v[2], b.v[2]), std::fmin(a.v[3], b.v[3]) } }; }
+			inline V4 max(V4 a, V4 b) { return V4{ { std::fmax(a.v[0], b.v[0]), std::fmax(a.v[1], b.v[1]), std::fmax(a.v[2], b.v[2]), std::fmax(a.v[3], b.v[3]) } }; }
+			inline V4 sqrt(V4 a) { return V4{ { std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3]) } }; }
+			inline V4 copySign(V4 a, V4 b) { return V4{ { std::copysign(a.v[0], b.v[0]), std::copysign(a.v[1], b.v[1]), std::copysign(a.v[2], b.v[2]), std::copysign(a.v[3], b.v[3]) } }; }
+			inline V4 madd(V4 a, V4 b, V4 c) { return add(mul(a, b), c); }
+			inline bool anyNegative(V4 a) { return a.v[0] < 0.0f || a.v[1] < 0.0f || a.v[2] < 0.0f || a.v[3] < 0.0f; }
+			inline int negativeMask(V4 a) { return (a.v[0] < 0.0f ? 1 : 0) | (a.v[1] < 0.0f ? 2 : 0) | (a.v[2] < 0.0f ? 4 : 0) | (a.v[3] < 0.0f ? 8 : 0); }
+			inline void transpose(V4 &a, V4 &b, V4 &c, V4 &d)
+			{
+				const V4 r[4] = { a, b, c, d };
+				a = V4{ { r[0].v[0], r[1].v[0], r[2].v[0], r[3].v[0] } };
+				b = V4{ { r[0].v[1], r[1].v[1], r[2].v[1], r[3].v[1] } };
+				c = V4{ { r[0].v[2], r[1].v[2], r[2].v[2], r[3].v[2] } };
+				d = V4{ { r[0].v[3], r[1].v[3], r[2].v[3], r[3].v[3] } };
+			}
+#endif
+
+			// Column major 4x4 multiply, dst may alias a or b
+			inline void multiplyMatrix(const float *a, const float *b, float *dst)
+			{
+				const V4 a0 = load(a);
+				const V4 a1 = load(a + 4);
+				const V4 a2 = load(a + 8);
+				const V4 a3 = load(a + 12);
+				V4 columns[4];
+				for (int j = 0; j < 4; j++) {
+					const float *column = b + j * 4;
+					columns[j] = madd(a3, set1(column[3]), madd(a2, set1(column[2]), madd(a1, set1(column[1]), mul(a0, set1(column[0])))));
+				}
+				for (int j = 0; j < 4; j++) {
+					store(dst + j * 4, columns[j]);
+				}
+			}
+
+			inline const float *data(const glm::mat4 &m) { return &m[0][0]; }
+			inline float *data(glm::mat4 &m) { return &m[0][0]; }
+
+			// Transform a box given as center and half extent with a column major matrix
+			inline void transformAabb(const Aabb &box, const float *m, Aabb &dst)
+			{
+				const glm::vec3 center = (box.min + box.max) * 0.5f;
+				const glm::vec3 extent = (box.max - box.min) * 0.5f;
+				const V4 m0 = load(m);
+				const V4 m1 = load(m + 4);
+				const V4 m2 = load(m + 8);
+				const V4 m3 = load(m + 12);
+				const V4 c = madd(m2, set1(center.z), madd(m1, set1(center.y), madd(m0, set1(center.x), m3)));
+				const V4 e = madd(abs(m2), set1(extent.z), madd(abs(m1), set1(extent.y), mul(abs(m0), set1(extent.x))));
+				float lo[4], hi[4];
+				store(lo, sub(c, e));
+				store(hi, add(c, e));
+				dst.min = glm::vec3(lo[0], lo[1], lo[2]);
+				dst.max = glm::vec3(hi[0], hi[1], hi[2]);
+			}
+
+			// Frustum planes transposed into x, y, z and w lanes, the last two planes are padded with planes every box passes
+			struct Planes
+			{
+				V4 x[2], y[2], z[2], w[2];
+				V4 absX[2], absY[2], absZ[2];
+			};
+
+			inline Planes transposePlanes(const glm::vec4 planes[6])
+			{
+				Planes result;
+				for (int i = 0; i < 2; i++) {
+					V4 p0 = load(&planes[i * 4][0]);
+					V4 p1 = load(&planes[i * 4 + 1][0]);
+					V4 p2 = i == 0 ? load(&planes[2][0]) : set(0.0f, 0.0f, 0.0f, 1.0f);
+					V4 p3 = i == 0 ? load(&planes[3][0]) : set(0.0f, 0.0f, 0.0f, 1.0f);
+					transpose(p0, p1, p2, p3);
+					result.x[i] = p0;
+					result.y[i] = p1;
+					result.z[i] = p2;
+					result.w[i] = p3;
+					result.absX[i] = abs(p0);
+					result.absY[i] = abs(p1);
+					result.absZ[i] = abs(p2);
+				}
+				return result;
+			}
+
+			// A box is outside if it is completely behind any plane (distance of the center plus the projected extent is negative)
+			inline bool testAabb(const Planes &planes, const Aabb &box)
+			{
+				const glm::vec3 center = (box.min + box.max) * 0.5f;
+				const glm::vec3 extent = (box.max - box.min) * 0.5f;
+				const V4 cx = set1(center.x), cy = set1(center.y), cz = set1(center.z);
+				const V4 ex = set1(extent.x), ey = set1(extent.y), ez = set1(extent.z);
+				V4 distance[2];
+				for (int i = 0; i < 2; i++) {
+					const V4 d = madd(planes.z[i], cz, madd(planes.y[i], cy, madd(planes.x[i], cx, planes.w[i])));
+					const V4 r = madd(planes.absZ[i], ez, madd(planes.absY[i], ey, mul(planes.absX[i], ex)));
+					distance[i] = add(d, r);
+				}
+				return !anyNegative(min(distance[0], distance[1]));
+			}
+
+			// Frustum planes with every component broadcast to all lanes, for testing one box per lane
+			struct BroadcastPlanes
+			{
+				V4 x[6], y[6], z[6], w[6];
+				V4 absX[6], absY[6], absZ[6];
+			};
+
+			// Test four boxes given as separate component arrays, returns bit i set if box i is outside
+			inline int testAabbs4(const BroadcastPlanes &planes, const AabbSoa &boxes, size_t first)
+			{
+				const V4 half = set1(0.5f);
+				const V4 minX = load(boxes.minX + first), minY = load(boxes.minY + first), minZ = load(boxes.minZ + first);
+				const V4 maxX = load(boxes.maxX + first), maxY = load(boxes.maxY + first), maxZ = load(boxes.maxZ + first);
+				const V4 cx = mul(add(minX, maxX), half), cy = mul(add(minY, maxY), half), cz = mul(add(minZ, maxZ), half);
+				const V4 ex = mul(sub(maxX, minX), half), ey = mul(sub(maxY, minY), half), ez = mul(sub(maxZ, minZ), half);
+				V4 distance = set1(1.0f);
+				for (int i = 0; i < 6; i++) {
+					const V4 d = madd(planes.z[i], cz, madd(planes.y[i], cy, madd(planes.x[i], cx, planes.w[i])));
+					const V4 r = madd(planes.absZ[i], ez, madd(planes.absY[i], ey, mul(planes.absX[i], ex)));
+					distance = min(distance, add(d, r));
+				}
+				return negativeMask(distance);
+			}
+
+#if defined(VKS_TRANSFORMS_AVX2)
+			// Eight lanes, only used where a kernel gains from the wider registers
+			using V8 = __m256;
+#if defined(__FMA__)
+			inline V8 madd8(V8 a, V8 b, V8 c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+			inline V8 madd8(V8 a, V8 b, V8 c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+
+			struct BroadcastPlanes8
+			{
+				V8 x[6], y[6], z[6], w[6];
+				V8 absX[6], absY[6], absZ[6];
+			};
+
+			inline int testAabbs8(const BroadcastPlanes8 &planes, const AabbSoa &boxes, size_t first)
+			{
+				const V8 half = _mm256_set1_ps(0.5f);
+				const V8 minX = _mm256_loadu_ps(boxes.minX + first), minY = _mm256_loadu_ps(boxes.minY + first), minZ = _mm256_loadu_ps(boxes.minZ + first);
+				const V8 maxX = _mm256_loadu_ps(boxes.maxX + first), maxY = _mm256_loadu_ps(boxes.maxY + first), maxZ = _mm256_loadu_ps(boxes.maxZ + first);
+				const V8 cx = _mm256_mul_ps(_mm256_add_ps(minX, maxX), half), cy = _mm256_mul_ps(_mm256_add_ps(minY, maxY), half), cz = _mm256_mul_ps(_mm256_add_ps(minZ, maxZ), half);
+				const V8 ex = _mm256_mul_ps(_mm256_sub_ps(maxX, minX), half), ey = _mm256_mul_ps(_mm256_sub_ps(maxY, minY), half), ez = _mm256_mul_ps(_mm256_sub_ps(maxZ, minZ), half);
+				V8 distance = _mm256_set1_ps(1.0f);
+				for (int i = 0; i < 6; i++) {
+					const V8 d = madd8(planes.z[i], cz, madd8(planes.y[i], cy, madd8(planes.x[i], cx, planes.w[i])));
+					const V8 r = madd8(planes.absZ[i], ez, madd8(planes.absY[i], ey, _mm256_mul_ps(planes.absX[i], ex)));
+					distance = _mm256_min_ps(distance, _mm256_add_ps(d, r));
+				}
+				return _mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+			}
+#endif
+		}
+
+		const char *simdLevel()
+		{
+#if defined(VKS_TRANSFORMS_AVX2)
+			return "AVX2";
+#elif defined(VKS_TRANSFORMS_SSE4)
+			return "SSE4.1";
+#elif defined(VKS_TRANSFORMS_NEON)
+			return "NEON";
+#else
+			return "Scalar";
+#endif
+		}
+
+		void composeTrs(const glm::vec3 *translations, const glm::quat *rotations, const glm::vec3 *scales, glm::mat4 *dst, size_t count)
+		{
+			const V4 zero = set1(0.0f);
+			const V4 one = set1(1.0f);
+			const V4 two = set1(2.0f);
+			size_t i = 0;
+			// Four matrices at a time, quaternion components and scales are transposed into one register each
+			for (; i + 4 <= count; i += 4) {
+				V4 qx = set(rotations[i].x, rotations[i + 1].x, rotations[i + 2].x, rotations[i + 3].x);
+				V4 qy = set(rotations[i].y, rotations[i + 1].y, rotations[i + 2].y, rotations[i + 3].y);
+				V4 qz = set(rotations[i].z, rotations[i + 1].z, rotations[i + 2].z, rotations[i + 3].z);
+				V4 qw = set(rotations[i].w, rotations[i + 1].w, rotations[i + 2].w, rotations[i + 3].w);
+				const V4 sx = set(scales[i].x, scales[i + 1].x, scales[i + 2].x, scales[i + 3].x);
+				const V4 sy = set(scales[i].y, scales[i + 1].y, scales[i + 2].y, scales[i + 3].y);
+				const V4 sz = set(scales[i].z, scales[i + 1].z, scales[i + 2].z, scales[i + 3].z);
+
+				const V4 xx = mul(qx, qx), yy = mul(qy, qy), zz = mul(qz, qz);
+				const V4 xy = mul(qx, qy), xz = mul(qx, qz), yz = mul(qy, qz);
+				const V4 wx = mul(qw, qx), wy = mul(qw, qy), wz = mul(qw, qz);
+
+				// Rotation columns scaled by the matching scale component
+				V4 c0x = mul(sub(one, mul(two, add(yy, zz))), sx);
+				V4 c0y = mul(mul(two, add(xy, wz)), sx);
+				V4 c0z = mul(mul(two, sub(xz, wy)), sx);
+				V4 c1x = mul(mul(two, sub(xy, wz)), sy);
+				V4 c1y = mul(sub(one, mul(two, add(xx, zz))), sy);
+				V4 c1z = mul(mul(two, add(yz, wx)), sy);
+				V4 c2x = mul(mul(two, add(xz, wy)), sz);
+				V4 c2y = mul(mul(two, sub(yz, wx)), sz);
+				V4 c2z = mul(sub(one, mul(two, add(xx, yy))), sz);
+				V4 c3x = set(translations[i].x, translations[i + 1].x, translations[i + 2].x, translations[i + 3].x);
+				V4 c3y = set(translations[i].y, translations[i + 1].y, translations[i + 2].y, translations[i + 3].y);
+				V4 c3z = set(translations[i].z, translations[i + 1].z, translations[i + 2].z, translations[i + 3].z);
+
+				// Transpose back, after which each register holds one column of one matrix
+				V4 c0w = zero, c1w = zero, c2w = zero, c3w = one;
+				transpose(c0x, c0y, c0z, c0w);
+				transpose(c1x, c1y, c1z, c1w);
+				transpose(c2x, c2y, c2z, c2w);
+				transpose(c3x, c3y, c3z, c3w);
+				const V4 columns[4][4] = {
+					{ c0x, c1x, c2x, c3x },
+					{ c0y, c1y, c2y, c3y },
+					{ c0z, c1z, c2z, c3z },
+					{ c0w, c1w, c2w, c3w },
+				};
+				for (int m = 0; m < 4; m++) {
+					float *out = data(dst[i + m]);
+					for (int c = 0; c < 4; c++) {
+						store(out + c * 4, columns[m][c]);
+					}
+				}
+			}
+			for (; i < count; i++) {
+				const glm::quat &q = rotations[i];
+				const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+				const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+				const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+				const glm::vec3 &s = scales[i];
+				glm::mat4 &m = dst[i];
+				m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * s.x;
+				m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * s.y;
+				m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * s.z;
+				m[3] = glm::vec4(translations[i], 1.0f);
+			}
+		}
+
+		void multiply(const glm::mat4 *a, const glm::mat4 *b, glm::mat4 *dst, size_t count)
+		{
+			for (size_t i = 0; i < count; i++) {
+				multiplyMatrix(data(a[i]), data(b[i]), data(dst[i]));
+			}
+		}
+
+		void multiply(const glm::mat4 &a, const glm::mat4 *b, glm::mat4 *dst, size_t count)
+		{
+			// Keep the common matrix in registers for the whole batch
+			const V4 a0 = load(data(a));
+			const V4 a1 = load(data(a) + 4);
+			const V4 a2 = load(data(a) + 8);
+			const V4 a3 = load(data(a) + 12);
+			for (size_t i = 0; i < count; i++) {
+				const float *in = data(b[i]);
+				V4 columns[4];
+				for (int j = 0; j < 4; j++) {
+					const float *column = in + j * 4;
+					columns[j] = madd(a3, set1(column[3]), madd(a2, set1(column[2]), madd(a1, set1(column[1]), mul(a0, set1(column[0])))));
+				}
+				float *out = data(dst[i]);
+				for (int j = 0; j < 4; j++) {
+					store(out + j * 4, columns[j]);
+				}
+			}
+		}
+
+		void toDualQuaternions(const glm::mat4 *matrices, glm::vec4 *dst, size_t count)
+		{
+			const V4 zero = set1(0.0f);
+			const V4 half = set1(0.5f);
+			const V4 one = set1(1.0f);
+			const V4 epsilon = set1(1e-12f);
+			// Four matrices at a time, transposed so each register holds one matrix element of all four
+			for (size_t i = 0; i < count; i++) {
+				const size_t batch = count - i < 4 ? count - i : 4;
+				V4 c[4][4];
+				for (int column = 0; column < 4; column++) {
+					V4 rows[4];
+					for (size_t m = 0; m < 4; m++) {
+						// Pad partial batches with the last matrix
+						rows[m] = load(data(matrices[i + (m < batch ? m : batch - 1)]) + column * 4);
+					}
+					transpose(rows[0], rows[1], rows[2], rows[3]);
+					for (int row = 0; row < 4; row++) {
+						c[column][row] = rows[row];
+					}
+				}
+				// Remove scale from the rotation columns, dual quaternions can only represent rigid transforms
+				for (int column = 0; column < 3; column++) {
+					const V4 length = sqrt(max(madd(c[column][2], c[column][2], madd(c[column][1], c[column][1], mul(c[column][0], c[column][0]))), epsilon));
+					for (int row = 0; row < 3; row++) {
+						c[column][row] = div(c[column][row], length);
+					}
+				}
+				const V4 m00 = c[0][0], m11 = c[1][1], m22 = c[2][2];
+				// Branchless rotation matrix to quaternion, signs of x, y and z follow the antisymmetric part
+				V4 qw = mul(half, sqrt(max(zero, add(add(one, m00), add(m11, m22)))));
+				V4 qx = mul(half, sqrt(max(zero, sub(sub(add(one, m00), m11), m22))));
+				V4 qy = mul(half, sqrt(max(zero, sub(add(sub(one, m00), m11), m22))));
+				V4 qz = mul(half, sqrt(max(zero, add(sub(sub(one, m00), m11), m22))));
+				qx = copySign(qx, sub(c[1][2], c[2][1]));
+				qy = copySign(qy, sub(c[2][0], c[0][2]));
+				qz = copySign(qz, sub(c[0][1], c[1][0]));
+				const V4 invLength = div(one, sqrt(max(madd(qw, qw, madd(qz, qz, madd(qy, qy, mul(qx, qx)))), epsilon)));
+				qx = mul(qx, invLength);
+				qy = mul(qy, invLength);
+				qz = mul(qz, invLength);
+				qw = mul(qw, invLength);
+
+				// Dual part 0.5 * (t, 0) * q
+				const V4 tx = c[3][0], ty = c[3][1], tz = c[3][2];
+				V4 dw = mul(set1(-0.5f), madd(tz, qz, madd(ty, qy, mul(tx, qx))));
+				V4 dx = mul(half, sub(madd(ty, qz, mul(tx, qw)), mul(tz, qy)));
+				V4 dy = mul(half, sub(madd(tz, qx, mul(ty, qw)), mul(tx, qz)));
+				V4 dz = mul(half, sub(madd(tz, qw, mul(tx, qy)), mul(ty, qx)));
+
+				transpose(qx, qy, qz, qw);
+				transpose(dx, dy, dz, dw);
+				const V4 real[4] = { qx, qy, qz, qw };
+				const V4 dual[4] = { dx, dy, dz, dw };
+				for (size_t m = 0; m < batch; m++) {
+					store(&dst[(i + m) * 2][0], real[m]);
+					store(&dst[(i + m) * 2 + 1][0], dual[m]);
+				}
+				i += batch - 1;
+			}
+		}
+
+		void updateHierarchy(const int32_t *parents, const glm::mat4 *local, glm::mat4 *world, uint8_t *dirty, size_t count)
+		{
+			for (size_t i = 0; i < count; i++) {
+				const int32_t parent = parents[i];
+				if (dirty) {
+					if (parent >= 0) {
+						dirty[i] |= dirty[parent];
+					}
+					if (!dirty[i]) {
+						continue;
+					}
+				}
+				if (parent >= 0) {
+					multiplyMatrix(data(world[parent]), data(local[i]), data(world[i]));
+				} else {
+					world[i] = local[i];
+				}
+			}
+		}
+
+		void transformAabbs(const Aabb *src, const glm::mat4 *matrices, const uint32_t *matrixIndices, Aabb *dst, size_t count)
+		{
+			for (size_t i = 0; i < count; i++) {
+				transformAabb(src[i], data(matrices[matrixIndices ? matrixIndices[i] : i]), dst[i]);
+			}
+		}
+
+		void extractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6])
+		{
+			const glm::mat4 m = glm::transpose(viewProjection);
+			planes[0] = m[3] + m[0];
+			planes[1] = m[3] - m[0];
+			planes[2] = m[3] + m[1];
+			planes[3] = m[3] - m[1];
+			planes[4] = m[2];
+			planes[5] = m[3] - m[2];
+			for (int i = 0; i < 6; i++) {
+				planes[i] /= glm::length(glm::vec3(planes[i]));
+			}
+		}
+
+		size_t cullAabbs(const glm::vec4 planes[6], const Aabb *boxes, uint8_t *visible, size_t count)
+		{
+			const Planes transposed = transposePlanes(planes);
+			size_t visibleCount = 0;
+			for (size_t i = 0; i < count; i++) {
+				const bool inside = testAabb(transposed, boxes[i]);
+				visible[i] = inside ? 1 : 0;
+				visibleCount += inside ? 1 : 0;
+			}
+			return visibleCount;
+		}
+
+		size_t cullAabbs(const glm::vec4 planes[6], const AabbSoa &boxes, uint8_t *visible, size_t count)
+		{
+			size_t visibleCount = 0;
+			size_t i = 0;
+#if defined(VKS_TRANSFORMS_AVX2)
+			BroadcastPlanes8 planes8;
+			for (int p = 0; p < 6; p++) {
+				planes8.x[p] = _mm256_set1_ps(planes[p].x);
+				planes8.y[p] = _mm256_set1_ps(planes[p].y);
+				planes8.z[p] = _mm256_set1_ps(planes[p].z);
+				planes8.w[p] = _mm256_set1_ps(planes[p].w);
+				planes8.absX[p] = _mm256_set1_ps(std::fabs(planes[p].x));
+				planes8.absY[p] = _mm256_set1_ps(std::fabs(planes[p].y));
+				planes8.absZ[p] = _mm256_set1_ps(std::fabs(planes[p].z));
+			}
+			for (; i + 8 <= count; i += 8) {
+				const int outside = testAabbs8(planes8, boxes, i);
+				for (size_t b = 0; b < 8; b++) {
+					visible[i + b] = (outside >> b) & 1 ? 0 : 1;
+					visibleCount += (outside >> b) & 1 ? 0 : 1;
+				}
+			}
+#endif
+			BroadcastPlanes planes4;
+			for (int p = 0; p < 6; p++) {
+				planes4.x[p] = set1(planes[p].x);
+				planes4.y[p] = set1(planes[p].y);
+				planes4.z[p] = set1(planes[p].z);
+				planes4.w[p] = set1(planes[p].w);
+				planes4.absX[p] = set1(std::fabs(planes[p].x));
+				planes4.absY[p] = set1(std::fabs(planes[p].y));
+				planes4.absZ[p] = set1(std::fabs(planes[p].z));
+			}
+			for (; i + 4 <= count; i += 4) {
+				const int outside = testAabbs4(planes4, boxes, i);
+				for (size_t b = 0; b < 4; b++) {
+					visible[i + b] = (outside >> b) & 1 ? 0 : 1;
+					visibleCount += (outside >> b) & 1 ? 0 : 1;
+				}
+			}
+			// Remaining boxes one at a time
+			const Planes transposed = transposePlanes(planes);
+			for (; i < count; i++) {
+				const Aabb box = { glm::vec3(boxes.minX[i], boxes.minY[i], boxes.minZ[i]), glm::vec3(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]) };
+				const bool inside = testAabb(transposed, box);
+				visible[i] = inside ? 1 : 0;
+				visibleCount += inside ? 1 : 0;
+			}
+			return visibleCount;
+		}
+
+		bool aabbInFrustum(const glm::vec4 planes[6], const Aabb &box)
+		{
+			return testAabb(transposePlanes(planes), box);
+		}
+	}
+}
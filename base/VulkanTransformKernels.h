@@ -0,0 +1,127 @@
+/*
+* Batched transform kernels
+*
+* Vectorized (AVX2, SSE4.1 or NEON, depending on the target the file is compiled for) matrix and
+* bounding volume operations over arrays of nodes, with a scalar fallback for other targets
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace vks
+{
+	namespace transforms
+	{
+		/** @brief Axis aligned bounding box */
+		struct Aabb
+		{
+			glm::vec3 min;
+			glm::vec3 max;
+		};
+
+		/** @brief Axis aligned bounding boxes stored as one array per component, so consecutive boxes fill the lanes of a vector */
+		struct AabbSoa
+		{
+			const float *minX;
+			const float *minY;
+			const float *minZ;
+			const float *maxX;
+			const float *maxY;
+			const float *maxZ;
+		};
+
+		/** @brief Returns the name of the instruction set the kernels have been compiled for */
+		const char *simdLevel();
+
+		/**
+		* Compose translation * rotation * scale matrices
+		*
+		* @param translations Translation of each matrix
+		* @param rotations Rotation of each matrix (unit quaternions)
+		* @param scales Scale of each matrix
+		* @param dst Composed matrices
+		* @param count Number of matrices to compose
+		*/
+		void composeTrs(const glm::vec3 *translations, const glm::quat *rotations, const glm::vec3 *scales, glm::mat4 *dst, size_t count);
+
+		/** @brief Multiply matrices pairwise (dst[i] = a[i] * b[i]), dst may alias a or b */
+		void multiply(const glm::mat4 *a, const glm::mat4 *b, glm::mat4 *dst, size_t count);
+
+		/** @brief Multiply matrices by a common matrix from the left (dst[i] = a * b[i]), dst may alias b */
+		void multiply(const glm::mat4 &a, const glm::mat4 *b, glm::mat4 *dst, size_t count);
+
+		/**
+		* Convert rigid transformation matrices to unit dual quaternions
+		*
+		* @param matrices Matrices to convert, any scale is removed
+		* @param dst Two values per matrix, the real part (rotation) followed by the dual part (translation), both as (x, y, z, w)
+		* @param count Number of matrices
+		*/
+		void toDualQuaternions(const glm::mat4 *matrices, glm::vec4 *dst, size_t count);
+
+		/**
+		* Compute world matrices of a flattened hierarchy in a single pass
+		*
+		* @param parents Index of each node's parent, -1 for root nodes. Parents must come before their children
+		* @param local Local matrix of each node
+		* @param world World matrix of each node, only those of dirty nodes are written
+		* @param dirty (Optional) Dirty flag of each node, propagated to the children (but not cleared). All nodes are updated if nullptr
+		* @param count Number of nodes
+		*/
+		void updateHierarchy(const int32_t *parents, const glm::mat4 *local, glm::mat4 *world, uint8_t *dirty, size_t count);
+
+		/**
+		* Transform bounding boxes, the result encloses the transformed box
+		*
+		* @param src Boxes to transform (must not be empty)
+		* @param matrices Transformation matrices
+		* @param matrixIndices (Optional) Index of the matrix for each box, box i uses matrix i if nullptr
+		* @param dst Transformed boxes, may alias src
+		* @param count Number of boxes
+		*/
+		void transformAabbs(const Aabb *src, const glm::mat4 *matrices, const uint32_t *matrixIndices, Aabb *dst, size_t count);
+
+		/**
+		* Extract the normalized frustum planes (left, right, bottom, top, near, far) from a view projection matrix
+		*
+		* @note Assumes a [0, 1] depth range, plane normals point into the frustum
+		*/
+		void extractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6]);
+
+		/**
+		* Test bounding boxes against frustum planes
+		*
+		* @param planes Frustum planes as returned by extractFrustumPlanes()
+		* @param boxes Boxes to test
+		* @param visible Set to 1 for boxes intersecting or inside the frustum, 0 otherwise
+		* @param count Number of boxes
+		*
+		* @return Number of visible boxes
+		*/
+		size_t cullAabbs(const glm::vec4 planes[6], const Aabb *boxes, uint8_t *visible, size_t count);
+
+		/**
+		* Test bounding boxes stored as component arrays against frustum planes, eight (AVX2) or four boxes per instruction
+		*
+		* @param planes Frustum planes as returned by extractFrustumPlanes()
+		* @param boxes Boxes to test, each array holding count values
+		* @param visible Set to 1 for boxes intersecting or inside the frustum, 0 otherwise
+		* @param count Number of boxes
+		*
+		* @return Number of visible boxes
+		*/
+		size_t cullAabbs(const glm::vec4 planes[6], const AabbSoa &boxes, uint8_t *visible, size_t count);
+
+		/** @brief Test a single bounding box against frustum planes */
+		bool aabbInFrustum(const glm::vec4 planes[6], const Aabb &box);
+	}
+}
@@ -79,12 +79,7 @@ namespace vks
 		imageInfo.sharingMode = vk::SharingMode::eExclusive;
 		imageInfo.initialLayout = vk::ImageLayout::eUndefined;
 		fontImage = device->logicalDevice->createImageUnique(imageInfo);
-		vk::MemoryRequirements2 memReqs = device->logicalDevice->getImageMemoryRequirements2(*fontImage);
-		vk::MemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		fontMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindImageMemory(*fontImage, *fontMemory, 0);
+		fontMemory = device->allocator.allocateForImage(*fontImage, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 		// Image view
 		vk::ImageViewCreateInfo viewInfo = vks::initializers::imageViewCreateInfo();
@@ -48,7 +48,7 @@ namespace vks
 		vk::UniquePipelineLayout pipelineLayout;
 		vk::UniquePipeline pipeline;
 
-		vk::UniqueDeviceMemory fontMemory;
+		vks::Allocation fontMemory;
 		vk::UniqueImage fontImage;
 		vk::UniqueImageView fontView;
 		vk::UniqueSampler sampler;
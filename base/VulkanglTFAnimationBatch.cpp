@@ -0,0 +1,72 @@
+/*
+* Batched glTF animation
+*
+* Evaluates the animations of many glTF models at once, spreading the models across the threads of a
+* thread pool
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanglTFAnimationBatch.h"
+
+#include <iostream>
+
+namespace vkglTF
+{
+	/**
+	* Queue a model to be animated by the next update()
+	*
+	* A model may be added more than once (e.g. to blend in a second clip), its animations are then applied one after the other
+	* in the order they were added, same as calling updateAnimation() for each of them
+	*
+	* @param model Model to animate
+	* @param animation Index of the animation to apply
+	* @param time Point in time of the animation
+	*/
+	void AnimationBatch::add(Model *model, uint32_t animation, float time)
+	{
+		if (animation >= model->animations.size()) {
+			std::cout << "No animation with index " << animation << std::endl;
+			return;
+		}
+		const uint32_t index = static_cast<uint32_t>(instances.size());
+		instances.push_back({ model, animation, time });
+		auto last = lastInstances.try_emplace(model, index);
+		if (last.second) {
+			models.push_back(index);
+		} else {
+			// Two threads must never write the same node hierarchy and uniform buffer, so the instance goes to the same thread
+			instances[last.first->second].next = index;
+			last.first->second = index;
+		}
+	}
+
+	/**
+	* Evaluate the animations of all instances and wait for them to finish
+	*
+	* Each thread runs the whole pipeline for all instances of its models: sampling the channels (with each model's cached keyframe
+	* cursors), composing the local poses in the model's structure of arrays transform buffers, propagating the world matrices and
+	* writing the meshes' matrices and joint palettes straight into the model's persistently mapped uniform buffer
+	*
+	* @param threadPool Threads to spread the instances across
+	*/
+	void AnimationBatch::update(vks::ThreadPool &threadPool)
+	{
+		threadPool.parallelFor(models.size(), grainSize, [this](size_t begin, size_t end, uint32_t) {
+			for (size_t i = begin; i < end; i++) {
+				for (uint32_t index = models[i]; index != noInstance; index = instances[index].next) {
+					const Instance &instance = instances[index];
+					instance.model->updateAnimation(instance.animation, instance.time);
+				}
+			}
+		});
+	}
+
+	/** @brief Remove all instances, usually done once per frame before adding the next clip times */
+	void AnimationBatch::clear()
+	{
+		instances.clear();
+		models.clear();
+		lastInstances.clear();
+	}
+}
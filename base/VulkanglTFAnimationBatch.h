@@ -0,0 +1,50 @@
+/*
+* Batched glTF animation
+*
+* Evaluates the animations of many glTF models at once, spreading the models across the threads of a
+* thread pool
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "VulkanThreadPool.h"
+#include "VulkanglTFModel.h"
+
+namespace vkglTF
+{
+	class AnimationBatch
+	{
+	public:
+		static constexpr uint32_t noInstance = UINT32_MAX;
+
+		/** @brief Animation to apply to a model, in the order they were added */
+		struct Instance
+		{
+			Model *model = nullptr;
+			uint32_t animation = 0;
+			float time = 0.0f;
+			/** @brief Index of the next instance of the same model, noInstance for its last one */
+			uint32_t next = noInstance;
+		};
+
+		std::vector<Instance> instances;
+		/** @brief Number of consecutive models a thread evaluates at once */
+		uint32_t grainSize = 4;
+
+		void add(Model *model, uint32_t animation, float time);
+		void update(vks::ThreadPool &threadPool);
+		void clear();
+
+	private:
+		/** @brief Index of the first instance of each distinct model, a model's instances are all evaluated by the same thread */
+		std::vector<uint32_t> models;
+		/** @brief Index of the last instance added for each model, to link the next one */
+		std::unordered_map<Model *, uint32_t> lastInstances;
+	};
+}
@@ -11,7 +11,11 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 
+#include <array>
+
 #include "VulkanglTFModel.h"
+#include "VulkanPixelConversion.h"
+#include "VulkanTransformKernels.h"
 
 vk::UniqueDescriptorSetLayout vkglTF::descriptorSetLayoutImage;
 vk::UniqueDescriptorSetLayout vkglTF::descriptorSetLayoutUbo;
@@ -39,6 +43,116 @@ bool loadImageDataFuncEmpty(tinygltf::Image* image, const int imageIndex, std::s
 	return true;
 }
 
+/*
+	Read a component of an accessor as float, normalized integers map to [0, 1] (unsigned) or [-1, 1] (signed)
+*/
+static float readComponent(const unsigned char* data, int componentType, bool normalized)
+{
+	switch (componentType) {
+	case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+		float value;
+		std::copy_n(reinterpret_cast<const std::byte*>(data), sizeof(value), reinterpret_cast<std::byte*>(&value));
+		return value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_BYTE: {
+		const float value = static_cast<float>(static_cast<int8_t>(data[0]));
+		return normalized ? std::max(value / 127.0f, -1.0f) : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return normalized ? data[0] / 255.0f : static_cast<float>(data[0]);
+	case TINYGLTF_COMPONENT_TYPE_SHORT: {
+		int16_t value;
+		std::copy_n(reinterpret_cast<const std::byte*>(data), sizeof(value), reinterpret_cast<std::byte*>(&value));
+		return normalized ? std::max(value / 32767.0f, -1.0f) : static_cast<float>(value);
+	}
+	default: {
+		uint16_t value;
+		std::copy_n(reinterpret_cast<const std::byte*>(data), sizeof(value), reinterpret_cast<std::byte*>(&value));
+		return normalized ? value / 65535.0f : static_cast<float>(value);
+	}
+	}
+}
+
+static glm::vec3 readVec3(const unsigned char* data, int componentType, bool normalized)
+{
+	const size_t componentSize = static_cast<size_t>(tinygltf::GetComponentSizeInBytes(componentType));
+	return glm::vec3(readComponent(data, componentType, normalized), readComponent(data + componentSize, componentType, normalized), readComponent(data + 2 * componentSize, componentType, normalized));
+}
+
+/*
+	Read a vec3 accessor, applying sparse substitution (sparse accessors without a buffer view start out as zeros)
+	Float, (normalized) byte and (normalized) short components are converted to float, returns false for other component types
+*/
+static bool readVec3Accessor(const tinygltf::Model& model, int accessorIndex, std::vector<glm::vec3>& dst)
+{
+	const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+	assert(accessor.type == TINYGLTF_TYPE_VEC3);
+	switch (accessor.componentType) {
+	case TINYGLTF_COMPONENT_TYPE_FLOAT:
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		break;
+	default:
+		dst.clear();
+		return false;
+	}
+	const size_t elementSize = 3 * static_cast<size_t>(tinygltf::GetComponentSizeInBytes(accessor.componentType));
+	dst.assign(accessor.count, glm::vec3(0.0f));
+	if (accessor.bufferView > -1) {
+		const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+		const size_t stride = static_cast<size_t>(accessor.ByteStride(view));
+		const unsigned char* data = &model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset];
+		for (size_t i = 0; i < accessor.count; i++) {
+			dst[i] = readVec3(data + i * stride, accessor.componentType, accessor.normalized);
+		}
+	}
+	if (accessor.sparse.isSparse) {
+		const tinygltf::BufferView& indexView = model.bufferViews[accessor.sparse.indices.bufferView];
+		const tinygltf::BufferView& valueView = model.bufferViews[accessor.sparse.values.bufferView];
+		const unsigned char* indices = &model.buffers[indexView.buffer].data[accessor.sparse.indices.byteOffset + indexView.byteOffset];
+		const unsigned char* values = &model.buffers[valueView.buffer].data[accessor.sparse.values.byteOffset + valueView.byteOffset];
+		for (int i = 0; i < accessor.sparse.count; i++) {
+			uint32_t index = 0;
+			switch (accessor.sparse.indices.componentType) {
+			case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
+				std::copy_n(reinterpret_cast<const std::byte*>(indices + i * sizeof(uint32_t)), sizeof(uint32_t), reinterpret_cast<std::byte*>(&index));
+				break;
+			case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
+				uint16_t shortIndex = 0;
+				std::copy_n(reinterpret_cast<const std::byte*>(indices + i * sizeof(uint16_t)), sizeof(uint16_t), reinterpret_cast<std::byte*>(&shortIndex));
+				index = shortIndex;
+				break;
+			}
+			default:
+				index = indices[i];
+				break;
+			}
+			if (index < dst.size()) {
+				dst[index] = readVec3(values + i * elementSize, accessor.componentType, accessor.normalized);
+			}
+		}
+	}
+	return true;
+}
+
+/*
+	Range of position offsets a vertex's morph target deltas [first, last) can add up to, for weights within morphTargets.weightMin/weightMax
+*/
+static void getMorphExtents(const vkglTF::Model::MorphTargets& morphTargets, uint32_t first, uint32_t last, glm::vec3& min, glm::vec3& max)
+{
+	min = glm::vec3(0.0f);
+	max = glm::vec3(0.0f);
+	for (uint32_t i = first; i < last; i++) {
+		const vkglTF::Model::MorphTargets::Delta& delta = morphTargets.deltas[i];
+		const glm::vec3 low = delta.position * morphTargets.weightMin[delta.weight];
+		const glm::vec3 high = delta.position * morphTargets.weightMax[delta.weight];
+		min += glm::min(low, high);
+		max += glm::max(low, high);
+	}
+}
+
 
 /*
 	glTF texture loading class
@@ -86,15 +200,7 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 			// TODO: Check actual format support and transform only if required
 			bufferSize = gltfimage.width * gltfimage.height * 4;
 			buffer = new unsigned char[bufferSize];
-			unsigned char* rgba = buffer;
-			unsigned char* rgb = &gltfimage.image[0];
-			for (size_t i = 0; i < gltfimage.width * gltfimage.height; ++i) {
-				for (int32_t j = 0; j < 3; ++j) {
-					rgba[j] = rgb[j];
-				}
-				rgba += 4;
-				rgb += 3;
-			}
+			vks::pixels::rgbToRgba(&gltfimage.image[0], buffer, static_cast<size_t>(gltfimage.width) * gltfimage.height);
 			deleteBuffer = true;
 		}
 		else {
@@ -114,27 +220,19 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 		assert(formatProperties.formatProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitSrc);
         assert(formatProperties.formatProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitDst);
 
-		vk::MemoryAllocateInfo memAllocInfo{};
-		vk::MemoryRequirements2 memReqs{};
-
 		vk::UniqueBuffer stagingBuffer;
-		vk::UniqueDeviceMemory stagingMemory;
+		vks::Allocation stagingMemory;
 
 		vk::BufferCreateInfo bufferCreateInfo{};
 		bufferCreateInfo.size = bufferSize;
 		bufferCreateInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
 		bufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
 		stagingBuffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
-		memReqs = device->logicalDevice->getBufferMemoryRequirements2(*stagingBuffer);
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-		stagingMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindBufferMemory(*stagingBuffer, *stagingMemory, 0);
+		stagingMemory = device->allocator.allocateForBuffer(*stagingBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
 		uint8_t* data;
-		data = (uint8_t*)device->logicalDevice->mapMemory(*stagingMemory, 0, memReqs.memoryRequirements.size, {});
+		data = (uint8_t*)stagingMemory.mapped();
 		std::copy_n(buffer, bufferSize, data);
-		device->logicalDevice->unmapMemory(*stagingMemory);
 
 		vk::ImageCreateInfo imageCreateInfo{};
 		imageCreateInfo.imageType = vk::ImageType::e2D;
@@ -149,11 +247,7 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 		imageCreateInfo.extent = vk::Extent3D{ width, height, 1 };
 		imageCreateInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled;
 		image = device->logicalDevice->createImageUnique(imageCreateInfo);
-		memReqs = device->logicalDevice->getImageMemoryRequirements2(*image);
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		deviceMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindImageMemory(*image, *deviceMemory, 0);
+		deviceMemory = device->allocator.allocateForImage(*image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 		vk::UniqueCommandBuffer copyCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
 
@@ -298,7 +392,7 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 
 		vk::UniqueCommandBuffer copyCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
 		vk::UniqueBuffer stagingBuffer;
-		vk::UniqueDeviceMemory stagingMemory;
+		vks::Allocation stagingMemory;
 
 		vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
 		bufferCreateInfo.size = ktxTextureSize;
@@ -307,17 +401,11 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 		bufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
 		stagingBuffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
 
-		vk::MemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		vk::MemoryRequirements2 memReqs = device->logicalDevice->getBufferMemoryRequirements2(*stagingBuffer);
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-		stagingMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindBufferMemory(*stagingBuffer, *stagingMemory, 0);
+		stagingMemory = device->allocator.allocateForBuffer(*stagingBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
 		uint8_t* data;
-		data = (uint8_t*)device->logicalDevice->mapMemory(*stagingMemory, 0, memReqs.memoryRequirements.size, {});
+		data = (uint8_t*)stagingMemory.mapped();
 		std::copy_n(ktxTextureData, ktxTextureSize, data);
-		device->logicalDevice->unmapMemory(*stagingMemory);
 
 		std::vector<vk::BufferImageCopy> bufferCopyRegions;
 		for (uint32_t i = 0; i < mipLevels; i++)
@@ -351,11 +439,7 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 		imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
 		image = device->logicalDevice->createImageUnique(imageCreateInfo);
 
-		memReqs = device->logicalDevice->getImageMemoryRequirements2(*image);
-		memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		deviceMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-		device->logicalDevice->bindImageMemory(*image, *deviceMemory, 0);
+		deviceMemory = device->allocator.allocateForImage(*image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 		vk::ImageSubresourceRange subresourceRange = {};
 		subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -458,26 +542,9 @@ void vkglTF::Primitive::setDimensions(glm::vec3 min, glm::vec3 max) {
 */
 vkglTF::Mesh::Mesh(vks::VulkanDevice *device, glm::mat4 matrix) {
 	this->device = device;
-	this->uniformBlock.matrix = matrix;
-	VK_CHECK_RESULT(device->createBuffer(
-	    vk::BufferUsageFlagBits::eUniformBuffer,
-		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-		sizeof(uniformBlock),
-		&uniformBuffer.buffer,
-		&uniformBuffer.memory,
-		&uniformBlock));
-	uniformBuffer.mapped = device->logicalDevice->mapMemory(*uniformBuffer.memory, 0, sizeof(uniformBlock), {});
-	uniformBuffer.descriptor = vk::DescriptorBufferInfo{ *uniformBuffer.buffer, 0, sizeof(uniformBlock) };
+	this->matrix = matrix;
 };
 
-vkglTF::Mesh::~Mesh() {
-	uniformBuffer.buffer.reset();
-	uniformBuffer.memory.reset();
-    for (auto primitive : primitives) {
-        delete primitive;
-    }
-}
-
 /*
 	glTF node
 */
@@ -495,37 +562,34 @@ glm::mat4 vkglTF::Node::getMatrix() {
 	return m;
 }
 
+/**
+* Write the uniform blocks of the node and its children
+*
+* @note Reads the cached world matrices, which must be up to date for the node and all joints of its skin
+*/
 void vkglTF::Node::update() {
-	if (mesh) {
-		glm::mat4 m = getMatrix();
-		if (skin) {
-			mesh->uniformBlock.matrix = m;
-			// Update join matrices
-			glm::mat4 inverseTransform = glm::inverse(m);
-			for (size_t i = 0; i < skin->joints.size(); i++) {
-				vkglTF::Node *jointNode = skin->joints[i];
-				glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
-				jointMat = inverseTransform * jointMat;
-				mesh->uniformBlock.jointMatrix[i] = jointMat;
-			}
-			mesh->uniformBlock.jointcount = (float)skin->joints.size();
-			std::copy_n(reinterpret_cast<std::byte*>(&mesh->uniformBlock), sizeof(mesh->uniformBlock), static_cast<std::byte*>(mesh->uniformBuffer.mapped));
-		} else {
-			std::copy_n(reinterpret_cast<std::byte*>(&m), sizeof(glm::mat4), static_cast<std::byte*>(mesh->uniformBuffer.mapped));
-		}
-	}
-
+	updateUniformBlock();
 	for (auto& child : children) {
 		child->update();
 	}
 }
 
-vkglTF::Node::~Node() {
-	if (mesh) {
-		delete mesh;
-	}
-	for (auto& child : children) {
-		delete child;
+/** @brief Write the uniform block of the node's mesh (if any), without descending into the children */
+void vkglTF::Node::updateUniformBlock() {
+	if (mesh && mesh->uniformBlock) {
+		// Written straight into the (host coherent) shared uniform buffer
+		const glm::mat4& m = worldMatrix;
+		mesh->uniformBlock->matrix = m;
+		if (skin) {
+			// Update joint matrices (inverse(m) * joint * inverseBind), built on the stack as the uniform buffer is slow to read back
+			glm::mat4 inverseTransform = glm::inverse(m);
+			glm::mat4 jointMatrices[Mesh::MAX_NUM_JOINTS];
+			for (uint32_t i = 0; i < mesh->jointCount; i++) {
+				jointMatrices[i] = skin->joints[i]->worldMatrix;
+			}
+			vks::transforms::multiply(jointMatrices, skin->inverseBindMatrices.data(), jointMatrices, mesh->jointCount);
+			vks::transforms::multiply(inverseTransform, jointMatrices, mesh->uniformBlock->jointMatrix, mesh->jointCount);
+		}
 	}
 }
 
@@ -587,7 +651,7 @@ vkglTF::Texture* vkglTF::Model::getTexture(uint32_t index)
 {
 
 	if (index < textures.size()) {
-		return &textures[index];
+		return textures[index].get();
 	}
 	return nullptr;
 }
@@ -605,7 +669,7 @@ void vkglTF::Model::createEmptyTexture(vk::Queue transferQueue)
 	memset(buffer, 0, bufferSize);
 
 	vk::UniqueBuffer stagingBuffer;
-	vk::UniqueDeviceMemory stagingMemory;
+	vks::Allocation stagingMemory;
 	vk::BufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
 	bufferCreateInfo.size = bufferSize;
 	// This buffer is used as a transfer source for the buffer copy
@@ -613,19 +677,12 @@ void vkglTF::Model::createEmptyTexture(vk::Queue transferQueue)
 	bufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
 	stagingBuffer = device->logicalDevice->createBufferUnique(bufferCreateInfo);
 
-	vk::MemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-	vk::MemoryRequirements2 memReqs;
-	memReqs = device->logicalDevice->getBufferMemoryRequirements2(*stagingBuffer);
-	memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-	memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-	stagingMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-	device->logicalDevice->bindBufferMemory(*stagingBuffer, *stagingMemory, 0);
+	stagingMemory = device->allocator.allocateForBuffer(*stagingBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
 	// Copy texture data into staging buffer
 	uint8_t* data;
-	data = (uint8_t*)device->logicalDevice->mapMemory(*stagingMemory, 0, memReqs.memoryRequirements.size, {});
+	data = (uint8_t*)stagingMemory.mapped();
 	std::copy_n(buffer, bufferSize, data);
-	device->logicalDevice->unmapMemory(*stagingMemory);
 
 	vk::BufferImageCopy bufferCopyRegion = {};
 	bufferCopyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -648,11 +705,7 @@ void vkglTF::Model::createEmptyTexture(vk::Queue transferQueue)
 	imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
 	emptyTexture.image = device->logicalDevice->createImageUnique(imageCreateInfo);
 
-	memReqs = device->logicalDevice->getImageMemoryRequirements2(*emptyTexture.image);
-	memAllocInfo.allocationSize = memReqs.memoryRequirements.size;
-	memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-	emptyTexture.deviceMemory = device->logicalDevice->allocateMemoryUnique(memAllocInfo);
-	device->logicalDevice->bindImageMemory(*emptyTexture.image, *emptyTexture.deviceMemory, 0);
+	emptyTexture.deviceMemory = device->allocator.allocateForImage(*emptyTexture.image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 	vk::ImageSubresourceRange subresourceRange{};
 	subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -705,15 +758,9 @@ vkglTF::Model::~Model()
 	vertices.memory.reset();
 	indices.buffer.reset();
 	indices.memory.reset();
-	for (auto& texture : textures) {
-		texture.destroy();
-	}
-	for (auto node : nodes) {
-		delete node;
-	}
-    for (auto skin : skins) {
-        delete skin;
-    }
+	uniformBuffer.buffer.destroy();
+	// Shared textures are destroyed once the last model referencing them is gone
+	textures.clear();
     descriptorSetLayoutUbo.reset();
 	descriptorSetLayoutImage.reset();
 	descriptorPool.reset();
@@ -722,7 +769,10 @@ vkglTF::Model::~Model()
 
 void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale)
 {
-	vkglTF::Node *newNode = new Node{};
+	vkglTF::Node *newNode = nodeStorage.create();
+	if (nodeIndex < nodesByIndex.size()) {
+		nodesByIndex[nodeIndex] = newNode;
+	}
 	newNode->index = nodeIndex;
 	newNode->parent = parent;
 	newNode->name = node.name;
@@ -762,8 +812,17 @@ void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, u
 	// Node contains mesh data
 	if (node.mesh > -1) {
 		const tinygltf::Mesh mesh = model.meshes[node.mesh];
-		Mesh *newMesh = new Mesh(device, newNode->matrix);
+		Mesh *newMesh = meshStorage.create(device, newNode->matrix);
 		newMesh->name = mesh.name;
+		// All primitives of a mesh have the same number of morph targets, the node's default weights take precedence over the mesh's
+		if (!mesh.primitives.empty() && !mesh.primitives[0].targets.empty()) {
+			const std::vector<double> &weights = node.weights.empty() ? mesh.weights : node.weights;
+			newMesh->morphWeightOffset = static_cast<uint32_t>(morphTargets.weights.size());
+			newMesh->morphTargetCount = static_cast<uint32_t>(mesh.primitives[0].targets.size());
+			for (uint32_t i = 0; i < newMesh->morphTargetCount; i++) {
+				morphTargets.weights.push_back(i < weights.size() ? static_cast<float>(weights[i]) : 0.0f);
+			}
+		}
 		for (size_t j = 0; j < mesh.primitives.size(); j++) {
 			const tinygltf::Primitive &primitive = mesh.primitives[j];
 			if (primitive.indices < 0) {
@@ -905,10 +964,11 @@ void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, u
 					return;
 				}
 			}
-			Primitive *newPrimitive = new Primitive(indexStart, indexCount, primitive.material > -1 ? materials[primitive.material] : materials.back());
+			Primitive *newPrimitive = primitiveStorage.create(indexStart, indexCount, primitive.material > -1 ? materials[primitive.material] : materials.back());
 			newPrimitive->firstVertex = vertexStart;
 			newPrimitive->vertexCount = vertexCount;
 			newPrimitive->setDimensions(posMin, posMax);
+			loadMorphTargets(newMesh, newPrimitive, primitive, model);
 			newMesh->primitives.push_back(newPrimitive);
 		}
 		newNode->mesh = newMesh;
@@ -921,10 +981,150 @@ void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, u
 	linearNodes.push_back(newNode);
 }
 
+/**
+* Append the non-zero morph target deltas of a primitive to morphTargets
+*
+* Deltas are grouped by vertex, so the skinning shader blends each vertex without writes from other invocations.
+* Targets a vertex doesn't move in take up no space at all
+*
+* @param mesh Mesh the primitive belongs to, its morph target weights must have been set up
+* @param primitive Primitive to load the targets of
+* @param source glTF primitive
+* @param model glTF model
+*/
+void vkglTF::Model::loadMorphTargets(Mesh *mesh, Primitive *primitive, const tinygltf::Primitive &source, const tinygltf::Model &model)
+{
+	const uint32_t targetCount = std::min(static_cast<uint32_t>(source.targets.size()), mesh->morphTargetCount);
+	if (targetCount == 0 || primitive->vertexCount == 0) {
+		return;
+	}
+
+	// Position, normal and tangent deltas of each target, empty if the target doesn't have the attribute
+	const std::array<const char *, 3> attributes = { "POSITION", "NORMAL", "TANGENT" };
+	std::vector<std::array<std::vector<glm::vec3>, 3>> targets(targetCount);
+	for (uint32_t t = 0; t < targetCount; t++) {
+		for (size_t a = 0; a < attributes.size(); a++) {
+			auto attribute = source.targets[t].find(attributes[a]);
+			if (attribute == source.targets[t].end()) {
+				continue;
+			}
+			if (!readVec3Accessor(model, attribute->second, targets[t][a])) {
+				std::cout << "Morph target " << attributes[a] << " component type " << model.accessors[attribute->second].componentType << " not supported, skipping attribute" << std::endl;
+				continue;
+			}
+			if (targets[t][a].size() != primitive->vertexCount) {
+				std::cout << "Morph target " << attributes[a] << " count doesn't match the primitive's vertex count, skipping attribute" << std::endl;
+				targets[t][a].clear();
+			}
+		}
+	}
+
+	const uint32_t morphOffset = static_cast<uint32_t>(morphTargets.offsets.size());
+	const size_t firstDelta = morphTargets.deltas.size();
+	auto get = [&](uint32_t t, size_t a, uint32_t v) {
+		return targets[t][a].empty() ? glm::vec3(0.0f) : targets[t][a][v];
+	};
+	for (uint32_t v = 0; v < primitive->vertexCount; v++) {
+		morphTargets.offsets.push_back(static_cast<uint32_t>(morphTargets.deltas.size()));
+		for (uint32_t t = 0; t < targetCount; t++) {
+			MorphTargets::Delta delta{ mesh->morphWeightOffset + t, get(t, 0, v), get(t, 1, v), get(t, 2, v) };
+			if (delta.position != glm::vec3(0.0f) || delta.normal != glm::vec3(0.0f) || delta.tangent != glm::vec3(0.0f)) {
+				morphTargets.deltas.push_back(delta);
+			}
+		}
+	}
+	morphTargets.offsets.push_back(static_cast<uint32_t>(morphTargets.deltas.size()));
+
+	if (morphTargets.deltas.size() == firstDelta) {
+		morphTargets.offsets.resize(morphOffset);
+		return;
+	}
+	primitive->morphOffset = morphOffset;
+}
+
+/**
+* Find the range each morph target weight can take, from the default weights and the keys of all weights animations
+*
+* Always includes [0, 1], the range applications usually set weights in themselves. Cubic spline segments are widened by
+* how far their tangents can move them past their keys
+*/
+void vkglTF::Model::getMorphWeightRanges()
+{
+	morphTargets.weightMin.resize(morphTargets.weights.size());
+	morphTargets.weightMax.resize(morphTargets.weights.size());
+	for (size_t i = 0; i < morphTargets.weights.size(); i++) {
+		morphTargets.weightMin[i] = std::min(morphTargets.weights[i], 0.0f);
+		morphTargets.weightMax[i] = std::max(morphTargets.weights[i], 1.0f);
+	}
+	for (const Animation &animation : animations) {
+		for (const AnimationChannel &channel : animation.channels) {
+			if (channel.path != AnimationChannel::PathType::WEIGHTS) {
+				continue;
+			}
+			const AnimationSampler &sampler = animation.samplers[channel.samplerIndex];
+			const std::vector<float> &times = animation.inputs[sampler.input].times;
+			const Mesh *mesh = channel.node->mesh;
+			const uint32_t count = mesh->morphTargetCount;
+			// Keys are stored as described in AnimationSampler::sampleWeights()
+			const size_t keySize = sampler.interpolation == AnimationSampler::CUBICSPLINE ? 3 * count : count;
+			const size_t valueOffset = sampler.interpolation == AnimationSampler::CUBICSPLINE ? count : 0;
+			const size_t keyCount = std::min(sampler.weights.size() / keySize, times.size());
+			for (size_t key = 0; key < keyCount; key++) {
+				for (uint32_t i = 0; i < count; i++) {
+					float low = sampler.weights[key * keySize + valueOffset + i];
+					float high = low;
+					if (sampler.interpolation == AnimationSampler::CUBICSPLINE && key + 1 < keyCount) {
+						// The tangent terms of the Hermite basis add at most 4/27 of each scaled tangent
+						const float next = sampler.weights[(key + 1) * keySize + valueOffset + i];
+						const float outTangent = sampler.weights[key * keySize + 2 * count + i];
+						const float inTangent = sampler.weights[(key + 1) * keySize + i];
+						const float overshoot = 4.0f / 27.0f * (std::abs(outTangent) + std::abs(inTangent)) * (times[key + 1] - times[key]);
+						low = std::min(low, next) - overshoot;
+						high = std::max(high, next) + overshoot;
+					}
+					float &weightMin = morphTargets.weightMin[mesh->morphWeightOffset + i];
+					float &weightMax = morphTargets.weightMax[mesh->morphWeightOffset + i];
+					weightMin = std::min(weightMin, low);
+					weightMax = std::max(weightMax, high);
+				}
+			}
+		}
+	}
+}
+
+/**
+* Grow the bounds of primitives with morph targets by how far the targets can move their vertices
+*
+* @param vertexBuffer Vertices of all primitives
+*/
+void vkglTF::Model::getMorphBounds(const std::vector<Vertex> &vertexBuffer)
+{
+	for (Node *node : linearNodes) {
+		if (!node->mesh) {
+			continue;
+		}
+		for (Primitive *primitive : node->mesh->primitives) {
+			if (primitive->morphOffset == Primitive::NO_MORPH_TARGETS) {
+				continue;
+			}
+			glm::vec3 posMin = primitive->dimensions.min;
+			glm::vec3 posMax = primitive->dimensions.max;
+			for (uint32_t v = 0; v < primitive->vertexCount; v++) {
+				glm::vec3 min, max;
+				getMorphExtents(morphTargets, morphTargets.offsets[primitive->morphOffset + v], morphTargets.offsets[primitive->morphOffset + v + 1], min, max);
+				const glm::vec3 pos = vertexBuffer[primitive->firstVertex + v].pos;
+				posMin = glm::min(posMin, pos + min);
+				posMax = glm::max(posMax, pos + max);
+			}
+			primitive->setDimensions(posMin, posMax);
+		}
+	}
+}
+
 void vkglTF::Model::loadSkins(tinygltf::Model &gltfModel)
 {
 	for (tinygltf::Skin &source : gltfModel.skins) {
-		Skin *newSkin = new Skin{};
+		Skin *newSkin = skinStorage.create();
 		newSkin->name = source.name;
 				
 		// Find skeleton root node
@@ -936,7 +1136,7 @@ void vkglTF::Model::loadSkins(tinygltf::Model &gltfModel)
 		for (int jointIndex : source.joints) {
 			Node* node = nodeFromIndex(jointIndex);
 			if (node) {
-				newSkin->joints.push_back(nodeFromIndex(jointIndex));
+				newSkin->joints.push_back(node);
 			}
 		}
 
@@ -956,8 +1156,32 @@ void vkglTF::Model::loadSkins(tinygltf::Model &gltfModel)
 void vkglTF::Model::loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device, vk::Queue transferQueue)
 {
 	for (tinygltf::Image &image : gltfModel.images) {
-		vkglTF::Texture texture;
-		texture.fromglTfImage(image, path, device, transferQueue);
+		std::shared_ptr<vkglTF::Texture> texture;
+		// Key on the decoded pixels for embedded/stb images, and on the file contents for external ktx files
+		vks::ContentHash key;
+		bool keyed = false;
+		if (textureCache) {
+			if (image.image.empty()) {
+				keyed = vks::fileContentHash(path + "/" + image.uri, key);
+			} else {
+				const int32_t dimensions[] = { image.width, image.height, image.component };
+				vks::ContentHasher hasher;
+				hasher.update(dimensions, sizeof(dimensions));
+				hasher.update(image.image.data(), image.image.size());
+				key = hasher.finish();
+				keyed = true;
+			}
+			if (keyed) {
+				texture = textureCache->find(key);
+			}
+		}
+		if (!texture) {
+			texture = std::make_shared<vkglTF::Texture>();
+			texture->fromglTfImage(image, path, device, transferQueue);
+			if (keyed) {
+				textureCache->insert(key, texture, device->logicalDevice->getImageMemoryRequirements(*texture->image).size);
+			}
+		}
 		textures.push_back(std::move(texture));
 	}
 	// Create an empty texture to be used for empty material images
@@ -1024,6 +1248,11 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 		}
 
 		// Samplers
+		// Input accessor index -> index into animation.inputs
+		std::map<int, uint32_t> inputIndices;
+		// Uncompressed outputs of each sampler, and whether they are rotations
+		std::vector<std::vector<glm::vec4>> outputs;
+		std::vector<uint8_t> rotations;
 		for (auto &samp : anim.samplers) {
 			vkglTF::AnimationSampler sampler{};
 
@@ -1037,8 +1266,16 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 				sampler.interpolation = AnimationSampler::InterpolationType::CUBICSPLINE;
 			}
 
-			// Read sampler input time values
-			{
+			// Read sampler input time values, channels often share them (e.g. all bones of a mocap clip)
+			auto input = inputIndices.find(samp.input);
+			if (input != inputIndices.end()) {
+				sampler.input = input->second;
+			} else {
+				sampler.input = static_cast<uint32_t>(animation.inputs.size());
+				inputIndices[samp.input] = sampler.input;
+				animation.inputs.emplace_back();
+				std::vector<float> &times = animation.inputs.back().times;
+
 				const tinygltf::Accessor &accessor = gltfModel.accessors[samp.input];
 				const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
 				const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
@@ -1048,21 +1285,23 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 				float *buf = new float[accessor.count];
 				std::copy_n(reinterpret_cast<const std::byte*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]), accessor.count * sizeof(float), reinterpret_cast<std::byte*>(buf));
 				for (size_t index = 0; index < accessor.count; index++) {
-					sampler.inputs.push_back(buf[index]);
+					times.push_back(buf[index]);
 				}
                 delete[] buf;
-				for (auto input : sampler.inputs) {
-					if (input < animation.start) {
-						animation.start = input;
+				for (auto time : times) {
+					if (time < animation.start) {
+						animation.start = time;
 					};
-					if (input > animation.end) {
-						animation.end = input;
+					if (time > animation.end) {
+						animation.end = time;
 					}
 				}
 			}
 
-			// Read sampler output T/R/S values 
+			// Read sampler output T/R/S values, or morph target weights
 			{
+				std::vector<glm::vec4> &values = outputs.emplace_back();
+				rotations.push_back(0);
 				const tinygltf::Accessor &accessor = gltfModel.accessors[samp.output];
 				const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
 				const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
@@ -1074,16 +1313,25 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 					glm::vec3 *buf = new glm::vec3[accessor.count];
 					std::copy_n(reinterpret_cast<const std::byte*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]), accessor.count * sizeof(glm::vec3), reinterpret_cast<std::byte*>(buf));
 					for (size_t index = 0; index < accessor.count; index++) {
-						sampler.outputsVec4.push_back(glm::vec4(buf[index], 0.0f));
+						values.push_back(glm::vec4(buf[index], 0.0f));
 					}
+					delete[] buf;
 					break;
 				}
 				case TINYGLTF_TYPE_VEC4: {
 					glm::vec4 *buf = new glm::vec4[accessor.count];
 					std::copy_n(reinterpret_cast<const std::byte*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]), accessor.count * sizeof(glm::vec4), reinterpret_cast<std::byte*>(buf));
 					for (size_t index = 0; index < accessor.count; index++) {
-						sampler.outputsVec4.push_back(buf[index]);
+						values.push_back(buf[index]);
 					}
+					delete[] buf;
+					rotations.back() = 1;
+					break;
+				}
+				case TINYGLTF_TYPE_SCALAR: {
+					// Weights of all targets per key, few enough to be kept as they are
+					sampler.weights.resize(accessor.count);
+					std::copy_n(reinterpret_cast<const std::byte*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]), accessor.count * sizeof(float), reinterpret_cast<std::byte*>(sampler.weights.data()));
 					break;
 				}
 				default: {
@@ -1110,22 +1358,118 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 				channel.path = AnimationChannel::PathType::SCALE;
 			}
 			if (source.target_path == "weights") {
-				std::cout << "weights not yet supported, skipping channel" << std::endl;
-				continue;
+				channel.path = AnimationChannel::PathType::WEIGHTS;
 			}
 			channel.samplerIndex = source.sampler;
 			channel.node = nodeFromIndex(source.target_node);
 			if (!channel.node) {
 				continue;
 			}
+			if (channel.path == AnimationChannel::PathType::WEIGHTS && (!channel.node->mesh || channel.node->mesh->morphTargetCount == 0)) {
+				continue;
+			}
 
 			animation.channels.push_back(channel);
 		}
 
+		compressAnimation(animation, outputs, rotations);
 		animations.push_back(animation);
 	}
 }
 
+/**
+* Drop keys that interpolating their neighbours reproduces within the tolerances, then encode the outputs of all samplers
+*
+* Keys are dropped from each input as a whole (so inputs stay shared), only if that works for all samplers reading it
+*
+* @param animation Animation whose samplers to encode
+* @param outputs Uncompressed outputs of each sampler, consumed by this function
+* @param rotations Whether each sampler's outputs are rotations
+*/
+void vkglTF::Model::compressAnimation(Animation &animation, std::vector<std::vector<glm::vec4>> &outputs, const std::vector<uint8_t> &rotations)
+{
+	// Longest run of dropped keys, bounds the cost of checking a run against the segment replacing it
+	constexpr uint32_t maxDroppedRun = 256;
+
+	auto error = [](const glm::vec4 &a, const glm::vec4 &b, bool rotation) {
+		if (rotation) {
+			// Rotation angle between the quaternions, from their chord length as acos(dot) is too imprecise for small angles
+			const float chord = std::min(glm::length(a - b), glm::length(a + b));
+			return 4.0f * std::asin(std::min(chord * 0.5f, 1.0f));
+		}
+		return glm::length(glm::vec3(a) - glm::vec3(b));
+	};
+
+	for (uint32_t inputIndex = 0; inputIndex < animation.inputs.size(); inputIndex++) {
+		std::vector<float> &times = animation.inputs[inputIndex].times;
+		std::vector<uint32_t> samplers;
+		bool reducible = times.size() > 2;
+		for (uint32_t i = 0; i < animation.samplers.size(); i++) {
+			if (animation.samplers[i].input != inputIndex) {
+				continue;
+			}
+			samplers.push_back(i);
+			const auto interpolation = animation.samplers[i].interpolation;
+			// Cubic spline tangents are relative to the key spacing, so those keys stay, as do the keys of morph target weights
+			reducible &= interpolation != AnimationSampler::CUBICSPLINE && outputs[i].size() == times.size();
+			reducible &= interpolation == animation.samplers[samplers.front()].interpolation;
+		}
+		if (!reducible || samplers.empty()) {
+			continue;
+		}
+		const bool step = animation.samplers[samplers.front()].interpolation == AnimationSampler::STEP;
+
+		std::vector<uint32_t> kept = { 0 };
+		for (uint32_t i = 1; i + 1 < times.size(); i++) {
+			// Check whether the segment from the last kept key to the next key reproduces all keys in between
+			const uint32_t a = kept.back();
+			const uint32_t b = i + 1;
+			bool drop = i - a < maxDroppedRun;
+			for (uint32_t s = 0; drop && s < samplers.size(); s++) {
+				const std::vector<glm::vec4> &values = outputs[samplers[s]];
+				const bool rotation = rotations[samplers[s]];
+				const float tolerance = rotation ? animationCompression.rotationTolerance : animationCompression.valueTolerance;
+				for (uint32_t j = a + 1; drop && j <= i; j++) {
+					glm::vec4 approximation = values[a];
+					if (!step) {
+						const float u = (times[j] - times[a]) / (times[b] - times[a]);
+						if (rotation) {
+							const glm::quat q = glm::normalize(glm::slerp(glm::quat(values[a].w, values[a].x, values[a].y, values[a].z), glm::quat(values[b].w, values[b].x, values[b].y, values[b].z), u));
+							approximation = glm::vec4(q.x, q.y, q.z, q.w);
+						} else {
+							approximation = glm::mix(values[a], values[b], u);
+						}
+					}
+					drop = error(approximation, values[j], rotation) <= tolerance;
+				}
+			}
+			if (!drop) {
+				kept.push_back(i);
+			}
+		}
+		kept.push_back(static_cast<uint32_t>(times.size()) - 1);
+
+		if (kept.size() < times.size()) {
+			for (uint32_t i = 0; i < kept.size(); i++) {
+				times[i] = times[kept[i]];
+				for (uint32_t s : samplers) {
+					outputs[s][i] = outputs[s][kept[i]];
+				}
+			}
+			times.resize(kept.size());
+			times.shrink_to_fit();
+			for (uint32_t s : samplers) {
+				outputs[s].resize(kept.size());
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < animation.samplers.size(); i++) {
+		animation.samplers[i].encode(outputs[i], rotations[i]);
+		outputs[i] = {};
+	}
+}
+
 void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device, vk::Queue transferQueue, uint32_t fileLoadingFlags, float scale)
 {
 	tinygltf::Model gltfModel;
@@ -1152,6 +1496,7 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 			loadImages(gltfModel, device, transferQueue);
 		}
 		loadMaterials(gltfModel);
+		nodesByIndex.assign(gltfModel.nodes.size(), nullptr);
 		const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
 		for (size_t i = 0; i < scene.nodes.size(); i++) {
 			const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
@@ -1160,18 +1505,22 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 		if (gltfModel.animations.size() > 0) {
 			loadAnimations(gltfModel);
 		}
+		// The weight ranges depend on the animations, so the bounds of morphed primitives are only known once those are loaded
+		getMorphWeightRanges();
+		getMorphBounds(vertexBuffer);
 		loadSkins(gltfModel);
 
+		// Assign skins
 		for (auto node : linearNodes) {
-			// Assign skins
 			if (node->skinIndex > -1) {
 				node->skin = skins[node->skinIndex];
 			}
-			// Initial pose
-			if (node->mesh) {
-				node->update();
-			}
 		}
+		// Blocks are sized by the joint count, so the uniform buffer can only be laid out once skins are known
+		prepareUniformBuffer();
+		// Initial pose
+		prepareTransforms();
+		updateTransforms();
 	}
 	else {
 		// TODO: throw
@@ -1205,11 +1554,30 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 							vertex.color = primitive->material.baseColorFactor * vertex.color;
 						}
 					}
+					// Morph target deltas move along with the vertices
+					if (primitive->morphOffset != Primitive::NO_MORPH_TARGETS && (preTransform || flipY)) {
+						const uint32_t first = morphTargets.offsets[primitive->morphOffset];
+						const uint32_t last = morphTargets.offsets[primitive->morphOffset + primitive->vertexCount];
+						for (uint32_t i = first; i < last; i++) {
+							MorphTargets::Delta& delta = morphTargets.deltas[i];
+							if (preTransform) {
+								delta.position = glm::mat3(localMatrix) * delta.position;
+								delta.normal = glm::mat3(localMatrix) * delta.normal;
+							}
+							if (flipY) {
+								delta.position.y *= -1.0f;
+								delta.normal.y *= -1.0f;
+							}
+						}
+					}
 				}
 			}
 		}
 	}
 
+	// After the pre-calculations, so the bounds match the vertices as uploaded
+	getInfluenceBounds(vertexBuffer);
+
 	for (auto extension : gltfModel.extensionsUsed) {
 		if (extension == "KHR_materials_pbrSpecularGlossiness") {
 			std::cout << "Required extension: " << extension;
@@ -1226,7 +1594,7 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 
 	struct StagingBuffer {
 		vk::UniqueBuffer buffer;
-		vk::UniqueDeviceMemory memory;
+		vks::Allocation memory;
 	} vertexStaging, indexStaging;
 
 	// Create staging buffers
@@ -1249,8 +1617,9 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 
 	// Create device local buffers
 	// Vertex buffer
+	// Also the source of ComputeSkinning, which reads it as a storage buffer and copies the unskinned vertices from it
 	VK_CHECK_RESULT(device->createBuffer(
-	    vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlags(static_cast<unsigned int>(memoryPropertyFlags)),
+	    vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlags(static_cast<unsigned int>(memoryPropertyFlags)),
 		vk::MemoryPropertyFlagBits::eDeviceLocal,
 		vertexBufferSize,
 		&vertices.buffer,
@@ -1284,20 +1653,16 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 	getSceneDimensions();
 
 	// Setup descriptors
-	uint32_t uboCount{ 0 };
+	// All meshes share a single dynamic uniform buffer descriptor
+	uint32_t uboCount = uniformBuffer.buffer.buffer ? 1 : 0;
 	uint32_t imageCount{ 0 };
-	for (auto node : linearNodes) {
-		if (node->mesh) {
-			uboCount++;
-		}
-	}
 	for (auto material : materials) {
 		if (material.baseColorTexture != nullptr) {
 			imageCount++;
 		}
 	}
 	std::vector<vk::DescriptorPoolSize> poolSizes = {
-		{ vk::DescriptorType::eUniformBuffer, uboCount },
+		{ vk::DescriptorType::eUniformBufferDynamic, std::max(uboCount, 1u) },
 	};
 	if (imageCount > 0) {
 		if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
@@ -1310,23 +1675,35 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 	vk::DescriptorPoolCreateInfo descriptorPoolCI{};
 	descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	descriptorPoolCI.pPoolSizes = poolSizes.data();
-	descriptorPoolCI.maxSets = uboCount + imageCount;
+	descriptorPoolCI.maxSets = std::max(uboCount + imageCount, 1u);
 	descriptorPool = device->logicalDevice->createDescriptorPoolUnique(descriptorPoolCI);
 
-	// Descriptors for per-node uniform buffers
+	// Descriptor for the per-mesh uniform blocks
 	{
 		// Layout is global, so only create if it hasn't already been created before
 		if (!descriptorSetLayoutUbo) {
 			std::vector<vk::DescriptorSetLayoutBinding> setLayoutBindings = {
-				vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eVertex, 0),
+				vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eUniformBufferDynamic, vk::ShaderStageFlagBits::eVertex, 0),
 			};
 			vk::DescriptorSetLayoutCreateInfo descriptorLayoutCI{};
 			descriptorLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
 			descriptorLayoutCI.pBindings = setLayoutBindings.data();
 			descriptorSetLayoutUbo = device->logicalDevice->createDescriptorSetLayoutUnique(descriptorLayoutCI);
 		}
-		for (auto node : nodes) {
-			prepareNodeDescriptor(node, *descriptorSetLayoutUbo);
+		if (uboCount > 0) {
+			vk::DescriptorSetAllocateInfo descriptorSetAllocInfo{};
+			descriptorSetAllocInfo.descriptorPool = *descriptorPool;
+			descriptorSetAllocInfo.pSetLayouts = &*descriptorSetLayoutUbo;
+			descriptorSetAllocInfo.descriptorSetCount = 1;
+			uniformBuffer.descriptorSet = device->logicalDevice->allocateDescriptorSets(descriptorSetAllocInfo)[0];
+
+			vk::WriteDescriptorSet writeDescriptorSet{};
+			writeDescriptorSet.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+			writeDescriptorSet.descriptorCount = 1;
+			writeDescriptorSet.dstSet = uniformBuffer.descriptorSet;
+			writeDescriptorSet.dstBinding = 0;
+			writeDescriptorSet.pBufferInfo = &uniformBuffer.buffer.descriptor;
+			device->logicalDevice->updateDescriptorSets({writeDescriptorSet}, {});
 		}
 	}
 
@@ -1362,9 +1739,12 @@ void vkglTF::Model::bindBuffers(vk::CommandBuffer commandBuffer)
 	buffersBound = true;
 }
 
-void vkglTF::Model::drawNode(Node *node, vk::CommandBuffer commandBuffer, uint32_t renderFlags, vk::PipelineLayout pipelineLayout, uint32_t bindImageSet)
+void vkglTF::Model::drawNode(Node *node, vk::CommandBuffer commandBuffer, uint32_t renderFlags, vk::PipelineLayout pipelineLayout, uint32_t bindImageSet, uint32_t bindMeshSet)
 {
 	if (node->mesh) {
+		if (renderFlags & RenderFlags::BindMeshUniforms) {
+			commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, bindMeshSet, {uniformBuffer.descriptorSet}, {node->mesh->uniformOffset});
+		}
 		for (Primitive* primitive : node->mesh->primitives) {
 			bool skip = false;
 			const vkglTF::Material& material = primitive->material;
@@ -1381,16 +1761,16 @@ void vkglTF::Model::drawNode(Node *node, vk::CommandBuffer commandBuffer, uint32
 				if (renderFlags & RenderFlags::BindImages) {
 					commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, bindImageSet, {material.descriptorSet}, {});
 				}
-				commandBuffer.drawIndexed(primitive->indexCount, 1, primitive->indexCount, 0, 0);
+				commandBuffer.drawIndexed(primitive->indexCount, 1, primitive->firstIndex, 0, 0);
 			}
 		}
 	}
 	for (auto& child : node->children) {
-		drawNode(child, commandBuffer, renderFlags);
+		drawNode(child, commandBuffer, renderFlags, pipelineLayout, bindImageSet, bindMeshSet);
 	}
 }
 
-void vkglTF::Model::draw(vk::CommandBuffer commandBuffer, uint32_t renderFlags, vk::PipelineLayout pipelineLayout, uint32_t bindImageSet)
+void vkglTF::Model::draw(vk::CommandBuffer commandBuffer, uint32_t renderFlags, vk::PipelineLayout pipelineLayout, uint32_t bindImageSet, uint32_t bindMeshSet)
 {
 	if (!buffersBound) {
 		const std::array<vk::DeviceSize, 1> offsets = {0};
@@ -1398,7 +1778,7 @@ void vkglTF::Model::draw(vk::CommandBuffer commandBuffer, uint32_t renderFlags,
 		commandBuffer.bindIndexBuffer(*indices.buffer, 0, vk::IndexType::eUint32);
 	}
 	for (auto& node : nodes) {
-		drawNode(node, commandBuffer, renderFlags, pipelineLayout, bindImageSet);
+		drawNode(node, commandBuffer, renderFlags, pipelineLayout, bindImageSet, bindMeshSet);
 	}
 }
 
@@ -1406,14 +1786,14 @@ void vkglTF::Model::getNodeDimensions(Node *node, glm::vec3 &min, glm::vec3 &max
 {
 	if (node->mesh) {
 		for (Primitive *primitive : node->mesh->primitives) {
-			glm::vec4 locMin = glm::vec4(primitive->dimensions.min, 1.0f) * node->getMatrix();
-			glm::vec4 locMax = glm::vec4(primitive->dimensions.max, 1.0f) * node->getMatrix();
-			if (locMin.x < min.x) { min.x = locMin.x; }
-			if (locMin.y < min.y) { min.y = locMin.y; }
-			if (locMin.z < min.z) { min.z = locMin.z; }
-			if (locMax.x > max.x) { max.x = locMax.x; }
-			if (locMax.y > max.y) { max.y = locMax.y; }
-			if (locMax.z > max.z) { max.z = locMax.z; }
+			if (primitive->dimensions.min.x > primitive->dimensions.max.x) {
+				continue;
+			}
+			// Transform all corners of the box (not just min and max) with the cached world matrix
+			vks::transforms::Aabb bounds{ primitive->dimensions.min, primitive->dimensions.max };
+			vks::transforms::transformAabbs(&bounds, &node->worldMatrix, nullptr, &bounds, 1);
+			min = glm::min(min, bounds.min);
+			max = glm::max(max, bounds.max);
 		}
 	}
 	for (auto child : node->children) {
@@ -1433,6 +1813,214 @@ void vkglTF::Model::getSceneDimensions()
 	dimensions.radius = glm::distance(dimensions.min, dimensions.max) / 2.0f;
 }
 
+/**
+* Quantize output values, rotations of linear and step samplers are encoded as smallest three, everything else within its range
+*
+* @param values Output values (x, y, z, w for quaternions)
+* @param rotation Whether the values are rotations
+*/
+void vkglTF::AnimationSampler::encode(const std::vector<glm::vec4> &values, bool rotation)
+{
+	this->rotation = rotation;
+	// Cubic spline tangents aren't unit quaternions
+	encoding = !rotation ? RANGE3 : (interpolation == CUBICSPLINE ? RANGE4 : SMALLEST_THREE);
+	const uint32_t components = encoding == RANGE4 ? 4 : 3;
+	outputs.assign(values.size() * components, 0);
+
+	if (encoding == SMALLEST_THREE) {
+		for (size_t i = 0; i < values.size(); i++) {
+			glm::vec4 q = glm::normalize(values[i]);
+			uint32_t largest = 0;
+			for (uint32_t c = 1; c < 4; c++) {
+				if (std::abs(q[c]) > std::abs(q[largest])) {
+					largest = c;
+				}
+			}
+			// q and -q are the same rotation, so the largest component can always be positive
+			if (q[largest] < 0.0f) {
+				q = -q;
+			}
+			uint16_t *words = &outputs[i * 3];
+			for (uint32_t c = 0, word = 0; c < 4; c++) {
+				if (c == largest) {
+					continue;
+				}
+				// The smaller components are within [-1 / sqrt(2), 1 / sqrt(2)]
+				const float normalized = glm::clamp(q[c] * glm::root_two<float>() * 0.5f + 0.5f, 0.0f, 1.0f);
+				words[word++] = static_cast<uint16_t>(normalized * 32767.0f + 0.5f);
+			}
+			words[0] |= static_cast<uint16_t>((largest >> 1) << 15);
+			words[1] |= static_cast<uint16_t>((largest & 1) << 15);
+		}
+		return;
+	}
+
+	glm::vec4 max(-FLT_MAX);
+	rangeMin = glm::vec4(FLT_MAX);
+	for (const auto &value : values) {
+		rangeMin = glm::min(rangeMin, value);
+		max = glm::max(max, value);
+	}
+	if (values.empty()) {
+		rangeMin = max = glm::vec4(0.0f);
+	}
+	rangeExtent = max - rangeMin;
+	for (size_t i = 0; i < values.size(); i++) {
+		for (uint32_t c = 0; c < components; c++) {
+			const float normalized = rangeExtent[c] > 0.0f ? (values[i][c] - rangeMin[c]) / rangeExtent[c] : 0.0f;
+			outputs[i * components + c] = static_cast<uint16_t>(glm::clamp(normalized, 0.0f, 1.0f) * 65535.0f + 0.5f);
+		}
+	}
+}
+
+/** @brief Decode a single output value (a tangent or value of a cubic spline key) */
+glm::vec4 vkglTF::AnimationSampler::decode(uint32_t value) const
+{
+	if (encoding == SMALLEST_THREE) {
+		const uint16_t *words = &outputs[value * 3];
+		const uint32_t largest = ((words[0] >> 15) << 1) | (words[1] >> 15);
+		glm::vec4 q(0.0f);
+		for (uint32_t c = 0, word = 0; c < 4; c++) {
+			if (c == largest) {
+				continue;
+			}
+			q[c] = ((words[word++] & 0x7fff) / 32767.0f * 2.0f - 1.0f) * glm::one_over_root_two<float>();
+		}
+		q[largest] = std::sqrt(std::max(0.0f, 1.0f - glm::dot(q, q)));
+		return q;
+	}
+
+	const uint32_t components = encoding == RANGE4 ? 4 : 3;
+	const uint16_t *words = &outputs[value * components];
+	glm::vec4 result(0.0f);
+	for (uint32_t c = 0; c < components; c++) {
+		result[c] = rangeMin[c] + rangeExtent[c] * (words[c] / 65535.0f);
+	}
+	return result;
+}
+
+/** @brief Number of keys stored in the sampler */
+uint32_t vkglTF::AnimationSampler::keyCount() const
+{
+	const uint32_t values = static_cast<uint32_t>(outputs.size() / (encoding == RANGE4 ? 4 : 3));
+	return interpolation == CUBICSPLINE ? values / 3 : values;
+}
+
+/**
+* Interpolate between two keys
+*
+* @param key Index of the first key
+* @param factor Interpolation factor towards the next key
+* @param duration Time between the two keys, scales cubic spline tangents
+*
+* @return Interpolated value, a normalized quaternion (x, y, z, w) for rotations
+*/
+glm::vec4 vkglTF::AnimationSampler::sample(uint32_t key, float factor, float duration) const
+{
+	switch (interpolation) {
+	case STEP:
+		return decode(factor >= 1.0f ? key + 1 : key);
+	case CUBICSPLINE: {
+		// Hermite spline as specified by glTF, keys are stored as (in tangent, value, out tangent)
+		const float t = factor;
+		const float t2 = t * t;
+		const float t3 = t2 * t;
+		const glm::vec4 p0 = decode(key * 3 + 1);
+		const glm::vec4 m0 = decode(key * 3 + 2) * duration;
+		const glm::vec4 p1 = decode((key + 1) * 3 + 1);
+		const glm::vec4 m1 = decode((key + 1) * 3) * duration;
+		const glm::vec4 result = (2.0f * t3 - 3.0f * t2 + 1.0f) * p0 + (t3 - 2.0f * t2 + t) * m0 + (-2.0f * t3 + 3.0f * t2) * p1 + (t3 - t2) * m1;
+		return rotation ? glm::normalize(result) : result;
+	}
+	default: {
+		const glm::vec4 a = decode(key);
+		const glm::vec4 b = decode(key + 1);
+		if (rotation) {
+			const glm::quat q = glm::normalize(glm::slerp(glm::quat(a.w, a.x, a.y, a.z), glm::quat(b.w, b.x, b.y, b.z), factor));
+			return glm::vec4(q.x, q.y, q.z, q.w);
+		}
+		return glm::mix(a, b, factor);
+	}
+	}
+}
+
+/**
+* Interpolate the morph target weights between two keys
+*
+* @param key Index of the first key
+* @param factor Interpolation factor towards the next key
+* @param duration Time between the two keys, scales cubic spline tangents
+* @param dst Receives the weights of all targets
+* @param count Number of targets
+*/
+void vkglTF::AnimationSampler::sampleWeights(uint32_t key, float factor, float duration, float *dst, uint32_t count) const
+{
+	switch (interpolation) {
+	case STEP:
+		std::copy_n(&weights[(factor >= 1.0f ? key + 1 : key) * count], count, dst);
+		break;
+	case CUBICSPLINE: {
+		// Keys are stored as the in tangents of all targets, then their values and then their out tangents
+		const float t = factor;
+		const float t2 = t * t;
+		const float t3 = t2 * t;
+		const float *k0 = &weights[key * 3 * count];
+		const float *k1 = &weights[(key + 1) * 3 * count];
+		for (uint32_t i = 0; i < count; i++) {
+			const float p0 = k0[count + i];
+			const float m0 = k0[2 * count + i] * duration;
+			const float p1 = k1[count + i];
+			const float m1 = k1[i] * duration;
+			dst[i] = (2.0f * t3 - 3.0f * t2 + 1.0f) * p0 + (t3 - 2.0f * t2 + t) * m0 + (-2.0f * t3 + 3.0f * t2) * p1 + (t3 - t2) * m1;
+		}
+		break;
+	}
+	default: {
+		const float *a = &weights[key * count];
+		const float *b = &weights[(key + 1) * count];
+		for (uint32_t i = 0; i < count; i++) {
+			dst[i] = glm::mix(a[i], b[i], factor);
+		}
+		break;
+	}
+	}
+}
+
+/**
+* Find the keyframe interval containing a point in time
+*
+* The cached interval and the one after it are tried first, so monotonic playback doesn't search at all. Seeks fall back to a binary search
+*
+* @param time Point in time to find
+*
+* @return False if time is outside of the keyframes, otherwise cursor and factor hold the interval and interpolation factor
+*/
+bool vkglTF::AnimationInput::seek(float time)
+{
+	if (times.size() < 2 || time < times.front() || time > times.back()) {
+		return false;
+	}
+	const uint32_t last = static_cast<uint32_t>(times.size()) - 2;
+	uint32_t i = std::min(cursor, last);
+	if (time < times[i] || time > times[i + 1]) {
+		if (i < last && time >= times[i + 1] && time <= times[i + 2]) {
+			i++;
+		} else {
+			i = static_cast<uint32_t>(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+			i = std::min(i > 0 ? i - 1 : 0, last);
+		}
+	}
+	cursor = i;
+	const float duration = times[i + 1] - times[i];
+	factor = duration > 0.0f ? std::max(0.0f, time - times[i]) / duration : 1.0f;
+	return true;
+}
+
+/**
+* Apply an animation at a point in time to the nodes it targets and update the affected subtrees
+*
+* Each distinct input of the animation is only searched once per call, all channels sampled from it reuse the interval
+*/
 void vkglTF::Model::updateAnimation(uint32_t index, float time)
 {
 	if (index > static_cast<uint32_t>(animations.size()) - 1) {
@@ -1441,101 +2029,239 @@ void vkglTF::Model::updateAnimation(uint32_t index, float time)
 	}
 	Animation &animation = animations[index];
 
+	// Interval lookup per input, 0 if the time is outside of its keyframes
+	std::vector<uint8_t> active(animation.inputs.size());
+	for (size_t i = 0; i < animation.inputs.size(); i++) {
+		active[i] = animation.inputs[i].seek(time);
+	}
+
 	bool updated = false;
 	for (auto& channel : animation.channels) {
 		vkglTF::AnimationSampler &sampler = animation.samplers[channel.samplerIndex];
-		if (sampler.inputs.size() > sampler.outputsVec4.size()) {
+		const vkglTF::AnimationInput &input = animation.inputs[sampler.input];
+		if (!active[sampler.input]) {
 			continue;
 		}
-
-		for (auto i = 0; i < sampler.inputs.size() - 1; i++) {
-			if ((time >= sampler.inputs[i]) && (time <= sampler.inputs[i + 1])) {
-				float u = std::max(0.0f, time - sampler.inputs[i]) / (sampler.inputs[i + 1] - sampler.inputs[i]);
-				if (u <= 1.0f) {
-					switch (channel.path) {
-					case vkglTF::AnimationChannel::PathType::TRANSLATION: {
-						glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-						channel.node->translation = glm::vec3(trans);
-						break;
-					}
-					case vkglTF::AnimationChannel::PathType::SCALE: {
-						glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-						channel.node->scale = glm::vec3(trans);
-						break;
-					}
-					case vkglTF::AnimationChannel::PathType::ROTATION: {
-						glm::quat q1;
-						q1.x = sampler.outputsVec4[i].x;
-						q1.y = sampler.outputsVec4[i].y;
-						q1.z = sampler.outputsVec4[i].z;
-						q1.w = sampler.outputsVec4[i].w;
-						glm::quat q2;
-						q2.x = sampler.outputsVec4[i + 1].x;
-						q2.y = sampler.outputsVec4[i + 1].y;
-						q2.z = sampler.outputsVec4[i + 1].z;
-						q2.w = sampler.outputsVec4[i + 1].w;
-						channel.node->rotation = glm::normalize(glm::slerp(q1, q2, u));
-						break;
-					}
-					}
-					updated = true;
-				}
+		const uint32_t i = input.cursor;
+		const float duration = input.times[i + 1] - input.times[i];
+
+		// Weights only affect the vertices, which ComputeSkinning blends from morphTargets.weights
+		if (channel.path == vkglTF::AnimationChannel::PathType::WEIGHTS) {
+			const Mesh *mesh = channel.node->mesh;
+			const size_t valuesPerKey = sampler.interpolation == vkglTF::AnimationSampler::CUBICSPLINE ? 3 : 1;
+			if (sampler.weights.size() == input.times.size() * valuesPerKey * mesh->morphTargetCount) {
+				sampler.sampleWeights(i, input.factor, duration, &morphTargets.weights[mesh->morphWeightOffset], mesh->morphTargetCount);
 			}
+			continue;
+		}
+
+		if (input.times.size() > sampler.keyCount()) {
+			continue;
+		}
+		const glm::vec4 value = sampler.sample(i, input.factor, duration);
+		switch (channel.path) {
+		case vkglTF::AnimationChannel::PathType::TRANSLATION:
+			channel.node->translation = glm::vec3(value);
+			break;
+		case vkglTF::AnimationChannel::PathType::SCALE:
+			channel.node->scale = glm::vec3(value);
+			break;
+		case vkglTF::AnimationChannel::PathType::ROTATION:
+			channel.node->rotation = glm::quat(value.w, value.x, value.y, value.z);
+			break;
 		}
+		markDirty(channel.node);
+		updated = true;
 	}
 	if (updated) {
-		for (auto &node : nodes) {
-			node->update();
-		}
+		updateTransforms();
 	}
 }
 
-/*
-	Helper functions
+/** @brief Flatten the node hierarchy for updateTransforms(), must be called whenever nodes are added or removed */
+void vkglTF::Model::prepareTransforms()
+{
+	transforms.nodes.assign(nodes.begin(), nodes.end());
+	transforms.parents.clear();
+	for (size_t i = 0; i < transforms.nodes.size(); i++) {
+		Node* node = transforms.nodes[i];
+		node->transformIndex = static_cast<uint32_t>(i);
+		transforms.parents.push_back(node->parent ? static_cast<int32_t>(node->parent->transformIndex) : -1);
+		transforms.nodes.insert(transforms.nodes.end(), node->children.begin(), node->children.end());
+	}
+	const size_t count = transforms.nodes.size();
+	transforms.translations.resize(count);
+	transforms.rotations.resize(count);
+	transforms.scales.resize(count);
+	transforms.matrices.resize(count);
+	transforms.packedLocalMatrices.resize(count);
+	transforms.localMatrices.resize(count);
+	transforms.worldMatrices.resize(count);
+	// Everything needs to be computed once
+	transforms.dirty.assign(count, 1);
+}
+
+/** @brief Flag a node whose translation, rotation, scale or matrix changed to be updated (along with its subtree) by the next updateTransforms() */
+void vkglTF::Model::markDirty(Node* node)
+{
+	transforms.dirty[node->transformIndex] = 1;
+}
+
+/**
+* Recompute the world matrices of all dirty nodes and their descendants with the batched transform kernels, then update the
+* uniform blocks of the affected meshes
+*
+* World matrices are computed once per node in a single pass, so meshes and skin joints don't have to walk their parent chain
 */
-vkglTF::Node* vkglTF::Model::findNode(Node *parent, uint32_t index) {
-	Node* nodeFound = nullptr;
-	if (parent->index == index) {
-		return parent;
-	}
-	for (auto& child : parent->children) {
-		nodeFound = findNode(child, index);
-		if (nodeFound) {
-			break;
+void vkglTF::Model::updateTransforms()
+{
+	const size_t count = transforms.nodes.size();
+	// Pack the local transforms of the nodes that changed
+	transforms.dirtyIndices.clear();
+	for (size_t i = 0; i < count; i++) {
+		if (!transforms.dirty[i]) {
+			continue;
+		}
+		const Node* node = transforms.nodes[i];
+		const size_t packed = transforms.dirtyIndices.size();
+		transforms.translations[packed] = node->translation;
+		transforms.rotations[packed] = node->rotation;
+		transforms.scales[packed] = node->scale;
+		transforms.matrices[packed] = node->matrix;
+		transforms.dirtyIndices.push_back(static_cast<uint32_t>(i));
+	}
+	const size_t dirtyCount = transforms.dirtyIndices.size();
+	if (dirtyCount == 0) {
+		return;
+	}
+	// Same as Node::localMatrix()
+	glm::mat4* packedLocalMatrices = transforms.packedLocalMatrices.data();
+	vks::transforms::composeTrs(transforms.translations.data(), transforms.rotations.data(), transforms.scales.data(), packedLocalMatrices, dirtyCount);
+	vks::transforms::multiply(packedLocalMatrices, transforms.matrices.data(), packedLocalMatrices, dirtyCount);
+	for (size_t i = 0; i < dirtyCount; i++) {
+		transforms.localMatrices[transforms.dirtyIndices[i]] = packedLocalMatrices[i];
+	}
+
+	// Propagates the dirty flags down to the descendants, only their world matrices are written
+	vks::transforms::updateHierarchy(transforms.parents.data(), transforms.localMatrices.data(), transforms.worldMatrices.data(), transforms.dirty.data(), count);
+	for (size_t i = 0; i < count; i++) {
+		if (transforms.dirty[i]) {
+			transforms.nodes[i]->worldMatrix = transforms.worldMatrices[i];
+		}
+	}
+
+	// A skinned mesh also moves with its joints, which don't have to be part of its subtree
+	for (size_t i = 0; i < count; i++) {
+		Node* node = transforms.nodes[i];
+		if (!node->mesh) {
+			continue;
+		}
+		bool affected = transforms.dirty[i];
+		if (!affected && node->skin) {
+			for (Node* joint : node->skin->joints) {
+				if (transforms.dirty[joint->transformIndex]) {
+					affected = true;
+					break;
+				}
+			}
+		}
+		if (affected) {
+			node->updateUniformBlock();
 		}
 	}
-	return nodeFound;
+	std::fill(transforms.dirty.begin(), transforms.dirty.end(), 0);
 }
 
+/*
+	Helper functions
+*/
 vkglTF::Node* vkglTF::Model::nodeFromIndex(uint32_t index) {
-	Node* nodeFound = nullptr;
-	for (auto &node : nodes) {
-		nodeFound = findNode(node, index);
-		if (nodeFound) {
-			break;
+	return index < nodesByIndex.size() ? nodesByIndex[index] : nullptr;
+}
+
+/**
+* Compute the bind pose bounds of the vertices influenced by each joint of all skinned meshes
+*
+* A skinned vertex is a weighted average of its positions transformed by each of its joints, so it always lies within the
+* union of the influence bounds transformed by their joint matrices. Morph targets are blended before skinning, so the bounds
+* include how far they can move each vertex
+*/
+void vkglTF::Model::getInfluenceBounds(const std::vector<Vertex>& vertexBuffer) {
+	for (auto node : linearNodes) {
+		if (!node->mesh || !node->skin) {
+			continue;
+		}
+		Mesh* mesh = node->mesh;
+		std::vector<vks::transforms::Aabb> bounds(node->skin->joints.size(), { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) });
+		for (Primitive* primitive : mesh->primitives) {
+			for (uint32_t i = 0; i < primitive->vertexCount; i++) {
+				const Vertex& vertex = vertexBuffer[primitive->firstVertex + i];
+				glm::vec3 morphMin(0.0f), morphMax(0.0f);
+				if (primitive->morphOffset != Primitive::NO_MORPH_TARGETS) {
+					getMorphExtents(morphTargets, morphTargets.offsets[primitive->morphOffset + i], morphTargets.offsets[primitive->morphOffset + i + 1], morphMin, morphMax);
+				}
+				for (int j = 0; j < 4; j++) {
+					const uint32_t joint = static_cast<uint32_t>(vertex.joint0[j]);
+					if (vertex.weight0[j] > 0.0f && joint < bounds.size()) {
+						bounds[joint].min = glm::min(bounds[joint].min, vertex.pos + morphMin);
+						bounds[joint].max = glm::max(bounds[joint].max, vertex.pos + morphMax);
+					}
+				}
+			}
+		}
+		mesh->influenceBounds.clear();
+		mesh->influenceJoints.clear();
+		for (uint32_t joint = 0; joint < bounds.size(); joint++) {
+			if (bounds[joint].min.x <= bounds[joint].max.x) {
+				mesh->influenceBounds.push_back(bounds[joint]);
+				mesh->influenceJoints.push_back(joint);
+			}
 		}
 	}
-	return nodeFound;
 }
 
-void vkglTF::Model::prepareNodeDescriptor(vkglTF::Node* node, vk::DescriptorSetLayout descriptorSetLayout) {
-	if (node->mesh) {
-		vk::DescriptorSetAllocateInfo descriptorSetAllocInfo{};
-		descriptorSetAllocInfo.descriptorPool = *descriptorPool;
-		descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
-		descriptorSetAllocInfo.descriptorSetCount = 1;
-		node->mesh->uniformBuffer.descriptorSet = device->logicalDevice->allocateDescriptorSets(descriptorSetAllocInfo)[0];
+/**
+* Lay out the uniform blocks of all meshes in a single persistently mapped buffer
+*
+* Each block only holds as many joint matrices as the mesh's skin has, aligned to the dynamic offset alignment
+*/
+void vkglTF::Model::prepareUniformBuffer() {
+	const uint32_t alignment = static_cast<uint32_t>(device->properties.properties.limits.minUniformBufferOffsetAlignment);
+	uint32_t size = 0;
+	for (auto node : linearNodes) {
+		if (node->mesh) {
+			Mesh* mesh = node->mesh;
+			mesh->jointCount = 0;
+			if (node->skin) {
+				if (node->skin->joints.size() > Mesh::MAX_NUM_JOINTS) {
+					std::cerr << "Skin \"" << node->skin->name << "\" has " << node->skin->joints.size() << " joints, only " << Mesh::MAX_NUM_JOINTS << " fit into the uniform block (use vkglTF::ComputeSkinning)\n";
+				}
+				mesh->jointCount = std::min(static_cast<uint32_t>(node->skin->joints.size()), Mesh::MAX_NUM_JOINTS);
+			}
+			mesh->uniformOffset = size;
+			size = vks::tools::alignedSize(size + static_cast<uint32_t>(Mesh::uniformBlockSize(mesh->jointCount)), alignment);
+		}
+	}
+	if (size == 0) {
+		return;
+	}
+	// The descriptor range always covers a full block, so leave room for that behind the last one
+	size += sizeof(Mesh::UniformBlock);
 
-		vk::WriteDescriptorSet writeDescriptorSet{};
-		writeDescriptorSet.descriptorType = vk::DescriptorType::eUniformBuffer;
-		writeDescriptorSet.descriptorCount = 1;
-		writeDescriptorSet.dstSet = node->mesh->uniformBuffer.descriptorSet;
-		writeDescriptorSet.dstBinding = 0;
-		writeDescriptorSet.pBufferInfo = &node->mesh->uniformBuffer.descriptor;
+	VK_CHECK_RESULT(device->createBuffer(
+		vk::BufferUsageFlagBits::eUniformBuffer,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		&uniformBuffer.buffer,
+		size));
+	uniformBuffer.buffer.map();
+	uniformBuffer.buffer.setupDescriptor(sizeof(Mesh::UniformBlock));
 
-		device->logicalDevice->updateDescriptorSets({writeDescriptorSet}, {});
-	}
-	for (auto& child : node->children) {
-		prepareNodeDescriptor(child, descriptorSetLayout);
+	for (auto node : linearNodes) {
+		if (node->mesh) {
+			Mesh* mesh = node->mesh;
+			mesh->uniformBlock = reinterpret_cast<Mesh::UniformBlock*>(static_cast<uint8_t*>(uniformBuffer.buffer.mapped) + mesh->uniformOffset);
+			mesh->uniformBlock->matrix = mesh->matrix;
+			mesh->uniformBlock->jointCount = glm::vec4(static_cast<float>(mesh->jointCount), 0.0f, 0.0f, 0.0f);
+		}
 	}
 }
@@ -9,12 +9,20 @@
 #pragma once
 
 #include <stdlib.h>
+#include <cstddef>
 #include <string>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.h"
+#include "VulkanTextureCache.hpp"
+#include "VulkanTransformKernels.h"
 
 #include <ktx.h>
 #include <ktxvulkan.h>
@@ -43,6 +51,45 @@ namespace vkglTF
 
 	struct Node;
 
+	/*
+		Chunked storage for the nodes, meshes, primitives and skins of a model
+		Elements are constructed in place in fixed size chunks, so they stay at the same address (and index) for the lifetime of the arena
+	*/
+	template <typename T, size_t ChunkSize = 256>
+	class Arena {
+	public:
+		Arena() = default;
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+		~Arena() { clear(); }
+
+		/** @brief Construct a new element at the end of the arena */
+		template <typename... Args>
+		T* create(Args&&... args) {
+			if (count == chunks.size() * ChunkSize) {
+				chunks.push_back(std::make_unique<Storage[]>(ChunkSize));
+			}
+			T* element = new (&chunks[count / ChunkSize][count % ChunkSize]) T(std::forward<Args>(args)...);
+			count++;
+			return element;
+		}
+		T& operator[](size_t index) { return *std::launder(reinterpret_cast<T*>(&chunks[index / ChunkSize][index % ChunkSize])); }
+		size_t size() const { return count; }
+		/** @brief Destroy all elements (in reverse order of creation) */
+		void clear() {
+			while (count > 0) {
+				(*this)[count - 1].~T();
+				count--;
+			}
+			chunks.clear();
+		}
+
+	private:
+		using Storage = std::aligned_storage_t<sizeof(T), alignof(T)>;
+		std::vector<std::unique_ptr<Storage[]>> chunks;
+		size_t count = 0;
+	};
+
 	/*
 		glTF texture loading class
 	*/
@@ -50,7 +97,7 @@ namespace vkglTF
 		vks::VulkanDevice* device = nullptr;
 		vk::UniqueImage image;
 		vk::ImageLayout imageLayout;
-		vk::UniqueDeviceMemory deviceMemory;
+		vks::Allocation deviceMemory;
 		vk::UniqueImageView view;
 		uint32_t width, height;
 		uint32_t mipLevels;
@@ -92,10 +139,14 @@ namespace vkglTF
 		glTF primitive
 	*/
 	struct Primitive {
+		static constexpr uint32_t NO_MORPH_TARGETS = std::numeric_limits<uint32_t>::max();
+
 		uint32_t firstIndex;
 		uint32_t indexCount;
 		uint32_t firstVertex;
 		uint32_t vertexCount;
+		/** @brief Index of the primitive's first entry in Model::morphTargets.offsets, NO_MORPH_TARGETS if it has no non-zero morph target deltas */
+		uint32_t morphOffset = NO_MORPH_TARGETS;
 		Material& material;
 
 		struct Dimensions {
@@ -114,27 +165,45 @@ namespace vkglTF
 		glTF mesh
 	*/
 	struct Mesh {
+		static constexpr uint32_t MAX_NUM_JOINTS = 64;
+
 		vks::VulkanDevice* device;
 
 		std::vector<Primitive*> primitives;
 		std::string name;
+		glm::mat4 matrix;
 
-		struct UniformBuffer {
-			vk::UniqueBuffer buffer;
-			vk::UniqueDeviceMemory memory;
-			vk::DescriptorBufferInfo descriptor;
-			vk::DescriptorSet descriptorSet;
-			void* mapped;
-		} uniformBuffer;
-
+		/**
+		* @brief Per-mesh uniform block as seen by the shader (dynamic uniform buffer at binding 0 of descriptorSetLayoutUbo)
+		* @note Only the first jointCount joint matrices are backed by this mesh, the block of the next mesh follows right after them
+		*/
 		struct UniformBlock {
 			glm::mat4 matrix;
-			glm::mat4 jointMatrix[64]{};
-			float jointcount{ 0 };
-		} uniformBlock;
+			/** @brief Number of joint matrices in x, yzw are padding */
+			glm::vec4 jointCount;
+			glm::mat4 jointMatrix[MAX_NUM_JOINTS];
+		};
+
+		/** @brief Number of joint matrices of the skin attached to the mesh */
+		uint32_t jointCount = 0;
+		/** @brief Dynamic offset of the mesh's block inside Model::uniformBuffer */
+		uint32_t uniformOffset = 0;
+		/** @brief Mesh's block inside the persistently mapped Model::uniformBuffer */
+		UniformBlock* uniformBlock = nullptr;
+
+		/** @brief Bind pose bounds of the vertices influenced by each joint in influenceJoints (skinned meshes only), used to bound the skinned mesh */
+		std::vector<vks::transforms::Aabb> influenceBounds;
+		/** @brief Index into the skin's joints for each of influenceBounds */
+		std::vector<uint32_t> influenceJoints;
+
+		/** @brief Index of the mesh's first morph target weight in Model::morphTargets.weights */
+		uint32_t morphWeightOffset = 0;
+		uint32_t morphTargetCount = 0;
+
+		/** @brief Size of a uniform block holding the given number of joint matrices */
+		static vk::DeviceSize uniformBlockSize(uint32_t jointCount) { return offsetof(UniformBlock, jointMatrix) + jointCount * sizeof(glm::mat4); }
 
 		Mesh(vks::VulkanDevice* device, glm::mat4 matrix);
-		~Mesh();
 	};
 
 	/*
@@ -162,17 +231,21 @@ namespace vkglTF
 		glm::vec3 translation{};
 		glm::vec3 scale{ 1.0f };
 		glm::quat rotation{};
+		/** @brief World matrix as of the last call to Model::updateTransforms() */
+		glm::mat4 worldMatrix{ 1.0f };
+		/** @brief Index of the node in Model::transforms */
+		uint32_t transformIndex = 0;
 		glm::mat4 localMatrix();
 		glm::mat4 getMatrix();
 		void update();
-		~Node();
+		void updateUniformBlock();
 	};
 
 	/*
 		glTF animation channel
 	*/
 	struct AnimationChannel {
-		enum PathType { TRANSLATION, ROTATION, SCALE };
+		enum PathType { TRANSLATION, ROTATION, SCALE, WEIGHTS };
 		PathType path;
 		Node* node;
 		uint32_t samplerIndex;
@@ -183,9 +256,41 @@ namespace vkglTF
 	*/
 	struct AnimationSampler {
 		enum InterpolationType { LINEAR, STEP, CUBICSPLINE };
+		/**
+		* @brief How the outputs are stored
+		* RANGE3 / RANGE4: 3 or 4 components quantized to 16 bits within [rangeMin, rangeMin + rangeExtent]
+		* SMALLEST_THREE: Unit quaternions in 48 bits, the three smallest components at 15 bits each plus the index of the largest one
+		*/
+		enum Encoding { RANGE3, RANGE4, SMALLEST_THREE };
 		InterpolationType interpolation;
-		std::vector<float> inputs;
-		std::vector<glm::vec4> outputsVec4;
+		/** @brief Index of the sampler's keyframe times in Animation::inputs */
+		uint32_t input = 0;
+		Encoding encoding = RANGE3;
+		/** @brief Outputs are quaternions (x, y, z, w) rather than vectors */
+		bool rotation = false;
+		/** @brief Encoded output values, cubic spline samplers store three per key (in tangent, value, out tangent) */
+		std::vector<uint16_t> outputs;
+		glm::vec4 rangeMin{ 0.0f };
+		glm::vec4 rangeExtent{ 0.0f };
+		/** @brief Unencoded morph target weights of weights samplers (one per target and key), outputs is empty for those */
+		std::vector<float> weights;
+		void encode(const std::vector<glm::vec4>& values, bool rotation);
+		glm::vec4 decode(uint32_t value) const;
+		uint32_t keyCount() const;
+		glm::vec4 sample(uint32_t key, float factor, float duration) const;
+		void sampleWeights(uint32_t key, float factor, float duration, float* dst, uint32_t count) const;
+	};
+
+	/*
+		glTF animation sampler input, shared by all samplers of an animation reading the same time accessor
+	*/
+	struct AnimationInput {
+		std::vector<float> times;
+		/** @brief Keyframe interval found by the last call to seek(), playback usually stays in it or moves on to the next one */
+		uint32_t cursor = 0;
+		/** @brief Interpolation factor between keyframes cursor and cursor + 1 as of the last call to seek() */
+		float factor = 0.0f;
+		bool seek(float time);
 	};
 
 	/*
@@ -193,6 +298,7 @@ namespace vkglTF
 	*/
 	struct Animation {
 		std::string name;
+		std::vector<AnimationInput> inputs;
 		std::vector<AnimationSampler> samplers;
 		std::vector<AnimationChannel> channels;
 		float start = std::numeric_limits<float>::max();
@@ -234,7 +340,8 @@ namespace vkglTF
 		BindImages = 0x00000001,
 		RenderOpaqueNodes = 0x00000002,
 		RenderAlphaMaskedNodes = 0x00000004,
-		RenderAlphaBlendedNodes = 0x00000008
+		RenderAlphaBlendedNodes = 0x00000008,
+		BindMeshUniforms = 0x00000010
 	};
 
 	/*
@@ -252,23 +359,90 @@ namespace vkglTF
 		struct Vertices {
 			int count;
 			vk::UniqueBuffer buffer;
-			vk::UniqueDeviceMemory memory;
+			vks::Allocation memory;
 		} vertices;
 		struct Indices {
 			int count;
 			vk::UniqueBuffer buffer;
-			vk::UniqueDeviceMemory memory;
+			vks::Allocation memory;
 		} indices;
 
+		/** @brief Uniform blocks of all meshes, packed into one persistently mapped buffer and selected with dynamic offsets */
+		struct UniformBuffer {
+			vks::Buffer buffer;
+			vk::DescriptorSet descriptorSet;
+		} uniformBuffer;
+
+		/** @brief Storage of all nodes, meshes, primitives and skins, the vectors below only reference elements in here */
+		Arena<Node> nodeStorage;
+		Arena<Mesh> meshStorage;
+		Arena<Primitive> primitiveStorage;
+		Arena<Skin> skinStorage;
+
+		/** @brief Root nodes of the scene */
 		std::vector<Node*> nodes;
+		/** @brief All nodes of the scene, each node follows its children */
 		std::vector<Node*> linearNodes;
+		/** @brief Nodes by glTF node index, nullptr for nodes not part of the scene */
+		std::vector<Node*> nodesByIndex;
 
 		std::vector<Skin*> skins;
 
-		std::vector<Texture> textures;
+		/** @brief Node transforms flattened in hierarchy order (parents before their children) for the batched transform kernels */
+		struct Transforms {
+			std::vector<Node*> nodes;
+			std::vector<int32_t> parents;
+			std::vector<glm::vec3> translations;
+			std::vector<glm::quat> rotations;
+			std::vector<glm::vec3> scales;
+			std::vector<glm::mat4> matrices;
+			std::vector<glm::mat4> packedLocalMatrices;
+			std::vector<glm::mat4> localMatrices;
+			std::vector<glm::mat4> worldMatrices;
+			/** @brief Nodes whose local transform changed since the last update, see markDirty() */
+			std::vector<uint8_t> dirty;
+			/** @brief Transform indices of the dirty nodes, translations, rotations, scales, matrices and packedLocalMatrices are packed in this order */
+			std::vector<uint32_t> dirtyIndices;
+		} transforms;
+
+		std::vector<std::shared_ptr<Texture>> textures;
+		/** @brief (Optional) Cache owned by the caller, byte-identical images of all models loaded with the same cache are only uploaded once */
+		vks::TextureCache<Texture>* textureCache = nullptr;
 		std::vector<Material> materials;
 		std::vector<Animation> animations;
 
+		/**
+		* @brief Morph targets of all meshes, keeping only the non-zero deltas
+		* The deltas of a primitive's vertex i are deltas[offsets[morphOffset + i]] up to deltas[offsets[morphOffset + i + 1]],
+		* blended by ComputeSkinning on the GPU
+		*/
+		struct MorphTargets {
+			/** @brief Position, normal and tangent delta of a vertex for one target, as read by the skinning shader */
+			struct Delta {
+				/** @brief Index of the target's weight in weights */
+				uint32_t weight;
+				glm::vec3 position;
+				glm::vec3 normal;
+				glm::vec3 tangent;
+			};
+			static_assert(sizeof(Delta) == 10 * sizeof(uint32_t), "Delta must match DELTA_STRIDE in skinning.comp");
+			std::vector<uint32_t> offsets;
+			std::vector<Delta> deltas;
+			/** @brief Current weights of all meshes' targets, set by animations */
+			std::vector<float> weights;
+			/** @brief Range of each weight over the defaults and all animations (including [0, 1]), the bounds of morphed primitives cover it */
+			std::vector<float> weightMin;
+			std::vector<float> weightMax;
+		} morphTargets;
+
+		/** @brief Error tolerances for dropping animation keys at load time, set to 0 to keep all keys (outputs are quantized regardless) */
+		struct AnimationCompression {
+			/** @brief Maximum distance of translations and scales from the original keys */
+			float valueTolerance = 0.0001f;
+			/** @brief Maximum angle (in radians) of rotations from the original keys */
+			float rotationTolerance = 0.0005f;
+		} animationCompression;
+
 		struct Dimensions {
 			glm::vec3 min = glm::vec3(FLT_MAX);
 			glm::vec3 max = glm::vec3(-FLT_MAX);
@@ -283,20 +457,27 @@ namespace vkglTF
 
 		Model() {};
 		~Model();
+		void loadMorphTargets(Mesh* mesh, Primitive* primitive, const tinygltf::Primitive& source, const tinygltf::Model& model);
 		void loadNode(vkglTF::Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale);
 		void loadSkins(tinygltf::Model& gltfModel);
 		void loadImages(tinygltf::Model& gltfModel, vks::VulkanDevice* device, vk::Queue transferQueue);
 		void loadMaterials(tinygltf::Model& gltfModel);
 		void loadAnimations(tinygltf::Model& gltfModel);
+		void getMorphWeightRanges();
+		void getMorphBounds(const std::vector<Vertex>& vertexBuffer);
+		void compressAnimation(Animation& animation, std::vector<std::vector<glm::vec4>>& outputs, const std::vector<uint8_t>& rotations);
 		void loadFromFile(std::string filename, vks::VulkanDevice* device, vk::Queue transferQueue, uint32_t fileLoadingFlags = vkglTF::FileLoadingFlags::None, float scale = 1.0f);
 	    void bindBuffers(vk::CommandBuffer commandBuffer);
-		void drawNode(Node* node, vk::CommandBuffer commandBuffer, uint32_t renderFlags = 0, vk::PipelineLayout pipelineLayout = {}, uint32_t bindImageSet = 1);
-		void draw(vk::CommandBuffer commandBuffer, uint32_t renderFlags = 0, vk::PipelineLayout pipelineLayout = {}, uint32_t bindImageSet = 1);
+		void drawNode(Node* node, vk::CommandBuffer commandBuffer, uint32_t renderFlags = 0, vk::PipelineLayout pipelineLayout = {}, uint32_t bindImageSet = 1, uint32_t bindMeshSet = 2);
+		void draw(vk::CommandBuffer commandBuffer, uint32_t renderFlags = 0, vk::PipelineLayout pipelineLayout = {}, uint32_t bindImageSet = 1, uint32_t bindMeshSet = 2);
 		void getNodeDimensions(Node* node, glm::vec3& min, glm::vec3& max);
 		void getSceneDimensions();
 		void updateAnimation(uint32_t index, float time);
-		Node* findNode(Node* parent, uint32_t index);
+		void prepareTransforms();
+		void markDirty(Node* node);
+		void updateTransforms();
 		Node* nodeFromIndex(uint32_t index);
-		void prepareNodeDescriptor(vkglTF::Node* node, vk::DescriptorSetLayout descriptorSetLayout);
+		void prepareUniformBuffer();
+		void getInfluenceBounds(const std::vector<Vertex>& vertexBuffer);
 	};
 }
\ No newline at end of file
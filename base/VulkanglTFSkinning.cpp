@@ -0,0 +1,278 @@
+/*
+* glTF compute skinning
+*
+* Skins the vertices of all skinned meshes of a glTF model once per frame in a compute pass, reading
+* the joint matrices from a storage buffer without a limit on the number of joints. Morph targets are
+* blended in the same pass before skinning. The skinned vertex buffer is bound in place of the model's
+* vertex buffer, so all passes share the result
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanglTFSkinning.h"
+
+#include <algorithm>
+#include <array>
+
+namespace vkglTF
+{
+	/**
+	* Create the skinned vertex buffer, joint buffer and compute pipeline for a model
+	*
+	* @param model Model to skin, must outlive this object
+	* @param queue Queue used to initialize the skinned vertex buffer
+	* @param pipelineCache Pipeline cache for the compute pipeline
+	* @param shaderFile Path to the compiled skinning shader (skinning/skinning.comp.spv)
+	*/
+	void ComputeSkinning::prepare(Model *model, vk::Queue queue, vk::PipelineCache pipelineCache, const std::string &shaderFile)
+	{
+		this->model = model;
+		device = model->device;
+
+		uint32_t jointCount = 0;
+		for (auto node : model->linearNodes) {
+			if (!node->mesh) {
+				continue;
+			}
+			const bool morphed = std::any_of(node->mesh->primitives.begin(), node->mesh->primitives.end(), [](const Primitive *primitive) {
+				return primitive->morphOffset != Primitive::NO_MORPH_TARGETS;
+			});
+			if (node->skin || morphed) {
+				SkinnedMesh mesh{};
+				mesh.node = node;
+				mesh.jointOffset = jointCount;
+				mesh.jointCount = node->skin ? static_cast<uint32_t>(node->skin->joints.size()) : 0;
+				meshes.push_back(mesh);
+				jointCount += mesh.jointCount;
+			}
+		}
+
+		// Unskinned vertices are never written, so start out with a copy of all of them
+		const vk::DeviceSize vertexBufferSize = static_cast<vk::DeviceSize>(model->vertices.count) * sizeof(Vertex);
+		VK_CHECK_RESULT(device->createBuffer(
+			vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			&vertices,
+			vertexBufferSize));
+		vertices.setupDescriptor();
+		vk::UniqueCommandBuffer copyCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+		vk::BufferCopy copyRegion{};
+		copyRegion.size = vertexBufferSize;
+		copyCmd->copyBuffer(*model->vertices.buffer, *vertices.buffer, { copyRegion });
+		device->flushCommandBuffer(copyCmd, queue, true);
+
+		// A dual quaternion is two vec4s, half the size of a matrix
+		const vk::DeviceSize jointSize = dualQuaternion ? 2 * sizeof(glm::vec4) : sizeof(glm::mat4);
+		VK_CHECK_RESULT(device->createBuffer(
+			vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			&joints,
+			std::max(jointCount, 1u) * jointSize));
+		joints.map();
+		joints.setupDescriptor();
+
+		// Deltas are static, so they live in device local memory, the weights change every frame
+		const Model::MorphTargets &morphTargets = model->morphTargets;
+		upload(morphTargets.offsets.data(), morphTargets.offsets.size() * sizeof(uint32_t), morphOffsets, queue);
+		upload(morphTargets.deltas.data(), morphTargets.deltas.size() * sizeof(Model::MorphTargets::Delta), morphDeltas, queue);
+		VK_CHECK_RESULT(device->createBuffer(
+			vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			&morphWeights,
+			std::max<vk::DeviceSize>(morphTargets.weights.size() * sizeof(float), sizeof(float))));
+		morphWeights.map();
+		morphWeights.setupDescriptor();
+
+		std::vector<vk::DescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 6),
+		};
+		descriptorPool = device->logicalDevice->createDescriptorPoolUnique(vks::initializers::descriptorPoolCreateInfo(poolSizes, 1));
+
+		std::vector<vk::DescriptorSetLayoutBinding> setLayoutBindings = {
+			// Binding 0: Unskinned vertices
+			vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 0),
+			// Binding 1: Skinned vertices
+			vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1),
+			// Binding 2: Joint matrices
+			vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 2),
+			// Binding 3: Morph target delta offsets per vertex
+			vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 3),
+			// Binding 4: Morph target deltas
+			vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 4),
+			// Binding 5: Morph target weights
+			vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 5),
+		};
+		descriptorSetLayout = device->logicalDevice->createDescriptorSetLayoutUnique(vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings));
+		descriptorSet = device->logicalDevice->allocateDescriptorSets(vks::initializers::descriptorSetAllocateInfo(*descriptorPool, &*descriptorSetLayout, 1))[0];
+
+		vk::DescriptorBufferInfo sourceDescriptor{ *model->vertices.buffer, 0, VK_WHOLE_SIZE };
+		std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
+			vks::initializers::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 0, &sourceDescriptor),
+			vks::initializers::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 1, &vertices.descriptor),
+			vks::initializers::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 2, &joints.descriptor),
+			vks::initializers::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 3, &morphOffsets.descriptor),
+			vks::initializers::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 4, &morphDeltas.descriptor),
+			vks::initializers::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 5, &morphWeights.descriptor),
+		};
+		device->logicalDevice->updateDescriptorSets(writeDescriptorSets, {});
+
+		vk::PushConstantRange pushConstantRange = vks::initializers::pushConstantRange(vk::ShaderStageFlagBits::eCompute, sizeof(PushConstants), 0);
+		vk::PipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&*descriptorSetLayout, 1);
+		pipelineLayoutCI.pushConstantRangeCount = 1;
+		pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+		pipelineLayout = device->logicalDevice->createPipelineLayoutUnique(pipelineLayoutCI);
+
+		vk::UniqueShaderModule shaderModule = vks::tools::loadShader(shaderFile.c_str(), *device->logicalDevice);
+		// Constant 0 selects the dual quaternion variant of the shader
+		const vk::Bool32 specializationData = dualQuaternion ? VK_TRUE : VK_FALSE;
+		const vk::SpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(vk::Bool32));
+		const vk::SpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(vk::Bool32), &specializationData);
+		vk::ComputePipelineCreateInfo pipelineCI = vks::initializers::computePipelineCreateInfo(*pipelineLayout);
+		pipelineCI.stage.stage = vk::ShaderStageFlagBits::eCompute;
+		pipelineCI.stage.module = *shaderModule;
+		pipelineCI.stage.pName = "main";
+		pipelineCI.stage.pSpecializationInfo = &specializationInfo;
+		pipeline = device->logicalDevice->createComputePipelineUnique(pipelineCache, pipelineCI).value;
+	}
+
+	/** @brief Create a device local storage buffer holding a copy of data, a placeholder if there is no data */
+	void ComputeSkinning::upload(const void *data, vk::DeviceSize size, vks::Buffer &buffer, vk::Queue queue)
+	{
+		VK_CHECK_RESULT(device->createBuffer(
+			vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			&buffer,
+			std::max<vk::DeviceSize>(size, sizeof(uint32_t))));
+		buffer.setupDescriptor();
+		if (size == 0) {
+			return;
+		}
+		vks::Buffer staging;
+		VK_CHECK_RESULT(device->createBuffer(
+			vk::BufferUsageFlagBits::eTransferSrc,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			&staging,
+			size,
+			const_cast<void *>(data)));
+		vk::UniqueCommandBuffer copyCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+		vk::BufferCopy copyRegion{};
+		copyRegion.size = size;
+		copyCmd->copyBuffer(*staging.buffer, *buffer.buffer, { copyRegion });
+		device->flushCommandBuffer(copyCmd, queue, true);
+		staging.destroy();
+	}
+
+	/**
+	* Write the joint matrices of all skinned meshes and the morph target weights, and update the meshes' bounds
+	*
+	* @note Reads the cached world matrices, call after the model's transforms have been updated
+	*/
+	void ComputeSkinning::update()
+	{
+		const std::vector<float> &weights = model->morphTargets.weights;
+		std::copy(weights.begin(), weights.end(), static_cast<float *>(morphWeights.mapped));
+
+		for (auto &mesh : meshes) {
+			const Node *node = mesh.node;
+			const Skin *skin = node->skin;
+			if (!skin) {
+				// The primitive bounds already cover how far the morph targets can move the vertices
+				mesh.bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+				for (const Primitive *primitive : node->mesh->primitives) {
+					mesh.bounds.min = glm::min(mesh.bounds.min, primitive->dimensions.min);
+					mesh.bounds.max = glm::max(mesh.bounds.max, primitive->dimensions.max);
+				}
+				continue;
+			}
+			// Same as Node::updateUniformBlock(), but for any number of joints
+			palette.resize(mesh.jointCount);
+			for (uint32_t i = 0; i < mesh.jointCount; i++) {
+				palette[i] = skin->joints[i]->worldMatrix;
+			}
+			vks::transforms::multiply(palette.data(), skin->inverseBindMatrices.data(), palette.data(), mesh.jointCount);
+			if (node->worldMatrix != mesh.worldMatrix) {
+				mesh.worldMatrix = node->worldMatrix;
+				mesh.inverseWorldMatrix = glm::inverse(mesh.worldMatrix);
+			}
+			vks::transforms::multiply(mesh.inverseWorldMatrix, palette.data(), palette.data(), mesh.jointCount);
+			if (dualQuaternion) {
+				vks::transforms::toDualQuaternions(palette.data(), static_cast<glm::vec4 *>(joints.mapped) + mesh.jointOffset * 2, mesh.jointCount);
+			} else {
+				std::copy(palette.begin(), palette.end(), static_cast<glm::mat4 *>(joints.mapped) + mesh.jointOffset);
+			}
+
+			// The bounds follow the blended matrices, which dual quaternion blending stays close to but may slightly exceed
+			const Mesh *nodeMesh = node->mesh;
+			if (nodeMesh->influenceBounds.empty()) {
+				mesh.bounds = {};
+				continue;
+			}
+			jointBounds.resize(nodeMesh->influenceBounds.size());
+			vks::transforms::transformAabbs(nodeMesh->influenceBounds.data(), palette.data(), nodeMesh->influenceJoints.data(), jointBounds.data(), jointBounds.size());
+			mesh.bounds = jointBounds.front();
+			for (const auto &bounds : jointBounds) {
+				mesh.bounds.min = glm::min(mesh.bounds.min, bounds.min);
+				mesh.bounds.max = glm::max(mesh.bounds.max, bounds.max);
+			}
+		}
+	}
+
+	/**
+	* Record the skinning dispatches, must be recorded outside of a render pass before the draws using the skinned vertices
+	*
+	* @param commandBuffer Command buffer to record to
+	*/
+	void ComputeSkinning::record(vk::CommandBuffer commandBuffer)
+	{
+		if (meshes.empty()) {
+			return;
+		}
+
+		// The previous frame's draws must be done reading the vertices before they are overwritten
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput, vk::PipelineStageFlagBits::eComputeShader, {}, {}, {}, {});
+
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipelineLayout, 0, { descriptorSet }, {});
+		for (const auto &mesh : meshes) {
+			for (const Primitive *primitive : mesh.node->mesh->primitives) {
+				const bool skinned = mesh.jointCount > 0;
+				if (primitive->vertexCount == 0 || (!skinned && primitive->morphOffset == Primitive::NO_MORPH_TARGETS)) {
+					continue;
+				}
+				const PushConstants pushConstants{ primitive->firstVertex, primitive->vertexCount, mesh.jointOffset, primitive->morphOffset, skinned ? VK_TRUE : VK_FALSE };
+				commandBuffer.pushConstants(*pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &pushConstants);
+				commandBuffer.dispatch((primitive->vertexCount + 63) / 64, 1, 1);
+			}
+		}
+
+		vk::BufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+		barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+		barrier.buffer = *vertices.buffer;
+		barrier.size = VK_WHOLE_SIZE;
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eVertexInput, {}, {}, { barrier }, {});
+	}
+
+	/** @brief Bind the skinned vertices and the model's indices, to be used in place of Model::bindBuffers() */
+	void ComputeSkinning::bindBuffers(vk::CommandBuffer commandBuffer)
+	{
+		const std::array<vk::DeviceSize, 1> offsets = { 0 };
+		commandBuffer.bindVertexBuffers(0, { *vertices.buffer }, offsets);
+		commandBuffer.bindIndexBuffer(*model->indices.buffer, 0, vk::IndexType::eUint32);
+		model->buffersBound = true;
+	}
+
+	void ComputeSkinning::destroy()
+	{
+		pipeline.reset();
+		pipelineLayout.reset();
+		descriptorSetLayout.reset();
+		descriptorPool.reset();
+		vertices.destroy();
+		joints.destroy();
+		morphOffsets.destroy();
+		morphDeltas.destroy();
+		morphWeights.destroy();
+		meshes.clear();
+	}
+}
@@ -0,0 +1,88 @@
+/*
+* glTF compute skinning
+*
+* Skins the vertices of all skinned meshes of a glTF model once per frame in a compute pass, reading
+* the joint matrices from a storage buffer without a limit on the number of joints. Morph targets are
+* blended in the same pass before skinning. The skinned vertex buffer is bound in place of the model's
+* vertex buffer, so all passes share the result
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "VulkanBuffer.h"
+#include "VulkanTransformKernels.h"
+#include "VulkanglTFModel.h"
+
+namespace vkglTF
+{
+	class ComputeSkinning
+	{
+	public:
+		struct SkinnedMesh
+		{
+			Node *node = nullptr;
+			/** @brief Index of the mesh's first joint matrix in the joint buffer */
+			uint32_t jointOffset = 0;
+			/** @brief 0 for meshes that only have morph targets */
+			uint32_t jointCount = 0;
+			/** @brief Mesh space bounds of the skinned and morphed vertices as of the last update() */
+			vks::transforms::Aabb bounds{};
+			/** @brief Node world matrix the inverse was computed from, the inverse is only recomputed when it changes */
+			glm::mat4 worldMatrix{ 0.0f };
+			glm::mat4 inverseWorldMatrix{ 0.0f };
+		};
+
+		/**
+		* @brief Blend joints as dual quaternions instead of matrices (set before prepare)
+		* Avoids the volume loss of linear blend skinning around twisting joints and halves the joint data, but ignores joint scale
+		*/
+		bool dualQuaternion = false;
+
+		std::vector<SkinnedMesh> meshes;
+		/** @brief Copy of the model's vertex buffer, the vertices of skinned and morphed meshes are overwritten by record() */
+		vks::Buffer vertices;
+		/** @brief Joint matrices (or dual quaternions) of all skinned meshes, persistently mapped */
+		vks::Buffer joints;
+		/** @brief Model::morphTargets offsets and deltas */
+		vks::Buffer morphOffsets;
+		vks::Buffer morphDeltas;
+		/** @brief Morph target weights of all meshes, persistently mapped */
+		vks::Buffer morphWeights;
+
+		void prepare(Model *model, vk::Queue queue, vk::PipelineCache pipelineCache, const std::string &shaderFile);
+		void update();
+		void record(vk::CommandBuffer commandBuffer);
+		void bindBuffers(vk::CommandBuffer commandBuffer);
+		void destroy();
+
+	private:
+		struct PushConstants
+		{
+			uint32_t firstVertex;
+			uint32_t vertexCount;
+			uint32_t jointOffset;
+			uint32_t morphOffset;
+			vk::Bool32 skinned;
+		};
+
+		Model *model = nullptr;
+		vks::VulkanDevice *device = nullptr;
+		vk::UniqueDescriptorPool descriptorPool;
+		vk::UniqueDescriptorSetLayout descriptorSetLayout;
+		vk::DescriptorSet descriptorSet;
+		vk::UniquePipelineLayout pipelineLayout;
+		vk::UniquePipeline pipeline;
+		void upload(const void *data, vk::DeviceSize size, vks::Buffer &buffer, vk::Queue queue);
+		/** @brief Joint matrices of a single mesh, built here as the mapped joint buffer is slow to read back */
+		std::vector<glm::mat4> palette;
+		std::vector<vks::transforms::Aabb> jointBounds;
+	};
+}
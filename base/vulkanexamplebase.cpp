@@ -323,7 +323,7 @@ void VulkanExampleBase::updateOverlay()
 	ImGui::Render();
 
 	if (UIOverlay.update() || UIOverlay.updated) {
-		buildCommandBuffers();
+		overlayChanged();
 		UIOverlay.updated = false;
 	}
 
@@ -674,6 +674,11 @@ void VulkanExampleBase::mouseMoved(double x, double y, bool & handled) {}
 
 void VulkanExampleBase::buildCommandBuffers() {}
 
+void VulkanExampleBase::overlayChanged()
+{
+	buildCommandBuffers();
+}
+
 void VulkanExampleBase::createSynchronizationPrimitives()
 {
 	// Wait fences to sync command buffer access
@@ -703,15 +708,13 @@ void VulkanExampleBase::setupDepthStencil()
 	imageCI.samples = vk::SampleCountFlagBits::e1;
 	imageCI.tiling = vk::ImageTiling::eOptimal;
 	imageCI.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+	// Sampled to build depth pyramids for occlusion culling, if the format allows it
+	if (physicalDevice.getFormatProperties(depthFormat).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage) {
+		imageCI.usage |= vk::ImageUsageFlagBits::eSampled;
+	}
 
     depthStencil.image = device.createImageUnique(imageCI);
-	vk::MemoryRequirements2 memReqs = device.getImageMemoryRequirements2(*depthStencil.image);
-
-	vk::MemoryAllocateInfo memAllloc{};
-	memAllloc.allocationSize = memReqs.memoryRequirements.size;
-	memAllloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-	depthStencil.mem = device.allocateMemoryUnique(memAllloc);
-	device.bindImageMemory(*depthStencil.image, *depthStencil.mem, 0);
+	depthStencil.mem = vulkanDevice->allocator.allocateForImage(*depthStencil.image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
 	vk::ImageViewCreateInfo imageViewCI{};
 	imageViewCI.viewType = vk::ImageViewType::e2D;
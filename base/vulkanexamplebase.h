@@ -199,7 +199,7 @@ public:
 
 	struct {
 		vk::UniqueImage image;
-		vk::UniqueDeviceMemory mem;
+		vks::Allocation mem;
 		vk::UniqueImageView view;
 	} depthStencil;
 
@@ -275,6 +275,8 @@ public:
 
 	/** @brief (Virtual) Called when the UI overlay is updating, can be used to add custom elements to the overlay */
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay);
+	/** @brief (Virtual) Called when the draw commands of the UI overlay have changed, rebuilds all command buffers unless overridden */
+	virtual void overlayChanged();
 };
 
 // OS specific macros for the example main entry points
@@ -0,0 +1,33 @@
+#version 450 core
+
+layout (location = 0) in vec3 inPos;
+
+layout (set = 0, binding = 0, std140) uniform UBOScene {
+	mat4 projection;
+	mat4 view;
+	vec4 viewPos;
+} uboScene;
+
+struct DrawData {
+	uint transformIndex;
+	int materialIndex;
+};
+layout (set = 4, binding = 0, std430) readonly buffer Draws {
+	DrawData draws[];
+};
+// World matrix and its inverse transpose for normals, per node
+struct TransformData {
+	mat4 model;
+	mat4 normal;
+};
+layout (set = 4, binding = 1, std430) readonly buffer Transforms {
+	TransformData transforms[];
+};
+
+// The main pass tests for equal depth, so positions must be computed exactly as in scene.vert
+invariant gl_Position;
+
+void main() {
+	vec4 pos = transforms[draws[gl_InstanceIndex].transformIndex].model * vec4(inPos, 1.0);
+	gl_Position = uboScene.projection * uboScene.view * pos;
+}
@@ -0,0 +1,15 @@
+#version 450 core
+
+layout (set = 1, binding = 0) uniform sampler2D samplerColorMap;
+
+layout (location = 2) in vec2 inUV;
+
+layout (constant_id = 1) const float ALPHA_MASK_CUTOFF = 0.0f;
+
+// Depth pre-pass of alpha masked materials, discards the fragments scene.frag discards
+void main()
+{
+	if (texture(samplerColorMap, inUV).a < ALPHA_MASK_CUTOFF) {
+		discard;
+	}
+}
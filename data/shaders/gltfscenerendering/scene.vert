@@ -15,9 +15,21 @@ layout (set = 2, binding = 0, std140) uniform Settings {
 	bool useBlinnPhong;
 } settings;
 
-layout(push_constant) uniform PushConsts {
+struct DrawData {
+	uint transformIndex;
+	int materialIndex;
+};
+layout (set = 4, binding = 0, std430) readonly buffer Draws {
+	DrawData draws[];
+};
+// World matrix and its inverse transpose for normals, per node
+struct TransformData {
 	mat4 model;
-} primitive;
+	mat4 normal;
+};
+layout (set = 4, binding = 1, std430) readonly buffer Transforms {
+	TransformData transforms[];
+};
 
 layout(constant_id = 2) const bool preTransformPos = true;
 
@@ -27,17 +39,24 @@ layout (location = 2) out vec2 outUV;
 layout (location = 3) out vec3 outViewVec;
 layout (location = 4) out vec4 outTangent;
 layout (location = 5) out vec3 outFragPos;
+// Index of the draw for later stages, set through firstInstance
+layout (location = 6) flat out uint outDrawIndex;
+
+// Matches the depth pre-pass in depth.vert
+invariant gl_Position;
 
 void main() {
 	outColor = inColor;
 	outUV = inUV;
 	outTangent = inTangent;
+	outDrawIndex = gl_InstanceIndex;
 
 	if (preTransformPos) {
-		vec4 pos = primitive.model * vec4(inPos, 1.0);
+		TransformData transform = transforms[draws[gl_InstanceIndex].transformIndex];
+		vec4 pos = transform.model * vec4(inPos, 1.0);
 
 		gl_Position = uboScene.projection * uboScene.view * pos;
-		outNormal = mat3(primitive.model) * inNormal;
+		outNormal = mat3(transform.normal) * inNormal;
 		outFragPos = pos.xyz;
 		outViewVec = uboScene.viewPos.xyz - outFragPos;
 	} else {
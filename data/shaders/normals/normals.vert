@@ -4,8 +4,11 @@ layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inNormal;
 
 layout(location = 0) out vec3 outNormal;
+// Index of the draw, set through firstInstance
+layout(location = 1) flat out uint outDrawIndex;
 
 void main(void) {
     outNormal = inNormal;
+    outDrawIndex = gl_InstanceIndex;
     gl_Position = vec4(inPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "command_recorder.h"
+
+void command_recorder::setup(VulkanExampleBase&) {
+  _thread_pool_.setThreadCount(0);
+}
+
+void command_recorder::destroy() {
+  _segments_.clear();
+}
+
+// Records count secondary command buffers of a segment for use within the render pass given by inheritance
+// The segment's previous command buffers are reset and reused, so the primary command buffers executing them must not be pending
+void command_recorder::record(std::size_t segment,
+                              std::size_t count,
+                              const vk::CommandBufferInheritanceInfo& inheritance,
+                              const record_function& function) {
+  const vk::Device device = app().device;
+  if (segment >= _segments_.size()) {
+    _segments_.resize(segment + 1);
+  }
+  segment_data& data = _segments_[segment];
+  if (data.threads.empty()) {
+    vk::CommandPoolCreateInfo command_pool_info = {};
+    command_pool_info.queueFamilyIndex = app().swapChain.queueNodeIndex;
+    command_pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    data.threads.resize(_thread_pool_.getThreadCount());
+    for (thread_data& thread : data.threads) {
+      thread.command_pool = device.createCommandPoolUnique(command_pool_info);
+    }
+  }
+  for (thread_data& thread : data.threads) {
+    device.resetCommandPool(*thread.command_pool, {});
+    thread.used = 0;
+  }
+
+  // Nothing is recorded per framebuffer, so the same command buffers are executed by the primary command buffers of all swapchain images
+  vk::CommandBufferBeginInfo begin_info = vks::initializers::commandBufferBeginInfo();
+  begin_info.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eSimultaneousUse;
+  begin_info.pInheritanceInfo = &inheritance;
+
+  data.command_buffers.resize(count);
+  _thread_pool_.parallelFor(count, 1, [&](std::size_t begin, std::size_t end, std::uint32_t thread_index) {
+    // Only this thread uses its pool, so allocating and recording need no locks
+    thread_data& thread = data.threads[thread_index];
+    for (std::size_t i = begin; i < end; ++i) {
+      if (thread.used == thread.command_buffers.size()) {
+        vk::CommandBufferAllocateInfo allocate_info = vks::initializers::commandBufferAllocateInfo(*thread.command_pool, vk::CommandBufferLevel::eSecondary, 1);
+        thread.command_buffers.emplace_back(std::move(device.allocateCommandBuffersUnique(allocate_info).front()));
+      }
+      const vk::CommandBuffer command_buffer = *thread.command_buffers[thread.used++];
+      command_buffer.begin(begin_info);
+      function(command_buffer, i);
+      command_buffer.end();
+      data.command_buffers[i] = command_buffer;
+    }
+  });
+}
+
+const std::vector<vk::CommandBuffer>& command_recorder::command_buffers(std::size_t segment) const {
+  static const std::vector<vk::CommandBuffer> empty;
+  return segment < _segments_.size() ? _segments_[segment].command_buffers : empty;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanThreadPool.h"
+#include "application_bound.h"
+
+// Records secondary command buffers on all cores, every thread allocating from its own command pool
+// Command buffers are grouped into segments, which can be re-recorded without touching the other segments
+class command_recorder : public application_bound {
+ public:
+  using record_function = std::function<void(vk::CommandBuffer command_buffer, std::size_t index)>;
+
+  void record(std::size_t segment, std::size_t count, const vk::CommandBufferInheritanceInfo& inheritance, const record_function& function);
+
+  // Secondary command buffers recorded by the last call to record() for a segment, in order of their index
+  const std::vector<vk::CommandBuffer>& command_buffers(std::size_t segment) const;
+  std::uint32_t thread_count() const noexcept { return _thread_pool_.getThreadCount(); }
+
+ protected:
+  void setup(VulkanExampleBase& app) override;
+  void destroy() override;
+
+ private:
+  struct thread_data {
+    vk::UniqueCommandPool command_pool;
+    std::vector<vk::UniqueCommandBuffer> command_buffers;
+    // Number of command buffers handed out since the pool was last reset
+    std::size_t used = 0;
+  };
+
+  struct segment_data {
+    std::vector<thread_data> threads;
+    std::vector<vk::CommandBuffer> command_buffers;
+  };
+
+  vks::ThreadPool _thread_pool_;
+  std::vector<segment_data> _segments_;
+};
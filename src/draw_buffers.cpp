@@ -0,0 +1,213 @@
+#include "draw_buffers.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+namespace {
+void write_transform(draw_buffers::transform_data& transform, const glm::mat4& world_matrix) {
+  transform.model = world_matrix;
+  transform.normal = glm::mat4{glm::inverseTranspose(glm::mat3{world_matrix})};
+}
+}  // namespace
+
+void draw_buffers::setup(VulkanExampleBase& app) {
+  if (!_scene_) {
+    throw std::runtime_error("draw_buffers::setup(): scene not bound to instance");
+  }
+
+  // Every primitive is drawn at most once, so the draw list never outgrows the BVH items
+  _capacity_ = static_cast<std::uint32_t>(std::max<std::size_t>(_scene_->bvh_items.size(), 1));
+  const vk::DeviceSize capacity = _capacity_;
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,
+                                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                 &_draw_data_,
+                                 capacity * sizeof(draw_data));
+  _draw_data_.map();
+  // Written in full here, then only for the nodes moved since
+  const std::size_t transform_count = _scene_->transforms.world_matrices.size();
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,
+                                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                 &_transforms_,
+                                 std::max<std::size_t>(transform_count, 1) * sizeof(transform_data));
+  _transforms_.map();
+  auto* transforms = static_cast<transform_data*>(_transforms_.mapped);
+  for (std::size_t i = 0; i < transform_count; ++i) {
+    write_transform(transforms[i], _scene_->transforms.world_matrices[i]);
+  }
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+                                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                 &_commands_,
+                                 capacity * sizeof(vk::DrawIndexedIndirectCommand));
+  _commands_.map();
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,
+                                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                 &_bounds_,
+                                 capacity * sizeof(draw_bounds));
+  _bounds_.map();
+  // Every draw may start a batch of its own
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,
+                                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                 &_batch_data_,
+                                 capacity * sizeof(batch_data));
+  _batch_data_.map();
+
+  auto set_layout_bindings = std::vector{
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer,
+                                                    vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eGeometry | vk::ShaderStageFlagBits::eTessellationEvaluation,
+                                                    0),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer,
+                                                    vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eGeometry | vk::ShaderStageFlagBits::eTessellationEvaluation,
+                                                    1),
+  };
+  auto descriptor_set_layout_ci = vk::DescriptorSetLayoutCreateInfo{}.setBindings(set_layout_bindings);
+  _descriptor_set_layout_ = app.device.createDescriptorSetLayoutUnique(descriptor_set_layout_ci);
+
+  auto pool_sizes = std::vector{
+      vks::initializers::descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 2),
+  };
+  _descriptor_pool_ = app.device.createDescriptorPoolUnique(vks::initializers::descriptorPoolCreateInfo(pool_sizes, 1));
+
+  auto alloc_info = vks::initializers::descriptorSetAllocateInfo(*_descriptor_pool_, &*_descriptor_set_layout_, 1);
+  _descriptor_set_ = app.device.allocateDescriptorSets(alloc_info)[0];
+  auto write_descriptor_sets = std::vector{
+      vks::initializers::writeDescriptorSet(_descriptor_set_, vk::DescriptorType::eStorageBuffer, 0, &_draw_data_.descriptor),
+      vks::initializers::writeDescriptorSet(_descriptor_set_, vk::DescriptorType::eStorageBuffer, 1, &_transforms_.descriptor),
+  };
+  app.device.updateDescriptorSets(write_descriptor_sets, {});
+
+  _batches_.clear();
+  _previous_batches_.clear();
+}
+
+void draw_buffers::destroy() {
+  _descriptor_set_ = nullptr;
+  _descriptor_pool_.reset();
+  _descriptor_set_layout_.reset();
+  _batch_data_.destroy();
+  _bounds_.destroy();
+  _commands_.destroy();
+  _transforms_.destroy();
+  _draw_data_.destroy();
+  _draw_count_ = 0;
+  _batches_.clear();
+  _previous_batches_.clear();
+}
+
+// Writes the per-draw data and draw commands of the scene's draw list, to be called whenever the draw list changed
+// The buffers are read by the GPU while drawing, so they may only be written while no frame is in flight
+// Returns whether the batches changed, indirect draws recorded before are only valid if they did not
+bool draw_buffers::update() {
+  const vulkan_gltf_scene& scene = *_scene_;
+  const auto& draws = scene.draw_list.draws;
+  auto* data = static_cast<draw_data*>(_draw_data_.mapped);
+  auto* commands = static_cast<vk::DrawIndexedIndirectCommand*>(_commands_.mapped);
+  auto* bounds = static_cast<draw_bounds*>(_bounds_.mapped);
+
+  _previous_batches_.swap(_batches_);
+  _batches_.clear();
+  for (std::size_t i = 0; i < draws.size(); ++i) {
+    const vulkan_gltf_scene::bvh_item& item = scene.bvh_items[draws[i].bvh_item];
+    const vulkan_gltf_scene::primitive& primitive = item.node->mesh.primitives[item.primitive_index];
+    const vulkan_gltf_scene::material& material = scene.materials[static_cast<std::size_t>(primitive.material_index)];
+    const std::uint32_t pipeline_index = material.pipeline_index;
+
+    data[i].transform_index = item.node->transform_index;
+    data[i].material_index = primitive.material_index;
+    commands[i].indexCount = primitive.index_count;
+    commands[i].instanceCount = 1;
+    commands[i].firstIndex = primitive.first_index;
+    commands[i].vertexOffset = 0;
+    commands[i].firstInstance = static_cast<std::uint32_t>(i);
+
+    // The draw list is sorted by pipeline and material within each bucket, so draws sharing them are mostly adjacent
+    if (_batches_.empty() || _batches_.back().pipeline_index != pipeline_index || _batches_.back().material_index != primitive.material_index) {
+      _batches_.push_back({static_cast<std::uint32_t>(i), 0, pipeline_index, primitive.material_index});
+    }
+    ++_batches_.back().draw_count;
+
+    bounds[i].min = primitive.bounds.min;
+    bounds[i].max = primitive.bounds.max;
+    bounds[i].batch = static_cast<std::uint32_t>(_batches_.size() - 1);
+    bounds[i].item = static_cast<std::uint32_t>(draws[i].bvh_item);
+  }
+  _draw_count_ = static_cast<std::uint32_t>(draws.size());
+
+  auto* batch_data = static_cast<draw_buffers::batch_data*>(_batch_data_.mapped);
+  for (std::size_t i = 0; i < _batches_.size(); ++i) {
+    const vulkan_gltf_scene::material& material = scene.materials[static_cast<std::size_t>(_batches_[i].material_index)];
+    batch_data[i].first_draw = _batches_[i].first_draw;
+    batch_data[i].draw_count = _batches_[i].draw_count;
+    batch_data[i].ordered = material.bucket == vulkan_gltf_scene::bucket_blend;
+  }
+  return _batches_ != _previous_batches_;
+}
+
+// Writes the world and normal matrices of the nodes moved by the scene's last update_transforms()
+// Like update(), may only be called while no frame is in flight
+void draw_buffers::update_transforms() {
+  const vulkan_gltf_scene& scene = *_scene_;
+  auto* transforms = static_cast<transform_data*>(_transforms_.mapped);
+  for (const std::uint32_t index : scene.transforms.updated) {
+    write_transform(transforms[index], scene.transforms.world_matrices[index]);
+  }
+}
+
+// Records one indirect draw per batch, binding the pipeline for the pass (unless one is given) and material descriptor set only when they change
+// Requires the multiDrawIndirect and drawIndirectFirstInstance features, and the descriptor set of the draw data to be bound
+// If culled commands are given, the batches are drawn from them with their draw counts read on the GPU, requiring the drawIndirectCount feature
+void draw_buffers::draw(vk::CommandBuffer command_buffer,
+                        vk::PipelineLayout pipeline_layout,
+                        vk::Pipeline pipeline,
+                        vulkan_gltf_scene::draw_stats* stats,
+                        const culled_commands* culled,
+                        vulkan_gltf_scene::draw_pass pass) const {
+  const vulkan_gltf_scene& scene = *_scene_;
+  auto offsets = std::array<vk::DeviceSize, 1>{{0}};
+  command_buffer.bindVertexBuffers(0, {*scene.vertices.buffer}, offsets);
+  command_buffer.bindIndexBuffer(*scene.indices.buffer.buffer, 0, vk::IndexType::eUint32);
+
+  vulkan_gltf_scene::draw_stats batch_stats;
+  vk::Pipeline bound_pipeline;
+  vk::DescriptorSet bound_descriptor_set;
+  for (std::size_t i = 0; i < _batches_.size(); ++i) {
+    const batch& batch = _batches_[i];
+    const vulkan_gltf_scene::material_pipeline& material_pipelines = scene.pipelines[batch.pipeline_index];
+    const vk::Pipeline batch_pipeline = pipeline ? pipeline : pass == vulkan_gltf_scene::pass_depth ? *material_pipelines.depth_pipeline : *material_pipelines.pipeline;
+    if (!batch_pipeline) {
+      continue;
+    }
+    if (batch_pipeline != bound_pipeline) {
+      command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, batch_pipeline);
+      bound_pipeline = batch_pipeline;
+      ++batch_stats.pipeline_binds;
+    }
+    const vk::DescriptorSet descriptor_set = scene.materials[static_cast<std::size_t>(batch.material_index)].descriptor_set;
+    if (descriptor_set != bound_descriptor_set) {
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 1, {descriptor_set}, {});
+      bound_descriptor_set = descriptor_set;
+      ++batch_stats.descriptor_binds;
+    }
+    if (culled) {
+      command_buffer.drawIndexedIndirectCount(culled->commands,
+                                              batch.first_draw * sizeof(vk::DrawIndexedIndirectCommand),
+                                              culled->counts,
+                                              i * sizeof(std::uint32_t),
+                                              batch.draw_count,
+                                              sizeof(vk::DrawIndexedIndirectCommand));
+    } else {
+      command_buffer.drawIndexedIndirect(*_commands_.buffer,
+                                         batch.first_draw * sizeof(vk::DrawIndexedIndirectCommand),
+                                         batch.draw_count,
+                                         sizeof(vk::DrawIndexedIndirectCommand));
+    }
+    // Upper bound if culled on the GPU
+    batch_stats.draws += batch.draw_count;
+    ++batch_stats.draw_calls;
+  }
+  if (stats) {
+    *stats += batch_stats;
+  }
+}
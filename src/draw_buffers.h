@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+#include <VulkanBuffer.h>
+
+#include "application_bound.h"
+#include "vulkan_gltf_scene.h"
+
+// Per-draw data and indirect draw commands for the draw list of a scene, both indexed by the position of a draw in the draw list
+// Draws pass their index as firstInstance, so shaders find their data at gl_InstanceIndex
+// World matrices are stored once per node in a separate buffer, which only needs the moved nodes rewritten
+class draw_buffers : public application_bound {
+ public:
+  // Layout of an element of the per-draw storage buffer (std430)
+  struct draw_data {
+    // Index of the draw's node in the transform buffer
+    std::uint32_t transform_index;
+    std::int32_t material_index;
+  };
+
+  // Layout of an element of the per-node transform storage buffer (std430)
+  struct transform_data {
+    glm::mat4 model;
+    // Inverse transpose of the model matrix, for normals
+    glm::mat4 normal;
+  };
+
+  // Object space bounds of a draw, for culling on the GPU (std430)
+  struct draw_bounds {
+    glm::vec3 min;
+    // Index of the draw's batch
+    std::uint32_t batch;
+    glm::vec3 max;
+    // Index of the draw's BVH item, which stays the same while the draw list is reordered
+    std::uint32_t item;
+  };
+
+  // Layout of an element of the batch storage buffer (std430)
+  struct batch_data {
+    std::uint32_t first_draw;
+    std::uint32_t draw_count;
+    // Set if the draws of the batch must stay in order, as blended draws do
+    vk::Bool32 ordered;
+    std::uint32_t padding;
+  };
+
+  // Draw commands written by a culling pass in place of the commands of the draw buffers
+  // The draws of batch i are at the same offsets as in the draw buffers, their number is element i of counts
+  struct culled_commands {
+    vk::Buffer commands;
+    vk::Buffer counts;
+  };
+
+  // Consecutive draws sharing pipeline and material, issued with a single indirect draw
+  struct batch {
+    std::uint32_t first_draw;
+    std::uint32_t draw_count;
+    std::uint32_t pipeline_index;
+    std::int32_t material_index;
+
+    bool operator==(const batch& other) const noexcept {
+      return first_draw == other.first_draw && draw_count == other.draw_count && pipeline_index == other.pipeline_index &&
+             material_index == other.material_index;
+    }
+  };
+
+  // Must be set before binding, the buffers are sized for all primitives of the scene
+  void set_scene(const vulkan_gltf_scene& scene) noexcept { _scene_ = &scene; }
+
+  bool update();
+  void update_transforms();
+  void draw(vk::CommandBuffer command_buffer,
+            vk::PipelineLayout pipeline_layout,
+            vk::Pipeline pipeline = {},
+            vulkan_gltf_scene::draw_stats* stats = nullptr,
+            const culled_commands* culled = nullptr,
+            vulkan_gltf_scene::draw_pass pass = vulkan_gltf_scene::pass_shading) const;
+
+  vk::DescriptorSetLayout descriptor_set_layout() const { return *_descriptor_set_layout_; }
+  vk::DescriptorSet descriptor_set() const { return _descriptor_set_; }
+  const std::vector<batch>& batches() const noexcept { return _batches_; }
+  // Number of draws in the draw list as of the last update()
+  std::uint32_t draw_count() const noexcept { return _draw_count_; }
+  // Buffers for the culling pass, sized for every primitive of the scene (or every node for the transforms)
+  const vks::Buffer& draw_data_buffer() const noexcept { return _draw_data_; }
+  const vks::Buffer& transform_buffer() const noexcept { return _transforms_; }
+  const vks::Buffer& commands_buffer() const noexcept { return _commands_; }
+  const vks::Buffer& bounds_buffer() const noexcept { return _bounds_; }
+  const vks::Buffer& batch_buffer() const noexcept { return _batch_data_; }
+  std::uint32_t capacity() const noexcept { return _capacity_; }
+
+ protected:
+  void setup(VulkanExampleBase& app) override;
+  void destroy() override;
+
+ private:
+  const vulkan_gltf_scene* _scene_ = nullptr;
+
+  vks::Buffer _draw_data_;
+  vks::Buffer _transforms_;
+  vks::Buffer _commands_;
+  vks::Buffer _bounds_;
+  vks::Buffer _batch_data_;
+  std::uint32_t _capacity_ = 0;
+  std::uint32_t _draw_count_ = 0;
+  std::vector<batch> _batches_;
+  std::vector<batch> _previous_batches_;
+
+  vk::UniqueDescriptorSetLayout _descriptor_set_layout_;
+  vk::UniqueDescriptorPool _descriptor_pool_;
+  vk::DescriptorSet _descriptor_set_;
+};
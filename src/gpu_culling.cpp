@@ -0,0 +1,419 @@
+#include "gpu_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include <VulkanTransformKernels.h>
+
+namespace {
+constexpr std::uint32_t CULL_GROUP_SIZE = 64;
+constexpr std::uint32_t PYRAMID_GROUP_SIZE = 8;
+constexpr vk::Format PYRAMID_FORMAT = vk::Format::eR32Sfloat;
+
+struct cull_push_constants {
+  std::uint32_t draw_count;
+  std::uint32_t phase;
+};
+
+struct pyramid_push_constants {
+  glm::ivec2 source_size;
+  glm::ivec2 destination_size;
+};
+
+std::uint32_t next_power_of_two(std::uint32_t value) {
+  std::uint32_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+}  // namespace
+
+void gpu_culling::setup(VulkanExampleBase& app) {
+  if (!_draw_buffers_) {
+    throw std::runtime_error("gpu_culling::setup(): draw buffers not bound to instance");
+  }
+
+  const vk::DeviceSize capacity = _draw_buffers_->capacity();
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eUniformBuffer,
+                                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                 &_params_,
+                                 sizeof(params));
+  _params_.map();
+  for (output& output : _outputs_) {
+    app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+                                   vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                   &output.culled_commands,
+                                   capacity * sizeof(vk::DrawIndexedIndirectCommand));
+    // One count per batch, every draw may start a batch of its own
+    app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                                   vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                   &output.counts,
+                                   capacity * sizeof(std::uint32_t));
+  }
+  // The draw buffers are sized for every BVH item
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                                 vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                 &_visibility_,
+                                 capacity * sizeof(std::uint32_t));
+  app.vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                 &_stats_buffer_,
+                                 sizeof(stats));
+  _stats_buffer_.map();
+  _stats_ = {};
+
+  // Nothing was visible before the first frame, so it is drawn entirely by the late phase
+  auto clear_cmd = app.vulkanDevice->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+  clear_cmd->fillBuffer(*_visibility_.buffer, 0, VK_WHOLE_SIZE, 0);
+  auto clear_barrier = vks::initializers::memoryBarrier();
+  clear_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  clear_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+  clear_cmd->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, {clear_barrier}, {}, {});
+  app.vulkanDevice->flushCommandBuffer(clear_cmd, app.queue, true);
+
+  auto sampler_info = vks::initializers::samplerCreateInfo();
+  sampler_info.magFilter = vk::Filter::eNearest;
+  sampler_info.minFilter = vk::Filter::eNearest;
+  sampler_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+  _sampler_ = app.device.createSamplerUnique(sampler_info);
+
+  // Culling pass
+  auto cull_bindings = std::vector{
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eCompute, 0),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 2),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 3),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 4),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 5),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 6),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 7),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, 8),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 9),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 10),
+  };
+  _cull_set_layout_ = app.device.createDescriptorSetLayoutUnique(vks::initializers::descriptorSetLayoutCreateInfo(cull_bindings));
+
+  auto cull_push_constant_range = vks::initializers::pushConstantRange(vk::ShaderStageFlagBits::eCompute, sizeof(cull_push_constants), 0);
+  auto cull_layout_info = vks::initializers::pipelineLayoutCreateInfo(&*_cull_set_layout_, 1);
+  cull_layout_info.pushConstantRangeCount = 1;
+  cull_layout_info.pPushConstantRanges = &cull_push_constant_range;
+  _cull_pipeline_layout_ = app.device.createPipelineLayoutUnique(cull_layout_info);
+
+  auto cull_pipeline_info = vks::initializers::computePipelineCreateInfo(*_cull_pipeline_layout_);
+  cull_pipeline_info.stage = app.loadShader(app.getShadersPath() + "culling/cull.comp.spv", vk::ShaderStageFlagBits::eCompute);
+  _cull_pipeline_ = app.device.createComputePipelineUnique(*app.pipelineCache, cull_pipeline_info).value;
+
+  const auto set_count = static_cast<std::uint32_t>(_outputs_.size());
+  auto pool_sizes = std::vector{
+      vks::initializers::descriptorPoolSize(vk::DescriptorType::eUniformBuffer, set_count),
+      vks::initializers::descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 9 * set_count),
+      vks::initializers::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, set_count),
+  };
+  _descriptor_pool_ = app.device.createDescriptorPoolUnique(vks::initializers::descriptorPoolCreateInfo(pool_sizes, set_count));
+  const std::vector<vk::DescriptorSetLayout> cull_set_layouts(set_count, *_cull_set_layout_);
+  auto alloc_info = vks::initializers::descriptorSetAllocateInfo(*_descriptor_pool_, cull_set_layouts.data(), set_count);
+  const std::vector<vk::DescriptorSet> cull_sets = app.device.allocateDescriptorSets(alloc_info);
+
+  // The draw buffers are never recreated while bound, the depth pyramid is written by _create_depth_pyramid()
+  auto draw_data_descriptor = _draw_buffers_->draw_data_buffer().descriptor;
+  auto transform_descriptor = _draw_buffers_->transform_buffer().descriptor;
+  auto bounds_descriptor = _draw_buffers_->bounds_buffer().descriptor;
+  auto batch_descriptor = _draw_buffers_->batch_buffer().descriptor;
+  auto commands_descriptor = _draw_buffers_->commands_buffer().descriptor;
+  std::vector<vk::WriteDescriptorSet> write_descriptor_sets;
+  for (std::size_t i = 0; i < _outputs_.size(); ++i) {
+    output& output = _outputs_[i];
+    output.cull_set = cull_sets[i];
+    write_descriptor_sets.insert(write_descriptor_sets.end(), {
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eUniformBuffer, 0, &_params_.descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 1, &draw_data_descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 2, &bounds_descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 3, &batch_descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 4, &commands_descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 5, &output.culled_commands.descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 6, &output.counts.descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 7, &_stats_buffer_.descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 9, &_visibility_.descriptor),
+        vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eStorageBuffer, 10, &transform_descriptor),
+    });
+  }
+  app.device.updateDescriptorSets(write_descriptor_sets, {});
+
+  // Depth pyramid pass
+  auto pyramid_bindings = std::vector{
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, 0),
+      vks::initializers::descriptorSetLayoutBinding(vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute, 1),
+  };
+  _pyramid_set_layout_ = app.device.createDescriptorSetLayoutUnique(vks::initializers::descriptorSetLayoutCreateInfo(pyramid_bindings));
+
+  auto pyramid_push_constant_range = vks::initializers::pushConstantRange(vk::ShaderStageFlagBits::eCompute, sizeof(pyramid_push_constants), 0);
+  auto pyramid_layout_info = vks::initializers::pipelineLayoutCreateInfo(&*_pyramid_set_layout_, 1);
+  pyramid_layout_info.pushConstantRangeCount = 1;
+  pyramid_layout_info.pPushConstantRanges = &pyramid_push_constant_range;
+  _pyramid_pipeline_layout_ = app.device.createPipelineLayoutUnique(pyramid_layout_info);
+
+  auto pyramid_pipeline_info = vks::initializers::computePipelineCreateInfo(*_pyramid_pipeline_layout_);
+  pyramid_pipeline_info.stage = app.loadShader(app.getShadersPath() + "culling/depth_pyramid.comp.spv", vk::ShaderStageFlagBits::eCompute);
+  _pyramid_pipeline_ = app.device.createComputePipelineUnique(*app.pipelineCache, pyramid_pipeline_info).value;
+  pyramid_pipeline_info.stage = app.loadShader(app.getShadersPath() + "culling/depth_pyramid_multisample.comp.spv", vk::ShaderStageFlagBits::eCompute);
+  _pyramid_multisample_pipeline_ = app.device.createComputePipelineUnique(*app.pipelineCache, pyramid_pipeline_info).value;
+}
+
+void gpu_culling::destroy() {
+  _destroy_depth_pyramid();
+
+  _pyramid_multisample_pipeline_.reset();
+  _pyramid_pipeline_.reset();
+  _pyramid_pipeline_layout_.reset();
+  _pyramid_set_layout_.reset();
+
+  for (output& output : _outputs_) {
+    output.cull_set = nullptr;
+  }
+  _descriptor_pool_.reset();
+  _cull_pipeline_.reset();
+  _cull_pipeline_layout_.reset();
+  _cull_set_layout_.reset();
+  _sampler_.reset();
+
+  _stats_buffer_.destroy();
+  _visibility_.destroy();
+  for (output& output : _outputs_) {
+    output.counts.destroy();
+    output.culled_commands.destroy();
+  }
+  _params_.destroy();
+  _occlusion_supported_ = false;
+}
+
+// Recreates the depth pyramid for the depth buffer drawn to, to be called after binding and whenever the depth buffer is recreated
+void gpu_culling::resize(vk::Image depth_image, vk::SampleCountFlagBits sample_count) {
+  _destroy_depth_pyramid();
+  _create_depth_pyramid(depth_image, sample_count);
+}
+
+void gpu_culling::_create_depth_pyramid(vk::Image depth_image, vk::SampleCountFlagBits sample_count) {
+  VulkanExampleBase& app = this->app();
+
+  // Depth buffers are only created with sampled usage if their format, and for multisampled ones their sample count, supports it
+  _occlusion_supported_ = (app.physicalDevice.getFormatProperties(app.depthFormat).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage) &&
+                          (sample_count == vk::SampleCountFlagBits::e1 || (app.deviceProperties.properties.limits.sampledImageDepthSampleCounts & sample_count));
+  _pyramid_.depth_image = depth_image;
+  _pyramid_.sample_count = sample_count;
+
+  // Level 0 halves the depth buffer rounded up to a power of two, so every texel covers exactly 2x2 texels of the level below
+  _pyramid_.depth_size = vk::Extent2D{app.width, app.height};
+  const std::uint32_t padded_width = next_power_of_two(app.width);
+  const std::uint32_t padded_height = next_power_of_two(app.height);
+  _pyramid_.level_sizes.clear();
+  do {
+    const std::uint32_t shift = static_cast<std::uint32_t>(_pyramid_.level_sizes.size()) + 1;
+    _pyramid_.level_sizes.push_back({std::max(padded_width >> shift, 1u), std::max(padded_height >> shift, 1u)});
+  } while (_pyramid_.level_sizes.back().width > 1 || _pyramid_.level_sizes.back().height > 1);
+  const auto level_count = static_cast<std::uint32_t>(_pyramid_.level_sizes.size());
+
+  auto image_info = vks::initializers::imageCreateInfo();
+  image_info.imageType = vk::ImageType::e2D;
+  image_info.format = PYRAMID_FORMAT;
+  image_info.extent = vk::Extent3D{_pyramid_.level_sizes[0].width, _pyramid_.level_sizes[0].height, 1};
+  image_info.mipLevels = level_count;
+  image_info.arrayLayers = 1;
+  image_info.samples = vk::SampleCountFlagBits::e1;
+  image_info.tiling = vk::ImageTiling::eOptimal;
+  image_info.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+  image_info.initialLayout = vk::ImageLayout::eUndefined;
+  _pyramid_.image = app.device.createImageUnique(image_info);
+  _pyramid_.memory = app.vulkanDevice->allocator.allocateForImage(*_pyramid_.image, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+  auto view_info = vks::initializers::imageViewCreateInfo();
+  view_info.image = *_pyramid_.image;
+  view_info.viewType = vk::ImageViewType::e2D;
+  view_info.format = PYRAMID_FORMAT;
+  view_info.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, level_count, 0, 1};
+  _pyramid_.view = app.device.createImageViewUnique(view_info);
+  for (std::uint32_t level = 0; level < level_count; ++level) {
+    view_info.subresourceRange.baseMipLevel = level;
+    view_info.subresourceRange.levelCount = 1;
+    _pyramid_.level_views.emplace_back(app.device.createImageViewUnique(view_info));
+  }
+
+  // Only the depth aspect can be sampled
+  view_info.image = depth_image;
+  view_info.format = app.depthFormat;
+  view_info.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1};
+  if (_occlusion_supported_) {
+    _pyramid_.depth_view = app.device.createImageViewUnique(view_info);
+  }
+
+  // The pyramid stays in the general layout, cleared to the far plane until it is first built
+  auto clear_cmd = app.vulkanDevice->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+  const vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, level_count, 0, 1};
+  auto barrier = vks::initializers::imageMemoryBarrier();
+  barrier.image = *_pyramid_.image;
+  barrier.oldLayout = vk::ImageLayout::eUndefined;
+  barrier.newLayout = vk::ImageLayout::eGeneral;
+  barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.subresourceRange = range;
+  clear_cmd->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {barrier});
+  clear_cmd->clearColorImage(*_pyramid_.image, vk::ImageLayout::eGeneral, vk::ClearColorValue(std::array{1.0f, 1.0f, 1.0f, 1.0f}), {range});
+  barrier.oldLayout = vk::ImageLayout::eGeneral;
+  barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+  clear_cmd->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, {}, {}, {barrier});
+  app.vulkanDevice->flushCommandBuffer(clear_cmd, app.queue, true);
+
+  auto pool_sizes = std::vector{
+      vks::initializers::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, level_count),
+      vks::initializers::descriptorPoolSize(vk::DescriptorType::eStorageImage, level_count),
+  };
+  _pyramid_.descriptor_pool = app.device.createDescriptorPoolUnique(vks::initializers::descriptorPoolCreateInfo(pool_sizes, level_count));
+  const std::vector<vk::DescriptorSetLayout> set_layouts(level_count, *_pyramid_set_layout_);
+  auto alloc_info = vks::initializers::descriptorSetAllocateInfo(*_pyramid_.descriptor_pool, set_layouts.data(), level_count);
+  _pyramid_.level_sets = app.device.allocateDescriptorSets(alloc_info);
+
+  std::vector<vk::DescriptorImageInfo> image_infos;
+  image_infos.reserve(level_count * 2 + 1);
+  std::vector<vk::WriteDescriptorSet> write_descriptor_sets;
+  for (std::uint32_t level = 0; level < level_count; ++level) {
+    // Without a sampled depth buffer, the first level is never built
+    if (level > 0 || _occlusion_supported_) {
+      image_infos.push_back(level == 0 ? vks::initializers::descriptorImageInfo(*_sampler_, *_pyramid_.depth_view, vk::ImageLayout::eDepthStencilReadOnlyOptimal)
+                                       : vks::initializers::descriptorImageInfo(*_sampler_, *_pyramid_.level_views[level - 1], vk::ImageLayout::eGeneral));
+      write_descriptor_sets.push_back(
+          vks::initializers::writeDescriptorSet(_pyramid_.level_sets[level], vk::DescriptorType::eCombinedImageSampler, 0, &image_infos.back()));
+    }
+    image_infos.push_back(vks::initializers::descriptorImageInfo({}, *_pyramid_.level_views[level], vk::ImageLayout::eGeneral));
+    write_descriptor_sets.push_back(vks::initializers::writeDescriptorSet(_pyramid_.level_sets[level], vk::DescriptorType::eStorageImage, 1, &image_infos.back()));
+  }
+  image_infos.push_back(vks::initializers::descriptorImageInfo(*_sampler_, *_pyramid_.view, vk::ImageLayout::eGeneral));
+  for (const output& output : _outputs_) {
+    write_descriptor_sets.push_back(vks::initializers::writeDescriptorSet(output.cull_set, vk::DescriptorType::eCombinedImageSampler, 8, &image_infos.back()));
+  }
+  app.device.updateDescriptorSets(write_descriptor_sets, {});
+}
+
+void gpu_culling::_destroy_depth_pyramid() {
+  _pyramid_.level_sets.clear();
+  _pyramid_.descriptor_pool.reset();
+  _pyramid_.depth_view.reset();
+  _pyramid_.level_views.clear();
+  _pyramid_.view.reset();
+  _pyramid_.memory.reset();
+  _pyramid_.image.reset();
+  _pyramid_.level_sizes.clear();
+}
+
+// Writes the parameters of the next culling passes, culling against the frustum of frustum_view_projection and testing occlusion in the
+// depth buffer drawn with view_projection
+// The parameters are read by the GPU while culling, so they may only be written while no frame is in flight
+void gpu_culling::update(const glm::mat4& view_projection, const glm::mat4& frustum_view_projection) {
+  auto& values = *static_cast<params*>(_params_.mapped);
+  values.view_projection = view_projection;
+  vks::transforms::extractFrustumPlanes(frustum_view_projection, values.frustum_planes);
+  values.depth_size = glm::vec2{_pyramid_.depth_size.width, _pyramid_.depth_size.height};
+  values.pyramid_levels = static_cast<std::uint32_t>(_pyramid_.level_sizes.size());
+}
+
+// Records the culling pass of a phase, to be recorded outside of the render pass drawing its culled commands
+// The late phase tests against the depth pyramid, which must have been built since the early phase was drawn
+void gpu_culling::record_cull(vk::CommandBuffer command_buffer, phase phase) const {
+  const std::uint32_t draw_count = _draw_buffers_->draw_count();
+  const output& output = _output(phase);
+
+  // Previous frames drew from the counts and culled commands, and the late phase reads the visibility written by the last one
+  auto barrier = vks::initializers::memoryBarrier();
+  barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+  command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect,
+                                 vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+                                 {}, {barrier}, {}, {});
+
+  command_buffer.fillBuffer(*output.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+  // The draws of a frame are counted once, by the phase deciding their visibility
+  if (phase != phase_early) {
+    command_buffer.fillBuffer(*_stats_buffer_.buffer, 0, VK_WHOLE_SIZE, 0);
+  }
+  barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+  command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, {barrier}, {}, {});
+
+  if (draw_count > 0) {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *_cull_pipeline_);
+    const cull_push_constants push_constants = {draw_count, phase};
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *_cull_pipeline_layout_, 0, {output.cull_set}, {});
+    command_buffer.pushConstants<cull_push_constants>(*_cull_pipeline_layout_, vk::ShaderStageFlagBits::eCompute, 0, {push_constants});
+    command_buffer.dispatch((draw_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+  }
+
+  barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead;
+  command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect, {}, {barrier}, {}, {});
+}
+
+// Records building the depth pyramid from the depth buffer, to be recorded between the render passes of the early and late phases
+// The depth buffer is read in the read-only layout and returned to the attachment layout for the late phase to draw to
+void gpu_culling::record_depth_pyramid(vk::CommandBuffer command_buffer) const {
+  if (!_occlusion_supported_) {
+    return;
+  }
+
+  vk::ImageAspectFlags depth_aspect = vk::ImageAspectFlagBits::eDepth;
+  if (app().depthFormat >= vk::Format::eD16UnormS8Uint) {
+    depth_aspect |= vk::ImageAspectFlagBits::eStencil;
+  }
+  auto depth_barrier = vks::initializers::imageMemoryBarrier();
+  depth_barrier.image = _pyramid_.depth_image;
+  depth_barrier.oldLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  depth_barrier.newLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+  depth_barrier.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+  depth_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+  depth_barrier.subresourceRange = vk::ImageSubresourceRange{depth_aspect, 0, 1, 0, 1};
+  command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+                                 vk::PipelineStageFlagBits::eComputeShader,
+                                 {}, {}, {}, {depth_barrier});
+
+  auto barrier = vks::initializers::memoryBarrier();
+  barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+  for (std::size_t level = 0; level < _pyramid_.level_sizes.size(); ++level) {
+    // The first level resolves the samples of a multisampled depth buffer
+    if (level == 0) {
+      command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                  _pyramid_.sample_count == vk::SampleCountFlagBits::e1 ? *_pyramid_pipeline_ : *_pyramid_multisample_pipeline_);
+    } else if (level == 1 && _pyramid_.sample_count != vk::SampleCountFlagBits::e1) {
+      command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *_pyramid_pipeline_);
+    }
+    const vk::Extent2D source_size = level == 0 ? _pyramid_.depth_size : _pyramid_.level_sizes[level - 1];
+    const vk::Extent2D destination_size = _pyramid_.level_sizes[level];
+    const pyramid_push_constants push_constants = {
+        glm::ivec2{source_size.width, source_size.height},
+        glm::ivec2{destination_size.width, destination_size.height},
+    };
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *_pyramid_pipeline_layout_, 0, {_pyramid_.level_sets[level]}, {});
+    command_buffer.pushConstants<pyramid_push_constants>(*_pyramid_pipeline_layout_, vk::ShaderStageFlagBits::eCompute, 0, {push_constants});
+    command_buffer.dispatch((destination_size.width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                            (destination_size.height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                            1);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, {barrier}, {}, {});
+  }
+
+  depth_barrier.oldLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+  depth_barrier.newLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  depth_barrier.srcAccessMask = {};
+  depth_barrier.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+  command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                 vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+                                 {}, {}, {}, {depth_barrier});
+}
+
+// Reads the results of the last culling pass, the frame must have completed
+void gpu_culling::read_stats() {
+  std::memcpy(&_stats_, _stats_buffer_.mapped, sizeof(stats));
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+#include <VulkanBuffer.h>
+
+#include "application_bound.h"
+#include "draw_buffers.h"
+
+// Culls the draws of draw_buffers in compute passes against the view frustum and, with occlusion culling, a depth pyramid (Hi-Z)
+// built from the depth buffer, compacting the surviving draws of each batch into an indirect buffer with draw counts
+// Occlusion culling draws a frame in two phases: the early phase draws what was visible last frame, the depth pyramid is then built
+// from its depth buffer, and the late phase tests every draw against it and draws those that became visible
+class gpu_culling : public application_bound {
+ public:
+  enum phase : std::uint32_t {
+    // Frustum culling only, drawing everything in one pass
+    phase_all,
+    phase_early,
+    phase_late,
+  };
+
+  struct stats {
+    std::uint32_t visible = 0;
+    std::uint32_t frustum_culled = 0;
+    std::uint32_t occlusion_culled = 0;
+  };
+
+  // Must be set before binding
+  void set_draw_buffers(const draw_buffers& draw_buffers) noexcept { _draw_buffers_ = &draw_buffers; }
+
+  // Whether the depth buffer can be sampled to build the depth pyramid
+  bool occlusion_supported() const noexcept { return _occlusion_supported_; }
+
+  void resize(vk::Image depth_image, vk::SampleCountFlagBits sample_count);
+  void update(const glm::mat4& view_projection, const glm::mat4& frustum_view_projection);
+  void record_cull(vk::CommandBuffer command_buffer, phase phase) const;
+  void record_depth_pyramid(vk::CommandBuffer command_buffer) const;
+  void read_stats();
+
+  // The early phase has its own commands, as both phases are drawn
+  draw_buffers::culled_commands culled_commands(phase phase) const noexcept {
+    const output& output = _output(phase);
+    return {*output.culled_commands.buffer, *output.counts.buffer};
+  }
+  // Results of the last frame read by read_stats()
+  const stats& last_stats() const noexcept { return _stats_; }
+
+ protected:
+  void setup(VulkanExampleBase& app) override;
+  void destroy() override;
+
+ private:
+  // Layout of the uniform buffer of the culling pass (std140)
+  struct params {
+    glm::mat4 view_projection;
+    glm::vec4 frustum_planes[6];
+    glm::vec2 depth_size;
+    std::uint32_t pyramid_levels;
+    std::uint32_t padding;
+  };
+
+  // Draws surviving a culling pass, with the descriptor set writing them
+  struct output {
+    vks::Buffer culled_commands;
+    vks::Buffer counts;
+    vk::DescriptorSet cull_set;
+  };
+
+  const output& _output(phase phase) const noexcept { return _outputs_[phase == phase_early ? 1 : 0]; }
+  void _create_depth_pyramid(vk::Image depth_image, vk::SampleCountFlagBits sample_count);
+  void _destroy_depth_pyramid();
+
+  const draw_buffers* _draw_buffers_ = nullptr;
+  bool _occlusion_supported_ = false;
+
+  vks::Buffer _params_;
+  std::array<output, 2> _outputs_;
+  // Per BVH item, whether it was visible at the end of the last late phase
+  vks::Buffer _visibility_;
+  // stats, persistently mapped for reading back
+  vks::Buffer _stats_buffer_;
+  stats _stats_;
+
+  vk::UniqueDescriptorSetLayout _cull_set_layout_;
+  vk::UniquePipelineLayout _cull_pipeline_layout_;
+  vk::UniquePipeline _cull_pipeline_;
+  vk::UniqueDescriptorPool _descriptor_pool_;
+
+  vk::UniqueDescriptorSetLayout _pyramid_set_layout_;
+  vk::UniquePipelineLayout _pyramid_pipeline_layout_;
+  vk::UniquePipeline _pyramid_pipeline_;
+  // Builds the first level from a multisampled depth buffer
+  vk::UniquePipeline _pyramid_multisample_pipeline_;
+  vk::UniqueSampler _sampler_;
+
+  // Recreated with the depth buffer
+  struct {
+    vk::Image depth_image;
+    vk::Extent2D depth_size;
+    vk::SampleCountFlagBits sample_count = vk::SampleCountFlagBits::e1;
+    std::vector<vk::Extent2D> level_sizes;
+    vk::UniqueImage image;
+    vks::Allocation memory;
+    // All levels, for the culling pass
+    vk::UniqueImageView view;
+    std::vector<vk::UniqueImageView> level_views;
+    vk::UniqueImageView depth_view;
+    vk::UniqueDescriptorPool descriptor_pool;
+    // Set i reads level i - 1 (or the depth buffer) and writes level i
+    std::vector<vk::DescriptorSet> level_sets;
+  } _pyramid_;
+};
@@ -9,6 +9,8 @@
 #include <fmt/format.h>
 
 constexpr bool ENABLE_VALIDATION = false;
+// Fewer draws than this aren't worth recording on another thread
+constexpr std::size_t MIN_DRAWS_PER_COMMAND_BUFFER = 256;
 
 vulkan_scene_renderer::vulkan_scene_renderer() : VulkanExampleBase(ENABLE_VALIDATION) {
   title = "Vulkan Scene Renderer";
@@ -22,6 +24,9 @@ vulkan_scene_renderer::vulkan_scene_renderer() : VulkanExampleBase(ENABLE_VALIDA
 
 vulkan_scene_renderer::~vulkan_scene_renderer() {
   _screenshot_.unbind();
+  _command_recorder_.unbind();
+  _gpu_culling_.unbind();
+  _draw_buffers_.unbind();
 
   _light_cube_.unbind();
   _gs_pipeline_.unbind();
@@ -44,10 +49,180 @@ void vulkan_scene_renderer::getEnabledFeatures() {
   enabledFeatures.features.geometryShader = deviceFeatures.features.geometryShader;
   enabledFeatures.features.tessellationShader = deviceFeatures.features.tessellationShader;
   enabledFeatures.features.pipelineStatisticsQuery = deviceFeatures.features.pipelineStatisticsQuery;
+  // Everything is drawn from secondary command buffers, which the statistics query may only stay active across with this
+  enabledFeatures.features.inheritedQueries = deviceFeatures.features.inheritedQueries;
   enabledFeatures.features.fillModeNonSolid = deviceFeatures.features.fillModeNonSolid;
+  // Required to issue a batch of draws with a single indirect draw
+  enabledFeatures.features.multiDrawIndirect = deviceFeatures.features.multiDrawIndirect;
+  enabledFeatures.features.drawIndirectFirstInstance = deviceFeatures.features.drawIndirectFirstInstance;
+  _use_indirect_draws_ = enabledFeatures.features.multiDrawIndirect && enabledFeatures.features.drawIndirectFirstInstance;
+  // Required to cull indirect draws on the GPU, which then decides how many draws of each batch are issued
+  const auto vulkan12_features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>().get<vk::PhysicalDeviceVulkan12Features>();
+  _enabled_vulkan12_features_.drawIndirectCount = vulkan12_features.drawIndirectCount;
+  deviceCreatepNextChain = &_enabled_vulkan12_features_;
+}
+
+void vulkan_scene_renderer::getEnabledExtensions() {
+  // Used by the texture residency manager to keep textures within the device memory budget
+  if (vulkanDevice->extensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+    enabledDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    _memory_budget_supported_ = true;
+  }
 }
 
 void vulkan_scene_renderer::buildCommandBuffers() {
+  _invalidate(dependency_all);
+  _record_command_buffers();
+}
+
+void vulkan_scene_renderer::overlayChanged() {
+  _invalidate(dependency_overlay);
+}
+
+// Marks everything recorded with the given dependencies for re-recording by the next call to _record_command_buffers()
+void vulkan_scene_renderer::_invalidate(std::uint32_t dependencies) {
+  _invalid_dependencies_ |= dependencies;
+}
+
+// Re-records the segments depending on anything invalidated since the last call, and the primary command buffers executing them
+void vulkan_scene_renderer::_record_command_buffers() {
+  // World matrices are read from the transform buffer, so moved nodes only need theirs rewritten unless the draw order changed
+  bool draws_changed = _draw_list_changed_;
+  if (_gltf_scene_.transforms.any_dirty) {
+    _gltf_scene_.update_transforms();
+    _draw_buffers_.update_transforms();
+    // A change to the draw list from before this call must not be lost if rebuilding it keeps the new order
+    draws_changed |= _gltf_scene_.build_draw_list(camera.matrices.view);
+    _draw_list_changed_ |= draws_changed;
+  }
+  if (draws_changed) {
+    // Indirect draws are recorded per batch, direct draws per primitive
+    const bool batches_changed = _draw_buffers_.update();
+    if (_use_indirect_draws_ ? batches_changed : _draw_list_changed_) {
+      _invalidate(dependency_draws);
+    }
+    _draw_list_changed_ = false;
+  }
+
+  if (_invalid_dependencies_ == 0) {
+    return;
+  }
+
+  // What the command buffers of each segment record, the normals are drawn with the material descriptor sets bound as well
+  constexpr std::array<std::uint32_t, segment_count> segment_dependencies = {
+      dependency_depth_pipelines | dependency_material_descriptors | dependency_draws,
+      dependency_scene_pipelines | dependency_material_descriptors | dependency_draws,
+      dependency_depth_pipelines | dependency_material_descriptors | dependency_draws,
+      dependency_scene_pipelines | dependency_material_descriptors | dependency_draws,
+      dependency_normals_pipeline | dependency_material_descriptors | dependency_draws,
+      dependency_light | dependency_overlay,
+  };
+
+  const vk::Viewport viewport = vks::initializers::viewport(static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f);
+  const vk::Rect2D scissor = vks::initializers::rect2D(static_cast<std::int32_t>(width), static_cast<std::int32_t>(height), 0, 0);
+
+  vk::CommandBufferInheritanceInfo inheritance_info = vks::initializers::commandBufferInheritanceInfo();
+  inheritance_info.renderPass = *renderPass;
+  inheritance_info.subpass = 0;
+  inheritance_info.pipelineStatistics = _query_pool_.pipeline_statistics();
+
+  // Dynamic state and bound descriptor sets aren't inherited from the primary command buffer
+  const auto set_dynamic_state = [&](vk::CommandBuffer command_buffer) {
+    command_buffer.setViewport(0, {viewport});
+    command_buffer.setScissor(0, {scissor});
+    command_buffer.setLineWidth(1.0f);
+  };
+
+  // Direct scene draws are split into ranges recorded in parallel, indirect draws only take a command per batch
+  const std::size_t draw_count = _gltf_scene_.draw_count();
+  const std::size_t chunk_count =
+      _use_indirect_draws_ ? 1 : std::min<std::size_t>(_command_recorder_.thread_count(), (draw_count + MIN_DRAWS_PER_COMMAND_BUFFER - 1) / MIN_DRAWS_PER_COMMAND_BUFFER);
+  // With occlusion culling the scene is drawn in two phases, and the normals of the draws of both phases along with the late phase
+  const bool two_phase = _gpu_occlusion_culling_active();
+  const draw_buffers::culled_commands early_culled_commands = _gpu_culling_.culled_commands(gpu_culling::phase_early);
+  const draw_buffers::culled_commands culled_commands = _gpu_culling_.culled_commands(two_phase ? gpu_culling::phase_late : gpu_culling::phase_all);
+  const auto record_scene = [&](render_segment segment,
+                                std::size_t count,
+                                vk::Pipeline pipeline,
+                                std::initializer_list<const draw_buffers::culled_commands*> culled,
+                                vulkan_gltf_scene::draw_pass pass = vulkan_gltf_scene::pass_shading) {
+    std::vector<vulkan_gltf_scene::draw_stats> chunk_stats(count);
+    _command_recorder_.record(segment, count, inheritance_info, [&](vk::CommandBuffer command_buffer, std::size_t chunk) {
+      set_dynamic_state(command_buffer);
+      // Bind scene matrices descriptor to set 0
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *_pipeline_layout_, 0, {_matrices_ubo_.descriptor_set()}, {});
+      // Bind settings descriptor to set 2
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *_pipeline_layout_, 2, {_settings_ubo_.descriptor_set()}, {});
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *_pipeline_layout_, 3, {_light_ubo_.descriptor_set()}, {});
+      // Bind per-draw data to set 4
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *_pipeline_layout_, 4, {_draw_buffers_.descriptor_set()}, {});
+
+      // POI: Draw the glTF scene, once per set of culled commands (nullptr draws all batches unculled)
+      if (_use_indirect_draws_) {
+        for (const draw_buffers::culled_commands* commands : culled) {
+          _draw_buffers_.draw(command_buffer, *_pipeline_layout_, pipeline, &chunk_stats[chunk], commands, pass);
+        }
+        return;
+      }
+      const std::size_t first = draw_count * chunk / chunk_count;
+      const std::size_t last = draw_count * (chunk + 1) / chunk_count;
+      _gltf_scene_.draw_range(command_buffer, *_pipeline_layout_, first, last, pipeline, &chunk_stats[chunk], pass);
+    });
+    _draw_stats_[segment] = {};
+    for (const vulkan_gltf_scene::draw_stats& stats : chunk_stats) {
+      _draw_stats_[segment] += stats;
+    }
+  };
+
+  // The depth pre-pass draws the same commands as the scene draws after it
+  const bool depth_prepass = _depth_prepass_active();
+  if (_invalid_dependencies_ & segment_dependencies[segment_depth_prepass]) {
+    record_scene(segment_depth_prepass, depth_prepass ? chunk_count : 0, {}, {_gpu_culling_active() ? &culled_commands : nullptr}, vulkan_gltf_scene::pass_depth);
+  }
+  if (_invalid_dependencies_ & segment_dependencies[segment_scene]) {
+    // Recorded even while the scene isn't drawn, so toggling it only needs the primary command buffers re-recorded
+    record_scene(segment_scene, chunk_count, {}, {_gpu_culling_active() ? &culled_commands : nullptr});
+  }
+  if (_invalid_dependencies_ & segment_dependencies[segment_depth_prepass_early]) {
+    record_scene(segment_depth_prepass_early, two_phase && depth_prepass ? chunk_count : 0, {}, {&early_culled_commands}, vulkan_gltf_scene::pass_depth);
+  }
+  if (_invalid_dependencies_ & segment_dependencies[segment_scene_early]) {
+    record_scene(segment_scene_early, two_phase ? chunk_count : 0, {}, {&early_culled_commands});
+  }
+  if (_invalid_dependencies_ & segment_dependencies[segment_normals]) {
+    const std::size_t normals_count = _gs_pipeline_.enabled() ? chunk_count : 0;
+    if (two_phase) {
+      record_scene(segment_normals, normals_count, _gs_pipeline_.pipeline(), {&early_culled_commands, &culled_commands});
+    } else {
+      record_scene(segment_normals, normals_count, _gs_pipeline_.pipeline(), {_gpu_culling_active() ? &culled_commands : nullptr});
+    }
+  }
+  if (_invalid_dependencies_ & segment_dependencies[segment_overlay]) {
+    _command_recorder_.record(segment_overlay, 1, inheritance_info, [&](vk::CommandBuffer command_buffer, std::size_t) {
+      set_dynamic_state(command_buffer);
+      if (_draw_light_) {
+        _light_cube_.draw(command_buffer);
+      }
+      drawUI(command_buffer);
+    });
+  }
+  _invalid_dependencies_ = 0;
+
+  // Primary command buffers referencing a re-recorded secondary command buffer are invalid, so they are always re-recorded
+  // Segments are executed in order, the early ones in a render pass of their own
+  std::vector<vk::CommandBuffer> early_secondary_command_buffers;
+  std::vector<vk::CommandBuffer> secondary_command_buffers;
+  for (std::size_t segment = 0; segment < segment_count; ++segment) {
+    const bool scene = segment == segment_depth_prepass || segment == segment_scene;
+    const bool early_scene = segment == segment_depth_prepass_early || segment == segment_scene_early;
+    if ((scene || early_scene) && !_draw_scene_) {
+      continue;
+    }
+    const auto& command_buffers = _command_recorder_.command_buffers(segment);
+    auto& executed = early_scene ? early_secondary_command_buffers : secondary_command_buffers;
+    executed.insert(executed.end(), command_buffers.begin(), command_buffers.end());
+  }
+
   vk::CommandBufferBeginInfo cmd_buf_info = vks::initializers::commandBufferBeginInfo();
 
   auto clear_color_value = vk::ClearColorValue(std::array{_clear_color_, _clear_color_, _clear_color_, 1.0f});
@@ -67,139 +242,152 @@ void vulkan_scene_renderer::buildCommandBuffers() {
   renderPassBeginInfo.clearValueCount = static_cast<std::uint32_t>(clear_values.size());
   renderPassBeginInfo.pClearValues = clear_values.data();
 
-  const vk::Viewport viewport = vks::initializers::viewport(static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f);
-  const vk::Rect2D scissor = vks::initializers::rect2D(static_cast<std::int32_t>(width), static_cast<std::int32_t>(height), 0, 0);
-
   for (std::size_t i = 0; i < drawCmdBuffers.size(); ++i) {
     renderPassBeginInfo.framebuffer = *frameBuffers[i];
     drawCmdBuffers[i]->begin(cmd_buf_info);
 
     _query_pool_.reset(*drawCmdBuffers[i]);
+    if (_gpu_culling_active()) {
+      _gpu_culling_.record_cull(*drawCmdBuffers[i], two_phase ? gpu_culling::phase_early : gpu_culling::phase_all);
+    }
 
-    drawCmdBuffers[i]->beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
-    drawCmdBuffers[i]->setViewport(0, {viewport});
-    drawCmdBuffers[i]->setScissor(0, {scissor});
-
-    drawCmdBuffers[i]->setLineWidth(1.0f);
-
+    // Queries span both render passes of two phase frames
     _query_pool_.begin(*drawCmdBuffers[i]);
 
-    // Bind scene matrices descriptor to set 0
-    drawCmdBuffers[i]->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *_pipeline_layout_, 0, {_matrices_ubo_.descriptor_set()}, {});
-    // Bind settings descriptor to set 2
-    drawCmdBuffers[i]->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *_pipeline_layout_, 2, {_settings_ubo_.descriptor_set()}, {});
-    drawCmdBuffers[i]->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *_pipeline_layout_, 3, {_light_ubo_.descriptor_set()}, {});
-
-    // POI: Draw the glTF scene
-    if (_draw_scene_) {
-      _gltf_scene_.draw(*drawCmdBuffers[i], *_pipeline_layout_);
-
-    }
-    if (_gs_pipeline_.enabled()) {
-      _gltf_scene_.draw(*drawCmdBuffers[i], *_pipeline_layout_, _gs_pipeline_.pipeline());
+    renderPassBeginInfo.renderPass = *renderPass;
+    if (two_phase) {
+      // Draws what was visible last frame, builds the depth pyramid from it, and draws what the late phase found to be visible
+      renderPassBeginInfo.renderPass = *_two_phase_render_passes_.early;
+      drawCmdBuffers[i]->beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+      if (!early_secondary_command_buffers.empty()) {
+        drawCmdBuffers[i]->executeCommands(early_secondary_command_buffers);
+      }
+      drawCmdBuffers[i]->endRenderPass();
+
+      auto barrier = vks::initializers::memoryBarrier();
+      barrier.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+      barrier.dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+      drawCmdBuffers[i]->pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                                         {}, {barrier}, {}, {});
+      _gpu_culling_.record_depth_pyramid(*drawCmdBuffers[i]);
+      _gpu_culling_.record_cull(*drawCmdBuffers[i], gpu_culling::phase_late);
+      renderPassBeginInfo.renderPass = *_two_phase_render_passes_.late;
     }
 
-    if (_draw_light_) {
-      _light_cube_.draw(*drawCmdBuffers[i]);
-    }
+    drawCmdBuffers[i]->beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+    drawCmdBuffers[i]->executeCommands(secondary_command_buffers);
+    drawCmdBuffers[i]->endRenderPass();
 
     _query_pool_.end(*drawCmdBuffers[i]);
-
-    drawUI(*drawCmdBuffers[i]);
-    drawCmdBuffers[i]->endRenderPass();
     drawCmdBuffers[i]->end();
   }
 }
 
 void vulkan_scene_renderer::setupRenderPass() {
-  if (_current_sample_count() == vk::SampleCountFlagBits::e1) {
-    VulkanExampleBase::setupRenderPass();
-  } else {
+  if (_current_sample_count() != vk::SampleCountFlagBits::e1) {
     _attachment_size_ = vk::Extent2D{width, height};
+  }
 
-    std::array<vk::AttachmentDescription2, 3> attachments = {};
-
-    // Multisampled attachment that we render to
-    attachments[0].format = swapChain.colorFormat;
-    attachments[0].samples = _current_sample_count();
-    attachments[0].loadOp = vk::AttachmentLoadOp::eClear;
-    attachments[0].storeOp = vk::AttachmentStoreOp::eDontCare;
-    attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    attachments[0].initialLayout = vk::ImageLayout::eUndefined;
-    attachments[0].finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+  renderPass = _create_render_pass(render_pass_single);
+  _two_phase_render_passes_.early = _create_render_pass(render_pass_early);
+  _two_phase_render_passes_.late = _create_render_pass(render_pass_late);
+}
 
+// Render passes only differ in their load and store operations and layouts, synchronization between the two phases is left to the
+// primary command buffers
+vk::UniqueRenderPass vulkan_scene_renderer::_create_render_pass(render_pass_type type) const {
+  const vk::SampleCountFlagBits sample_count = _current_sample_count();
+  const bool multisampled = sample_count != vk::SampleCountFlagBits::e1;
+  const bool first = type != render_pass_late;
+  const bool last = type != render_pass_early;
+
+  std::vector<vk::AttachmentDescription2> attachments;
+
+  // Multisampled attachment that we render to, otherwise the swapchain image
+  vk::AttachmentDescription2& color = attachments.emplace_back();
+  color.format = swapChain.colorFormat;
+  color.samples = sample_count;
+  color.loadOp = first ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eLoad;
+  color.storeOp = last && multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
+  color.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+  color.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+  color.initialLayout = first ? vk::ImageLayout::eUndefined : vk::ImageLayout::eColorAttachmentOptimal;
+  color.finalLayout = last && !multisampled ? vk::ImageLayout::ePresentSrcKHR : vk::ImageLayout::eColorAttachmentOptimal;
+
+  if (multisampled) {
     // Framebuffer attachment where multisampled image will be resolved and presented to the swapchain
-    attachments[1].format = swapChain.colorFormat;
-    attachments[1].samples = vk::SampleCountFlagBits::e1;
-    attachments[1].loadOp = vk::AttachmentLoadOp::eDontCare;
-    attachments[1].storeOp = vk::AttachmentStoreOp::eStore;
-    attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    attachments[1].initialLayout = vk::ImageLayout::eUndefined;
-    attachments[1].finalLayout = vk::ImageLayout::ePresentSrcKHR;
-
-    // Multisampled depth attachment
-    attachments[2].format = depthFormat;
-    attachments[2].samples = _current_sample_count();
-    attachments[2].loadOp = vk::AttachmentLoadOp::eClear;
-    attachments[2].storeOp = vk::AttachmentStoreOp::eDontCare;
-    attachments[2].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    attachments[2].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    attachments[2].initialLayout = vk::ImageLayout::eUndefined;
-    attachments[2].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-
-    vk::AttachmentReference2 color_reference = {};
-    color_reference.attachment = 0;
-    color_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
-
-    vk::AttachmentReference2 depth_reference = {};
-    depth_reference.attachment = 2;
-    depth_reference.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-
-    // Resolve attachment reference for the color attachment
-    vk::AttachmentReference2 resolve_reference = {};
-    resolve_reference.attachment = 1;
-    resolve_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
-
-    vk::SubpassDescription2 subpass = {};
-    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &color_reference;
-    // Pass our resolve attachments to the subpass
-    subpass.pResolveAttachments = &resolve_reference;
-    subpass.pDepthStencilAttachment = &depth_reference;
-
-    std::array<vk::SubpassDependency2, 2> dependencies = {};
-
-    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[0].dstSubpass = 0;
-    dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
-    dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependencies[0].srcAccessMask = vk::AccessFlagBits::eMemoryRead;
-    dependencies[0].dstAccessMask =
-        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
-    dependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
-
-    dependencies[1].srcSubpass = 0;
-    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
-    dependencies[1].srcAccessMask =
-        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
-    dependencies[1].dstAccessMask = vk::AccessFlagBits::eMemoryRead;
-    dependencies[1].dependencyFlags = vk::DependencyFlagBits::eByRegion;
-
-    vk::RenderPassCreateInfo2 render_pass_info = vks::initializers::renderPassCreateInfo();
-    render_pass_info.attachmentCount = attachments.size();
-    render_pass_info.pAttachments = attachments.data();
-    render_pass_info.subpassCount = 1;
-    render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 2;
-    render_pass_info.pDependencies = dependencies.data();
-
-    renderPass = device.createRenderPass2Unique(render_pass_info);
+    vk::AttachmentDescription2& resolve = attachments.emplace_back();
+    resolve.format = swapChain.colorFormat;
+    resolve.samples = vk::SampleCountFlagBits::e1;
+    resolve.loadOp = vk::AttachmentLoadOp::eDontCare;
+    resolve.storeOp = last ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+    resolve.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    resolve.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    resolve.initialLayout = vk::ImageLayout::eUndefined;
+    resolve.finalLayout = last ? vk::ImageLayout::ePresentSrcKHR : vk::ImageLayout::eColorAttachmentOptimal;
   }
+
+  // Depth attachment, kept by the early pass to build the depth pyramid from
+  vk::AttachmentDescription2& depth = attachments.emplace_back();
+  depth.format = depthFormat;
+  depth.samples = sample_count;
+  depth.loadOp = first ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eLoad;
+  depth.storeOp = last && multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
+  depth.stencilLoadOp = first && !multisampled ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eDontCare;
+  depth.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+  depth.initialLayout = first ? vk::ImageLayout::eUndefined : vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  depth.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+  vk::AttachmentReference2 color_reference = {};
+  color_reference.attachment = 0;
+  color_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
+
+  vk::AttachmentReference2 depth_reference = {};
+  depth_reference.attachment = static_cast<std::uint32_t>(attachments.size() - 1);
+  depth_reference.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+  // Resolve attachment reference for the color attachment
+  vk::AttachmentReference2 resolve_reference = {};
+  resolve_reference.attachment = 1;
+  resolve_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
+
+  vk::SubpassDescription2 subpass = {};
+  subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color_reference;
+  // Pass our resolve attachments to the subpass
+  subpass.pResolveAttachments = multisampled ? &resolve_reference : nullptr;
+  subpass.pDepthStencilAttachment = &depth_reference;
+
+  std::array<vk::SubpassDependency2, 2> dependencies = {};
+
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
+  dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  dependencies[0].srcAccessMask = vk::AccessFlagBits::eMemoryRead;
+  dependencies[0].dstAccessMask =
+      vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+  dependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
+  dependencies[1].srcAccessMask =
+      vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+  dependencies[1].dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+  dependencies[1].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+
+  vk::RenderPassCreateInfo2 render_pass_info = vks::initializers::renderPassCreateInfo();
+  render_pass_info.attachmentCount = static_cast<std::uint32_t>(attachments.size());
+  render_pass_info.pAttachments = attachments.data();
+  render_pass_info.subpassCount = 1;
+  render_pass_info.pSubpasses = &subpass;
+  render_pass_info.dependencyCount = static_cast<std::uint32_t>(dependencies.size());
+  render_pass_info.pDependencies = dependencies.data();
+
+  return device.createRenderPass2Unique(render_pass_info);
 }
 
 void vulkan_scene_renderer::setupFrameBuffer() {
@@ -237,6 +425,11 @@ void vulkan_scene_renderer::setupFrameBuffer() {
       frameBuffers[i] = device.createFramebufferUnique(framebuffer_create_info);
     }
   }
+
+  // The depth pyramid is sized for the depth buffer, which is recreated along with the framebuffers
+  if (_gpu_culling_.bound()) {
+    _resize_depth_pyramid();
+  }
 }
 
 void vulkan_scene_renderer::load_gltf_file(std::string filename) {
@@ -251,6 +444,9 @@ void vulkan_scene_renderer::load_gltf_file(std::string filename) {
   // Pass some Vulkan resources required for setup and rendering to the glTF model loading class
   _gltf_scene_.vulkan_device = vulkanDevice.get();
   _gltf_scene_.copy_queue = queue;
+  _gltf_scene_.texture_residency = &_texture_residency_;
+  _gltf_scene_.texture_cache = &_texture_cache_;
+  _gltf_scene_.defragmenter = &_defragmenter_;
 
   std::size_t pos = filename.find_last_of('/');
   _gltf_scene_.path = filename.substr(0, pos);
@@ -267,6 +463,7 @@ void vulkan_scene_renderer::load_gltf_file(std::string filename) {
       const tinygltf::Node node = gltf_input.nodes[static_cast<std::size_t>(i)];
       _gltf_scene_.load_node(node, gltf_input, nullptr, index_buffer, vertex_buffer);
     }
+    _gltf_scene_.build_transform_hierarchy();
   } else {
     vks::tools::exitFatal("Could not open the glTF file.\n\nThe file is part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
     return;
@@ -299,12 +496,12 @@ void vulkan_scene_renderer::load_gltf_file(std::string filename) {
 
   // Create device local buffers (target)
   vulkanDevice->createBuffer(
-      vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+      vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
       vk::MemoryPropertyFlagBits::eDeviceLocal,
       &_gltf_scene_.vertices,
       vertex_buffer_size);
   vulkanDevice->createBuffer(
-      vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+      vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
       vk::MemoryPropertyFlagBits::eDeviceLocal,
       &_gltf_scene_.indices.buffer,
       index_buffer_size);
@@ -324,6 +521,8 @@ void vulkan_scene_renderer::load_gltf_file(std::string filename) {
   // Free staging resources
   vertex_staging.destroy();
   index_staging.destroy();
+
+  _gltf_scene_.register_buffers();
 }
 
 void vulkan_scene_renderer::load_assets() {
@@ -367,18 +566,15 @@ void vulkan_scene_renderer::setup_descriptors() {
   _light_ubo_.setup_descriptor_set_layout(device, vk::ShaderStageFlagBits::eFragment);
 
   // Pipeline layout using both descriptor sets (set 0 = matrices, set 1 = material, set 2 = settings)
+  // World matrices of the primitives are read from the per-draw data in set 4 instead of push constants
   auto setLayouts = std::array{
       _matrices_ubo_.descriptor_set_layout(),
       *_descriptor_set_layouts_.textures,
       _settings_ubo_.descriptor_set_layout(),
-      _light_ubo_.descriptor_set_layout()
+      _light_ubo_.descriptor_set_layout(),
+      _draw_buffers_.descriptor_set_layout()
   };
   vk::PipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(setLayouts.data(), static_cast<uint32_t>(setLayouts.size()));
-  // We will use push constants to push the local matrices of a primitive to the vertex shader
-  vk::PushConstantRange pushConstantRange = vks::initializers::pushConstantRange(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eGeometry | vk::ShaderStageFlagBits::eTessellationEvaluation, sizeof(glm::mat4), 0);
-  // Push constant ranges are part of the pipeline layout
-  pipelineLayoutCI.pushConstantRangeCount = 1;
-  pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
   _pipeline_layout_ = device.createPipelineLayoutUnique(pipelineLayoutCI);
 
   // Descriptor set for scene matrices
@@ -388,6 +584,16 @@ void vulkan_scene_renderer::setup_descriptors() {
   for (auto& material : _gltf_scene_.materials) {
     const vk::DescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(*descriptorPool, &*_descriptor_set_layouts_.textures, 1);
     material.descriptor_set = device.allocateDescriptorSets(allocInfo)[0];
+  }
+  _update_material_descriptor_sets();
+
+  _settings_ubo_.setup_descriptor_sets(device, *descriptorPool);
+
+  _light_ubo_.setup_descriptor_sets(device, *descriptorPool);
+}
+
+void vulkan_scene_renderer::_update_material_descriptor_sets() {
+  for (auto& material : _gltf_scene_.materials) {
     vk::DescriptorImageInfo colorMap = _gltf_scene_.get_texture_descriptor(material.base_color_texture_index);
     vk::DescriptorImageInfo normalMap = _gltf_scene_.get_texture_descriptor(material.normal_texture_index);
     std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
@@ -396,13 +602,18 @@ void vulkan_scene_renderer::setup_descriptors() {
     };
     device.updateDescriptorSets(writeDescriptorSets, {});
   }
+}
 
-  _settings_ubo_.setup_descriptor_sets(device, *descriptorPool);
+void vulkan_scene_renderer::prepare_pipelines() {
+  _gs_pipeline_.unbind();
+  _gs_pipeline_.set_pipeline_layout(*_pipeline_layout_);
+  _gs_pipeline_.bind(*this);
 
-  _light_ubo_.setup_descriptor_sets(device, *descriptorPool);
+  _prepare_material_pipelines(dependency_scene_pipelines | dependency_depth_pipelines);
 }
 
-void vulkan_scene_renderer::prepare_pipelines() {
+// Recreates the scene and/or depth pre-pass pipelines of every material, as given by the dependency_*_pipelines bits
+void vulkan_scene_renderer::_prepare_material_pipelines(std::uint32_t pipelines) {
   vk::PipelineInputAssemblyStateCreateInfo inputAssemblyStateCI = vks::initializers::pipelineInputAssemblyStateCreateInfo(vk::PrimitiveTopology::eTriangleList, {}, false);
 
   vk::PipelineRasterizationStateCreateInfo rasterizationStateCI = vks::initializers::pipelineRasterizationStateCreateInfo(vk::PolygonMode::eFill, vk::CullModeFlagBits::eBack, vk::FrontFace::eCounterClockwise, {});
@@ -455,10 +666,6 @@ void vulkan_scene_renderer::prepare_pipelines() {
     pipelineCI.pTessellationState = &tessellation_state;
   }
 
-  _gs_pipeline_.unbind();
-  _gs_pipeline_.set_pipeline_layout(*_pipeline_layout_);
-  _gs_pipeline_.bind(*this);
-
   shaderStages.resize(2);
   pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
   pipelineCI.pStages = shaderStages.data();
@@ -483,8 +690,38 @@ void vulkan_scene_renderer::prepare_pipelines() {
     _ts_.populate_ci(pipelineCI, shaderStages);
   }
 
-  // POI: Instead if using a few fixed pipelines, we create one pipeline for each material using the properties of that material
-  for (auto &material : _gltf_scene_.materials) {
+  // The depth pre-pass writes no color, opaque materials only read positions and alpha masked ones discard as in the main pass
+  const bool depthPrepass = _depth_prepass_active();
+  if (pipelines & dependency_scene_pipelines) {
+    _pipelines_depth_prepass_ = depthPrepass;
+  }
+  if (depthPrepass && !_shader_modules_._depth_vert) {
+    _shader_modules_._depth_vert = loadShader(getShadersPath() + "gltfscenerendering/depth.vert.spv", vk::ShaderStageFlagBits::eVertex).module;
+    _shader_modules_._depth_mask_frag = loadShader(getShadersPath() + "gltfscenerendering/depth_mask.frag.spv", vk::ShaderStageFlagBits::eFragment).module;
+  }
+  vk::PipelineColorBlendAttachmentState depthBlendAttachmentStateCI = vks::initializers::pipelineColorBlendAttachmentState(vk::ColorComponentFlags{}, false);
+  vk::PipelineColorBlendStateCreateInfo depthColorBlendStateCI = vks::initializers::pipelineColorBlendStateCreateInfo(1, &depthBlendAttachmentStateCI);
+  vk::PipelineDepthStencilStateCreateInfo depthDepthStencilStateCI = vks::initializers::pipelineDepthStencilStateCreateInfo(true, true, vk::CompareOp::eLessOrEqual);
+  const std::vector<vk::VertexInputAttributeDescription> depthVertexInputAttributes = {vertexInputAttributes[0]};
+  vk::PipelineVertexInputStateCreateInfo depthVertexInputStateCI = vks::initializers::pipelineVertexInputStateCreateInfo(vertexInputBindings, depthVertexInputAttributes);
+  std::array<vk::PipelineShaderStageCreateInfo, 2> depthShaderStages;
+  depthShaderStages[0].stage = vk::ShaderStageFlagBits::eVertex;
+  depthShaderStages[0].module = _shader_modules_._depth_vert;
+  depthShaderStages[0].pName = "main";
+  depthShaderStages[1].stage = vk::ShaderStageFlagBits::eFragment;
+  depthShaderStages[1].module = _shader_modules_._depth_mask_frag;
+  depthShaderStages[1].pName = "main";
+
+  // Only used by the pipelines of blended materials
+  blendAttachmentStateCI.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+  blendAttachmentStateCI.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+  blendAttachmentStateCI.colorBlendOp = vk::BlendOp::eAdd;
+  blendAttachmentStateCI.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+  blendAttachmentStateCI.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+  blendAttachmentStateCI.alphaBlendOp = vk::BlendOp::eAdd;
+
+  // POI: Instead if using a few fixed pipelines, we create one pipeline for each distinct set of material properties
+  for (auto &material : _gltf_scene_.pipelines) {
 
     struct MaterialSpecializationData {
       vk::Bool32 alphaMask;
@@ -494,7 +731,7 @@ void vulkan_scene_renderer::prepare_pipelines() {
       float tessAlpha;
     } materialSpecializationData;
 
-    materialSpecializationData.alphaMask = material.alpha_mode == "MASK";
+    materialSpecializationData.alphaMask = material.bucket == vulkan_gltf_scene::bucket_mask;
     materialSpecializationData.alphaMaskCutoff = material.alpha_cutoff;
     materialSpecializationData.preTransformPos = !_ts_.enabled();
     materialSpecializationData.tessLevel = _ts_.level();
@@ -515,11 +752,51 @@ void vulkan_scene_renderer::prepare_pipelines() {
 
     // For double sided materials, culling will be disabled
     rasterizationStateCI.cullMode = material.double_sided ? vk::CullModeFlagBits::eNone : vk::CullModeFlagBits::eBack;
+    // Blended materials are drawn last, back to front, without hiding what is behind them
+    const bool blend = material.bucket == vulkan_gltf_scene::bucket_blend;
+    blendAttachmentStateCI.blendEnable = blend;
+    // After a depth pre-pass, only the fragments that wrote the final depth are shaded
+    depthStencilStateCI.depthWriteEnable = !blend && !depthPrepass;
+    depthStencilStateCI.depthCompareOp = depthPrepass && !blend ? vk::CompareOp::eEqual : vk::CompareOp::eLessOrEqual;
+
+    if (pipelines & dependency_scene_pipelines) {
+      material.pipeline = device.createGraphicsPipelineUnique(*pipelineCache, {pipelineCI}).value;
+    }
 
-    material.pipeline = device.createGraphicsPipelineUnique(*pipelineCache, {pipelineCI}).value;
+    if (!(pipelines & dependency_depth_pipelines)) {
+      continue;
+    }
+    material.depth_pipeline.reset();
+    if (depthPrepass && !blend) {
+      vk::GraphicsPipelineCreateInfo depthPipelineCI = pipelineCI;
+      depthPipelineCI.pColorBlendState = &depthColorBlendStateCI;
+      depthPipelineCI.pDepthStencilState = &depthDepthStencilStateCI;
+      // The scene vertex shader computes the same positions and passes on the UVs for alpha masking
+      std::array<vk::PipelineShaderStageCreateInfo, 2> maskShaderStages = {shaderStages[0], depthShaderStages[1]};
+      maskShaderStages[1].pSpecializationInfo = &specializationInfo;
+      if (material.bucket == vulkan_gltf_scene::bucket_mask) {
+        depthPipelineCI.stageCount = static_cast<uint32_t>(maskShaderStages.size());
+        depthPipelineCI.pStages = maskShaderStages.data();
+      } else {
+        depthPipelineCI.pVertexInputState = &depthVertexInputStateCI;
+        depthPipelineCI.stageCount = 1;
+        depthPipelineCI.pStages = &depthShaderStages[0];
+      }
+      material.depth_pipeline = device.createGraphicsPipelineUnique(*pipelineCache, {depthPipelineCI}).value;
+    }
   }
 }
 
+// Recreates the given material pipelines after a setting they are created with changed, and marks the segments drawing with them
+void vulkan_scene_renderer::_update_material_pipelines(std::uint32_t pipelines) {
+  // Starting or stopping the depth pre-pass changes how the scene pipelines test depth, and whether it is drawn at all
+  if (_depth_prepass_active() != _pipelines_depth_prepass_) {
+    pipelines |= dependency_scene_pipelines | dependency_depth_pipelines;
+  }
+  _prepare_material_pipelines(pipelines);
+  _invalidate(pipelines);
+}
+
 void vulkan_scene_renderer::prepare_uniform_buffers() {
   _matrices_ubo_.prepare(*vulkanDevice, false);
 
@@ -538,6 +815,18 @@ void vulkan_scene_renderer::update_uniform_buffers() {
   _matrices_ubo_.values().viewPos = camera.viewPos;
   _matrices_ubo_.update();
 
+  // The draw buffers are rewritten before the next frame if the visible primitives or their order changed
+  // Culling on the GPU is given every primitive
+  if (!_freeze_culling_) {
+    _culling_view_projection_ = camera.matrices.perspective * camera.matrices.view;
+  }
+  if (_gpu_culling_active()) {
+    _gltf_scene_.reset_visibility();
+  } else {
+    _gltf_scene_.cull(_culling_view_projection_, static_cast<vulkan_gltf_scene::cull_method>(_cull_method_));
+  }
+  _draw_list_changed_ |= _gltf_scene_.build_draw_list(camera.matrices.view);
+
   _settings_ubo_.update();
 
   auto& spot_light = _light_ubo_.values().spot_light;
@@ -559,12 +848,22 @@ void vulkan_scene_renderer::prepare() {
   _get_max_usable_sample_count();
   _update_sample_count(_current_sample_count(), false);
   VulkanExampleBase::prepare();
+  _texture_residency_.prepare(vulkanDevice.get(), queue, _memory_budget_supported_);
+  _defragmenter_.prepare(vulkanDevice.get(), queue);
   load_assets();
+  _draw_buffers_.set_scene(_gltf_scene_);
+  _draw_buffers_.bind(*this);
+  if (_enabled_vulkan12_features_.drawIndirectCount) {
+    _gpu_culling_.set_draw_buffers(_draw_buffers_);
+    _gpu_culling_.bind(*this);
+    _resize_depth_pyramid();
+  }
   _query_pool_.bind(*this);
   _light_cube_.bind(*this);
   prepare_uniform_buffers();
   setup_descriptors();
   _ts_.bind(*this);
+  _command_recorder_.bind(*this);
   prepare_pipelines();
   buildCommandBuffers();
   _screenshot_.bind(*this);
@@ -583,6 +882,25 @@ void vulkan_scene_renderer::viewChanged() {
 }
 
 void vulkan_scene_renderer::draw() {
+  // The previous frame has completed (submitFrame() waits for the queue to idle), so textures can be recreated here
+  ++_frame_index_;
+  _gltf_scene_.mark_textures_used(_frame_index_);
+  _idle_frames_ = camera.updated ? 0 : _idle_frames_ + 1;
+  if (_texture_residency_.update(_frame_index_)) {
+    _update_material_descriptor_sets();
+    _invalidate(dependency_material_descriptors);
+  } else if (_idle_frames_ >= 30 && _defragmenter_.step()) {
+    // Moved buffers and images have new handles, so descriptors and the recorded binds need to be updated
+    _update_material_descriptor_sets();
+    _invalidate(dependency_all);
+  }
+  // Occlusion is tested from the live view, which the depth pyramid is built from, even while the culling frustum is frozen
+  if (_gpu_culling_.bound()) {
+    _gpu_culling_.update(camera.matrices.perspective * camera.matrices.view, _culling_view_projection_);
+  }
+  // Everything changed since the last frame, including by the UI, is recorded at once
+  _record_command_buffers();
+
   VulkanExampleBase::prepareFrame();
   if (resized) {
     resized = false;
@@ -595,6 +913,9 @@ void vulkan_scene_renderer::draw() {
   _query_pool_.update_query_results();
 
   VulkanExampleBase::submitFrame();
+  if (_gpu_culling_active()) {
+    _gpu_culling_.read_stats();
+  }
 }
 
 void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
@@ -609,6 +930,58 @@ void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
     const auto dir = _calc_camera_direction();
     caption = fmt::format("Camera Dir.: {:.3f}, {:.3f}, {:.3f}", dir.x, dir.y, dir.z);
     overlay->text(caption.c_str());
+
+    caption = fmt::format("Visible Primitives: {} / {}", _gltf_scene_.visibility.visible_primitives, _gltf_scene_.bvh_items.size());
+    overlay->text(caption.c_str());
+    if (!_gpu_culling_active()) {
+      caption = fmt::format("CPU Culling: {} Culled ({})", _gltf_scene_.bvh_items.size() - _gltf_scene_.visibility.visible_primitives,
+                            _cull_method_ == vulkan_gltf_scene::cull_simd ? vks::transforms::simdLevel() : "BVH");
+      overlay->text(caption.c_str());
+    }
+    if (_gpu_culling_active()) {
+      const auto& culling_stats = _gpu_culling_.last_stats();
+      caption = fmt::format("GPU Culling: {} Visible (Frustum Culled: {}, Occlusion Culled: {})",
+                            culling_stats.visible, culling_stats.frustum_culled, culling_stats.occlusion_culled);
+      overlay->text(caption.c_str());
+    }
+
+    // Commands executed every frame by the scene, depth pre-pass and normals segments
+    vulkan_gltf_scene::draw_stats draw_stats = _draw_stats_[segment_normals];
+    if (_draw_scene_) {
+      draw_stats += _draw_stats_[segment_depth_prepass];
+      draw_stats += _draw_stats_[segment_scene];
+      draw_stats += _draw_stats_[segment_depth_prepass_early];
+      draw_stats += _draw_stats_[segment_scene_early];
+    }
+    caption = fmt::format("Draws: {} (Draw Calls: {}, Pipeline Binds: {}, Descriptor Binds: {})",
+                          draw_stats.draws, draw_stats.draw_calls, draw_stats.pipeline_binds, draw_stats.descriptor_binds);
+    overlay->text(caption.c_str());
+
+    const auto& residency_stats = _texture_residency_.stats;
+    caption = fmt::format("Texture Memory: {} MiB (Budget: {} / {} MiB)", residency_stats.textureBytes >> 20, residency_stats.usage >> 20, residency_stats.budget >> 20);
+    overlay->text(caption.c_str());
+    if (residency_stats.downsampledTextures > 0) {
+      caption = fmt::format("Downsampled Textures: {}", residency_stats.downsampledTextures);
+      overlay->text(caption.c_str());
+    }
+
+    const auto& cache_stats = _texture_cache_.stats;
+    caption = fmt::format("Shared Textures: {} (Saved: {} MiB)", cache_stats.sharedReferences, cache_stats.bytesSaved >> 20);
+    overlay->text(caption.c_str());
+
+    const auto allocator_stats = vulkanDevice->allocator.getStats();
+    caption = fmt::format("Device Memory: {} / {} MiB ({} Allocations in {} Blocks, {} Dedicated)",
+                          allocator_stats.usedBytes >> 20, allocator_stats.reservedBytes >> 20,
+                          allocator_stats.subAllocations, allocator_stats.blocks, allocator_stats.dedicatedAllocations);
+    overlay->text(caption.c_str());
+
+    const auto& defrag_stats = _defragmenter_.stats;
+    caption = fmt::format("Fragmentation: {:.1f}% ({} Free Ranges, Largest: {} KiB)",
+                          allocator_stats.fragmentation * 100.0f, allocator_stats.freeRanges, allocator_stats.largestFreeRange >> 10);
+    overlay->text(caption.c_str());
+    caption = fmt::format("Defragmented: {} Resources, {} MiB ({} Blocks Released)",
+                          defrag_stats.movedResources, defrag_stats.movedBytes >> 20, defrag_stats.releasedBlocks);
+    overlay->text(caption.c_str());
   }
 
   const auto& pipeline_stats = _query_pool_.query_results();
@@ -631,11 +1004,34 @@ void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
     }
 
     if (overlay->checkBox("Draw Scene", &_draw_scene_)) {
-      buildCommandBuffers();
+      _invalidate(dependency_frame);
     }
 
     if (overlay->sliderFloat("Background Color", &_clear_color_, 0.0f, 1.0f)) {
-      buildCommandBuffers();
+      _invalidate(dependency_frame);
+    }
+
+    if (enabledFeatures.features.multiDrawIndirect && enabledFeatures.features.drawIndirectFirstInstance) {
+      if (overlay->checkBox("Indirect Draws", &_use_indirect_draws_)) {
+        _invalidate(dependency_draws);
+        // Culling moves between the CPU and GPU with GPU culling enabled
+        update_uniform_buffers();
+      }
+    }
+
+    if (overlay->comboBox("CPU Culling", &_cull_method_, {"BVH", "SIMD"})) {
+      update_uniform_buffers();
+    }
+
+    if (overlay->checkBox("Freeze Culling Frustum", &_freeze_culling_)) {
+      update_uniform_buffers();
+    }
+
+    if (_gpu_culling_.bound() && _use_indirect_draws_) {
+      if (overlay->checkBox("GPU Culling", &_use_gpu_culling_)) {
+        _invalidate(dependency_draws);
+        update_uniform_buffers();
+      }
     }
 
     if (enabledFeatures.features.geometryShader) {
@@ -643,7 +1039,7 @@ void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
         _gs_pipeline_.length() = std::max(_gs_pipeline_.length(), 0.0f);
 
         _gs_pipeline_.create_pipeline();
-        buildCommandBuffers();
+        _invalidate(dependency_normals_pipeline);
       }
     }
 
@@ -651,9 +1047,16 @@ void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
       if (overlay->checkBox("Wireframe", &_wireframe_)) {
         _light_cube_.wireframe() = _wireframe_;
         _light_cube_.prepare_pipeline();
+        _invalidate(dependency_light);
 
-        prepare_pipelines();
-        buildCommandBuffers();
+        // Only the polygon mode of the scene pipelines changes, the pre-pass is stopped while drawing wireframes
+        _update_material_pipelines(dependency_scene_pipelines);
+      }
+    }
+
+    if (!_ts_.enabled() && !_wireframe_) {
+      if (overlay->checkBox("Depth Pre-Pass", &_use_depth_prepass_)) {
+        _update_material_pipelines(dependency_scene_pipelines | dependency_depth_pipelines);
       }
     }
 
@@ -668,8 +1071,9 @@ void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
       if (_current_sample_count() != vk::SampleCountFlagBits::e1) {
         if (overlay->checkBox("Use Sample-Rate Shading", &_use_sample_shading_)) {
           _gs_pipeline_.use_sample_shading() = _use_sample_shading_;
-          prepare_pipelines();
-          buildCommandBuffers();
+          _gs_pipeline_.create_pipeline();
+          _invalidate(dependency_normals_pipeline);
+          _update_material_pipelines(dependency_scene_pipelines | dependency_depth_pipelines);
         }
       }
     } else {
@@ -684,20 +1088,18 @@ void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
           "Passthrough",
           "PN-Triangles"
       }};
+      // The normals and depth pre-pass pipelines aren't tessellated
       if (overlay->comboBox("Tessellation Mode", &_ts_.mode(), tess_mode_labels)) {
-        prepare_pipelines();
-        buildCommandBuffers();
+        _update_material_pipelines(dependency_scene_pipelines);
       }
 
       if (_ts_.mode() == 2) {
         if (overlay->sliderFloat("Tessellation Alpha", &_ts_.alpha(), 0.0f, 1.0f)) {
-          prepare_pipelines();
-          buildCommandBuffers();
+          _update_material_pipelines(dependency_scene_pipelines);
         }
 
         if (overlay->inputFloat("Tessellation Level", &_ts_.level(), 0.25f, 2)) {
-          prepare_pipelines();
-          buildCommandBuffers();
+          _update_material_pipelines(dependency_scene_pipelines);
         }
       }
     } else {
@@ -733,7 +1135,7 @@ void vulkan_scene_renderer::OnUpdateUIOverlay(vks::UIOverlay* overlay) {
 
   if (overlay->header("Point Light")) {
     if (overlay->checkBox("Draw Point Light", &_draw_light_)) {
-      buildCommandBuffers();
+      _invalidate(dependency_light);
     }
 
     if (overlay->button("Reset Point Light")) {
@@ -839,6 +1241,28 @@ void vulkan_scene_renderer::_setup_multisample_target() {
   _depth_ms_target_.bind(*this);
 }
 
+bool vulkan_scene_renderer::_gpu_culling_active() const {
+  return _use_gpu_culling_ && _use_indirect_draws_ && _gpu_culling_.bound();
+}
+
+bool vulkan_scene_renderer::_gpu_occlusion_culling_active() const {
+  return _gpu_culling_active() && _gpu_culling_.occlusion_supported();
+}
+
+// Tessellated and wireframe primitives don't rasterize to the depth the position only pre-pass writes
+bool vulkan_scene_renderer::_depth_prepass_active() const {
+  return _use_depth_prepass_ && !_ts_.enabled() && !_wireframe_;
+}
+
+// The depth pyramid is built from the multisampled depth buffer if multisampling, which can only be sampled if its sample count allows
+void vulkan_scene_renderer::_resize_depth_pyramid() {
+  if (_current_sample_count() == vk::SampleCountFlagBits::e1) {
+    _gpu_culling_.resize(*depthStencil.image, vk::SampleCountFlagBits::e1);
+  } else {
+    _gpu_culling_.resize(_depth_ms_target_.image_handle(), _current_sample_count());
+  }
+}
+
 glm::vec3 vulkan_scene_renderer::_calc_camera_direction() {
   const auto flipY = camera.flipY ? -1.0f : 1.0f;
 
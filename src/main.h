@@ -1,7 +1,12 @@
 #pragma once
 
+#include <array>
+
 #include <vulkan/vulkan.hpp>
 
+#include "command_recorder.h"
+#include "draw_buffers.h"
+#include "gpu_culling.h"
 #include "light_cube.h"
 #include "light_ubo.h"
 #include "multisample_target.h"
@@ -18,6 +23,7 @@ class vulkan_scene_renderer : public VulkanExampleBase {
   vulkan_scene_renderer();
   ~vulkan_scene_renderer() override;
   void getEnabledFeatures() override;
+  void getEnabledExtensions() override;
   void buildCommandBuffers() override;
   void setupRenderPass() override;
   void setupFrameBuffer() override;
@@ -32,14 +38,73 @@ class vulkan_scene_renderer : public VulkanExampleBase {
   void viewChanged() override;
   void draw();
   void OnUpdateUIOverlay(vks::UIOverlay* overlay) override;
+  void overlayChanged() override;
   void windowResized() override;
 
  private:
+  // What the recorded command buffers depend on, changes are passed to _invalidate()
+  enum render_dependency : std::uint32_t {
+    // Clear color and which segments are executed, only recorded in the primary command buffers
+    dependency_frame = 1u << 0,
+    // Pipelines of the materials in the scene segments
+    dependency_scene_pipelines = 1u << 1,
+    // Depth pre-pass pipelines of the materials, and whether the pre-pass is drawn
+    dependency_depth_pipelines = 1u << 2,
+    dependency_normals_pipeline = 1u << 3,
+    // Light cube pipeline and whether it is drawn
+    dependency_light = 1u << 4,
+    dependency_material_descriptors = 1u << 5,
+    // Visible primitives and world matrices
+    dependency_draws = 1u << 6,
+    // UI overlay draw commands
+    dependency_overlay = 1u << 7,
+    dependency_all = ~0u,
+  };
+  // Groups of secondary command buffers that are re-recorded independently
+  enum render_segment : std::size_t {
+    // Depth of the scene draws, drawn before them to only shade the nearest fragments
+    segment_depth_prepass,
+    segment_scene,
+    segment_depth_prepass_early,
+    // Scene draws visible last frame, drawn before the depth pyramid is built with GPU occlusion culling
+    segment_scene_early,
+    segment_normals,
+    // Light cube and UI overlay
+    segment_overlay,
+    segment_count,
+  };
+  // Render passes drawing a frame, compatible with each other so they share the framebuffers and secondary command buffers
+  enum render_pass_type {
+    render_pass_single,
+    // Draws the early phase of occlusion culling, keeping the attachments for the late phase to draw over
+    render_pass_early,
+    render_pass_late,
+  };
+
+  void _invalidate(std::uint32_t dependencies);
+  void _record_command_buffers();
+  void _prepare_material_pipelines(std::uint32_t pipelines);
+  void _update_material_pipelines(std::uint32_t pipelines);
+  vk::UniqueRenderPass _create_render_pass(render_pass_type type) const;
   vk::SampleCountFlagBits _get_max_usable_sample_count();
   vk::SampleCountFlagBits _current_sample_count() const;
   void _setup_multisample_target();
   glm::vec3 _calc_camera_direction();
   void _update_sample_count(vk::SampleCountFlagBits sample_count, bool update_now = true);
+  void _update_material_descriptor_sets();
+  bool _gpu_culling_active() const;
+  bool _gpu_occlusion_culling_active() const;
+  bool _depth_prepass_active() const;
+  void _resize_depth_pyramid();
+
+  // Declared before the scene, which releases its textures from these on destruction
+  vks::TextureResidency _texture_residency_;
+  vks::TextureCache<vulkan_gltf_scene::image> _texture_cache_;
+  bool _memory_budget_supported_ = false;
+  std::uint64_t _frame_index_ = 0;
+  vks::Defragmenter _defragmenter_;
+  // Number of consecutive frames without camera movement, memory is only defragmented while idle
+  std::uint32_t _idle_frames_ = 0;
 
   vulkan_gltf_scene _gltf_scene_;
 
@@ -50,6 +115,11 @@ class vulkan_scene_renderer : public VulkanExampleBase {
   } _descriptor_set_layouts_;
 
   vk::Extent2D _attachment_size_;
+  // Used in place of renderPass while occlusion culling on the GPU
+  struct {
+    vk::UniqueRenderPass early;
+    vk::UniqueRenderPass late;
+  } _two_phase_render_passes_;
 
   struct alignas(4) _matrices {
     glm::mat4 projection;
@@ -72,10 +142,21 @@ class vulkan_scene_renderer : public VulkanExampleBase {
   bool _draw_scene_ = true;
 
   bool _wireframe_ = false;
+  // Draw the depth of opaque and alpha masked draws first, and shade only the fragments matching it
+  bool _use_depth_prepass_ = false;
+  // Whether the scene pipelines were last created to shade after the depth pre-pass
+  bool _pipelines_depth_prepass_ = false;
+
+  int _cull_method_ = vulkan_gltf_scene::cull_simd;
+  // Keeps culling against the frustum at the time it was frozen, to inspect what is culled from elsewhere
+  bool _freeze_culling_ = false;
+  glm::mat4 _culling_view_projection_{1.0f};
 
   struct {
     vk::ShaderModule _vert;
     vk::ShaderModule _frag;
+    vk::ShaderModule _depth_vert;
+    vk::ShaderModule _depth_mask_frag;
   } _shader_modules_;
 
   query_pool _query_pool_;
@@ -94,4 +175,18 @@ class vulkan_scene_renderer : public VulkanExampleBase {
   tessellation _ts_;
 
   screenshot _screenshot_;
+
+  command_recorder _command_recorder_;
+  draw_buffers _draw_buffers_;
+  // Draw the scene with one indirect draw per batch instead of one draw per primitive, if supported
+  bool _use_indirect_draws_ = false;
+  gpu_culling _gpu_culling_;
+  // Cull the indirect draws on the GPU instead of the visible primitives on the CPU, if supported
+  bool _use_gpu_culling_ = false;
+  vk::PhysicalDeviceVulkan12Features _enabled_vulkan12_features_{};
+  // Set when the order of the draw list changed, the draw buffers are rewritten before the next frame
+  bool _draw_list_changed_ = true;
+  std::uint32_t _invalid_dependencies_ = dependency_all;
+  // Commands recorded to the scene, depth pre-pass and normals segments
+  std::array<vulkan_gltf_scene::draw_stats, segment_count> _draw_stats_{};
 };
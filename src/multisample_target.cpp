@@ -29,18 +29,13 @@ void image_multisample_target::setup(VulkanExampleBase& app) {
   image() = app.device.createImageUnique(info);
 
   vk::MemoryRequirements2 mem_reqs = app.device.getImageMemoryRequirements2(*image());
-  auto mem_alloc = vks::initializers::memoryAllocateInfo();
-  mem_alloc.allocationSize = mem_reqs.memoryRequirements.size;
   // We prefer a lazily allocated memory type
   // This means that the memory gets allocated when the implementation sees fit, e.g. when first using the images
   vk::Bool32 lazy_mem_type_present;
-  mem_alloc.memoryTypeIndex = app.vulkanDevice->getMemoryType(mem_reqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated, &lazy_mem_type_present);
-  if (!lazy_mem_type_present) {
-    // If this is not available, fall back to device local memory
-    mem_alloc.memoryTypeIndex = app.vulkanDevice->getMemoryType(mem_reqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-  }
-  memory() = app.device.allocateMemoryUnique(mem_alloc);
-  app.device.bindImageMemory(*image(), *memory(), 0);
+  app.vulkanDevice->getMemoryType(mem_reqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated, &lazy_mem_type_present);
+  // If this is not available, fall back to device local memory
+  const auto mem_properties = lazy_mem_type_present ? vk::MemoryPropertyFlagBits::eLazilyAllocated : vk::MemoryPropertyFlagBits::eDeviceLocal;
+  memory() = app.vulkanDevice->allocator.allocateForImage(*image(), mem_properties);
 
   // Create image view for the MSAA target
   auto view_info = vks::initializers::imageViewCreateInfo();
@@ -74,23 +69,24 @@ void depth_multisample_target::setup(VulkanExampleBase& app) {
   info.sharingMode = vk::SharingMode::eExclusive;
   info.tiling = vk::ImageTiling::eOptimal;
   info.samples = sample_count();
-  // Image will only be used as a transient target
-  info.usage = vk::ImageUsageFlagBits::eTransientAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment;
+  // Sampled to build the depth pyramid for occlusion culling if the format and sample count allow it, otherwise the image will only be
+  // used as a transient target
+  const bool sampled = (app.physicalDevice.getFormatProperties(app.depthFormat).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage) &&
+                       (app.deviceProperties.properties.limits.sampledImageDepthSampleCounts & sample_count());
+  info.usage = sampled ? vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eDepthStencilAttachment
+                       : vk::ImageUsageFlagBits::eTransientAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment;
   info.initialLayout = vk::ImageLayout::eUndefined;
 
   image() = app.device.createImageUnique(info);
 
   vk::MemoryRequirements2 mem_reqs = app.device.getImageMemoryRequirements2(*image());
-  auto mem_alloc = vks::initializers::memoryAllocateInfo();
-  mem_alloc.allocationSize = mem_reqs.memoryRequirements.size;
-  vk::Bool32 lazy_mem_type_present;
-  mem_alloc.memoryTypeIndex = app.vulkanDevice->getMemoryType(mem_reqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated, &lazy_mem_type_present);
-  if (!lazy_mem_type_present) {
-    mem_alloc.memoryTypeIndex = app.vulkanDevice->getMemoryType(mem_reqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+  vk::Bool32 lazy_mem_type_present = VK_FALSE;
+  if (!sampled) {
+    app.vulkanDevice->getMemoryType(mem_reqs.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated, &lazy_mem_type_present);
   }
+  const auto mem_properties = lazy_mem_type_present ? vk::MemoryPropertyFlagBits::eLazilyAllocated : vk::MemoryPropertyFlagBits::eDeviceLocal;
 
-  memory() = app.device.allocateMemoryUnique(mem_alloc);
-  app.device.bindImageMemory(*image(), *memory(), 0);
+  memory() = app.vulkanDevice->allocator.allocateForImage(*image(), mem_properties);
 
   // Create image view for the MSAA target
   auto view_info = vks::initializers::imageViewCreateInfo();
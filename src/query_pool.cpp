@@ -3,7 +3,8 @@
 #include <fmt/format.h>
 
 void query_pool::setup(VulkanExampleBase& app) {
-  if (!app.enabledFeatures.features.pipelineStatisticsQuery) {
+  // The scene is drawn from secondary command buffers, executing those while the query is active requires inherited queries
+  if (!app.enabledFeatures.features.pipelineStatisticsQuery || !app.enabledFeatures.features.inheritedQueries) {
     return;
   }
 
@@ -49,10 +50,12 @@ void query_pool::setup(VulkanExampleBase& app) {
   }
   query_pool_info.queryCount = static_cast<std::uint32_t>(_pipeline_stat_names_.size());
   _query_pool_ = app.device.createQueryPoolUnique(query_pool_info);
+  _pipeline_statistics_ = query_pool_info.pipelineStatistics;
 }
 
 void query_pool::destroy() {
   _query_pool_.reset();
+  _pipeline_statistics_ = {};
 }
 
 void query_pool::begin(vk::CommandBuffer command_buffer) const {
@@ -15,6 +15,8 @@ class query_pool : public application_bound {
   void update_query_results();
 
   bool enabled() const noexcept { return static_cast<bool>(_query_pool_); }
+  // Statistics counted by the query, secondary command buffers executed while it is active must inherit these (none while disabled)
+  vk::QueryPipelineStatisticFlags pipeline_statistics() const noexcept { return _pipeline_statistics_; }
   const std::vector<std::uint64_t>& query_results() const;
   const std::vector<std::string>& pipeline_stat_names() const;
 
@@ -24,6 +26,7 @@ class query_pool : public application_bound {
 
  private:
   vk::UniqueQueryPool _query_pool_;
+  vk::QueryPipelineStatisticFlags _pipeline_statistics_;
 
   std::vector<std::string> _pipeline_stat_names_;
   std::vector<std::uint64_t> _query_results_;
@@ -1,6 +1,7 @@
 #include "screenshot.h"
 
 #include <fmt/format.h>
+#include <VulkanPixelConversion.h>
 
 void screenshot::setup(VulkanExampleBase& app) {
   _app_ = &app;
@@ -57,15 +58,10 @@ void screenshot::capture() {
   image_create_ci.usage = vk::ImageUsageFlagBits::eTransferDst;
   // Create the image
   vk::UniqueImage dst_image = app.device.createImageUnique(image_create_ci);
-  // Create memory to back up the image
-  auto mem_requirements = app.device.getImageMemoryRequirements2(*dst_image);
-  auto mem_alloc_info = vks::initializers::memoryAllocateInfo();
-  mem_alloc_info.allocationSize = mem_requirements.memoryRequirements.size;
+  // Take memory to back up the image from the allocator
   // Memory must be host visible to copy from
-  mem_alloc_info.memoryTypeIndex = app.vulkanDevice->getMemoryType(mem_requirements.memoryRequirements.memoryTypeBits,
-                                                               vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-  vk::UniqueDeviceMemory dst_image_memory = app.device.allocateMemoryUnique(mem_alloc_info);
-  app.device.bindImageMemory(*dst_image, *dst_image_memory, 0);
+  vks::Allocation dst_image_memory = app.vulkanDevice->allocator.allocateForImage(
+      *dst_image, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, vk::ImageTiling::eLinear);
 
   // Do the actual blit from the swapchain image to our host visible destination image
   vk::UniqueCommandBuffer copy_cmd = app.vulkanDevice->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
@@ -167,8 +163,8 @@ void screenshot::capture() {
   vk::ImageSubresource subresource{vk::ImageAspectFlagBits::eColor, 0, 0};
   vk::SubresourceLayout subresource_layout = app.device.getImageSubresourceLayout(*dst_image, subresource);
 
-  // Map image memory so we can start copying from it
-  const std::byte* data = static_cast<std::byte*>(app.device.mapMemory(*dst_image_memory, 0, VK_WHOLE_SIZE, {}));
+  // Host visible memory is kept mapped by the allocator, so we can start copying from it right away
+  const std::byte* data = static_cast<std::byte*>(dst_image_memory.mapped()) + subresource_layout.offset;
 
   std::ofstream file{_filename_, std::ios::out | std::ios::binary};
 
@@ -188,27 +184,24 @@ void screenshot::capture() {
     color_swizzle = (std::find(formats_bgr.begin(), formats_bgr.end(), app.swapChain.colorFormat) != formats_bgr.end());
   }
 
-  // ppm binary pixel data
+  // ppm binary pixel data, converted row by row (rows may be padded) and written in one go
+  std::vector<std::uint8_t> pixels(static_cast<std::size_t>(app.width) * app.height * 3);
   for (std::uint32_t y = 0; y < app.height; ++y) {
-    auto row = reinterpret_cast<const unsigned int*>(data);
-    for (std::uint32_t x = 0; x < app.width; ++x) {
-      if (color_swizzle) {
-        file.write(reinterpret_cast<const char*>(row + 2), 1);
-        file.write(reinterpret_cast<const char*>(row + 1), 1);
-        file.write(reinterpret_cast<const char*>(row), 1);
-      } else {
-        file.write(reinterpret_cast<const char*>(row), 3);
-      }
-      ++row;
+    const auto row = reinterpret_cast<const std::uint8_t*>(data);
+    std::uint8_t* dst = pixels.data() + static_cast<std::size_t>(y) * app.width * 3;
+    if (color_swizzle) {
+      vks::pixels::bgraToRgb(row, dst, app.width);
+    } else {
+      vks::pixels::rgbaToRgb(row, dst, app.width);
     }
     data += subresource_layout.rowPitch;
   }
+  file.write(reinterpret_cast<const char*>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
   file.close();
 
   fmt::print("Screenshot saved to disk\n");
 
   // Clean up resources
-  app.device.unmapMemory(*dst_image_memory);
   dst_image_memory.reset();
   dst_image.reset();
 
@@ -1,5 +1,11 @@
 #include "vulkan_gltf_scene.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
 #include <fmt/format.h>
 
 vulkan_gltf_scene::~vulkan_gltf_scene() {
@@ -7,17 +13,15 @@ vulkan_gltf_scene::~vulkan_gltf_scene() {
     node.reset();
   }
   // Release all Vulkan resources allocated for the model
+  if (_buffers_registered_) {
+    defragmenter->release(_vertices_defragmenter_handle_);
+    defragmenter->release(_indices_defragmenter_handle_);
+  }
   vertices.destroy();
   indices.buffer.destroy();
-  for (vulkan_gltf_scene::image& image : images) {
-    image.texture.view.reset();
-    image.texture.image.reset();
-    image.texture.sampler.reset();
-    image.texture.deviceMemory.reset();
-  }
-  for (vulkan_gltf_scene::material& material : materials) {
-    material.pipeline.reset();
-  }
+  // Images shared with other scenes are destroyed along with the last scene referencing them
+  images.clear();
+  pipelines.clear();
 }
 
 void vulkan_gltf_scene::load_images(tinygltf::Model& input) {
@@ -25,10 +29,52 @@ void vulkan_gltf_scene::load_images(tinygltf::Model& input) {
   images.resize(input.images.size());
   for (std::size_t i = 0; i < input.images.size(); ++i) {
     tinygltf::Image& gltf_image = input.images[i];
-    images[i].texture.loadFromFile(path + "/" + gltf_image.uri, vk::Format::eR8G8B8A8Unorm, vulkan_device, copy_queue);
+    const std::string filename = path + "/" + gltf_image.uri;
+
+    // Images are keyed on the contents of the ktx file, so copies under a different name are shared as well
+    vks::ContentHash key;
+    const bool keyed = texture_cache && vks::fileContentHash(filename, key);
+    if (keyed) {
+      images[i] = texture_cache->find(key);
+      if (images[i]) {
+        continue;
+      }
+    }
+
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled;
+    if (defragmenter) {
+      usage |= vk::ImageUsageFlagBits::eTransferSrc;
+    }
+
+    images[i] = std::make_shared<vulkan_gltf_scene::image>();
+    if (texture_residency) {
+      texture_residency->imageUsageFlags = usage;
+      images[i]->residency = texture_residency;
+      images[i]->residency_handle = texture_residency->load(&images[i]->texture, filename, vk::Format::eR8G8B8A8Unorm);
+    } else {
+      images[i]->texture.loadFromFile(filename, vk::Format::eR8G8B8A8Unorm, vulkan_device, copy_queue, usage);
+    }
+    if (defragmenter) {
+      images[i]->defragmenter = defragmenter;
+      images[i]->defragmenter_handle = defragmenter->registerTexture(&images[i]->texture, vk::Format::eR8G8B8A8Unorm, usage);
+    }
+
+    if (keyed) {
+      texture_cache->insert(key, images[i], vulkan_device->logicalDevice->getImageMemoryRequirements(*images[i]->texture.image).size);
+    }
   }
 }
 
+// Allows the defragmenter (if set) to move the vertex and index buffers, which must have been created with transfer source and destination usage
+void vulkan_gltf_scene::register_buffers() {
+  if (!defragmenter || _buffers_registered_) {
+    return;
+  }
+  _vertices_defragmenter_handle_ = defragmenter->registerBuffer(&vertices);
+  _indices_defragmenter_handle_ = defragmenter->registerBuffer(&indices.buffer);
+  _buffers_registered_ = true;
+}
+
 void vulkan_gltf_scene::load_textures(tinygltf::Model& input) {
   textures.resize(input.textures.size());
   for (std::size_t i = 0; i < input.textures.size(); ++i) {
@@ -59,6 +105,29 @@ void vulkan_gltf_scene::load_materials(tinygltf::Model& input) {
     materials[i].alpha_mode = gltf_material.alphaMode;
     materials[i].alpha_cutoff = static_cast<float>(gltf_material.alphaCutoff);
     materials[i].double_sided = gltf_material.doubleSided;
+    if (materials[i].alpha_mode == "MASK") {
+      materials[i].bucket = bucket_mask;
+    } else if (materials[i].alpha_mode == "BLEND") {
+      materials[i].bucket = bucket_blend;
+    }
+  }
+  // Material indices are packed into the draw list keys
+  if (materials.size() > (1u << draw_item::material_index_bits)) {
+    throw std::runtime_error(fmt::format("Too many materials ({})", materials.size()));
+  }
+
+  // Materials only differing in properties read from their descriptor sets share a pipeline
+  pipelines.clear();
+  for (vulkan_gltf_scene::material& material : materials) {
+    const float alpha_cutoff = material.bucket == bucket_mask ? material.alpha_cutoff : 0.0f;
+    auto it = std::find_if(pipelines.begin(), pipelines.end(), [&](const material_pipeline& pipeline) {
+      return pipeline.bucket == material.bucket && pipeline.alpha_cutoff == alpha_cutoff && pipeline.double_sided == material.double_sided;
+    });
+    if (it == pipelines.end()) {
+      pipelines.push_back({material.bucket, alpha_cutoff, material.double_sided, {}});
+      it = std::prev(pipelines.end());
+    }
+    material.pipeline_index = static_cast<std::uint32_t>(std::distance(pipelines.begin(), it));
   }
 }
 
@@ -105,6 +174,7 @@ void vulkan_gltf_scene::load_node(const tinygltf::Node& input_node,
       auto first_index = static_cast<std::uint32_t>(index_buffer.size());
       auto vertex_start = static_cast<std::uint32_t>(vertex_buffer.size());
       std::uint32_t index_count = 0;
+      vks::transforms::Aabb primitive_bounds{};
 
       // Vertices
       {
@@ -150,6 +220,14 @@ void vulkan_gltf_scene::load_node(const tinygltf::Node& input_node,
               accessor.byteOffset + view.byteOffset]));
         }
 
+        primitive_bounds.min = glm::vec3{vertex_count > 0 ? FLT_MAX : 0.0f};
+        primitive_bounds.max = glm::vec3{vertex_count > 0 ? -FLT_MAX : 0.0f};
+        for (size_t v = 0; v < vertex_count; v++) {
+          const glm::vec3 pos = glm::make_vec3(&position_buffer[v * 3]);
+          primitive_bounds.min = glm::min(primitive_bounds.min, pos);
+          primitive_bounds.max = glm::max(primitive_bounds.max, pos);
+        }
+
         // Append data to model's vertex buffer
         for (size_t v = 0; v < vertex_count; v++) {
           vulkan_gltf_scene::vertex vert{};
@@ -203,6 +281,7 @@ void vulkan_gltf_scene::load_node(const tinygltf::Node& input_node,
       primitive.first_index = first_index;
       primitive.index_count = index_count;
       primitive.material_index = gltf_primitive.material;
+      primitive.bounds = primitive_bounds;
       node->mesh.primitives.emplace_back(primitive);
     }
   }
@@ -215,55 +294,317 @@ void vulkan_gltf_scene::load_node(const tinygltf::Node& input_node,
 }
 
 vk::DescriptorImageInfo vulkan_gltf_scene::get_texture_descriptor(std::size_t index) {
-  return images[index].texture.descriptor;
+  return images[index]->texture.descriptor;
 }
 
-void vulkan_gltf_scene::draw_node(vk::CommandBuffer command_buffer,
-                                  vk::PipelineLayout pipeline_layout,
-                                  const vulkan_gltf_scene::node& node,
-                                  vk::Pipeline pipeline) {
-  if (!node.visible) {
+// Marks the textures of the primitives in the draw list as used, so the residency manager evicts the least recently drawn ones first
+// With culling, primitives outside the frustum are left out of the draw list and so do not count as used
+void vulkan_gltf_scene::mark_textures_used(std::uint64_t frame) {
+  if (!texture_residency) {
     return;
   }
-  if (!node.mesh.primitives.empty()) {
-    // Pass the node's matrix via push constants
-    // Traverse the node hierarchy to the top-most parent to get the final matrix of the current node
-    glm::mat4 node_matrix = node.matrix;
-    vulkan_gltf_scene::node* current_parent = node.parent;
-    while (current_parent) {
-      node_matrix = current_parent->matrix * node_matrix;
-      current_parent = current_parent->parent;
+  for (const draw_item& draw : draw_list.draws) {
+    const bvh_item& item = bvh_items[draw.bvh_item];
+    const vulkan_gltf_scene::primitive& primitive = item.node->mesh.primitives[item.primitive_index];
+    if (primitive.material_index >= 0) {
+      // Materials index images the same way as get_texture_descriptor() does
+      const vulkan_gltf_scene::material& material = materials[static_cast<std::size_t>(primitive.material_index)];
+      texture_residency->touch(images[material.base_color_texture_index]->residency_handle, frame);
+      texture_residency->touch(images[material.normal_texture_index]->residency_handle, frame);
     }
-    // Pass the final matrix to the vertex shader using push constants
-    command_buffer.pushConstants<glm::mat4>(pipeline_layout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eGeometry | vk::ShaderStageFlagBits::eTessellationEvaluation, 0, {node_matrix});
-    for (const vulkan_gltf_scene::primitive& primitive : node.mesh.primitives) {
-      if (primitive.index_count > 0) {
-        vulkan_gltf_scene::material& material = materials[static_cast<std::size_t>(primitive.material_index)];
-        if (!pipeline) {
-          pipeline = *material.pipeline;
-        }
-
-        // POI: Bind the pipeline for the node's material
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
-        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 1, {material.descriptor_set}, {});
-        vkCmdDrawIndexed(command_buffer, primitive.index_count, 1, primitive.first_index, 0, 0);
-      }
-    }
-  }
-  for (auto& child : node.children) {
-    draw_node(command_buffer, pipeline_layout, *child, pipeline);
   }
 }
 
 void vulkan_gltf_scene::draw(vk::CommandBuffer command_buffer,
                              vk::PipelineLayout pipeline_layout,
                              vk::Pipeline pipeline) {
+  draw_range(command_buffer, pipeline_layout, 0, draw_count(), pipeline);
+}
+
+// Records the draws [first, last) of the draw list, so disjoint ranges can be recorded to separate command buffers concurrently
+// Every primitive is drawn with its material's pipeline for the pass unless a pipeline is given, state is only bound when it differs from the
+// previous draw
+// Shaders read the world matrix of a draw from the per-draw data at gl_InstanceIndex, which is set to the index of the draw
+void vulkan_gltf_scene::draw_range(vk::CommandBuffer command_buffer,
+                                   vk::PipelineLayout pipeline_layout,
+                                   std::size_t first,
+                                   std::size_t last,
+                                   vk::Pipeline pipeline,
+                                   draw_stats* stats,
+                                   draw_pass pass) const {
   // All vertices and indices are stored in single buffers, so we only need to bind once
   auto offsets = std::array<vk::DeviceSize, 1>{{0}};
   command_buffer.bindVertexBuffers(0, {*vertices.buffer}, offsets);
   command_buffer.bindIndexBuffer(*indices.buffer.buffer, 0, vk::IndexType::eUint32);
-  // Render all nodes at top-level
+
+  draw_stats range_stats;
+  vk::Pipeline bound_pipeline;
+  vk::DescriptorSet bound_descriptor_set;
+  for (std::size_t i = first; i < last; ++i) {
+    const bvh_item& item = bvh_items[draw_list.draws[i].bvh_item];
+    const vulkan_gltf_scene::primitive& primitive = item.node->mesh.primitives[item.primitive_index];
+
+    const vulkan_gltf_scene::material& material = materials[static_cast<std::size_t>(primitive.material_index)];
+    // POI: Bind the pipeline for the node's material
+    const material_pipeline& material_pipelines = pipelines[material.pipeline_index];
+    const vk::Pipeline primitive_pipeline = pipeline ? pipeline : pass == pass_depth ? *material_pipelines.depth_pipeline : *material_pipelines.pipeline;
+    if (!primitive_pipeline) {
+      continue;
+    }
+    if (primitive_pipeline != bound_pipeline) {
+      command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, primitive_pipeline);
+      bound_pipeline = primitive_pipeline;
+      ++range_stats.pipeline_binds;
+    }
+    if (material.descriptor_set != bound_descriptor_set) {
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 1, {material.descriptor_set}, {});
+      bound_descriptor_set = material.descriptor_set;
+      ++range_stats.descriptor_binds;
+    }
+    command_buffer.drawIndexed(primitive.index_count, 1, primitive.first_index, 0, static_cast<std::uint32_t>(i));
+    ++range_stats.draws;
+    ++range_stats.draw_calls;
+  }
+  if (stats) {
+    *stats += range_stats;
+  }
+}
+
+void vulkan_gltf_scene::build_transform_hierarchy() {
+  transforms.parents.clear();
+  transforms.local_matrices.clear();
+
+  std::vector<vulkan_gltf_scene::node*>& queue = transforms.nodes;
+  queue.clear();
   for (auto& node : nodes) {
-    draw_node(command_buffer, pipeline_layout, *node, pipeline);
+    queue.push_back(node.get());
+  }
+  for (std::size_t i = 0; i < queue.size(); ++i) {
+    vulkan_gltf_scene::node* node = queue[i];
+    node->transform_index = static_cast<std::uint32_t>(i);
+    transforms.parents.push_back(node->parent ? static_cast<std::int32_t>(node->parent->transform_index) : -1);
+    transforms.local_matrices.push_back(node->matrix);
+    for (auto& child : node->children) {
+      queue.push_back(child.get());
+    }
+  }
+
+  transforms.world_matrices.assign(queue.size(), glm::mat4{1.0f});
+  transforms.dirty.assign(queue.size(), 1);
+  transforms.any_dirty = true;
+  update_transforms();
+  build_bvh();
+}
+
+void vulkan_gltf_scene::set_local_matrix(vulkan_gltf_scene::node& node, const glm::mat4& matrix) {
+  node.matrix = matrix;
+  transforms.local_matrices[node.transform_index] = matrix;
+  transforms.dirty[node.transform_index] = 1;
+  transforms.any_dirty = true;
+}
+
+void vulkan_gltf_scene::update_transforms() {
+  transforms.updated.clear();
+  if (!transforms.any_dirty) {
+    return;
   }
+  // Parents are updated before their children, so a single pass propagates changes down the whole subtree
+  vks::transforms::updateHierarchy(transforms.parents.data(), transforms.local_matrices.data(), transforms.world_matrices.data(),
+                                   transforms.dirty.data(), transforms.parents.size());
+  for (std::size_t i = 0; i < transforms.dirty.size(); ++i) {
+    if (transforms.dirty[i]) {
+      transforms.updated.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+
+  // Refit the BVH to the primitives of moved nodes only
+  if (!bvh.empty()) {
+    for (std::uint32_t transform : transforms.updated) {
+      for (std::uint32_t item = transform_items[transform]; item < transform_items[transform + 1]; ++item) {
+        const vks::transforms::Aabb bounds = _world_bounds(bvh_items[item]);
+        bvh.update(item, bounds);
+        _set_item_bounds(item, bounds);
+      }
+    }
+    bvh.refit();
+  }
+  for (std::uint32_t transform : transforms.updated) {
+    transforms.dirty[transform] = 0;
+  }
+  transforms.any_dirty = false;
+}
+
+const glm::mat4& vulkan_gltf_scene::world_matrix(const vulkan_gltf_scene::node& node) const {
+  return transforms.world_matrices[node.transform_index];
+}
+
+void vulkan_gltf_scene::build_bvh() {
+  bvh_items.clear();
+  transform_items.clear();
+  std::vector<vks::transforms::Aabb> local_bounds;
+  std::vector<std::uint32_t> matrix_indices;
+  for (vulkan_gltf_scene::node* node : transforms.nodes) {
+    transform_items.push_back(static_cast<std::uint32_t>(bvh_items.size()));
+    for (std::size_t i = 0; i < node->mesh.primitives.size(); ++i) {
+      vulkan_gltf_scene::primitive& primitive = node->mesh.primitives[i];
+      primitive.bvh_item = static_cast<std::uint32_t>(bvh_items.size());
+      bvh_items.push_back({node, static_cast<std::uint32_t>(i)});
+      local_bounds.push_back(primitive.bounds);
+      matrix_indices.push_back(node->transform_index);
+    }
+  }
+  transform_items.push_back(static_cast<std::uint32_t>(bvh_items.size()));
+
+  std::vector<vks::transforms::Aabb> world_bounds(local_bounds.size());
+  vks::transforms::transformAabbs(local_bounds.data(), transforms.world_matrices.data(), matrix_indices.data(), world_bounds.data(), world_bounds.size());
+  bvh.build(world_bounds);
+
+  for (auto* bounds : {&item_bounds.min_x, &item_bounds.min_y, &item_bounds.min_z, &item_bounds.max_x, &item_bounds.max_y, &item_bounds.max_z}) {
+    bounds->resize(world_bounds.size());
+  }
+  for (std::size_t i = 0; i < world_bounds.size(); ++i) {
+    _set_item_bounds(i, world_bounds[i]);
+  }
+
+  reset_visibility();
+}
+
+// Marks every primitive visible, as when culling is done elsewhere
+// Returns whether the visibility changed
+bool vulkan_gltf_scene::reset_visibility() {
+  const bool changed = !visibility.primitives.empty();
+  visibility.primitives.clear();
+  visibility.visible_primitives = static_cast<std::uint32_t>(bvh_items.size());
+  return changed;
+}
+
+// Marks the primitives whose world space bounds intersect the frustum as visible
+// Returns whether the visibility changed
+bool vulkan_gltf_scene::cull(const glm::mat4& view_projection, cull_method method) {
+  glm::vec4 planes[6];
+  vks::transforms::extractFrustumPlanes(view_projection, planes);
+
+  std::vector<std::uint8_t>& primitives = _cull_buffer_;
+  primitives.assign(bvh_items.size(), 0);
+  std::size_t visible_primitives = 0;
+  if (method == cull_bvh) {
+    _visible_items_.clear();
+    bvh.queryFrustum(planes, _visible_items_);
+    for (std::uint32_t item : _visible_items_) {
+      primitives[item] = 1;
+    }
+    visible_primitives = _visible_items_.size();
+  } else {
+    const vks::transforms::AabbSoa boxes = {
+        item_bounds.min_x.data(), item_bounds.min_y.data(), item_bounds.min_z.data(),
+        item_bounds.max_x.data(), item_bounds.max_y.data(), item_bounds.max_z.data(),
+    };
+    visible_primitives = vks::transforms::cullAabbs(planes, boxes, primitives.data(), primitives.size());
+  }
+  if (primitives == visibility.primitives) {
+    return false;
+  }
+  visibility.primitives.swap(primitives);
+  visibility.visible_primitives = static_cast<std::uint32_t>(visible_primitives);
+  return true;
+}
+
+// Collects the visible primitives into the draw list, sorted by state and then front to back within the opaque and alpha masked buckets, and
+// back to front within the blended bucket
+// Returns whether the order of the draws changed, otherwise only their keys have been updated and recorded draws are still valid
+bool vulkan_gltf_scene::build_draw_list(const glm::mat4& view) {
+  _sort_buffer_.clear();
+  for (std::size_t i = 0; i < bvh_items.size(); ++i) {
+    const bvh_item& item = bvh_items[i];
+    const vulkan_gltf_scene::primitive& primitive = item.node->mesh.primitives[item.primitive_index];
+    if (primitive.index_count == 0 || (!visibility.primitives.empty() && !visibility.primitives[i])) {
+      continue;
+    }
+    // Hidden nodes hide their whole subtree
+    bool visible = true;
+    for (const vulkan_gltf_scene::node* node = item.node; node && visible; node = node->parent) {
+      visible = node->visible;
+    }
+    if (!visible) {
+      continue;
+    }
+
+    // View space depth of the primitive's center, the bits of non-negative floats compare like unsigned integers
+    const glm::vec3 center = (primitive.bounds.min + primitive.bounds.max) * 0.5f;
+    const float depth = std::max(-(view * world_matrix(*item.node) * glm::vec4{center, 1.0f}).z, 0.0f);
+    std::uint32_t depth_bits;
+    std::memcpy(&depth_bits, &depth, sizeof(depth));
+
+    const vulkan_gltf_scene::material& material = materials[static_cast<std::size_t>(primitive.material_index)];
+    // Wider indices would spill into the neighbouring fields and break the ordering
+    if (material.pipeline_index >= (1u << draw_item::pipeline_index_bits) ||
+        static_cast<std::uint32_t>(primitive.material_index) >= (1u << draw_item::material_index_bits)) {
+      throw std::runtime_error(fmt::format("Pipeline index {} or material index {} doesn't fit into the draw list keys",
+                                           material.pipeline_index, primitive.material_index));
+    }
+    const std::uint64_t pipeline_bits = material.pipeline_index;
+    const std::uint64_t material_bits = static_cast<std::uint64_t>(primitive.material_index);
+    std::uint64_t key = static_cast<std::uint64_t>(material.bucket) << 62;
+    if (material.bucket == bucket_blend) {
+      key |= static_cast<std::uint64_t>(~depth_bits) << 30 | pipeline_bits << 18 | material_bits;
+    } else {
+      key |= pipeline_bits << 50 | material_bits << 32 | depth_bits;
+    }
+    _sort_buffer_.push_back({key, static_cast<std::uint32_t>(i)});
+  }
+  _sort_draws(_sort_buffer_);
+
+  const bool changed = !std::equal(_sort_buffer_.begin(), _sort_buffer_.end(), draw_list.draws.begin(), draw_list.draws.end(),
+                                   [](const draw_item& a, const draw_item& b) { return a.bvh_item == b.bvh_item; });
+  draw_list.draws.swap(_sort_buffer_);
+
+  draw_list.bucket_offsets.fill(0);
+  for (const draw_item& draw : draw_list.draws) {
+    ++draw_list.bucket_offsets[(draw.key >> 62) + 1];
+  }
+  for (std::size_t i = 1; i < draw_list.bucket_offsets.size(); ++i) {
+    draw_list.bucket_offsets[i] += draw_list.bucket_offsets[i - 1];
+  }
+  return changed;
+}
+
+// Least significant digit first radix sort by key, one byte per pass, skipping bytes that are the same in all keys
+void vulkan_gltf_scene::_sort_draws(std::vector<draw_item>& draws) {
+  if (draws.empty()) {
+    return;
+  }
+  _sort_scratch_.resize(draws.size());
+  for (std::uint32_t shift = 0; shift < 64; shift += 8) {
+    std::array<std::uint32_t, 256> offsets{};
+    for (const draw_item& draw : draws) {
+      ++offsets[(draw.key >> shift) & 0xffu];
+    }
+    if (offsets[(draws.front().key >> shift) & 0xffu] == draws.size()) {
+      continue;
+    }
+    std::uint32_t offset = 0;
+    for (std::uint32_t& count : offsets) {
+      offset += std::exchange(count, offset);
+    }
+    for (const draw_item& draw : draws) {
+      _sort_scratch_[offsets[(draw.key >> shift) & 0xffu]++] = draw;
+    }
+    draws.swap(_sort_scratch_);
+  }
+}
+
+void vulkan_gltf_scene::_set_item_bounds(std::size_t item, const vks::transforms::Aabb& bounds) {
+  item_bounds.min_x[item] = bounds.min.x;
+  item_bounds.min_y[item] = bounds.min.y;
+  item_bounds.min_z[item] = bounds.min.z;
+  item_bounds.max_x[item] = bounds.max.x;
+  item_bounds.max_y[item] = bounds.max.y;
+  item_bounds.max_z[item] = bounds.max.z;
+}
+
+vks::transforms::Aabb vulkan_gltf_scene::_world_bounds(const bvh_item& item) const {
+  vks::transforms::Aabb bounds{};
+  const vulkan_gltf_scene::primitive& primitive = item.node->mesh.primitives[item.primitive_index];
+  vks::transforms::transformAabbs(&primitive.bounds, &transforms.world_matrices[item.node->transform_index], nullptr, &bounds, 1);
+  return bounds;
 }
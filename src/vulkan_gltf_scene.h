@@ -1,15 +1,29 @@
 #pragma once
 
+#include <array>
 #include <memory>
 #include <tiny_gltf.h>
 #include <vulkan/vulkan.hpp>
 
 #include "vulkanexamplebase.h"
+#include "VulkanBvh.h"
+#include "VulkanDefragmenter.h"
+#include "VulkanTextureCache.hpp"
+#include "VulkanTextureResidency.h"
+#include "VulkanTransformKernels.h"
 
 class vulkan_gltf_scene {
  public:
   vks::VulkanDevice* vulkan_device;
   vk::Queue copy_queue;
+  // Optional, images are loaded under control of the residency manager if set
+  vks::TextureResidency* texture_residency = nullptr;
+
+  struct image;
+  // Optional, images with identical contents are shared with other scenes using the same cache if set
+  vks::TextureCache<image>* texture_cache = nullptr;
+  // Optional, images are registered with the defragmenter (and created with transfer source usage) if set
+  vks::Defragmenter* defragmenter = nullptr;
 
   struct vertex {
     glm::vec3 pos;
@@ -32,6 +46,10 @@ class vulkan_gltf_scene {
     std::uint32_t first_index;
     std::uint32_t index_count;
     std::int32_t material_index;
+    // Object space bounds of the primitive's vertices
+    vks::transforms::Aabb bounds;
+    // Index of the primitive in bvh_items
+    std::uint32_t bvh_item = 0;
   };
 
   struct mesh {
@@ -42,9 +60,12 @@ class vulkan_gltf_scene {
     node* parent;
     std::vector<std::unique_ptr<node>> children;
     vulkan_gltf_scene::mesh mesh;
+    // Local matrix, use set_local_matrix() to change it after the transform hierarchy has been built
     glm::mat4 matrix;
     std::string name;
     bool visible = true;
+    // Index of the node in the transform hierarchy
+    std::uint32_t transform_index = 0;
 
     ~node() {
       for (auto& child : children) {
@@ -53,6 +74,14 @@ class vulkan_gltf_scene {
     }
   };
 
+  // Draws are bucketed by how their material treats alpha, the buckets are drawn in this order
+  enum draw_bucket : std::uint8_t {
+    bucket_opaque,
+    bucket_mask,
+    bucket_blend,
+    bucket_count,
+  };
+
   struct material {
     glm::vec4 base_color_factor = glm::vec4{1.0f};
     std::uint32_t base_color_texture_index;
@@ -61,27 +90,139 @@ class vulkan_gltf_scene {
     float alpha_cutoff;
     bool double_sided = false;
     vk::DescriptorSet descriptor_set;
+    draw_bucket bucket = bucket_opaque;
+    // Index into pipelines
+    std::uint32_t pipeline_index = 0;
+  };
+
+  // Materials with the same fixed function and specialization state share a pipeline, created by the application
+  struct material_pipeline {
+    draw_bucket bucket;
+    // Only used by alpha masked materials
+    float alpha_cutoff;
+    bool double_sided;
     vk::UniquePipeline pipeline;
+    // Writes depth only for the depth pre-pass, none for blended materials or while there is no pre-pass
+    vk::UniquePipeline depth_pipeline;
+  };
+
+  // Which of its material's pipelines a primitive is drawn with
+  enum draw_pass {
+    pass_shading,
+    // Skips primitives without a depth pipeline
+    pass_depth,
   };
 
   struct image {
     vks::Texture2D texture;
+    vks::TextureResidency* residency = nullptr;
+    std::uint32_t residency_handle = 0;
+    vks::Defragmenter* defragmenter = nullptr;
+    std::uint32_t defragmenter_handle = 0;
+
+    ~image() {
+      if (residency) {
+        residency->release(residency_handle);
+      }
+      if (defragmenter) {
+        defragmenter->release(defragmenter_handle);
+      }
+    }
   };
 
   struct texture {
     std::int32_t image_index;
   };
 
-  std::vector<image> images;
+  std::vector<std::shared_ptr<image>> images;
   std::vector<texture> textures;
   std::vector<material> materials;
+  std::vector<material_pipeline> pipelines;
   std::vector<std::unique_ptr<node>> nodes;
 
+  // Node transforms flattened in breadth-first order (parents always come before their children), as structure of arrays
+  struct {
+    std::vector<node*> nodes;
+    // Transform index of the parent, -1 for root nodes
+    std::vector<std::int32_t> parents;
+    std::vector<glm::mat4> local_matrices;
+    std::vector<glm::mat4> world_matrices;
+    std::vector<std::uint8_t> dirty;
+    bool any_dirty = false;
+    // Transform indices whose world matrices changed in the last call to update_transforms()
+    std::vector<std::uint32_t> updated;
+  } transforms;
+
+  // Spatial index over the world space bounds of all primitives, BVH items index into bvh_items
+  struct bvh_item {
+    vulkan_gltf_scene::node* node;
+    std::uint32_t primitive_index;
+  };
+  vks::Bvh bvh;
+  // Grouped by node in transform order, the items of transform index i are [transform_items[i], transform_items[i + 1])
+  std::vector<bvh_item> bvh_items;
+  std::vector<std::uint32_t> transform_items;
+  // World space bounds of the BVH items with one array per component, kept up to date with the BVH
+  struct {
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+  } item_bounds;
+
+  // How cull() finds the visible primitives
+  enum cull_method {
+    // Walk the BVH, skipping whole subtrees outside the frustum
+    cull_bvh,
+    // Test the bounds of every primitive, several at a time with SIMD
+    cull_simd,
+  };
+
+  // Result of the last call to cull(), everything is drawn while empty
+  struct {
+    // Per BVH item
+    std::vector<std::uint8_t> primitives;
+    std::uint32_t visible_primitives = 0;
+  } visibility;
+
+  // Visible primitives sorted by state, built by build_draw_list()
+  struct draw_item {
+    // Bucket, pipeline, material and depth from the most to the least significant bits (depth first after the bucket for blended draws)
+    std::uint64_t key;
+    std::uint32_t bvh_item;
+
+    // Widths of the pipeline and material index fields of key
+    static constexpr std::uint32_t pipeline_index_bits = 12;
+    static constexpr std::uint32_t material_index_bits = 18;
+  };
+  struct {
+    std::vector<draw_item> draws;
+    // Draws of bucket i are [bucket_offsets[i], bucket_offsets[i + 1])
+    std::array<std::uint32_t, bucket_count + 1> bucket_offsets{};
+  } draw_list;
+
+  // Commands recorded by draw_range()
+  struct draw_stats {
+    std::uint32_t draws = 0;
+    // Draw commands, a single indirect draw can issue many draws
+    std::uint32_t draw_calls = 0;
+    std::uint32_t pipeline_binds = 0;
+    std::uint32_t descriptor_binds = 0;
+
+    draw_stats& operator+=(const draw_stats& other) noexcept {
+      draws += other.draws;
+      draw_calls += other.draw_calls;
+      pipeline_binds += other.pipeline_binds;
+      descriptor_binds += other.descriptor_binds;
+      return *this;
+    }
+  };
+
   std::string path;
 
   ~vulkan_gltf_scene();
   vk::DescriptorImageInfo get_texture_descriptor(std::size_t index);
+  void mark_textures_used(std::uint64_t frame);
   void load_images(tinygltf::Model& input);
+  void register_buffers();
   void load_textures(tinygltf::Model& input);
   void load_materials(tinygltf::Model& input);
   void load_node(const tinygltf::Node& input_node,
@@ -89,9 +230,39 @@ class vulkan_gltf_scene {
                  vulkan_gltf_scene::node* parent,
                  std::vector<std::uint32_t>& index_buffer,
                  std::vector<vulkan_gltf_scene::vertex>& vertex_buffer);
-  void draw_node(vk::CommandBuffer command_buffer,
-                 vk::PipelineLayout pipeline_layout,
-                 const vulkan_gltf_scene::node& node,
-                 vk::Pipeline pipeline = {});
   void draw(vk::CommandBuffer command_buffer, vk::PipelineLayout pipeline_layout, vk::Pipeline pipeline = {});
+  // Draws of the scene for draw_range(), one per entry of the draw list
+  std::size_t draw_count() const noexcept { return draw_list.draws.size(); }
+  void draw_range(vk::CommandBuffer command_buffer,
+                  vk::PipelineLayout pipeline_layout,
+                  std::size_t first,
+                  std::size_t last,
+                  vk::Pipeline pipeline = {},
+                  draw_stats* stats = nullptr,
+                  draw_pass pass = pass_shading) const;
+  void build_transform_hierarchy();
+  void set_local_matrix(vulkan_gltf_scene::node& node, const glm::mat4& matrix);
+  void update_transforms();
+  const glm::mat4& world_matrix(const vulkan_gltf_scene::node& node) const;
+  void build_bvh();
+  bool cull(const glm::mat4& view_projection, cull_method method = cull_simd);
+  bool reset_visibility();
+  bool build_draw_list(const glm::mat4& view);
+
+ private:
+  vks::transforms::Aabb _world_bounds(const bvh_item& item) const;
+  void _set_item_bounds(std::size_t item, const vks::transforms::Aabb& bounds);
+  void _sort_draws(std::vector<draw_item>& draws);
+
+  // Defragmenter handles of vertices and indices.buffer, registered by register_buffers()
+  bool _buffers_registered_ = false;
+  std::uint32_t _vertices_defragmenter_handle_ = 0;
+  std::uint32_t _indices_defragmenter_handle_ = 0;
+
+  std::vector<std::uint32_t> _visible_items_;
+  // Visibility being computed by cull(), swapped with visibility.primitives if it changed
+  std::vector<std::uint8_t> _cull_buffer_;
+  // Draw list being built, swapped with draw_list.draws when done
+  std::vector<draw_item> _sort_buffer_;
+  std::vector<draw_item> _sort_scratch_;
 };
@@ -0,0 +1,163 @@
+/*
+* Checks the batched glTF animation against applying the same animations to identical models one after the other, with
+* several models spread across the threads and some models added more than once per batch
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanglTFAnimationBatch.h"
+#include "kernel_test.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+	constexpr uint32_t modelCount = 16;
+	constexpr uint32_t jointCount = 3;
+
+	// Skinned model without a device, its uniform blocks live in host memory instead of the mapped uniform buffer
+	struct TestModel
+	{
+		vkglTF::Model model;
+		std::vector<vkglTF::Mesh::UniformBlock> uniformBlocks;
+	};
+
+	vkglTF::Node *createNode(vkglTF::Model &model, vkglTF::Node *parent, uint32_t index)
+	{
+		vkglTF::Node *node = model.nodeStorage.create();
+		node->parent = parent;
+		node->index = index;
+		node->matrix = glm::mat4(1.0f);
+		node->mesh = nullptr;
+		node->skin = nullptr;
+		if (parent) {
+			parent->children.push_back(node);
+		}
+		model.linearNodes.push_back(node);
+		return node;
+	}
+
+	void addChannel(vkglTF::Animation &animation, vkglTF::Node *node, vkglTF::AnimationChannel::PathType path, const std::vector<glm::vec4> &values)
+	{
+		vkglTF::AnimationSampler sampler{};
+		sampler.interpolation = vkglTF::AnimationSampler::LINEAR;
+		sampler.input = 0;
+		sampler.encode(values, path == vkglTF::AnimationChannel::ROTATION);
+		animation.channels.push_back({ path, node, static_cast<uint32_t>(animation.samplers.size()) });
+		animation.samplers.push_back(sampler);
+	}
+
+	// Root with a chain of joints and a skinned mesh, animation 0 moves the joints and animation 1 scales the root
+	std::unique_ptr<TestModel> createModel(uint32_t seed)
+	{
+		std::mt19937 engine(seed);
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		auto vec4 = [&](float w) { return glm::vec4(distribution(engine), distribution(engine), distribution(engine), w); };
+
+		auto testModel = std::make_unique<TestModel>();
+		vkglTF::Model &model = testModel->model;
+		testModel->uniformBlocks.resize(1);
+
+		vkglTF::Node *root = createNode(model, nullptr, 0);
+		vkglTF::Skin *skin = model.skinStorage.create();
+		vkglTF::Node *parent = root;
+		for (uint32_t i = 0; i < jointCount; i++) {
+			parent = createNode(model, parent, i + 1);
+			parent->translation = glm::vec3(vec4(0.0f));
+			skin->joints.push_back(parent);
+			skin->inverseBindMatrices.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(vec4(0.0f))));
+		}
+		model.skins.push_back(skin);
+
+		vkglTF::Node *meshNode = createNode(model, root, jointCount + 1);
+		meshNode->mesh = model.meshStorage.create(nullptr, glm::mat4(1.0f));
+		meshNode->mesh->jointCount = jointCount;
+		meshNode->mesh->uniformBlock = &testModel->uniformBlocks[0];
+		meshNode->skin = skin;
+		model.nodes.push_back(root);
+		model.prepareTransforms();
+
+		model.animations.resize(2);
+		for (vkglTF::Animation &animation : model.animations) {
+			animation.inputs.resize(1);
+			animation.inputs[0].times = { 0.0f, 0.5f, 1.25f, 2.0f };
+			animation.start = 0.0f;
+			animation.end = 2.0f;
+		}
+		for (vkglTF::Node *joint : skin->joints) {
+			std::vector<glm::vec4> translations, rotations;
+			for (size_t key = 0; key < model.animations[0].inputs[0].times.size(); key++) {
+				translations.push_back(vec4(0.0f));
+				rotations.push_back(glm::normalize(vec4(2.0f)));
+			}
+			addChannel(model.animations[0], joint, vkglTF::AnimationChannel::TRANSLATION, translations);
+			addChannel(model.animations[0], joint, vkglTF::AnimationChannel::ROTATION, rotations);
+		}
+		std::vector<glm::vec4> scales;
+		for (size_t key = 0; key < model.animations[1].inputs[0].times.size(); key++) {
+			scales.push_back(vec4(0.0f) * 0.5f + glm::vec4(1.0f));
+		}
+		addChannel(model.animations[1], root, vkglTF::AnimationChannel::SCALE, scales);
+		return testModel;
+	}
+
+	// Every third model also plays its second animation, in the same batch
+	template <typename Function>
+	void forEachAnimation(uint32_t frame, float time, Function &&function)
+	{
+		for (uint32_t i = 0; i < modelCount; i++) {
+			function(i, 0u, time + 0.1f * static_cast<float>(i % 4));
+			if ((i + frame) % 3 == 0) {
+				function(i, 1u, time * 0.75f);
+			}
+		}
+	}
+}
+
+int main()
+{
+	std::vector<std::unique_ptr<TestModel>> batched, serial;
+	for (uint32_t i = 0; i < modelCount; i++) {
+		batched.push_back(createModel(i));
+		serial.push_back(createModel(i));
+	}
+
+	vks::ThreadPool threadPool;
+	threadPool.setThreadCount(4);
+	vkglTF::AnimationBatch batch;
+	batch.grainSize = 1;
+
+	kernel_test::Checker checker;
+	for (uint32_t frame = 0; frame < 40; frame++) {
+		const float time = static_cast<float>(frame) * 0.05f;
+
+		batch.clear();
+		forEachAnimation(frame, time, [&](uint32_t model, uint32_t animation, float t) {
+			batch.add(&batched[model]->model, animation, t);
+		});
+		batch.update(threadPool);
+
+		forEachAnimation(frame, time, [&](uint32_t model, uint32_t animation, float t) {
+			serial[model]->model.updateAnimation(animation, t);
+		});
+
+		// Both run the same code for each model, so the results have to be bit identical
+		for (uint32_t i = 0; i < modelCount; i++) {
+			const vkglTF::Model &a = batched[i]->model;
+			const vkglTF::Model &b = serial[i]->model;
+			const bool worldMatrices = std::memcmp(a.transforms.worldMatrices.data(), b.transforms.worldMatrices.data(), a.transforms.worldMatrices.size() * sizeof(glm::mat4)) == 0;
+			checker.check(worldMatrices, "frame %u model %u: world matrices differ", frame, i);
+
+			const vkglTF::Mesh::UniformBlock &blockA = batched[i]->uniformBlocks[0];
+			const vkglTF::Mesh::UniformBlock &blockB = serial[i]->uniformBlocks[0];
+			const bool matrix = std::memcmp(&blockA.matrix, &blockB.matrix, sizeof(glm::mat4)) == 0;
+			const bool jointMatrices = std::memcmp(blockA.jointMatrix, blockB.jointMatrix, jointCount * sizeof(glm::mat4)) == 0;
+			checker.check(matrix && jointMatrices, "frame %u model %u: uniform blocks differ", frame, i);
+		}
+	}
+	return checker.finish("animation_batch");
+}
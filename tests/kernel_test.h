@@ -0,0 +1,97 @@
+/*
+* Helpers shared by the kernel tests and benchmarks
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+
+namespace kernel_test
+{
+	/** @brief Exit code reported to CTest when the machine lacks the instruction set of the kernels */
+	constexpr int skipped = 77;
+
+	/** @brief Returns whether the CPU running the executable supports the instruction set it was compiled for */
+	inline bool simdSupported()
+	{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+		__builtin_cpu_init();
+#if defined(__AVX2__)
+		if (!__builtin_cpu_supports("avx2")) {
+			return false;
+		}
+#endif
+#if defined(__FMA__)
+		if (!__builtin_cpu_supports("fma")) {
+			return false;
+		}
+#endif
+#if defined(__SSE4_1__)
+		if (!__builtin_cpu_supports("sse4.1")) {
+			return false;
+		}
+#endif
+#endif
+		return true;
+	}
+
+	/** @brief Counts failed checks, printing the first few */
+	class Checker
+	{
+	public:
+		void check(bool condition, const char *format, ...)
+		{
+			if (condition) {
+				return;
+			}
+			if (failures++ < 20) {
+				va_list args;
+				va_start(args, format);
+				std::vfprintf(stderr, format, args);
+				va_end(args);
+				std::fputc('\n', stderr);
+			}
+		}
+
+		/** @brief Prints a summary and returns the exit code of the test */
+		int finish(const char *simdLevel) const
+		{
+			std::printf("%s: %zu checks failed\n", simdLevel, failures);
+			return failures == 0 ? 0 : 1;
+		}
+
+	private:
+		size_t failures = 0;
+	};
+
+	/** @brief Average time in nanoseconds per element of running function, best of several repetitions */
+	template <typename Function>
+	double nanosecondsPerElement(Function &&function, size_t elementCount, size_t iterations = 20)
+	{
+		double best = 0.0;
+		for (int repetition = 0; repetition < 3; repetition++) {
+			const auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < iterations; i++) {
+				function();
+				// Keeps the compiler from merging the stores of repeated calls it can see into
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+			}
+			const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			const double time = elapsed.count() / static_cast<double>(iterations * elementCount);
+			best = repetition == 0 || time < best ? time : best;
+		}
+		return best;
+	}
+
+	/** @brief Prints the time per element of a kernel and its scalar reference */
+	inline void report(const char *name, double kernelTime, double referenceTime)
+	{
+		std::printf("%-24s %8.3f ns/element (reference %8.3f ns/element, %5.2fx)\n", name, kernelTime, referenceTime, referenceTime / kernelTime);
+	}
+}
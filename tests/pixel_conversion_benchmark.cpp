@@ -0,0 +1,122 @@
+/*
+* Times the pixel conversion kernels against plain per-pixel loops over a 2048x2048 image
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanPixelConversion.h"
+#include "kernel_test.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+	constexpr size_t pixelCount = 2048 * 2048;
+
+	// Keeps the compiler from dropping the loops whose results are otherwise unused
+	volatile uint32_t sink;
+
+	template <typename T>
+	void consume(const std::vector<T> &values)
+	{
+		sink = sink + static_cast<uint32_t>(values[values.size() / 2]);
+	}
+}
+
+int main()
+{
+	if (!kernel_test::simdSupported()) {
+		std::printf("%s is not supported on this machine\n", vks::pixels::simdLevel());
+		return kernel_test::skipped;
+	}
+	std::printf("Pixel conversion kernels (%s), %zu pixels\n", vks::pixels::simdLevel(), pixelCount);
+
+	std::vector<uint8_t> rgb(pixelCount * 3), rgba(pixelCount * 4), scratch(pixelCount * 4);
+	std::vector<uint16_t> unorm16(pixelCount);
+	std::vector<float> floats(pixelCount * 3), normals(pixelCount * 3);
+	for (size_t i = 0; i < rgba.size(); i++) {
+		rgba[i] = static_cast<uint8_t>(i * 7 + 3);
+	}
+	for (size_t i = 0; i < rgb.size(); i++) {
+		rgb[i] = static_cast<uint8_t>(i * 5 + 1);
+	}
+	for (size_t i = 0; i < unorm16.size(); i++) {
+		unorm16[i] = static_cast<uint16_t>(i * 31);
+	}
+	for (size_t i = 0; i < normals.size(); i++) {
+		normals[i] = std::sin(static_cast<float>(i));
+	}
+
+	kernel_test::report("rgbToRgba",
+		kernel_test::nanosecondsPerElement([&] { vks::pixels::rgbToRgba(rgb.data(), scratch.data(), pixelCount); }, pixelCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < pixelCount; i++) {
+				scratch[i * 4 + 0] = rgb[i * 3 + 0];
+				scratch[i * 4 + 1] = rgb[i * 3 + 1];
+				scratch[i * 4 + 2] = rgb[i * 3 + 2];
+				scratch[i * 4 + 3] = 0xff;
+			}
+		}, pixelCount));
+	consume(scratch);
+
+	kernel_test::report("bgraToRgb",
+		kernel_test::nanosecondsPerElement([&] { vks::pixels::bgraToRgb(rgba.data(), scratch.data(), pixelCount); }, pixelCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < pixelCount; i++) {
+				scratch[i * 3 + 0] = rgba[i * 4 + 2];
+				scratch[i * 3 + 1] = rgba[i * 4 + 1];
+				scratch[i * 3 + 2] = rgba[i * 4 + 0];
+			}
+		}, pixelCount));
+	consume(scratch);
+
+	kernel_test::report("srgbToLinear",
+		kernel_test::nanosecondsPerElement([&] { vks::pixels::srgbToLinear(rgb.data(), floats.data(), rgb.size()); }, rgb.size()),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < rgb.size(); i++) {
+				const float c = static_cast<float>(rgb[i]) / 255.0f;
+				floats[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}, rgb.size(), 5));
+	consume(floats);
+
+	kernel_test::report("premultiplyAlpha",
+		kernel_test::nanosecondsPerElement([&] {
+			scratch = rgba;
+			vks::pixels::premultiplyAlpha(scratch.data(), pixelCount);
+		}, pixelCount),
+		kernel_test::nanosecondsPerElement([&] {
+			scratch = rgba;
+			for (size_t i = 0; i < pixelCount; i++) {
+				uint8_t *p = scratch.data() + i * 4;
+				for (size_t c = 0; c < 3; c++) {
+					p[c] = static_cast<uint8_t>(std::lround(p[c] * p[3] / 255.0f));
+				}
+			}
+		}, pixelCount));
+	consume(scratch);
+
+	kernel_test::report("unorm16ToFloat",
+		kernel_test::nanosecondsPerElement([&] { vks::pixels::unorm16ToFloat(unorm16.data(), floats.data(), pixelCount); }, pixelCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < pixelCount; i++) {
+				floats[i] = static_cast<float>(unorm16[i]) / 65535.0f;
+			}
+		}, pixelCount));
+	consume(floats);
+
+	kernel_test::report("packNormals",
+		kernel_test::nanosecondsPerElement([&] { vks::pixels::packNormals(normals.data(), scratch.data(), pixelCount); }, pixelCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < pixelCount; i++) {
+				for (size_t c = 0; c < 3; c++) {
+					scratch[i * 4 + c] = static_cast<uint8_t>(std::lround(std::fmin(std::fmax(normals[i * 3 + c] * 127.5f + 127.5f, 0.0f), 255.0f)));
+				}
+				scratch[i * 4 + 3] = 0xff;
+			}
+		}, pixelCount));
+	consume(scratch);
+	return 0;
+}
@@ -0,0 +1,238 @@
+/*
+* Checks the pixel conversion kernels against scalar references, for pixel counts covering the vector loops and their remainders
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanPixelConversion.h"
+#include "kernel_test.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// Round(x * a / 255) computed in floating point
+	uint8_t referenceMultiply(uint8_t x, uint8_t a)
+	{
+		return static_cast<uint8_t>(std::floor(static_cast<double>(x) * a / 255.0 + 0.5));
+	}
+
+	float referenceSrgbToLinear(uint8_t value)
+	{
+		const double c = value / 255.0;
+		return static_cast<float>(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+	}
+
+	// Pixel counts of every remainder of the vector loops, plus a large one
+	std::vector<size_t> pixelCounts()
+	{
+		std::vector<size_t> counts;
+		for (size_t i = 0; i <= 40; i++) {
+			counts.push_back(i);
+		}
+		counts.push_back(1021);
+		return counts;
+	}
+
+	std::vector<uint8_t> randomBytes(std::mt19937 &random, size_t count)
+	{
+		std::uniform_int_distribution<int> distribution(0, 255);
+		std::vector<uint8_t> bytes(count);
+		for (uint8_t &byte : bytes) {
+			byte = static_cast<uint8_t>(distribution(random));
+		}
+		return bytes;
+	}
+
+	// Guard bytes after each destination catch kernels writing past the end
+	constexpr size_t guardSize = 32;
+	constexpr uint8_t guardValue = 0xcd;
+
+	bool guardIntact(const std::vector<uint8_t> &buffer, size_t used)
+	{
+		for (size_t i = used; i < buffer.size(); i++) {
+			if (buffer[i] != guardValue) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void testRgbToRgba(kernel_test::Checker &checker, std::mt19937 &random)
+	{
+		for (size_t count : pixelCounts()) {
+			// Offset by one byte so loads are unaligned
+			const std::vector<uint8_t> src = randomBytes(random, count * 3 + 1);
+			std::vector<uint8_t> dst(count * 4 + guardSize, guardValue);
+			vks::pixels::rgbToRgba(src.data() + 1, dst.data(), count, 0x7f);
+			for (size_t i = 0; i < count; i++) {
+				for (size_t c = 0; c < 3; c++) {
+					checker.check(dst[i * 4 + c] == src[1 + i * 3 + c], "rgbToRgba: count %zu pixel %zu channel %zu", count, i, c);
+				}
+				checker.check(dst[i * 4 + 3] == 0x7f, "rgbToRgba: count %zu pixel %zu alpha", count, i);
+			}
+			checker.check(guardIntact(dst, count * 4), "rgbToRgba: count %zu writes past the end", count);
+		}
+	}
+
+	void testFourToThree(kernel_test::Checker &checker, std::mt19937 &random, bool bgra)
+	{
+		const char *name = bgra ? "bgraToRgb" : "rgbaToRgb";
+		for (size_t count : pixelCounts()) {
+			const std::vector<uint8_t> src = randomBytes(random, count * 4 + 1);
+			std::vector<uint8_t> dst(count * 3 + guardSize, guardValue);
+			if (bgra) {
+				vks::pixels::bgraToRgb(src.data() + 1, dst.data(), count);
+			} else {
+				vks::pixels::rgbaToRgb(src.data() + 1, dst.data(), count);
+			}
+			for (size_t i = 0; i < count; i++) {
+				const uint8_t *pixel = src.data() + 1 + i * 4;
+				const uint8_t expected[3] = { bgra ? pixel[2] : pixel[0], pixel[1], bgra ? pixel[0] : pixel[2] };
+				for (size_t c = 0; c < 3; c++) {
+					checker.check(dst[i * 3 + c] == expected[c], "%s: count %zu pixel %zu channel %zu", name, count, i, c);
+				}
+			}
+			checker.check(guardIntact(dst, count * 3), "%s: count %zu writes past the end", name, count);
+		}
+	}
+
+	void testSrgbToLinear(kernel_test::Checker &checker)
+	{
+		// Every value, then counts covering the remainders
+		std::vector<uint8_t> values(256);
+		for (size_t i = 0; i < values.size(); i++) {
+			values[i] = static_cast<uint8_t>(i);
+		}
+		std::vector<float> dst(values.size());
+		vks::pixels::srgbToLinear(values.data(), dst.data(), values.size());
+		for (size_t i = 0; i < values.size(); i++) {
+			const float expected = referenceSrgbToLinear(values[i]);
+			checker.check(std::fabs(dst[i] - expected) <= 1e-6f, "srgbToLinear: value %zu gives %g, expected %g", i, dst[i], expected);
+		}
+		for (size_t count : pixelCounts()) {
+			std::vector<uint8_t> src(count);
+			for (size_t i = 0; i < count; i++) {
+				src[i] = static_cast<uint8_t>(i * 37 + 11);
+			}
+			std::vector<float> out(count + 4, -1.0f);
+			vks::pixels::srgbToLinear(src.data(), out.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				checker.check(std::fabs(out[i] - referenceSrgbToLinear(src[i])) <= 1e-6f, "srgbToLinear: count %zu value %zu", count, i);
+			}
+			checker.check(out[count] == -1.0f, "srgbToLinear: count %zu writes past the end", count);
+		}
+	}
+
+	void testPremultiplyAlpha(kernel_test::Checker &checker, std::mt19937 &random)
+	{
+		// Every color and alpha pair
+		std::vector<uint8_t> pairs(256 * 256 * 4);
+		for (size_t i = 0; i < 256 * 256; i++) {
+			pairs[i * 4 + 0] = static_cast<uint8_t>(i & 0xff);
+			pairs[i * 4 + 1] = static_cast<uint8_t>(255 - (i & 0xff));
+			pairs[i * 4 + 2] = static_cast<uint8_t>(i & 0xff);
+			pairs[i * 4 + 3] = static_cast<uint8_t>(i >> 8);
+		}
+		const std::vector<uint8_t> original = pairs;
+		vks::pixels::premultiplyAlpha(pairs.data(), 256 * 256);
+		for (size_t i = 0; i < 256 * 256; i++) {
+			const uint8_t alpha = original[i * 4 + 3];
+			for (size_t c = 0; c < 3; c++) {
+				const uint8_t expected = referenceMultiply(original[i * 4 + c], alpha);
+				checker.check(pairs[i * 4 + c] == expected, "premultiplyAlpha: %u * %u gives %u, expected %u", original[i * 4 + c], alpha, pairs[i * 4 + c], expected);
+			}
+			checker.check(pairs[i * 4 + 3] == alpha, "premultiplyAlpha: alpha of pixel %zu changed", i);
+		}
+		for (size_t count : pixelCounts()) {
+			std::vector<uint8_t> pixels = randomBytes(random, count * 4 + 1);
+			pixels.resize(pixels.size() + guardSize, guardValue);
+			const std::vector<uint8_t> before = pixels;
+			vks::pixels::premultiplyAlpha(pixels.data() + 1, count);
+			for (size_t i = 0; i < count; i++) {
+				const uint8_t *pixel = before.data() + 1 + i * 4;
+				for (size_t c = 0; c < 3; c++) {
+					checker.check(pixels[1 + i * 4 + c] == referenceMultiply(pixel[c], pixel[3]), "premultiplyAlpha: count %zu pixel %zu channel %zu", count, i, c);
+				}
+			}
+			checker.check(guardIntact(pixels, count * 4 + 1), "premultiplyAlpha: count %zu writes past the end", count);
+		}
+	}
+
+	void testUnorm16ToFloat(kernel_test::Checker &checker, std::mt19937 &random)
+	{
+		std::uniform_int_distribution<int> distribution(0, 65535);
+		for (size_t count : pixelCounts()) {
+			std::vector<uint16_t> src(count + 1);
+			for (uint16_t &value : src) {
+				value = static_cast<uint16_t>(distribution(random));
+			}
+			// The extremes must map exactly
+			if (count >= 2) {
+				src[1] = 0;
+				src[count] = 65535;
+			}
+			std::vector<float> dst(count + 4, -1.0f);
+			vks::pixels::unorm16ToFloat(src.data() + 1, dst.data(), count, 2.0f);
+			for (size_t i = 0; i < count; i++) {
+				const double expected = src[1 + i] / 65535.0 * 2.0;
+				checker.check(std::fabs(dst[i] - expected) <= 1e-6 * 2.0, "unorm16ToFloat: count %zu value %zu gives %g, expected %g", count, i, dst[i], expected);
+			}
+			if (count >= 2) {
+				checker.check(dst[0] == 0.0f && std::fabs(dst[count - 1] - 2.0f) <= 1e-6f, "unorm16ToFloat: count %zu extremes", count);
+			}
+			checker.check(dst[count] == -1.0f, "unorm16ToFloat: count %zu writes past the end", count);
+		}
+	}
+
+	void testPackNormals(kernel_test::Checker &checker, std::mt19937 &random)
+	{
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		for (size_t count : pixelCounts()) {
+			std::vector<float> src(count * 3);
+			for (float &value : src) {
+				value = distribution(random);
+			}
+			// Out of range values must be clamped
+			if (count >= 1) {
+				src[0] = -1.5f;
+				src[1] = 1.5f;
+				src[2] = 0.0f;
+			}
+			std::vector<uint8_t> dst(count * 4 + guardSize, guardValue);
+			vks::pixels::packNormals(src.data(), dst.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				for (size_t c = 0; c < 3; c++) {
+					const double scaled = std::fmin(std::fmax(src[i * 3 + c] * 127.5 + 127.5, 0.0), 255.0);
+					// Values halfway between two bytes may round either way depending on the instruction set
+					const double difference = std::fabs(dst[i * 4 + c] - scaled);
+					checker.check(difference <= 0.5 + 1e-4, "packNormals: count %zu normal %zu component %zu gives %u for %g", count, i, c, dst[i * 4 + c], src[i * 3 + c]);
+				}
+				checker.check(dst[i * 4 + 3] == 0xff, "packNormals: count %zu normal %zu alpha", count, i);
+			}
+			checker.check(guardIntact(dst, count * 4), "packNormals: count %zu writes past the end", count);
+		}
+	}
+}
+
+int main()
+{
+	if (!kernel_test::simdSupported()) {
+		std::printf("%s is not supported on this machine\n", vks::pixels::simdLevel());
+		return kernel_test::skipped;
+	}
+
+	std::mt19937 random(5411);
+	kernel_test::Checker checker;
+	testRgbToRgba(checker, random);
+	testFourToThree(checker, random, true);
+	testFourToThree(checker, random, false);
+	testSrgbToLinear(checker);
+	testPremultiplyAlpha(checker, random);
+	testUnorm16ToFloat(checker, random);
+	testPackNormals(checker, random);
+	return checker.finish(vks::pixels::simdLevel());
+}
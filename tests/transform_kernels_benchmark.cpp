@@ -0,0 +1,175 @@
+/*
+* Times the batched transform kernels against per-element glm loops over 100000 nodes
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanTransformKernels.h"
+#include "kernel_test.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using vks::transforms::Aabb;
+using vks::transforms::AabbSoa;
+
+namespace
+{
+	constexpr size_t nodeCount = 100000;
+
+	// Keeps the compiler from dropping the loops whose results are otherwise unused
+	volatile float sink;
+
+	void consume(float value)
+	{
+		sink = sink + value;
+	}
+
+	float wave(size_t i, float frequency)
+	{
+		return std::sin(static_cast<float>(i) * frequency);
+	}
+}
+
+int main()
+{
+	if (!kernel_test::simdSupported()) {
+		std::printf("%s is not supported on this machine\n", vks::transforms::simdLevel());
+		return kernel_test::skipped;
+	}
+	std::printf("Transform kernels (%s), %zu nodes\n", vks::transforms::simdLevel(), nodeCount);
+
+	std::vector<glm::vec3> translations(nodeCount), scales(nodeCount);
+	std::vector<glm::quat> rotations(nodeCount);
+	std::vector<int32_t> parents(nodeCount);
+	std::vector<Aabb> boxes(nodeCount);
+	for (size_t i = 0; i < nodeCount; i++) {
+		translations[i] = glm::vec3(wave(i, 0.1f), wave(i, 0.2f), wave(i, 0.3f)) * 50.0f;
+		rotations[i] = glm::normalize(glm::quat(1.0f + wave(i, 0.4f), wave(i, 0.5f), wave(i, 0.6f), wave(i, 0.7f)));
+		scales[i] = glm::vec3(1.0f + 0.5f * wave(i, 0.8f));
+		// Wide and shallow, like the node trees of glTF scenes
+		parents[i] = i == 0 ? -1 : static_cast<int32_t>((i - 1) / 4);
+		boxes[i] = { translations[i] - glm::vec3(1.0f), translations[i] + glm::vec3(1.0f) };
+	}
+	std::vector<glm::mat4> local(nodeCount), world(nodeCount), scratch(nodeCount);
+	std::vector<glm::vec4> dualQuaternions(nodeCount * 2);
+	std::vector<Aabb> transformedBoxes(nodeCount);
+
+	kernel_test::report("composeTrs",
+		kernel_test::nanosecondsPerElement([&] { vks::transforms::composeTrs(translations.data(), rotations.data(), scales.data(), local.data(), nodeCount); }, nodeCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < nodeCount; i++) {
+				scratch[i] = glm::translate(glm::mat4(1.0f), translations[i]) * glm::mat4_cast(rotations[i]) * glm::scale(glm::mat4(1.0f), scales[i]);
+			}
+		}, nodeCount));
+	consume(local[nodeCount / 2][3][0] + scratch[nodeCount / 2][3][0]);
+
+	kernel_test::report("multiply",
+		kernel_test::nanosecondsPerElement([&] { vks::transforms::multiply(local.data(), local.data(), world.data(), nodeCount); }, nodeCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < nodeCount; i++) {
+				scratch[i] = local[i] * local[i];
+			}
+		}, nodeCount));
+	consume(world[nodeCount / 2][3][0] + scratch[nodeCount / 2][3][0]);
+
+	const glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 1.5f, 0.1f, 500.0f) * glm::lookAt(glm::vec3(0.0f, 0.0f, -100.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	kernel_test::report("multiply (common)",
+		kernel_test::nanosecondsPerElement([&] { vks::transforms::multiply(viewProjection, local.data(), world.data(), nodeCount); }, nodeCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < nodeCount; i++) {
+				scratch[i] = viewProjection * local[i];
+			}
+		}, nodeCount));
+	consume(world[nodeCount / 2][3][0] + scratch[nodeCount / 2][3][0]);
+
+	kernel_test::report("toDualQuaternions",
+		kernel_test::nanosecondsPerElement([&] { vks::transforms::toDualQuaternions(local.data(), dualQuaternions.data(), nodeCount); }, nodeCount),
+		kernel_test::nanosecondsPerElement([&] {
+			// Same conversion one matrix at a time: normalize the rotation columns, then branch on the largest diagonal term
+			for (size_t i = 0; i < nodeCount; i++) {
+				const glm::mat4 &m = local[i];
+				const glm::vec3 c0 = glm::normalize(glm::vec3(m[0])), c1 = glm::normalize(glm::vec3(m[1])), c2 = glm::normalize(glm::vec3(m[2]));
+				glm::quat q;
+				const float trace = c0.x + c1.y + c2.z;
+				if (trace > 0.0f) {
+					const float s = 0.5f / std::sqrt(trace + 1.0f);
+					q = glm::quat(0.25f / s, (c1.z - c2.y) * s, (c2.x - c0.z) * s, (c0.y - c1.x) * s);
+				} else if (c0.x > c1.y && c0.x > c2.z) {
+					const float s = 2.0f * std::sqrt(1.0f + c0.x - c1.y - c2.z);
+					q = glm::quat((c1.z - c2.y) / s, 0.25f * s, (c1.x + c0.y) / s, (c2.x + c0.z) / s);
+				} else if (c1.y > c2.z) {
+					const float s = 2.0f * std::sqrt(1.0f + c1.y - c0.x - c2.z);
+					q = glm::quat((c2.x - c0.z) / s, (c1.x + c0.y) / s, 0.25f * s, (c2.y + c1.z) / s);
+				} else {
+					const float s = 2.0f * std::sqrt(1.0f + c2.z - c0.x - c1.y);
+					q = glm::quat((c0.y - c1.x) / s, (c2.x + c0.z) / s, (c2.y + c1.z) / s, 0.25f * s);
+				}
+				const glm::quat dual = glm::quat(0.0f, m[3].x, m[3].y, m[3].z) * q * 0.5f;
+				dualQuaternions[i * 2] = glm::vec4(q.x, q.y, q.z, q.w);
+				dualQuaternions[i * 2 + 1] = glm::vec4(dual.x, dual.y, dual.z, dual.w);
+			}
+		}, nodeCount));
+	consume(dualQuaternions[nodeCount].x);
+
+	kernel_test::report("updateHierarchy",
+		kernel_test::nanosecondsPerElement([&] { vks::transforms::updateHierarchy(parents.data(), local.data(), world.data(), nullptr, nodeCount); }, nodeCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < nodeCount; i++) {
+				scratch[i] = parents[i] < 0 ? local[i] : scratch[static_cast<size_t>(parents[i])] * local[i];
+			}
+		}, nodeCount));
+	consume(world[nodeCount / 2][3][0] + scratch[nodeCount / 2][3][0]);
+
+	kernel_test::report("transformAabbs",
+		kernel_test::nanosecondsPerElement([&] { vks::transforms::transformAabbs(boxes.data(), local.data(), nullptr, transformedBoxes.data(), nodeCount); }, nodeCount),
+		kernel_test::nanosecondsPerElement([&] {
+			for (size_t i = 0; i < nodeCount; i++) {
+				Aabb result{ glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+				for (int corner = 0; corner < 8; corner++) {
+					const glm::vec3 p((corner & 1) ? boxes[i].max.x : boxes[i].min.x, (corner & 2) ? boxes[i].max.y : boxes[i].min.y, (corner & 4) ? boxes[i].max.z : boxes[i].min.z);
+					const glm::vec3 transformed(local[i] * glm::vec4(p, 1.0f));
+					result.min = glm::min(result.min, transformed);
+					result.max = glm::max(result.max, transformed);
+				}
+				transformedBoxes[i] = result;
+			}
+		}, nodeCount));
+	consume(transformedBoxes[nodeCount / 2].min.x);
+
+	glm::vec4 planes[6];
+	vks::transforms::extractFrustumPlanes(viewProjection, planes);
+	std::vector<float> minX(nodeCount), minY(nodeCount), minZ(nodeCount), maxX(nodeCount), maxY(nodeCount), maxZ(nodeCount);
+	for (size_t i = 0; i < nodeCount; i++) {
+		minX[i] = boxes[i].min.x;
+		minY[i] = boxes[i].min.y;
+		minZ[i] = boxes[i].min.z;
+		maxX[i] = boxes[i].max.x;
+		maxY[i] = boxes[i].max.y;
+		maxZ[i] = boxes[i].max.z;
+	}
+	const AabbSoa soa{ minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data() };
+	std::vector<uint8_t> visible(nodeCount);
+	const auto referenceCull = [&] {
+		for (size_t i = 0; i < nodeCount; i++) {
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++) {
+				const glm::vec3 corner(planes[p].x >= 0.0f ? boxes[i].max.x : boxes[i].min.x, planes[p].y >= 0.0f ? boxes[i].max.y : boxes[i].min.y,
+				                       planes[p].z >= 0.0f ? boxes[i].max.z : boxes[i].min.z);
+				inside = glm::dot(glm::vec3(planes[p]), corner) + planes[p].w >= 0.0f;
+			}
+			visible[i] = inside ? 1 : 0;
+		}
+	};
+	const double referenceCullTime = kernel_test::nanosecondsPerElement(referenceCull, nodeCount);
+	kernel_test::report("cullAabbs", kernel_test::nanosecondsPerElement([&] { vks::transforms::cullAabbs(planes, boxes.data(), visible.data(), nodeCount); }, nodeCount),
+		referenceCullTime);
+	consume(visible[nodeCount / 2]);
+	kernel_test::report("cullAabbs (SoA)", kernel_test::nanosecondsPerElement([&] { vks::transforms::cullAabbs(planes, soa, visible.data(), nodeCount); }, nodeCount),
+		referenceCullTime);
+	consume(visible[nodeCount / 2]);
+	return 0;
+}
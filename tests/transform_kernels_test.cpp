@@ -0,0 +1,376 @@
+/*
+* Checks the batched transform kernels against glm and scalar references, for batch sizes covering the vector loops and their remainders
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanTransformKernels.h"
+#include "kernel_test.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using vks::transforms::Aabb;
+using vks::transforms::AabbSoa;
+
+namespace
+{
+	// Batch sizes of every remainder of the vector loops, plus a large one
+	std::vector<size_t> batchSizes()
+	{
+		std::vector<size_t> sizes;
+		for (size_t i = 0; i <= 20; i++) {
+			sizes.push_back(i);
+		}
+		sizes.push_back(1001);
+		return sizes;
+	}
+
+	class Random
+	{
+	public:
+		explicit Random(uint32_t seed) : engine(seed) {}
+
+		float uniform(float min, float max)
+		{
+			return std::uniform_real_distribution<float>(min, max)(engine);
+		}
+
+		glm::vec3 vec3(float min, float max)
+		{
+			return glm::vec3(uniform(min, max), uniform(min, max), uniform(min, max));
+		}
+
+		// Unit quaternion with w >= minW, so the rotation is unambiguous for the dual quaternion conversion
+		glm::quat rotation(float minW = -1.0f)
+		{
+			for (;;) {
+				const glm::quat q = glm::normalize(glm::quat(uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f)));
+				if (q.w >= minW) {
+					return q;
+				}
+			}
+		}
+
+		// Parents before their children, roots at -1
+		std::vector<int32_t> hierarchy(size_t count)
+		{
+			std::vector<int32_t> parents(count);
+			for (size_t i = 0; i < count; i++) {
+				parents[i] = i == 0 || uniform(0.0f, 1.0f) < 0.1f ? -1 : static_cast<int32_t>(std::uniform_int_distribution<size_t>(0, i - 1)(engine));
+			}
+			return parents;
+		}
+
+	private:
+		std::mt19937 engine;
+	};
+
+	glm::mat4 referenceTrs(const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale)
+	{
+		return glm::translate(glm::mat4(1.0f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+	}
+
+	// Largest difference of two matrices, relative to the magnitude of the expected elements where they exceed 1
+	float difference(const glm::mat4 &actual, const glm::mat4 &expected)
+	{
+		float result = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				result = std::fmax(result, std::fabs(actual[c][r] - expected[c][r]) / std::fmax(1.0f, std::fabs(expected[c][r])));
+			}
+		}
+		return result;
+	}
+
+	float difference(const glm::vec3 &actual, const glm::vec3 &expected)
+	{
+		float result = 0.0f;
+		for (int i = 0; i < 3; i++) {
+			result = std::fmax(result, std::fabs(actual[i] - expected[i]) / std::fmax(1.0f, std::fabs(expected[i])));
+		}
+		return result;
+	}
+
+	std::vector<glm::mat4> randomMatrices(Random &random, size_t count)
+	{
+		std::vector<glm::mat4> matrices(count);
+		for (glm::mat4 &matrix : matrices) {
+			matrix = referenceTrs(random.vec3(-10.0f, 10.0f), random.rotation(), random.vec3(0.5f, 2.0f));
+		}
+		return matrices;
+	}
+
+	void testComposeTrs(kernel_test::Checker &checker, Random &random)
+	{
+		for (size_t count : batchSizes()) {
+			std::vector<glm::vec3> translations(count), scales(count);
+			std::vector<glm::quat> rotations(count);
+			for (size_t i = 0; i < count; i++) {
+				translations[i] = random.vec3(-100.0f, 100.0f);
+				rotations[i] = random.rotation();
+				// Negative scales mirror, which the kernel must handle like any other scale
+				scales[i] = random.vec3(-3.0f, 3.0f);
+			}
+			std::vector<glm::mat4> dst(count + 1, glm::mat4(-1.0f));
+			vks::transforms::composeTrs(translations.data(), rotations.data(), scales.data(), dst.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				const float d = difference(dst[i], referenceTrs(translations[i], rotations[i], scales[i]));
+				checker.check(d <= 1e-5f, "composeTrs: count %zu matrix %zu differs by %g", count, i, d);
+			}
+			checker.check(dst[count] == glm::mat4(-1.0f), "composeTrs: count %zu writes past the end", count);
+		}
+	}
+
+	void testMultiply(kernel_test::Checker &checker, Random &random)
+	{
+		for (size_t count : batchSizes()) {
+			const std::vector<glm::mat4> a = randomMatrices(random, count);
+			const std::vector<glm::mat4> b = randomMatrices(random, count);
+			const glm::mat4 common = randomMatrices(random, 1)[0];
+
+			std::vector<glm::mat4> dst(count);
+			vks::transforms::multiply(a.data(), b.data(), dst.data(), count);
+			// dst aliasing either operand
+			std::vector<glm::mat4> aliasA = a, aliasB = b;
+			vks::transforms::multiply(aliasA.data(), b.data(), aliasA.data(), count);
+			vks::transforms::multiply(a.data(), aliasB.data(), aliasB.data(), count);
+			std::vector<glm::mat4> commonDst = b;
+			vks::transforms::multiply(common, commonDst.data(), commonDst.data(), count);
+
+			for (size_t i = 0; i < count; i++) {
+				const glm::mat4 expected = a[i] * b[i];
+				checker.check(difference(dst[i], expected) <= 1e-5f, "multiply: count %zu matrix %zu", count, i);
+				checker.check(difference(aliasA[i], expected) <= 1e-5f, "multiply: count %zu matrix %zu with dst aliasing a", count, i);
+				checker.check(difference(aliasB[i], expected) <= 1e-5f, "multiply: count %zu matrix %zu with dst aliasing b", count, i);
+				checker.check(difference(commonDst[i], common * b[i]) <= 1e-5f, "multiply: count %zu matrix %zu with a common matrix", count, i);
+			}
+		}
+	}
+
+	void testToDualQuaternions(kernel_test::Checker &checker, Random &random)
+	{
+		for (size_t count : batchSizes()) {
+			std::vector<glm::vec3> translations(count);
+			std::vector<glm::quat> rotations(count);
+			std::vector<glm::mat4> matrices(count);
+			for (size_t i = 0; i < count; i++) {
+				translations[i] = random.vec3(-10.0f, 10.0f);
+				rotations[i] = random.rotation(0.2f);
+				// Scale is removed by the conversion
+				matrices[i] = referenceTrs(translations[i], rotations[i], random.vec3(0.5f, 2.0f));
+			}
+			std::vector<glm::vec4> dst(count * 2 + 1, glm::vec4(-1.0f));
+			vks::transforms::toDualQuaternions(matrices.data(), dst.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				const glm::quat &real = rotations[i];
+				const glm::quat dual = glm::quat(0.0f, translations[i].x, translations[i].y, translations[i].z) * real * 0.5f;
+				const glm::vec4 expectedReal(real.x, real.y, real.z, real.w);
+				const glm::vec4 expectedDual(dual.x, dual.y, dual.z, dual.w);
+				float d = 0.0f;
+				for (int c = 0; c < 4; c++) {
+					d = std::fmax(d, std::fabs(dst[i * 2][c] - expectedReal[c]));
+					d = std::fmax(d, std::fabs(dst[i * 2 + 1][c] - expectedDual[c]) / std::fmax(1.0f, std::fabs(expectedDual[c])));
+				}
+				// Components near zero come from the square root of a difference near zero, which amplifies rounding errors
+				checker.check(d <= 1e-3f, "toDualQuaternions: count %zu matrix %zu differs by %g", count, i, d);
+			}
+			checker.check(dst[count * 2] == glm::vec4(-1.0f), "toDualQuaternions: count %zu writes past the end", count);
+		}
+	}
+
+	void testUpdateHierarchy(kernel_test::Checker &checker, Random &random)
+	{
+		for (size_t count : batchSizes()) {
+			const std::vector<int32_t> parents = random.hierarchy(count);
+			const std::vector<glm::mat4> local = randomMatrices(random, count);
+			std::vector<glm::mat4> expected(count);
+			for (size_t i = 0; i < count; i++) {
+				expected[i] = parents[i] < 0 ? local[i] : expected[static_cast<size_t>(parents[i])] * local[i];
+			}
+
+			std::vector<glm::mat4> world(count);
+			vks::transforms::updateHierarchy(parents.data(), local.data(), world.data(), nullptr, count);
+			for (size_t i = 0; i < count; i++) {
+				const float d = difference(world[i], expected[i]);
+				checker.check(d <= 1e-4f, "updateHierarchy: count %zu node %zu differs by %g", count, i, d);
+			}
+
+			// Only dirty nodes and their descendants are written, and the flags are propagated to the descendants
+			std::vector<uint8_t> dirty(count, 0);
+			std::vector<uint8_t> expectedDirty(count, 0);
+			for (size_t i = 0; i < count; i++) {
+				dirty[i] = random.uniform(0.0f, 1.0f) < 0.05f ? 1 : 0;
+				expectedDirty[i] = dirty[i] || (parents[i] >= 0 && expectedDirty[static_cast<size_t>(parents[i])]) ? 1 : 0;
+			}
+			// Clean nodes get a different local matrix, so a clean node written by mistake no longer matches its world matrix
+			std::vector<glm::mat4> changedLocal = local;
+			std::vector<glm::mat4> partial = expected;
+			for (size_t i = 0; i < count; i++) {
+				if (expectedDirty[i]) {
+					partial[i] = glm::mat4(0.0f);
+				} else {
+					changedLocal[i] = local[i] * 2.0f;
+				}
+			}
+			const std::vector<glm::mat4> before = partial;
+			vks::transforms::updateHierarchy(parents.data(), changedLocal.data(), partial.data(), dirty.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				checker.check(dirty[i] == expectedDirty[i], "updateHierarchy: count %zu node %zu dirty flag not propagated", count, i);
+				if (expectedDirty[i]) {
+					checker.check(difference(partial[i], expected[i]) <= 1e-4f, "updateHierarchy: count %zu dirty node %zu", count, i);
+				} else {
+					checker.check(partial[i] == before[i], "updateHierarchy: count %zu clean node %zu written", count, i);
+				}
+			}
+		}
+	}
+
+	Aabb referenceTransformAabb(const Aabb &box, const glm::mat4 &matrix)
+	{
+		Aabb result{ glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+		for (int corner = 0; corner < 8; corner++) {
+			const glm::vec3 p((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z);
+			const glm::vec3 transformed(matrix * glm::vec4(p, 1.0f));
+			result.min = glm::min(result.min, transformed);
+			result.max = glm::max(result.max, transformed);
+		}
+		return result;
+	}
+
+	std::vector<Aabb> randomBoxes(Random &random, size_t count, float range, float maxSize)
+	{
+		std::vector<Aabb> boxes(count);
+		for (Aabb &box : boxes) {
+			box.min = random.vec3(-range, range);
+			box.max = box.min + random.vec3(0.0f, maxSize);
+		}
+		return boxes;
+	}
+
+	void testTransformAabbs(kernel_test::Checker &checker, Random &random)
+	{
+		for (size_t count : batchSizes()) {
+			const std::vector<Aabb> boxes = randomBoxes(random, count, 10.0f, 5.0f);
+			const std::vector<glm::mat4> matrices = randomMatrices(random, count + 3);
+			std::vector<uint32_t> indices(count);
+			for (size_t i = 0; i < count; i++) {
+				indices[i] = static_cast<uint32_t>((i * 7) % matrices.size());
+			}
+
+			std::vector<Aabb> dst(count);
+			vks::transforms::transformAabbs(boxes.data(), matrices.data(), nullptr, dst.data(), count);
+			// Indexed matrices, in place
+			std::vector<Aabb> indexed = boxes;
+			vks::transforms::transformAabbs(indexed.data(), matrices.data(), indices.data(), indexed.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				const Aabb expected = referenceTransformAabb(boxes[i], matrices[i]);
+				checker.check(difference(dst[i].min, expected.min) <= 1e-4f && difference(dst[i].max, expected.max) <= 1e-4f, "transformAabbs: count %zu box %zu", count, i);
+				const Aabb expectedIndexed = referenceTransformAabb(boxes[i], matrices[indices[i]]);
+				checker.check(difference(indexed[i].min, expectedIndexed.min) <= 1e-4f && difference(indexed[i].max, expectedIndexed.max) <= 1e-4f,
+				              "transformAabbs: count %zu box %zu with matrix indices", count, i);
+			}
+		}
+	}
+
+	glm::mat4 viewProjection()
+	{
+		return glm::perspective(glm::radians(60.0f), 1.5f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(3.0f, 2.0f, -20.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	void testExtractFrustumPlanes(kernel_test::Checker &checker, Random &random)
+	{
+		const glm::mat4 vp = viewProjection();
+		glm::vec4 planes[6];
+		vks::transforms::extractFrustumPlanes(vp, planes);
+		for (int p = 0; p < 6; p++) {
+			checker.check(std::fabs(glm::length(glm::vec3(planes[p])) - 1.0f) <= 1e-5f, "extractFrustumPlanes: plane %d not normalized", p);
+		}
+		// Points are inside the clip volume (with [0, 1] depth) exactly when they are in front of every plane
+		for (int i = 0; i < 10000; i++) {
+			const glm::vec3 point = random.vec3(-120.0f, 120.0f);
+			const glm::vec4 clip = vp * glm::vec4(point, 1.0f);
+			const bool inside = clip.w > 0.0f && std::fabs(clip.x) <= clip.w && std::fabs(clip.y) <= clip.w && clip.z >= 0.0f && clip.z <= clip.w;
+			bool inFront = true;
+			bool ambiguous = false;
+			for (int p = 0; p < 6; p++) {
+				const float distance = glm::dot(glm::vec3(planes[p]), point) + planes[p].w;
+				inFront = inFront && distance >= 0.0f;
+				ambiguous = ambiguous || std::fabs(distance) < 1e-3f;
+			}
+			checker.check(ambiguous || inside == inFront, "extractFrustumPlanes: point (%g, %g, %g) classified wrongly", point.x, point.y, point.z);
+		}
+	}
+
+	// Returns whether the box is in front of every plane, using the corner furthest along each plane's normal
+	bool referenceInFrustum(const glm::vec4 planes[6], const Aabb &box, bool &ambiguous)
+	{
+		bool inside = true;
+		ambiguous = false;
+		for (int p = 0; p < 6; p++) {
+			const glm::vec3 corner(planes[p].x >= 0.0f ? box.max.x : box.min.x, planes[p].y >= 0.0f ? box.max.y : box.min.y, planes[p].z >= 0.0f ? box.max.z : box.min.z);
+			const float distance = glm::dot(glm::vec3(planes[p]), corner) + planes[p].w;
+			inside = inside && distance >= 0.0f;
+			ambiguous = ambiguous || std::fabs(distance) < 1e-3f;
+		}
+		return inside;
+	}
+
+	void testCullAabbs(kernel_test::Checker &checker, Random &random)
+	{
+		glm::vec4 planes[6];
+		vks::transforms::extractFrustumPlanes(viewProjection(), planes);
+		for (size_t count : batchSizes()) {
+			const std::vector<Aabb> boxes = randomBoxes(random, count, 60.0f, 8.0f);
+			std::vector<float> minX(count), minY(count), minZ(count), maxX(count), maxY(count), maxZ(count);
+			for (size_t i = 0; i < count; i++) {
+				minX[i] = boxes[i].min.x;
+				minY[i] = boxes[i].min.y;
+				minZ[i] = boxes[i].min.z;
+				maxX[i] = boxes[i].max.x;
+				maxY[i] = boxes[i].max.y;
+				maxZ[i] = boxes[i].max.z;
+			}
+			const AabbSoa soa{ minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data() };
+
+			std::vector<uint8_t> visible(count + 1, 0xcd), visibleSoa(count + 1, 0xcd);
+			const size_t visibleCount = vks::transforms::cullAabbs(planes, boxes.data(), visible.data(), count);
+			const size_t visibleCountSoa = vks::transforms::cullAabbs(planes, soa, visibleSoa.data(), count);
+			size_t expectedCount = 0, expectedCountSoa = 0;
+			for (size_t i = 0; i < count; i++) {
+				bool ambiguous;
+				const bool expected = referenceInFrustum(planes, boxes[i], ambiguous);
+				checker.check(ambiguous || visible[i] == (expected ? 1 : 0), "cullAabbs: count %zu box %zu", count, i);
+				checker.check(ambiguous || visibleSoa[i] == (expected ? 1 : 0), "cullAabbs (SoA): count %zu box %zu", count, i);
+				checker.check(ambiguous || vks::transforms::aabbInFrustum(planes, boxes[i]) == expected, "aabbInFrustum: count %zu box %zu", count, i);
+				expectedCount += visible[i];
+				expectedCountSoa += visibleSoa[i];
+			}
+			checker.check(visibleCount == expectedCount && visibleCountSoa == expectedCountSoa, "cullAabbs: count %zu returns a wrong number of visible boxes", count);
+			checker.check(visible[count] == 0xcd && visibleSoa[count] == 0xcd, "cullAabbs: count %zu writes past the end", count);
+		}
+	}
+}
+
+int main()
+{
+	if (!kernel_test::simdSupported()) {
+		std::printf("%s is not supported on this machine\n", vks::transforms::simdLevel());
+		return kernel_test::skipped;
+	}
+
+	Random random(5411);
+	kernel_test::Checker checker;
+	testComposeTrs(checker, random);
+	testMultiply(checker, random);
+	testToDualQuaternions(checker, random);
+	testUpdateHierarchy(checker, random);
+	testTransformAabbs(checker, random);
+	testExtractFrustumPlanes(checker, random);
+	testCullAabbs(checker, random);
+	return checker.finish(vks::transforms::simdLevel());
+}